@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// 统计全局operator new的调用次数，用来确认每一帧的热路径没有堆分配
+// 与stb_image一样，需要在且仅在一个源文件中先定义PHYSICS_ALLOCATION_COUNTER_IMPLEMENTATION再包含本文件，
+// 这样才会替换全局的operator new/delete；没有定义时count()始终为0
+class AllocationCounter
+{
+public:
+    inline static std::atomic<size_t> allocations{ 0 };
+    // 为true的线程不计数，例如与物理帧并行、自己会分配内存的渲染线程
+    inline static thread_local bool ignored = false;
+
+    static size_t count() {
+        return allocations.load(std::memory_order_relaxed);
+    }
+
+    static void ignoreCurrentThread() {
+        ignored = true;
+    }
+};
+
+#ifdef PHYSICS_ALLOCATION_COUNTER_IMPLEMENTATION
+
+// GCC会把这些函数内联进调用处，然后误报new与free不匹配
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+    if (!AllocationCounter::ignored)
+        AllocationCounter::allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    if (!AllocationCounter::ignored)
+        AllocationCounter::allocations.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t align = static_cast<std::size_t>(alignment);
+#ifdef _MSC_VER
+    if (void* p = _aligned_malloc(size ? size : 1, align))
+        return p;
+#else
+    if (void* p = std::aligned_alloc(align, (size + align - 1) / align * align))
+        return p;
+#endif
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return ::operator new(size, alignment);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void operator delete[](void* p, std::align_val_t alignment) noexcept {
+    ::operator delete(p, alignment);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept {
+    ::operator delete(p, alignment);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t alignment) noexcept {
+    ::operator delete(p, alignment);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+enum class CollisionSchedule
+{
+    Slices, // 按列条带分两轮，见SlicePartition
+    Tiles4, // 2x2着色的二维块，块的边长至少2个cell
+    Tiles9  // 3x3着色的二维块，块的边长至少1个cell
+};
+
+// 碰撞检测的二维块着色：网格按行列切成边长约为blockSize的块，块(bx, by)的颜色为(bx % period) + period * (by % period)
+// 处理一个cell会读写周围一圈的cell，同色的两个块之间至少隔着一个（period为3时两个）异色的块，即至少2个cell，所以同色的块可以并行处理
+// 按颜色依次处理，每种颜色的块各是一个小任务，块数远多于线程数时由工作窃取平衡负载，比两轮条带的负载更均匀
+// 块的划分只取决于网格大小与blockSize，与线程数无关，确定性模式下也可以使用
+class BlockTiling
+{
+public:
+    std::vector<uint32_t> xBounds, yBounds; // 第bx列块包含[xBounds[bx], xBounds[bx + 1])列，行同理
+    std::vector<uint32_t> order;            // 按颜色排好的块下标 by * 列块数 + bx
+    std::vector<uint32_t> colorBounds;      // 第c种颜色的块为order[colorBounds[c], colorBounds[c + 1])
+    uint32_t period = 2;
+
+    size_t colorCount() const {
+        return static_cast<size_t>(period) * period;
+    }
+
+    size_t colorBlockCount(size_t color) const {
+        return colorBounds[color + 1] - colorBounds[color];
+    }
+
+    // 按颜色划分，参数与上次相同时不重新计算
+    void tile(uint32_t width, uint32_t height, uint32_t blockSize, CollisionSchedule schedule) {
+        const uint32_t p = schedule == CollisionSchedule::Tiles9 ? 3 : 2;
+        const uint32_t size = std::max(blockSize, p == 2 ? 2u : 1u);
+        if (p == period && size == lastSize && !xBounds.empty() && xBounds.back() == width && yBounds.back() == height)
+            return;
+        period = p;
+        lastSize = size;
+        split(xBounds, width, size);
+        split(yBounds, height, size);
+        const uint32_t bx_count = static_cast<uint32_t>(xBounds.size()) - 1;
+        const uint32_t by_count = static_cast<uint32_t>(yBounds.size()) - 1;
+        order.clear();
+        colorBounds.assign(1, 0);
+        for (uint32_t cy = 0; cy < period; ++cy) {
+            for (uint32_t cx = 0; cx < period; ++cx) {
+                for (uint32_t by = cy; by < by_count; by += period) {
+                    for (uint32_t bx = cx; bx < bx_count; bx += period)
+                        order.push_back(by * bx_count + bx);
+                }
+                colorBounds.push_back(static_cast<uint32_t>(order.size()));
+            }
+        }
+    }
+
+    // 对第color种颜色的第i个块的每一列调用f(start, end)，[start, end)为该列在块内的cell下标范围
+    template<typename F>
+    void forEachColumn(size_t color, size_t i, size_t height, F&& f) const {
+        const uint32_t bx_count = static_cast<uint32_t>(xBounds.size()) - 1;
+        const uint32_t block = order[colorBounds[color] + i];
+        const uint32_t bx = block % bx_count, by = block / bx_count;
+        for (size_t x = xBounds[bx]; x < xBounds[bx + 1]; ++x)
+            f(x * height + yBounds[by], x * height + yBounds[by + 1]);
+    }
+
+private:
+    // 均分为边长不小于size的若干段
+    static void split(std::vector<uint32_t>& bounds, uint32_t length, uint32_t size) {
+        const uint32_t count = std::max(1u, length / size);
+        bounds.resize(count + 1);
+        for (uint32_t i = 0; i <= count; ++i)
+            bounds[i] = static_cast<uint32_t>(static_cast<uint64_t>(i) * length / count);
+    }
+
+    uint32_t lastSize = 0;
+};
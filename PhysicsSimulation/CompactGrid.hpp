@@ -0,0 +1,99 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "Grid.hpp"
+
+// CompactGrid中一个cell的只读视图，与CollisionCell一样通过objects/objects_count访问
+class CompactCell
+{
+public:
+    const uint32_t* objects;
+    uint32_t objects_count;
+};
+
+// 用计数排序构建的网格，cell没有容量上限，不会像CollisionCell那样在拥挤时覆盖掉最后一个物体
+// ids按cell顺序保存网格内的全部物体，cell_end[i]是第i个cell在ids中的结束位置，起始位置即前一个cell的结束位置
+// 内存为每个物体4字节加每个cell4字节（CollisionCell每个cell固定20字节）
+class CompactGrid
+{
+public:
+    using Cell = CompactCell;
+
+    int32_t width, height;
+    std::vector<std::atomic<uint32_t>> cell_end;
+    std::vector<uint32_t> ids;
+    bool deterministic = false; // 建完网格后把每个cell内的物体按下标排序，使结果与线程调度无关
+
+    CompactGrid() :width(0), height(0) {}
+    CompactGrid(int32_t w, int32_t h) :width(w), height(h), cell_end(static_cast<size_t>(w) * h) {}
+
+    void clear() {
+        for (auto& end : cell_end)
+            end.store(0, std::memory_order_relaxed);
+        ids.clear();
+    }
+
+    CompactCell cell(size_t index) const {
+        const uint32_t begin = index ? cell_end[index - 1].load(std::memory_order_relaxed) : 0;
+        const uint32_t end = cell_end[index].load(std::memory_order_relaxed);
+        return { ids.data() + begin, end - begin };
+    }
+
+    bool contains(float x, float y) const {
+        return x > 1.0f && x < width - 1.0f
+            && y > 1.0f && y < height - 1.0f;
+    }
+
+    size_t cellIndex(float x, float y) const {
+        return static_cast<size_t>(x) * height + static_cast<size_t>(y);
+    }
+
+    // 每个子步重建一次：并行计数 -> 串行前缀和 -> 并行散射
+    // 散射时cell_end先作为每个cell的写入游标（初值为起始位置），全部写完后恰好变成结束位置
+    // 同一cell内物体的先后顺序取决于线程调度，需要可复现的结果时打开deterministic；filter(i)为false的物体不插入
+    template<typename Pool, typename Filter = InsertAll>
+    void build(const float* x, const float* y, size_t count, Pool& pool, Filter filter = {}) {
+        const size_t cell_count = cell_end.size();
+        pool.dispatch(cell_count, [this](size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i)
+                cell_end[i].store(0, std::memory_order_relaxed);
+        });
+
+        pool.dispatch(count, [this, x, y, &filter](size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i) {
+                if (filter(i) && contains(x[i], y[i]))
+                    cell_end[cellIndex(x[i], y[i])].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+
+        uint32_t total = 0;
+        for (size_t i = 0; i < cell_count; ++i) {
+            const uint32_t n = cell_end[i].load(std::memory_order_relaxed);
+            cell_end[i].store(total, std::memory_order_relaxed);
+            total += n;
+        }
+        ids.resize(total);
+
+        pool.dispatch(count, [this, x, y, &filter](size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i) {
+                if (filter(i) && contains(x[i], y[i])) {
+                    const uint32_t slot = cell_end[cellIndex(x[i], y[i])].fetch_add(1, std::memory_order_relaxed);
+                    ids[slot] = static_cast<uint32_t>(i);
+                }
+            }
+        });
+
+        if (deterministic) {
+            pool.dispatch(cell_count, [this](size_t start, size_t end) {
+                for (size_t i = start; i < end; ++i) {
+                    const uint32_t begin = i ? cell_end[i - 1].load(std::memory_order_relaxed) : 0;
+                    std::sort(ids.begin() + begin, ids.begin() + cell_end[i].load(std::memory_order_relaxed));
+                }
+            });
+        }
+    }
+};
@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+template<typename Signature>
+class FunctionRef;
+
+// 不持有可调用对象的轻量引用，只保存对象地址和一个调用函数指针，构造时不会分配内存
+// 被引用的对象必须比FunctionRef活得更久，因此只适合作为同步调用的参数
+template<typename R, typename... Args>
+class FunctionRef<R(Args...)>
+{
+private:
+    void* object;
+    R(*invoker)(void*, Args...);
+
+public:
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, FunctionRef>>>
+    FunctionRef(F&& f) noexcept :
+        object(const_cast<void*>(static_cast<const void*>(std::addressof(f)))),
+        invoker([](void* o, Args... args) -> R {
+            return (*static_cast<std::remove_reference_t<F>*>(o))(std::forward<Args>(args)...);
+        }) {}
+
+    R operator()(Args... args) const {
+        return invoker(object, std::forward<Args>(args)...);
+    }
+};
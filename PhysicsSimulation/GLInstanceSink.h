@@ -0,0 +1,149 @@
+﻿#pragma once
+
+#include <GL/glew.h>
+
+#include "InstanceBuffer.hpp"
+#include "StateExchange.hpp"
+
+// 渲染线程绘制StateExchange前台帧所用的GL缓冲，第slot帧的数据从buffer()的第offset(slot)个字节开始
+class GLInstanceSink
+{
+public:
+    explicit GLInstanceSink(size_t capacity) : maxElements(capacity) {}
+    virtual ~GLInstanceSink() = default;
+
+    size_t capacity() const {
+        return maxElements;
+    }
+
+    // StateExchange三帧的存储，物理线程直接写进去；为空时StateExchange自己分配主机内存
+    virtual InstanceData* storage() {
+        return nullptr;
+    }
+
+    // 第slot帧交还给物理线程之前调用
+    virtual void retire(uint32_t) {}
+
+    // 绘制第slot帧的前count个实例之前调用，data为该帧的数据，返回为此上传的字节数
+    virtual size_t prepare(uint32_t slot, const InstanceData* data, size_t count) = 0;
+
+    virtual GLuint buffer() const = 0;
+    virtual size_t offset(uint32_t slot) const = 0;
+
+    // 读取第slot帧的绘制命令提交之后调用
+    virtual void submitted(uint32_t) {}
+
+private:
+    size_t maxElements;
+};
+
+// GL 3.3的退路：StateExchange的三帧在主机内存，绘制前先用空指针重新分配整个缓冲（orphaning），驱动不必等待上一帧的绘制，再只上传前台帧写入的部分
+class OrphanInstanceSink : public GLInstanceSink
+{
+public:
+    explicit OrphanInstanceSink(size_t max_elements) : GLInstanceSink(max_elements) {
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceData) * max_elements, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    ~OrphanInstanceSink() override {
+        glDeleteBuffers(1, &vbo);
+    }
+
+    size_t prepare(uint32_t, const InstanceData* data, size_t count) override {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceData) * capacity(), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(InstanceData) * count, data);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return sizeof(InstanceData) * count;
+    }
+
+    GLuint buffer() const override {
+        return vbo;
+    }
+
+    size_t offset(uint32_t) const override {
+        return 0;
+    }
+
+private:
+    GLuint vbo;
+};
+
+// 持久映射的三缓冲：缓冲分成frame_count段，就是StateExchange的三帧，物理线程的工作线程直接写进GPU读取的内存，没有主机端的中转，驱动也不会重新分配缓冲
+// 一段要等上次读取它的绘制命令完成（fence）之后才会交还给物理线程，GPU落后时retire会阻塞渲染线程
+// 需要GL 4.4或ARB_buffer_storage，见available()；生产端可以用自己分配内存的StateExchange在没有GPU的机器上测试
+class PersistentInstanceSink : public GLInstanceSink
+{
+public:
+    static constexpr size_t frame_count = StateExchange::frame_count;
+
+    static bool available() {
+        return GLEW_ARB_buffer_storage;
+    }
+
+    explicit PersistentInstanceSink(size_t max_elements) : GLInstanceSink(max_elements) {
+        const GLsizeiptr bytes = sizeof(InstanceData) * max_elements * frame_count;
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+        mapped = static_cast<InstanceData*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    ~PersistentInstanceSink() override {
+        for (GLsync& fence : fences) {
+            if (fence)
+                glDeleteSync(fence);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glDeleteBuffers(1, &vbo);
+    }
+
+    InstanceData* storage() override {
+        return mapped;
+    }
+
+    void retire(uint32_t slot) override {
+        wait(fences[slot]);
+    }
+
+    // 数据已经在缓冲里，不需要上传
+    size_t prepare(uint32_t, const InstanceData*, size_t) override {
+        return 0;
+    }
+
+    GLuint buffer() const override {
+        return vbo;
+    }
+
+    size_t offset(uint32_t slot) const override {
+        return sizeof(InstanceData) * slot * capacity();
+    }
+
+    // 同一帧可能被画多次，只需等最后一次绘制
+    void submitted(uint32_t slot) override {
+        if (fences[slot])
+            glDeleteSync(fences[slot]);
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    // 映射是GL_MAP_COHERENT_BIT的，写入不需要显式flush，只需等待GPU读完
+    static void wait(GLsync& fence) {
+        if (!fence)
+            return;
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    GLuint vbo;
+    InstanceData* mapped;
+    GLsync fences[frame_count] = {};
+};
@@ -1,6 +1,23 @@
-#pragma once
+﻿#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <vector>
 
+// 建网格时的默认过滤器：插入所有物体
+struct InsertAll
+{
+    bool operator()(size_t) const {
+        return true;
+    }
+};
+
+enum class GridUpdate
+{
+    Rebuild,        // 每个子步清空所有cell并重新插入所有物体
+    Incremental     // 只移动所在cell变化了的物体，见Grid::update
+};
+
 class CollisionCell
 {
 public:
@@ -35,8 +52,27 @@ public:
 class Grid
 {
 public:
+    using Cell = CollisionCell;
+
     int32_t width, height;
     std::vector<CollisionCell> data;
+    static constexpr uint32_t no_cell = std::numeric_limits<uint32_t>::max();
+
+    // update中从cell移除或插入cell的物体
+    struct CellMove
+    {
+        uint32_t cell;
+        uint32_t object;
+    };
+
+    // 并行建网格用的分桶，bins[chunk * chunk_count + block]是第chunk段物体中落在第block个列块里的物体
+    std::vector<std::vector<uint32_t>> bins;
+    // 为true时build记录每个物体所在的cell，之后update只需移动换了cell的物体
+    bool incremental = false;
+    // 每个物体所在的cell，被过滤、在网格外或者因cell已满没有插入时为no_cell
+    std::vector<uint32_t> object_cells;
+    // 与bins的布局相同，分别是每个列块中要移除和插入的物体
+    std::vector<std::vector<CellMove>> removals, insertions;
 
     Grid() :width(0), height(0) {}
     Grid(int32_t w, int32_t h) :width(w), height(h) {
@@ -50,5 +86,142 @@ public:
     void clear() {
         for (auto& c : data)
             c.clear();
+        object_cells.clear();
+    }
+
+    const CollisionCell& cell(size_t index) const {
+        return data[index];
+    }
+
+    // 物体所在的cell，不插入时为no_cell
+    template<typename Filter>
+    uint32_t cellOf(float x, float y, size_t i, const Filter& filter) const {
+        if (!filter(i) || !contains(x, y))
+            return no_cell;
+        return static_cast<uint32_t>(x) * height + static_cast<uint32_t>(y);
+    }
+
+    // cell所在的列块，与build的划分相同
+    size_t blockOf(uint32_t cell_id, size_t chunk_count) const {
+        return cell_id / height * chunk_count / static_cast<size_t>(width);
+    }
+
+    bool contains(float x, float y) const {
+        return x > 1.0f && x < width - 1.0f
+            && y > 1.0f && y < height - 1.0f;
+    }
+
+    // 并行建网格，分两步：
+    // 1. 物体按下标均分为chunk_count段，每个线程把自己那段中的物体按所在的列块分桶
+    // 2. 网格按列均分为chunk_count块，每个线程清空自己的列块，再按段的顺序插入落在该块中的物体
+    // 每个cell中物体的插入顺序与串行按下标插入完全相同，结果是确定的，cell溢出时被覆盖的也是同一个物体
+    // filter(i)为false的物体不插入
+    template<typename Pool, typename Filter = InsertAll>
+    void build(const float* x, const float* y, size_t count, Pool& pool, Filter filter = {}) {
+        const size_t chunk_count = pool.getThreadCount();
+        const size_t columns = static_cast<size_t>(width);
+        bins.resize(chunk_count * chunk_count);
+        object_cells.resize(incremental ? count : 0);
+        pool.dispatch(chunk_count, [&](size_t first, size_t last) {
+            for (size_t chunk = first; chunk < last; ++chunk) {
+                std::vector<uint32_t>* const chunk_bins = bins.data() + chunk * chunk_count;
+                for (size_t block = 0; block < chunk_count; ++block)
+                    chunk_bins[block].clear();
+                const size_t start = count * chunk / chunk_count;
+                const size_t end = count * (chunk + 1) / chunk_count;
+                for (size_t i = start; i < end; ++i) {
+                    if (filter(i) && contains(x[i], y[i])) {
+                        const size_t column = static_cast<size_t>(x[i]);
+                        chunk_bins[column * chunk_count / columns].push_back(static_cast<uint32_t>(i));
+                    }
+                }
+                if (incremental)
+                    std::fill(object_cells.begin() + start, object_cells.begin() + end, no_cell);
+            }
+        });
+        pool.dispatch(chunk_count, [&](size_t first, size_t last) {
+            for (size_t block = first; block < last; ++block) {
+                // 第block块包含满足 column * chunk_count / columns == block 的所有列
+                const size_t column_start = (block * columns + chunk_count - 1) / chunk_count;
+                const size_t column_end = ((block + 1) * columns + chunk_count - 1) / chunk_count;
+                for (size_t idx = column_start * height; idx < column_end * height; ++idx)
+                    data[idx].clear();
+                for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+                    for (const uint32_t id : bins[chunk * chunk_count + block]) {
+                        if (incremental)
+                            insert(cellOf(x[id], y[id], id, InsertAll{}), id);
+                        else
+                            add(static_cast<size_t>(x[id]), static_cast<size_t>(y[id]), id);
+                    }
+                }
+            }
+        });
+    }
+
+    // build的增量版本：只把上次build或update之后换了cell的物体从原来的cell移除、插入新的cell，其余cell不动
+    // 1. 物体按下标分段，每个线程比较自己那段物体现在的cell与object_cells，把要移除和插入的物体按列块分桶
+    // 2. 每个列块先做自己cell中的移除，再按段的顺序做插入
+    // 不同列块没有共同的cell，所以两步都没有数据竞争；插入按下标顺序，结果与线程数无关
+    // 但与重建不完全相同：留在原cell的物体位置不变而不是按下标排序，因cell已满没有插入的物体要等有空位才能插入
+    // incremental为false或者clear之后退化为build，下标超出上次物体数的新物体与换了cell的物体一样插入
+    template<typename Pool, typename Filter = InsertAll>
+    void update(const float* x, const float* y, size_t count, Pool& pool, Filter filter = {}) {
+        if (!incremental || object_cells.empty() || object_cells.size() > count) {
+            build(x, y, count, pool, filter);
+            return;
+        }
+        object_cells.resize(count, no_cell);
+        const size_t chunk_count = pool.getThreadCount();
+        removals.resize(chunk_count * chunk_count);
+        insertions.resize(chunk_count * chunk_count);
+        pool.dispatch(chunk_count, [&](size_t first, size_t last) {
+            for (size_t chunk = first; chunk < last; ++chunk) {
+                std::vector<CellMove>* const chunk_removals = removals.data() + chunk * chunk_count;
+                std::vector<CellMove>* const chunk_insertions = insertions.data() + chunk * chunk_count;
+                for (size_t block = 0; block < chunk_count; ++block) {
+                    chunk_removals[block].clear();
+                    chunk_insertions[block].clear();
+                }
+                const size_t start = count * chunk / chunk_count;
+                const size_t end = count * (chunk + 1) / chunk_count;
+                for (size_t i = start; i < end; ++i) {
+                    const uint32_t old_cell = object_cells[i];
+                    const uint32_t new_cell = cellOf(x[i], y[i], i, filter);
+                    if (new_cell == old_cell)
+                        continue;
+                    const uint32_t id = static_cast<uint32_t>(i);
+                    if (old_cell != no_cell)
+                        chunk_removals[blockOf(old_cell, chunk_count)].push_back({ old_cell, id });
+                    if (new_cell != no_cell)
+                        chunk_insertions[blockOf(new_cell, chunk_count)].push_back({ new_cell, id });
+                    object_cells[i] = new_cell; // 新cell已满时第二步再改回no_cell
+                }
+            }
+        });
+        pool.dispatch(chunk_count, [&](size_t first, size_t last) {
+            for (size_t block = first; block < last; ++block) {
+                for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+                    for (const CellMove& move : removals[chunk * chunk_count + block])
+                        data[move.cell].remove(move.object);
+                }
+                for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+                    for (const CellMove& move : insertions[chunk * chunk_count + block])
+                        insert(move.cell, move.object);
+                }
+            }
+        });
+    }
+
+private:
+    // 插入物体并记录它所在的cell，cell已满时与add一样丢掉它
+    void insert(uint32_t cell_id, uint32_t id) {
+        CollisionCell& c = data[cell_id];
+        if (c.objects_count < CollisionCell::max_cell_id) {
+            c.add(id);
+            object_cells[id] = cell_id;
+        }
+        else {
+            object_cells[id] = no_cell;
+        }
     }
 };
\ No newline at end of file
@@ -0,0 +1,169 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "SlicePartition.hpp"
+
+// 可变半径物体的多层网格
+// 第0层就是求解器原有的网格（cell边长1，放半径不超过0.5的物体），第L层（1 <= L <= max_level）的cell边长为2^L，
+// 放直径在(2^(L-1), 2^L]之间的物体，所以大物体不会迫使所有物体都用粗网格
+// 每个大物体查询自己这一层以及所有更细的层，覆盖[p - r - s/2, p + r + s/2]的cell（s为被查询层的cell边长），
+// 同层的物体对从两边各处理一次（与第0层一样），跨层的物体对只从大物体这边处理一次
+template<typename GridType>
+class GridHierarchy
+{
+public:
+    static constexpr uint32_t max_level = 3;
+    static constexpr float max_radius = 4.0f; // 2^max_level / 2
+
+    using Cell = typename GridType::Cell;
+
+    class Level
+    {
+    public:
+        float cell_size = 1.0f;
+        GridType grid;
+        SlicePartition slices;
+        std::vector<uint32_t> ids;  // 层内下标 -> 物体下标
+        std::vector<float> x, y;    // 建网格用的层内坐标：p / cell_size + 1，加1是因为网格最外一圈不放物体
+    };
+
+    Level levels[max_level];
+
+    GridHierarchy() = default;
+    GridHierarchy(float world_width, float world_height) {
+        for (uint32_t l = 0; l < max_level; ++l) {
+            Level& level = levels[l];
+            level.cell_size = static_cast<float>(2u << l);
+            level.grid = GridType(
+                static_cast<int32_t>(std::ceil(world_width / level.cell_size)) + 2,
+                static_cast<int32_t>(std::ceil(world_height / level.cell_size)) + 2);
+            level.grid.clear();
+        }
+    }
+
+    // 半径为r的物体所在的层，0为求解器原有的网格
+    static uint32_t levelOf(float r) {
+        uint32_t l = 0;
+        while (l < max_level && r > 0.5f * static_cast<float>(1u << l))
+            ++l;
+        return l;
+    }
+
+    size_t largeCount() const {
+        size_t n = 0;
+        for (const Level& level : levels)
+            n += level.ids.size();
+        return n;
+    }
+
+    // 把半径大于0.5的物体分到各层并建网格，第0层由求解器用过滤器自己建
+    template<typename Pool>
+    void build(const float* x, const float* y, const float* radius, size_t count, Pool& pool, bool deterministic) {
+        for (Level& level : levels) {
+            level.ids.clear();
+            level.x.clear();
+            level.y.clear();
+        }
+        for (size_t i = 0; i < count; ++i) {
+            const uint32_t l = levelOf(radius[i]);
+            if (l == 0)
+                continue;
+            Level& level = levels[l - 1];
+            level.ids.push_back(static_cast<uint32_t>(i));
+            level.x.push_back(x[i] / level.cell_size + 1.0f);
+            level.y.push_back(y[i] / level.cell_size + 1.0f);
+        }
+        for (Level& level : levels) {
+            if constexpr (requires { level.grid.deterministic; })
+                level.grid.deterministic = deterministic;
+            level.grid.build(level.x.data(), level.y.data(), level.ids.size(), pool);
+        }
+    }
+
+    // 逐层处理大物体的碰撞，每层内部与第0层一样按列条带分两轮并行
+    // 条带至少2列，同一轮的两个条带之间隔着至少2个粗cell，而一个物体只会移动与它距离小于一个粗cell的物体，所以不会同时写到同一个物体
+    // partition(slices, grid)负责划分条带，contact(a, b)处理一对物体，a总是大物体
+    template<typename Pool, typename Partition, typename Contact>
+    void solve(const GridType& base, const float* x, const float* y, const float* radius, Pool& pool, Partition&& partition, Contact&& contact) {
+        for (uint32_t l = 1; l <= max_level; ++l) {
+            Level& level = levels[l - 1];
+            if (level.ids.empty())
+                continue;
+            partition(level.slices, level.grid);
+            const size_t height = static_cast<size_t>(level.grid.height);
+            for (size_t phase = 0; phase < 2; ++phase) {
+                pool.parallelFor(
+                    0, level.slices.phaseSliceCount(phase), 1,
+                    [&, l, phase, height](size_t start, size_t end) {
+                        for (size_t i = start; i < end; ++i) {
+                            const size_t slice = 2 * i + phase;
+                            size_t first = level.slices.begin(slice, height), last = level.slices.end(slice, height);
+                            if constexpr (requires { GridType::sparse; }) {
+                                // 稀疏网格的条带按非空列划分
+                                first = level.grid.columnBegin(level.slices.begin(slice, 1));
+                                last = level.grid.columnBegin(level.slices.end(slice, 1));
+                            }
+                            for (size_t idx = first; idx < last; ++idx) {
+                                const auto c = level.grid.cell(idx);
+                                for (uint32_t k = 0; k < c.objects_count; ++k) {
+                                    const uint32_t a = level.ids[c.objects[k]];
+                                    for (uint32_t m = 0; m <= l; ++m)
+                                        query(base, m, a, x[a], y[a], radius[a], contact);
+                                }
+                            }
+                        }
+                    }
+                );
+            }
+        }
+    }
+
+    // 大物体不能只按默认的2个单位的边距夹在世界里，否则会穿出边界
+    void clampToWorld(float* x, float* y, const float* radius, float world_width, float world_height) const {
+        for (const Level& level : levels) {
+            for (const uint32_t id : level.ids) {
+                const float margin = std::max(2.0f, radius[id]);
+                x[id] = std::clamp(x[id], margin, world_width - margin);
+                y[id] = std::clamp(y[id], margin, world_height - margin);
+            }
+        }
+    }
+
+    // 第m层中可能与物体a接触的物体，m层物体的半径不超过该层cell边长的一半，求解器划分休眠的接触岛时也用它
+    template<typename Contact>
+    void query(const GridType& base, uint32_t m, uint32_t a, float px, float py, float r, Contact& contact) const {
+        const GridType& grid = m ? levels[m - 1].grid : base;
+        const float cell_size = m ? levels[m - 1].cell_size : 1.0f;
+        const float offset = m ? 1.0f : 0.0f;
+        const float reach = r + 0.5f * cell_size;
+        int32_t x0 = static_cast<int32_t>(std::floor((px - reach) / cell_size + offset));
+        int32_t x1 = static_cast<int32_t>(std::floor((px + reach) / cell_size + offset));
+        int32_t y0 = static_cast<int32_t>(std::floor((py - reach) / cell_size + offset));
+        int32_t y1 = static_cast<int32_t>(std::floor((py + reach) / cell_size + offset));
+        constexpr bool sparse = requires { GridType::sparse; };
+        if constexpr (!sparse) {
+            x0 = std::max(x0, 0);
+            x1 = std::min(x1, grid.width - 1);
+            y0 = std::max(y0, 0);
+            y1 = std::min(y1, grid.height - 1);
+        }
+        for (int32_t cx = x0; cx <= x1; ++cx) {
+            for (int32_t cy = y0; cy <= y1; ++cy) {
+                Cell c;
+                if constexpr (sparse)
+                    c = grid.find(cx, cy);
+                else
+                    c = grid.cell(static_cast<size_t>(cx) * grid.height + cy);
+                for (uint32_t k = 0; k < c.objects_count; ++k) {
+                    const uint32_t b = m ? levels[m - 1].ids[c.objects[k]] : c.objects[k];
+                    if (b != a)
+                        contact(a, b);
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,294 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "CompactGrid.hpp"
+
+// 稀疏网格：只保存有物体的cell，内存与物体数成正比，与世界大小无关，也不会丢弃网格范围以外的物体
+// 每个子步重建：并行把物体所在cell的坐标插入开放寻址散列表并计数 -> 非空cell按(x, y)基数排序并求前缀和 -> 并行散射
+// 排序后的cell与CompactGrid一样按列优先存放，cell_end[p]是第p个cell在ids中的结束位置
+// 条带按“非空列”划分：width是本次建网格后有物体的列数，第k个非空列的cell为[column_begin[k], column_begin[k + 1])
+// 两个非空列之间的实际距离不小于它们的下标差，所以同一轮的条带仍然至少隔着2列
+class HashGrid
+{
+public:
+    using Cell = CompactCell;
+
+    static constexpr bool sparse = true;
+    static constexpr uint64_t empty_key = ~0ull;
+    static constexpr uint32_t no_slot = ~0u;
+
+    int32_t width = 0;  // 非空列数
+    int32_t height = 1; // 没有意义，只是与稠密网格保持相同的成员
+    bool deterministic = false; // 建完网格后把每个cell内的物体按下标排序，使结果与线程调度无关
+
+    // 散列表，容量为2的幂，装填率不超过一半
+    std::vector<std::atomic<uint64_t>> table_keys;
+    std::vector<std::atomic<uint32_t>> table_counts; // 先是cell中的物体数，之后作为散射的写入游标
+    std::vector<uint32_t> table_cells;               // 槽 -> 排序后的cell下标
+    uint32_t table_shift = 64;
+
+    std::vector<uint32_t> object_slots;              // 物体 -> 散列表的槽，不插入的物体为no_slot
+    std::vector<std::pair<uint64_t, uint32_t>> sorted_cells, sort_buffer; // (排序键, 槽)
+    std::vector<uint64_t> cell_keys;
+    std::vector<uint32_t> cell_end;
+    std::vector<uint32_t> column_begin;
+    std::vector<uint32_t> ids;
+
+    HashGrid() {
+        clear();
+    }
+
+    // 与稠密网格的构造参数相同，但不按世界大小分配任何内存
+    HashGrid(int32_t, int32_t) {
+        clear();
+    }
+
+    void clear() {
+        for (auto& key : table_keys)
+            key.store(empty_key, std::memory_order_relaxed);
+        cell_keys.clear();
+        cell_end.clear();
+        column_begin.assign(1, 0);
+        ids.clear();
+        width = 0;
+    }
+
+    // cell坐标按有符号整数比较的顺序打包，x在高32位，因此按键排序就是列优先
+    static uint64_t packKey(int32_t cx, int32_t cy) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(cx) ^ 0x80000000u) << 32)
+            | (static_cast<uint32_t>(cy) ^ 0x80000000u);
+    }
+
+    static uint64_t cellKey(float x, float y) {
+        return packKey(static_cast<int32_t>(std::floor(x)), static_cast<int32_t>(std::floor(y)));
+    }
+
+    // 坐标必须能放进int32，NaN与无穷大不插入
+    bool contains(float x, float y) const {
+        constexpr float limit = 2.0e9f;
+        return std::abs(x) < limit && std::abs(y) < limit;
+    }
+
+    CompactCell cell(size_t p) const {
+        const uint32_t begin = p ? cell_end[p - 1] : 0;
+        return { ids.data() + begin, cell_end[p] - begin };
+    }
+
+    int32_t cellX(size_t p) const {
+        return static_cast<int32_t>(static_cast<uint32_t>(cell_keys[p] >> 32) ^ 0x80000000u);
+    }
+
+    int32_t cellY(size_t p) const {
+        return static_cast<int32_t>(static_cast<uint32_t>(cell_keys[p]) ^ 0x80000000u);
+    }
+
+    // 第column个非空列的第一个cell，column == width时为cell总数
+    size_t columnBegin(size_t column) const {
+        return column_begin[column];
+    }
+
+    uint32_t columnObjectCount(size_t column) const {
+        const uint32_t first = column_begin[column];
+        const uint32_t last = column_begin[column + 1];
+        return first == last ? 0 : cell_end[last - 1] - (first ? cell_end[first - 1] : 0);
+    }
+
+    // 坐标为(cx, cy)的cell，没有物体时返回空的cell
+    CompactCell find(int32_t cx, int32_t cy) const {
+        if (table_keys.empty())
+            return { nullptr, 0 };
+        const uint64_t key = packKey(cx, cy);
+        const size_t mask = table_keys.size() - 1;
+        for (size_t slot = hash(key);; slot = (slot + 1) & mask) {
+            const uint64_t k = table_keys[slot].load(std::memory_order_relaxed);
+            if (k == key)
+                return cell(table_cells[slot]);
+            if (k == empty_key)
+                return { nullptr, 0 };
+        }
+    }
+
+    // 依次对第column个非空列中的每个cell调用f(neighbours)，neighbours[1]是cell自身，其余8个相邻cell的顺序与稠密网格的邻域相同：
+    // 上、自身、下，右边一列的上中下，左边一列的上中下；同一列与左右两列都按y排序，用三个游标顺序推进，不需要查散列表
+    template<typename F>
+    void forEachCell(size_t column, F&& f) const {
+        const size_t begin = column_begin[column];
+        const size_t end = column_begin[column + 1];
+        const int32_t cx = cellX(begin);
+        // 左右两列没有物体时游标范围为空
+        size_t left = 0, left_end = 0, right = 0, right_end = 0;
+        if (column > 0 && cellX(column_begin[column - 1]) == cx - 1) {
+            left = column_begin[column - 1];
+            left_end = begin;
+        }
+        if (column + 1 < static_cast<size_t>(width) && cellX(end) == cx + 1) {
+            right = end;
+            right_end = column_begin[column + 2];
+        }
+        for (size_t p = begin; p < end; ++p) {
+            const int32_t cy = cellY(p);
+            while (left < left_end && cellY(left) < cy - 1)
+                ++left;
+            while (right < right_end && cellY(right) < cy - 1)
+                ++right;
+            const CompactCell neighbours[9] = {
+                p > begin && cellY(p - 1) == cy - 1 ? cell(p - 1) : CompactCell{ nullptr, 0 },
+                cell(p),
+                p + 1 < end && cellY(p + 1) == cy + 1 ? cell(p + 1) : CompactCell{ nullptr, 0 },
+                row(right, right_end, cy - 1), row(right, right_end, cy), row(right, right_end, cy + 1),
+                row(left, left_end, cy - 1), row(left, left_end, cy), row(left, left_end, cy + 1)
+            };
+            f(neighbours);
+        }
+    }
+
+    // filter(i)为false的物体不插入
+    template<typename Pool, typename Filter = InsertAll>
+    void build(const float* x, const float* y, size_t count, Pool& pool, Filter filter = {}) {
+        size_t capacity = 16;
+        uint32_t shift = 60;
+        while (capacity < 2 * count) {
+            capacity <<= 1;
+            --shift;
+        }
+        if (table_keys.size() != capacity) {
+            table_keys = std::vector<std::atomic<uint64_t>>(capacity);
+            table_counts = std::vector<std::atomic<uint32_t>>(capacity);
+            table_cells.resize(capacity);
+        }
+        table_shift = shift;
+        object_slots.resize(count);
+
+        pool.dispatch(capacity, [this](size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i) {
+                table_keys[i].store(empty_key, std::memory_order_relaxed);
+                table_counts[i].store(0, std::memory_order_relaxed);
+            }
+        });
+
+        pool.dispatch(count, [this, x, y, &filter](size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i) {
+                if (filter(i) && contains(x[i], y[i])) {
+                    const uint32_t slot = insert(cellKey(x[i], y[i]));
+                    table_counts[slot].fetch_add(1, std::memory_order_relaxed);
+                    object_slots[i] = slot;
+                }
+                else {
+                    object_slots[i] = no_slot;
+                }
+            }
+        });
+
+        sortCells();
+
+        const size_t cell_count = sorted_cells.size();
+        cell_keys.resize(cell_count);
+        cell_end.resize(cell_count);
+        column_begin.clear();
+        uint32_t total = 0;
+        for (size_t p = 0; p < cell_count; ++p) {
+            const uint32_t slot = sorted_cells[p].second;
+            const uint64_t key = table_keys[slot].load(std::memory_order_relaxed);
+            if (p == 0 || (key >> 32) != (cell_keys[p - 1] >> 32))
+                column_begin.push_back(static_cast<uint32_t>(p));
+            cell_keys[p] = key;
+            table_cells[slot] = static_cast<uint32_t>(p);
+            const uint32_t n = table_counts[slot].load(std::memory_order_relaxed);
+            table_counts[slot].store(total, std::memory_order_relaxed);
+            total += n;
+            cell_end[p] = total;
+        }
+        column_begin.push_back(static_cast<uint32_t>(cell_count));
+        width = static_cast<int32_t>(column_begin.size() - 1);
+        ids.resize(total);
+
+        pool.dispatch(count, [this](size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i) {
+                const uint32_t slot = object_slots[i];
+                if (slot != no_slot)
+                    ids[table_counts[slot].fetch_add(1, std::memory_order_relaxed)] = static_cast<uint32_t>(i);
+            }
+        });
+
+        if (deterministic) {
+            pool.dispatch(cell_count, [this](size_t start, size_t end) {
+                for (size_t p = start; p < end; ++p)
+                    std::sort(ids.begin() + (p ? cell_end[p - 1] : 0), ids.begin() + cell_end[p]);
+            });
+        }
+    }
+
+private:
+    // 收集散列表中的非空cell并按(x, y)排序
+    // 坐标先平移到从0开始再拼成排序键，然后每轮11位做LSD基数排序，轮数取决于非空区域的跨度而不是世界大小
+    void sortCells() {
+        sorted_cells.clear();
+        uint32_t min_x = ~0u, max_x = 0, min_y = ~0u, max_y = 0;
+        for (size_t slot = 0; slot < table_keys.size(); ++slot) {
+            const uint64_t key = table_keys[slot].load(std::memory_order_relaxed);
+            if (key == empty_key)
+                continue;
+            const uint32_t kx = static_cast<uint32_t>(key >> 32), ky = static_cast<uint32_t>(key);
+            min_x = std::min(min_x, kx); max_x = std::max(max_x, kx);
+            min_y = std::min(min_y, ky); max_y = std::max(max_y, ky);
+            sorted_cells.emplace_back(key, static_cast<uint32_t>(slot));
+        }
+        if (sorted_cells.empty())
+            return;
+        uint32_t y_bits = 0;
+        while (y_bits < 32 && (max_y - min_y) >> y_bits)
+            ++y_bits;
+        uint32_t x_bits = 0;
+        while (x_bits < 32 && (max_x - min_x) >> x_bits)
+            ++x_bits;
+        for (auto& [key, slot] : sorted_cells)
+            key = (static_cast<uint64_t>(static_cast<uint32_t>(key >> 32) - min_x) << y_bits) | (static_cast<uint32_t>(key) - min_y);
+
+        constexpr uint32_t radix_bits = 11;
+        constexpr size_t radix = size_t{ 1 } << radix_bits;
+        sort_buffer.resize(sorted_cells.size());
+        for (uint32_t shift = 0; shift < x_bits + y_bits; shift += radix_bits) {
+            uint32_t offsets[radix] = {};
+            for (const auto& cell : sorted_cells)
+                ++offsets[(cell.first >> shift) & (radix - 1)];
+            uint32_t sum = 0;
+            for (uint32_t& offset : offsets) {
+                const uint32_t n = offset;
+                offset = sum;
+                sum += n;
+            }
+            for (const auto& cell : sorted_cells)
+                sort_buffer[offsets[(cell.first >> shift) & (radix - 1)]++] = cell;
+            sorted_cells.swap(sort_buffer);
+        }
+    }
+
+    // [first, last)中y坐标为cy的cell，first处的y不小于cy - 2，最多看3个cell
+    CompactCell row(size_t first, size_t last, int32_t cy) const {
+        for (size_t k = first; k < last && cellY(k) <= cy; ++k) {
+            if (cellY(k) == cy)
+                return cell(k);
+        }
+        return { nullptr, 0 };
+    }
+
+    size_t hash(uint64_t key) const {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> table_shift);
+    }
+
+    // 线性探测，多个线程同时插入同一个键时只有一个会成功写入，其余的读到相同的键
+    uint32_t insert(uint64_t key) {
+        const size_t mask = table_keys.size() - 1;
+        for (size_t slot = hash(key);; slot = (slot + 1) & mask) {
+            uint64_t expected = empty_key;
+            if (table_keys[slot].compare_exchange_strong(expected, key, std::memory_order_relaxed) || expected == key)
+                return static_cast<uint32_t>(slot);
+        }
+    }
+};
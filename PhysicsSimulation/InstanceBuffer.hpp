@@ -0,0 +1,104 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "ThreadPool.h"
+
+// 每个物体一个实例：四边形的中心在(x + 0.5, y + 0.5)，边长为2 * radius，颜色为RGBA8，见vertex.vert
+// 原来每个实例是glm::mat4加glm::vec3共76字节，而且每帧按max_elements整个上传
+struct InstanceData
+{
+    float x, y;
+    float radius;
+    uint32_t color; // 内存中依次为R、G、B、A，以归一化的GL_UNSIGNED_BYTE读取
+};
+
+static_assert(sizeof(InstanceData) == 16, "InstanceData must stay tightly packed");
+
+// [0, 1]的颜色转为RGBA8，alpha为255
+inline uint32_t packColor(const glm::vec3& color) {
+    const auto channel = [](float c) {
+        return static_cast<uint32_t>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+    };
+    return channel(color.x) | channel(color.y) << 8 | channel(color.z) << 16 | 0xFF000000u;
+}
+
+// 实例数据的去处：每帧先acquire得到至少capacity()个实例的可写区域，多个线程写入互不重叠的部分，再commit写入的个数
+// 区域可以是主机内存，也可以直接是映射的GPU缓冲，见StateExchange与PersistentInstanceSink；写入与上传的字节数统计不依赖OpenGL
+class InstanceSink
+{
+public:
+    // 旧格式每帧上传的字节数：max_elements个glm::mat4与glm::vec3
+    static constexpr size_t legacy_instance_size = 16 * sizeof(float) + 3 * sizeof(float);
+
+    explicit InstanceSink(size_t capacity) : maxElements(capacity) {}
+    virtual ~InstanceSink() = default;
+
+    size_t capacity() const {
+        return maxElements;
+    }
+
+    // 本帧的可写区域，commit之前有效
+    virtual InstanceData* acquire() = 0;
+
+    // 本帧写了前count个实例
+    virtual void commit(size_t count) {
+        committed = count;
+        frameBytes = count * sizeof(InstanceData);
+        totalBytes += frameBytes;
+        ++frames;
+    }
+
+    // 最近一帧commit的实例个数
+    size_t size() const {
+        return committed;
+    }
+
+    // 最近一帧以及累计上传的字节数
+    size_t lastFrameBytes() const {
+        return frameBytes;
+    }
+
+    uint64_t totalUploadedBytes() const {
+        return totalBytes;
+    }
+
+    uint64_t frameCount() const {
+        return frames;
+    }
+
+    // 同样帧数下旧格式的上传量
+    uint64_t legacyUploadedBytes() const {
+        return frames * legacy_instance_size * maxElements;
+    }
+
+private:
+    size_t maxElements;
+    size_t committed = 0;
+    size_t frameBytes = 0;
+    uint64_t totalBytes = 0;
+    uint64_t frames = 0;
+};
+
+// 用线程池把前count个物体的实例数据直接写进sink.acquire()的区域，返回写入的个数，之后由调用方commit；超过容量的物体不绘制
+template<typename Storage>
+size_t writeInstances(const Storage& objects, InstanceSink& sink, WorkStealingThreadPool& threadPool) {
+    const size_t count = std::min(objects.size(), sink.capacity());
+    InstanceData* const out = sink.acquire();
+    threadPool.dispatch(
+        count,
+        [out, &objects](size_t start, size_t end) {
+            const float* const x = objects.x.data();
+            const float* const y = objects.y.data();
+            const float* const radius = objects.radius.data();
+            const glm::vec3* const color = objects.color.data();
+            for (size_t i = start; i < end; ++i)
+                out[i] = { x[i], y[i], radius[i], packColor(color[i]) };
+        }
+    );
+    return count;
+}
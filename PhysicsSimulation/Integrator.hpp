@@ -0,0 +1,284 @@
+﻿#pragma once
+
+#include <cstddef>
+
+#include "Simd.hpp"
+
+// 积分器实现，Auto在运行时选择当前CPU支持的最快实现
+// 三种实现按与标量版本完全相同的顺序执行相同的IEEE运算（边界处理用min/max代替分支，结果等价），
+// 因此结果逐位一致；唯一的例外是编译器对标量版本做了乘加融合（/fp:fast、-ffp-contract=fast且启用FMA），
+// 此时每个子步的误差不超过1 ulp。位置为NaN时两者的处理也不同，NaN本身已是错误状态，不作保证
+enum class IntegratorKind
+{
+    Auto,
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// 将请求的积分器落实为当前机器可用的实现，请求AVX2但CPU不支持时退回SSE2
+inline IntegratorKind resolveIntegrator(IntegratorKind kind) {
+#if defined(PHYSICS_SIMD_X86)
+    static const bool avx2 = cpuSupportsAVX2();
+    if (kind == IntegratorKind::Auto || kind == IntegratorKind::AVX2)
+        return avx2 ? IntegratorKind::AVX2 : IntegratorKind::SSE2;
+    return kind;
+#else
+    (void)kind;
+    return IntegratorKind::Scalar;
+#endif
+}
+
+// 积分时访问的数组
+struct VerletStreams
+{
+    float* x;
+    float* y;
+    float* last_x;
+    float* last_y;
+    float* acceleration_x;
+    float* acceleration_y;
+};
+
+struct MassVerletStreams : VerletStreams
+{
+    const float* mass;
+    const float* constant_acceleration_x;
+    const float* constant_acceleration_y;
+};
+
+struct IntegratorParams
+{
+    float gravity_x, gravity_y;
+    float damping;
+    float deltaTime;
+    // 边界，位置被限制在[min, max]中
+    float min_x, max_x;
+    float min_y, max_y;
+    // 撞到边界后保留的冲量比例，即1 - energyLossRate，仅MassVerlet使用
+    float restitution;
+};
+
+class Integrator
+{
+public:
+    // SimplePhysicalObject::Update + 边界限制
+    static void simpleScalar(const VerletStreams& s, size_t start, size_t end, const IntegratorParams& p) {
+        const float dt2 = p.deltaTime * p.deltaTime;
+        for (size_t i = start; i < end; ++i) {
+            const float ax = s.acceleration_x[i] + p.gravity_x;
+            const float ay = s.acceleration_y[i] + p.gravity_y;
+            const float move_x = s.x[i] - s.last_x[i];
+            const float move_y = s.y[i] - s.last_y[i];
+            float new_x = s.x[i] + move_x + (ax - move_x * p.damping) * dt2;
+            float new_y = s.y[i] + move_y + (ay - move_y * p.damping) * dt2;
+            if (new_x > p.max_x) {
+                new_x = p.max_x;
+            }
+            else if (new_x < p.min_x) {
+                new_x = p.min_x;
+            }
+            if (new_y > p.max_y) {
+                new_y = p.max_y;
+            }
+            else if (new_y < p.min_y) {
+                new_y = p.min_y;
+            }
+            s.last_x[i] = s.x[i];
+            s.last_y[i] = s.y[i];
+            s.x[i] = new_x;
+            s.y[i] = new_y;
+            s.acceleration_x[i] = 0.0f;
+            s.acceleration_y[i] = 0.0f;
+        }
+    }
+
+    // PhysicalObject::Update + 边界反弹
+    static void massScalar(const MassVerletStreams& s, size_t start, size_t end, const IntegratorParams& p) {
+        const float dt = p.deltaTime;
+        for (size_t i = start; i < end; ++i) {
+            const float ax = (s.acceleration_x[i] + p.gravity_x) + s.constant_acceleration_x[i];
+            const float ay = (s.acceleration_y[i] + p.gravity_y) + s.constant_acceleration_y[i];
+            const float vx = (s.x[i] - s.last_x[i]) / dt;
+            const float vy = (s.y[i] - s.last_y[i]) / dt;
+            const float nvx = vx + (ax - vx * p.damping) * dt;
+            const float nvy = vy + (ay - vy * p.damping) * dt;
+            s.last_x[i] = s.x[i];
+            s.last_y[i] = s.y[i];
+            s.x[i] = s.x[i] + (vx + nvx) * dt * 0.5f;
+            s.y[i] = s.y[i] + (vy + nvy) * dt * 0.5f;
+            s.acceleration_x[i] = 0.0f;
+            s.acceleration_y[i] = 0.0f;
+            // 撞墙后把法向速度反向，以冲量的形式加到下一步的加速度上
+            if (s.x[i] > p.max_x || s.x[i] < p.min_x) {
+                s.x[i] = s.x[i] > p.max_x ? p.max_x : p.min_x;
+                const float v = (s.x[i] - s.last_x[i]) / dt;
+                s.acceleration_x[i] += ((-v) - v) * s.mass[i] / dt * p.restitution / s.mass[i];
+            }
+            if (s.y[i] > p.max_y || s.y[i] < p.min_y) {
+                s.y[i] = s.y[i] > p.max_y ? p.max_y : p.min_y;
+                const float v = (s.y[i] - s.last_y[i]) / dt;
+                s.acceleration_y[i] += ((-v) - v) * s.mass[i] / dt * p.restitution / s.mass[i];
+            }
+        }
+    }
+
+#if defined(PHYSICS_SIMD_X86)
+    static void simpleSSE2(const VerletStreams& s, size_t start, size_t end, const IntegratorParams& p) {
+        const __m128 gx = _mm_set1_ps(p.gravity_x), gy = _mm_set1_ps(p.gravity_y);
+        const __m128 damping = _mm_set1_ps(p.damping);
+        const __m128 dt2 = _mm_set1_ps(p.deltaTime * p.deltaTime);
+        const __m128 min_x = _mm_set1_ps(p.min_x), max_x = _mm_set1_ps(p.max_x);
+        const __m128 min_y = _mm_set1_ps(p.min_y), max_y = _mm_set1_ps(p.max_y);
+        const __m128 zero = _mm_setzero_ps();
+        size_t i = start;
+        for (; i + 4 <= end; i += 4) {
+            const __m128 x = _mm_loadu_ps(s.x + i), y = _mm_loadu_ps(s.y + i);
+            const __m128 ax = _mm_add_ps(_mm_loadu_ps(s.acceleration_x + i), gx);
+            const __m128 ay = _mm_add_ps(_mm_loadu_ps(s.acceleration_y + i), gy);
+            const __m128 move_x = _mm_sub_ps(x, _mm_loadu_ps(s.last_x + i));
+            const __m128 move_y = _mm_sub_ps(y, _mm_loadu_ps(s.last_y + i));
+            __m128 new_x = _mm_add_ps(_mm_add_ps(x, move_x), _mm_mul_ps(_mm_sub_ps(ax, _mm_mul_ps(move_x, damping)), dt2));
+            __m128 new_y = _mm_add_ps(_mm_add_ps(y, move_y), _mm_mul_ps(_mm_sub_ps(ay, _mm_mul_ps(move_y, damping)), dt2));
+            new_x = _mm_min_ps(_mm_max_ps(new_x, min_x), max_x);
+            new_y = _mm_min_ps(_mm_max_ps(new_y, min_y), max_y);
+            _mm_storeu_ps(s.last_x + i, x);
+            _mm_storeu_ps(s.last_y + i, y);
+            _mm_storeu_ps(s.x + i, new_x);
+            _mm_storeu_ps(s.y + i, new_y);
+            _mm_storeu_ps(s.acceleration_x + i, zero);
+            _mm_storeu_ps(s.acceleration_y + i, zero);
+        }
+        simpleScalar(s, i, end, p);
+    }
+
+    static void massSSE2(const MassVerletStreams& s, size_t start, size_t end, const IntegratorParams& p) {
+        const __m128 gx = _mm_set1_ps(p.gravity_x), gy = _mm_set1_ps(p.gravity_y);
+        const __m128 damping = _mm_set1_ps(p.damping);
+        const __m128 dt = _mm_set1_ps(p.deltaTime);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 restitution = _mm_set1_ps(p.restitution);
+        const __m128 min_x = _mm_set1_ps(p.min_x), max_x = _mm_set1_ps(p.max_x);
+        const __m128 min_y = _mm_set1_ps(p.min_y), max_y = _mm_set1_ps(p.max_y);
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        const __m128 zero = _mm_setzero_ps();
+        size_t i = start;
+        for (; i + 4 <= end; i += 4) {
+            const __m128 x = _mm_loadu_ps(s.x + i), y = _mm_loadu_ps(s.y + i);
+            const __m128 mass = _mm_loadu_ps(s.mass + i);
+            const __m128 ax = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(s.acceleration_x + i), gx), _mm_loadu_ps(s.constant_acceleration_x + i));
+            const __m128 ay = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(s.acceleration_y + i), gy), _mm_loadu_ps(s.constant_acceleration_y + i));
+            const __m128 vx = _mm_div_ps(_mm_sub_ps(x, _mm_loadu_ps(s.last_x + i)), dt);
+            const __m128 vy = _mm_div_ps(_mm_sub_ps(y, _mm_loadu_ps(s.last_y + i)), dt);
+            const __m128 nvx = _mm_add_ps(vx, _mm_mul_ps(_mm_sub_ps(ax, _mm_mul_ps(vx, damping)), dt));
+            const __m128 nvy = _mm_add_ps(vy, _mm_mul_ps(_mm_sub_ps(ay, _mm_mul_ps(vy, damping)), dt));
+            __m128 new_x = _mm_add_ps(x, _mm_mul_ps(_mm_mul_ps(_mm_add_ps(vx, nvx), dt), half));
+            __m128 new_y = _mm_add_ps(y, _mm_mul_ps(_mm_mul_ps(_mm_add_ps(vy, nvy), dt), half));
+            const __m128 hit_x = _mm_or_ps(_mm_cmpgt_ps(new_x, max_x), _mm_cmplt_ps(new_x, min_x));
+            const __m128 hit_y = _mm_or_ps(_mm_cmpgt_ps(new_y, max_y), _mm_cmplt_ps(new_y, min_y));
+            new_x = _mm_min_ps(_mm_max_ps(new_x, min_x), max_x);
+            new_y = _mm_min_ps(_mm_max_ps(new_y, min_y), max_y);
+            const __m128 bx = _mm_div_ps(_mm_sub_ps(new_x, x), dt);
+            const __m128 by = _mm_div_ps(_mm_sub_ps(new_y, y), dt);
+            const __m128 fx = _mm_mul_ps(_mm_div_ps(_mm_mul_ps(_mm_sub_ps(_mm_xor_ps(bx, sign), bx), mass), dt), restitution);
+            const __m128 fy = _mm_mul_ps(_mm_div_ps(_mm_mul_ps(_mm_sub_ps(_mm_xor_ps(by, sign), by), mass), dt), restitution);
+            _mm_storeu_ps(s.last_x + i, x);
+            _mm_storeu_ps(s.last_y + i, y);
+            _mm_storeu_ps(s.x + i, new_x);
+            _mm_storeu_ps(s.y + i, new_y);
+            _mm_storeu_ps(s.acceleration_x + i, _mm_add_ps(zero, _mm_and_ps(hit_x, _mm_div_ps(fx, mass))));
+            _mm_storeu_ps(s.acceleration_y + i, _mm_add_ps(zero, _mm_and_ps(hit_y, _mm_div_ps(fy, mass))));
+        }
+        massScalar(s, i, end, p);
+    }
+
+    PHYSICS_TARGET_AVX2 static void simpleAVX2(const VerletStreams& s, size_t start, size_t end, const IntegratorParams& p) {
+        const __m256 gx = _mm256_set1_ps(p.gravity_x), gy = _mm256_set1_ps(p.gravity_y);
+        const __m256 damping = _mm256_set1_ps(p.damping);
+        const __m256 dt2 = _mm256_set1_ps(p.deltaTime * p.deltaTime);
+        const __m256 min_x = _mm256_set1_ps(p.min_x), max_x = _mm256_set1_ps(p.max_x);
+        const __m256 min_y = _mm256_set1_ps(p.min_y), max_y = _mm256_set1_ps(p.max_y);
+        const __m256 zero = _mm256_setzero_ps();
+        size_t i = start;
+        for (; i + 8 <= end; i += 8) {
+            const __m256 x = _mm256_loadu_ps(s.x + i), y = _mm256_loadu_ps(s.y + i);
+            const __m256 ax = _mm256_add_ps(_mm256_loadu_ps(s.acceleration_x + i), gx);
+            const __m256 ay = _mm256_add_ps(_mm256_loadu_ps(s.acceleration_y + i), gy);
+            const __m256 move_x = _mm256_sub_ps(x, _mm256_loadu_ps(s.last_x + i));
+            const __m256 move_y = _mm256_sub_ps(y, _mm256_loadu_ps(s.last_y + i));
+            __m256 new_x = _mm256_add_ps(_mm256_add_ps(x, move_x), _mm256_mul_ps(_mm256_sub_ps(ax, _mm256_mul_ps(move_x, damping)), dt2));
+            __m256 new_y = _mm256_add_ps(_mm256_add_ps(y, move_y), _mm256_mul_ps(_mm256_sub_ps(ay, _mm256_mul_ps(move_y, damping)), dt2));
+            new_x = _mm256_min_ps(_mm256_max_ps(new_x, min_x), max_x);
+            new_y = _mm256_min_ps(_mm256_max_ps(new_y, min_y), max_y);
+            _mm256_storeu_ps(s.last_x + i, x);
+            _mm256_storeu_ps(s.last_y + i, y);
+            _mm256_storeu_ps(s.x + i, new_x);
+            _mm256_storeu_ps(s.y + i, new_y);
+            _mm256_storeu_ps(s.acceleration_x + i, zero);
+            _mm256_storeu_ps(s.acceleration_y + i, zero);
+        }
+        simpleScalar(s, i, end, p);
+    }
+
+    PHYSICS_TARGET_AVX2 static void massAVX2(const MassVerletStreams& s, size_t start, size_t end, const IntegratorParams& p) {
+        const __m256 gx = _mm256_set1_ps(p.gravity_x), gy = _mm256_set1_ps(p.gravity_y);
+        const __m256 damping = _mm256_set1_ps(p.damping);
+        const __m256 dt = _mm256_set1_ps(p.deltaTime);
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 restitution = _mm256_set1_ps(p.restitution);
+        const __m256 min_x = _mm256_set1_ps(p.min_x), max_x = _mm256_set1_ps(p.max_x);
+        const __m256 min_y = _mm256_set1_ps(p.min_y), max_y = _mm256_set1_ps(p.max_y);
+        const __m256 sign = _mm256_set1_ps(-0.0f);
+        const __m256 zero = _mm256_setzero_ps();
+        size_t i = start;
+        for (; i + 8 <= end; i += 8) {
+            const __m256 x = _mm256_loadu_ps(s.x + i), y = _mm256_loadu_ps(s.y + i);
+            const __m256 mass = _mm256_loadu_ps(s.mass + i);
+            const __m256 ax = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(s.acceleration_x + i), gx), _mm256_loadu_ps(s.constant_acceleration_x + i));
+            const __m256 ay = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(s.acceleration_y + i), gy), _mm256_loadu_ps(s.constant_acceleration_y + i));
+            const __m256 vx = _mm256_div_ps(_mm256_sub_ps(x, _mm256_loadu_ps(s.last_x + i)), dt);
+            const __m256 vy = _mm256_div_ps(_mm256_sub_ps(y, _mm256_loadu_ps(s.last_y + i)), dt);
+            const __m256 nvx = _mm256_add_ps(vx, _mm256_mul_ps(_mm256_sub_ps(ax, _mm256_mul_ps(vx, damping)), dt));
+            const __m256 nvy = _mm256_add_ps(vy, _mm256_mul_ps(_mm256_sub_ps(ay, _mm256_mul_ps(vy, damping)), dt));
+            __m256 new_x = _mm256_add_ps(x, _mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(vx, nvx), dt), half));
+            __m256 new_y = _mm256_add_ps(y, _mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(vy, nvy), dt), half));
+            const __m256 hit_x = _mm256_or_ps(_mm256_cmp_ps(new_x, max_x, _CMP_GT_OQ), _mm256_cmp_ps(new_x, min_x, _CMP_LT_OQ));
+            const __m256 hit_y = _mm256_or_ps(_mm256_cmp_ps(new_y, max_y, _CMP_GT_OQ), _mm256_cmp_ps(new_y, min_y, _CMP_LT_OQ));
+            new_x = _mm256_min_ps(_mm256_max_ps(new_x, min_x), max_x);
+            new_y = _mm256_min_ps(_mm256_max_ps(new_y, min_y), max_y);
+            const __m256 bx = _mm256_div_ps(_mm256_sub_ps(new_x, x), dt);
+            const __m256 by = _mm256_div_ps(_mm256_sub_ps(new_y, y), dt);
+            const __m256 fx = _mm256_mul_ps(_mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_xor_ps(bx, sign), bx), mass), dt), restitution);
+            const __m256 fy = _mm256_mul_ps(_mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_xor_ps(by, sign), by), mass), dt), restitution);
+            _mm256_storeu_ps(s.last_x + i, x);
+            _mm256_storeu_ps(s.last_y + i, y);
+            _mm256_storeu_ps(s.x + i, new_x);
+            _mm256_storeu_ps(s.y + i, new_y);
+            _mm256_storeu_ps(s.acceleration_x + i, _mm256_add_ps(zero, _mm256_and_ps(hit_x, _mm256_div_ps(fx, mass))));
+            _mm256_storeu_ps(s.acceleration_y + i, _mm256_add_ps(zero, _mm256_and_ps(hit_y, _mm256_div_ps(fy, mass))));
+        }
+        massScalar(s, i, end, p);
+    }
+#endif
+
+    // kind应当已经经过resolveIntegrator
+    static void simple(IntegratorKind kind, const VerletStreams& s, size_t start, size_t end, const IntegratorParams& p) {
+#if defined(PHYSICS_SIMD_X86)
+        if (kind == IntegratorKind::AVX2)
+            return simpleAVX2(s, start, end, p);
+        if (kind == IntegratorKind::SSE2)
+            return simpleSSE2(s, start, end, p);
+#endif
+        simpleScalar(s, start, end, p);
+    }
+
+    static void mass(IntegratorKind kind, const MassVerletStreams& s, size_t start, size_t end, const IntegratorParams& p) {
+#if defined(PHYSICS_SIMD_X86)
+        if (kind == IntegratorKind::AVX2)
+            return massAVX2(s, start, end, p);
+        if (kind == IntegratorKind::SSE2)
+            return massSSE2(s, start, end, p);
+#endif
+        massScalar(s, start, end, p);
+    }
+};
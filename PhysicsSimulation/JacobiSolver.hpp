@@ -0,0 +1,126 @@
+﻿#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Simd.hpp"
+
+enum class ContactSolver
+{
+    GaussSeidel, // 逐个接触原地移动两个物体，见PhysicsSolver::solveContact，需要条带或着色块避免写冲突
+    Jacobi       // 只读位置，每个物体累加自己的修正量，之后统一加到位置上，见JacobiSolver
+};
+
+// Jacobi接触求解：一轮迭代中位置只读，每个物体把它所有接触的修正量累加到correctionX/correctionY中自己的那一项，
+// 不会写别的物体，因此所有cell可以按任意顺序并行处理，不需要条带也不需要两轮；cell的内容不随线程数变化时
+// （Grid总是如此，其他网格要开确定性模式）结果与线程数无关
+// 收集完之后每个物体的位置加上relaxation倍的修正量。接触两侧各移动一半，与Gauss-Seidel相同，但修正量在一轮内不会传递，
+// 堆积的物体收敛更慢：iterations增加每个子步的迭代次数，relaxation小于1可以减弱被多个方向同时推动的物体的抖动
+class JacobiSolver
+{
+public:
+    static constexpr size_t columnGrain = 8; // 收集时每个任务处理的列数
+
+    uint32_t iterations = 1;
+    float relaxation = 1.0f;
+    std::vector<float> correctionX, correctionY; // 与物体下标对应，apply之后清零
+
+    void resize(size_t count) {
+        correctionX.resize(count, 0.0f);
+        correctionY.resize(count, 0.0f);
+    }
+
+    // 物体a与物体b接触时a的修正量，位移与PhysicsSolver::solveContact中a的位移相同
+    template<bool VariableRadius = false>
+    static void contact(const float* x, const float* y, const float* radius, size_t a, size_t b, float& sum_x, float& sum_y) {
+        constexpr float response_coef = 1.0f;
+        constexpr float eps = 0.0001f;
+        const float dx = x[a] - x[b], dy = y[a] - y[b];
+        const float dist2 = dx * dx + dy * dy;
+        if constexpr (VariableRadius) {
+            const float r1 = radius[a], r2 = radius[b];
+            const float min_dist = r1 + r2;
+            if (dist2 < min_dist * min_dist && dist2 > eps) {
+                const float dist = std::sqrt(dist2);
+                const float delta = response_coef * (min_dist - dist);
+                const float ratio1 = r2 * r2 / (r1 * r1 + r2 * r2);
+                sum_x += dx / dist * delta * ratio1;
+                sum_y += dy / dist * delta * ratio1;
+            }
+        }
+        else if (dist2 < 1.0f && dist2 > eps) {
+            (void)radius;
+            const float dist = std::sqrt(dist2);
+            const float delta = response_coef * 0.5f * (1.0f - dist);
+            sum_x += dx / dist * delta;
+            sum_y += dy / dist * delta;
+        }
+    }
+
+    // 下标在[start, end)中的物体：位置 += relaxation * 修正量，修正量清零；三种实现结果逐位一致
+    void apply(SimdLevel level, float* x, float* y, size_t start, size_t end) {
+#if defined(PHYSICS_SIMD_X86)
+        if (level == SimdLevel::AVX2)
+            return applyAVX2(x, y, start, end);
+        if (level == SimdLevel::SSE2)
+            return applySSE2(x, y, start, end);
+#else
+        (void)level;
+#endif
+        applyScalar(x, y, start, end);
+    }
+
+private:
+    void applyScalar(float* x, float* y, size_t start, size_t end) {
+        float* const cx = correctionX.data();
+        float* const cy = correctionY.data();
+        for (size_t i = start; i < end; ++i) {
+            x[i] += cx[i] * relaxation;
+            y[i] += cy[i] * relaxation;
+            cx[i] = 0.0f;
+            cy[i] = 0.0f;
+        }
+    }
+
+#if defined(PHYSICS_SIMD_X86)
+    void applySSE2(float* x, float* y, size_t start, size_t end) {
+        float* const cx = correctionX.data();
+        float* const cy = correctionY.data();
+        const __m128 factor = _mm_set1_ps(relaxation);
+        const __m128 zero = _mm_setzero_ps();
+        size_t i = start;
+        for (; i + 4 <= end; i += 4) {
+            _mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(_mm_loadu_ps(cx + i), factor)));
+            _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(_mm_loadu_ps(cy + i), factor)));
+            _mm_storeu_ps(cx + i, zero);
+            _mm_storeu_ps(cy + i, zero);
+        }
+        applyScalar(x, y, i, end);
+    }
+
+    PHYSICS_TARGET_AVX2 void applyAVX2(float* x, float* y, size_t start, size_t end) {
+        float* const cx = correctionX.data();
+        float* const cy = correctionY.data();
+        const __m256 factor = _mm256_set1_ps(relaxation);
+        const __m256 zero = _mm256_setzero_ps();
+        size_t i = start;
+        for (; i + 8 <= end; i += 8) {
+            _mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_mul_ps(_mm256_loadu_ps(cx + i), factor)));
+            _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(_mm256_loadu_ps(cy + i), factor)));
+            _mm256_storeu_ps(cx + i, zero);
+            _mm256_storeu_ps(cy + i, zero);
+        }
+        applyScalar(x, y, i, end);
+    }
+#endif
+};
+
+// 互相重叠的物体对的穿透深度，单位与世界坐标相同（默认直径为1）
+struct ContactError
+{
+    uint64_t contacts = 0;
+    float mean = 0.0f;
+    float max = 0.0f;
+};
@@ -0,0 +1,158 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+
+#include "Simd.hpp"
+
+enum class NarrowPhaseKind
+{
+    Scalar,  // 逐对调用solveContact
+    Batched  // 先收集一个cell的3x3邻域，再用SIMD一次算完其中每个原子的全部碰撞
+};
+
+// 一个cell在3x3邻域内的全部物体，cell自身的物体排在最前面
+// 原子自身也在batch中，距离为0会被eps排除
+// 批量求解时原子对整批的修正累加后一次性加到原子上（标量版本每处理一对就更新一次），
+// 因此结果与Scalar模式有细微差别，但不影响收敛
+struct alignas(32) ContactBatch
+{
+    // 3x3邻域、每格最多4个物体，补齐到8的倍数以便AVX2整批处理
+    static constexpr uint32_t capacity = 40;
+
+    alignas(32) float x[capacity];
+    alignas(32) float y[capacity];
+    alignas(32) float correction_x[capacity];
+    alignas(32) float correction_y[capacity];
+    uint32_t ids[capacity];
+    uint32_t count = 0;
+    uint64_t hits = 0; // 第i位表示候选i发生了碰撞，只需要回写这些候选
+
+    void add(uint32_t id, float px, float py) {
+        ids[count] = id;
+        x[count] = px;
+        y[count] = py;
+        ++count;
+    }
+
+    // 用不可能发生碰撞的位置补齐到width的倍数，返回补齐后的数量
+    uint32_t pad(uint32_t width, float atom_x, float atom_y) {
+        uint32_t padded = count;
+        while (padded % width) {
+            x[padded] = atom_x + 4.0f;
+            y[padded] = atom_y + 4.0f;
+            ++padded;
+        }
+        return padded;
+    }
+};
+
+class NarrowPhase
+{
+public:
+    static constexpr float response_coef = 1.0f;
+    static constexpr float eps = 0.0001f;
+
+    // 计算原子与batch中所有候选的碰撞修正
+    // 候选j应当减去correction[j]，原子应当加上correction_sum
+    static void solve(SimdLevel level, float atom_x, float atom_y, ContactBatch& batch, float& sum_x, float& sum_y) {
+#if defined(PHYSICS_SIMD_X86)
+        if (level == SimdLevel::AVX2)
+            return solveAVX2(atom_x, atom_y, batch, sum_x, sum_y);
+        if (level == SimdLevel::SSE2)
+            return solveSSE2(atom_x, atom_y, batch, sum_x, sum_y);
+#endif
+        solveScalar(atom_x, atom_y, batch, sum_x, sum_y);
+    }
+
+    static void solveScalar(float atom_x, float atom_y, ContactBatch& batch, float& sum_x, float& sum_y) {
+        sum_x = 0.0f;
+        sum_y = 0.0f;
+        batch.hits = 0;
+        for (uint32_t i = 0; i < batch.count; ++i) {
+            const float dx = atom_x - batch.x[i];
+            const float dy = atom_y - batch.y[i];
+            const float dist2 = dx * dx + dy * dy;
+            float cx = 0.0f, cy = 0.0f;
+            if (dist2 < 1.0f && dist2 > eps) {
+                const float dist = std::sqrt(dist2);
+                const float delta = response_coef * 0.5f * (1.0f - dist);
+                cx = dx / dist * delta;
+                cy = dy / dist * delta;
+            }
+            batch.correction_x[i] = cx;
+            batch.correction_y[i] = cy;
+            batch.hits |= static_cast<uint64_t>(cx != 0.0f || cy != 0.0f) << i;
+            sum_x += cx;
+            sum_y += cy;
+        }
+    }
+
+#if defined(PHYSICS_SIMD_X86)
+    // rsqrt只有12位精度，做一次牛顿迭代后约为22位，对位置修正已经足够
+    static void solveSSE2(float atom_x, float atom_y, ContactBatch& batch, float& sum_x, float& sum_y) {
+        const uint32_t padded = batch.pad(4, atom_x, atom_y);
+        const __m128 ax = _mm_set1_ps(atom_x), ay = _mm_set1_ps(atom_y);
+        const __m128 one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f), three_halves = _mm_set1_ps(1.5f);
+        const __m128 epsilon = _mm_set1_ps(eps);
+        const __m128 coef = _mm_set1_ps(response_coef * 0.5f);
+        __m128 acc_x = _mm_setzero_ps(), acc_y = _mm_setzero_ps();
+        batch.hits = 0;
+        for (uint32_t i = 0; i < padded; i += 4) {
+            const __m128 dx = _mm_sub_ps(ax, _mm_load_ps(batch.x + i));
+            const __m128 dy = _mm_sub_ps(ay, _mm_load_ps(batch.y + i));
+            const __m128 dist2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+            const __m128 mask = _mm_and_ps(_mm_cmplt_ps(dist2, one), _mm_cmpgt_ps(dist2, epsilon));
+            batch.hits |= static_cast<uint64_t>(_mm_movemask_ps(mask)) << i;
+            __m128 inv = _mm_rsqrt_ps(dist2);
+            inv = _mm_mul_ps(inv, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, dist2), _mm_mul_ps(inv, inv))));
+            const __m128 dist = _mm_mul_ps(dist2, inv);
+            const __m128 scale = _mm_and_ps(mask, _mm_mul_ps(_mm_mul_ps(coef, _mm_sub_ps(one, dist)), inv));
+            const __m128 cx = _mm_mul_ps(dx, scale);
+            const __m128 cy = _mm_mul_ps(dy, scale);
+            _mm_store_ps(batch.correction_x + i, cx);
+            _mm_store_ps(batch.correction_y + i, cy);
+            acc_x = _mm_add_ps(acc_x, cx);
+            acc_y = _mm_add_ps(acc_y, cy);
+        }
+        sum_x = horizontalSum(acc_x);
+        sum_y = horizontalSum(acc_y);
+    }
+
+    PHYSICS_TARGET_AVX2 static void solveAVX2(float atom_x, float atom_y, ContactBatch& batch, float& sum_x, float& sum_y) {
+        const uint32_t padded = batch.pad(8, atom_x, atom_y);
+        const __m256 ax = _mm256_set1_ps(atom_x), ay = _mm256_set1_ps(atom_y);
+        const __m256 one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f), three_halves = _mm256_set1_ps(1.5f);
+        const __m256 epsilon = _mm256_set1_ps(eps);
+        const __m256 coef = _mm256_set1_ps(response_coef * 0.5f);
+        __m256 acc_x = _mm256_setzero_ps(), acc_y = _mm256_setzero_ps();
+        batch.hits = 0;
+        for (uint32_t i = 0; i < padded; i += 8) {
+            const __m256 dx = _mm256_sub_ps(ax, _mm256_load_ps(batch.x + i));
+            const __m256 dy = _mm256_sub_ps(ay, _mm256_load_ps(batch.y + i));
+            const __m256 dist2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            const __m256 mask = _mm256_and_ps(_mm256_cmp_ps(dist2, one, _CMP_LT_OQ), _mm256_cmp_ps(dist2, epsilon, _CMP_GT_OQ));
+            batch.hits |= static_cast<uint64_t>(_mm256_movemask_ps(mask)) << i;
+            __m256 inv = _mm256_rsqrt_ps(dist2);
+            inv = _mm256_mul_ps(inv, _mm256_sub_ps(three_halves, _mm256_mul_ps(_mm256_mul_ps(half, dist2), _mm256_mul_ps(inv, inv))));
+            const __m256 dist = _mm256_mul_ps(dist2, inv);
+            const __m256 scale = _mm256_and_ps(mask, _mm256_mul_ps(_mm256_mul_ps(coef, _mm256_sub_ps(one, dist)), inv));
+            const __m256 cx = _mm256_mul_ps(dx, scale);
+            const __m256 cy = _mm256_mul_ps(dy, scale);
+            _mm256_store_ps(batch.correction_x + i, cx);
+            _mm256_store_ps(batch.correction_y + i, cy);
+            acc_x = _mm256_add_ps(acc_x, cx);
+            acc_y = _mm256_add_ps(acc_y, cy);
+        }
+        sum_x = horizontalSum(_mm_add_ps(_mm256_castps256_ps128(acc_x), _mm256_extractf128_ps(acc_x, 1)));
+        sum_y = horizontalSum(_mm_add_ps(_mm256_castps256_ps128(acc_y), _mm256_extractf128_ps(acc_y, 1)));
+    }
+
+    static float horizontalSum(__m128 v) {
+        const __m128 high = _mm_movehl_ps(v, v);
+        const __m128 pair = _mm_add_ps(v, high);
+        return _mm_cvtss_f32(_mm_add_ss(pair, _mm_shuffle_ps(pair, pair, 1)));
+    }
+#endif
+};
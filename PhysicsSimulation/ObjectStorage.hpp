@@ -0,0 +1,347 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "PhysicalObject.hpp"
+#include "Snapshot.hpp"
+
+// 对SoA中一对x/y分量的引用，使外部仍然可以像AoS那样写 objects[id].position.x -= ...
+class Vec2Ref
+{
+public:
+    float& x;
+    float& y;
+
+    Vec2Ref(float& x, float& y) : x(x), y(y) {}
+    Vec2Ref(const Vec2Ref&) = default;
+
+    operator glm::vec2() const {
+        return { x, y };
+    }
+
+    Vec2Ref& operator=(const glm::vec2& v) {
+        x = v.x;
+        y = v.y;
+        return *this;
+    }
+
+    Vec2Ref& operator=(const Vec2Ref& v) {
+        return *this = static_cast<glm::vec2>(v);
+    }
+
+    Vec2Ref& operator+=(const glm::vec2& v) {
+        x += v.x;
+        y += v.y;
+        return *this;
+    }
+
+    Vec2Ref& operator-=(const glm::vec2& v) {
+        x -= v.x;
+        y -= v.y;
+        return *this;
+    }
+};
+
+// 以SoA方式保存物体，每个分量都是独立的连续数组
+// 积分、建网格与碰撞只需要遍历它们实际用到的数组，而不必把颜色、质量等冷数据一起拖进缓存
+// 物体在数组中的下标会因为重排而改变，创建物体时返回的id不变，二者通过ids/indices相互转换
+class ObjectStorage
+{
+public:
+    std::vector<float> x, y;
+    std::vector<float> last_x, last_y;
+    std::vector<float> acceleration_x, acceleration_y;
+    std::vector<glm::vec3> color;
+    std::vector<float> radius;
+    std::vector<SleepState> sleep_state;
+    std::vector<uint16_t> still_substeps; // 物体停留在anchor附近的子步数，见SleepTracker
+    std::vector<float> anchor_x, anchor_y;
+    // 休眠的物体所在接触岛的编号，0表示不属于任何岛；buried为1的物体被同一个岛完全包围，不插入网格，见SleepTracker
+    // 二者可以由休眠状态重新得出，不保存到快照中
+    std::vector<uint32_t> island;
+    std::vector<uint8_t> buried;
+    std::vector<uint32_t> ids;     // 下标 -> id
+    std::vector<uint32_t> indices; // id -> 下标
+
+    // 对单个物体的轻量代理，仅在创建物体或逐个修改时使用，热循环应当直接访问数组
+    class Handle
+    {
+    public:
+        Vec2Ref position, last_position, acceleration;
+        glm::vec3& color;
+        float& radius;
+
+        Handle(ObjectStorage& s, size_t i) :
+            position(s.x[i], s.y[i]),
+            last_position(s.last_x[i], s.last_y[i]),
+            acceleration(s.acceleration_x[i], s.acceleration_y[i]),
+            color(s.color[i]),
+            radius(s.radius[i]) {}
+    };
+
+    ObjectStorage() = default;
+
+    size_t size() const {
+        return x.size();
+    }
+
+    bool empty() const {
+        return x.empty();
+    }
+
+    void reserve(size_t n) {
+        x.reserve(n); y.reserve(n);
+        last_x.reserve(n); last_y.reserve(n);
+        acceleration_x.reserve(n); acceleration_y.reserve(n);
+        color.reserve(n);
+        radius.reserve(n);
+        sleep_state.reserve(n); still_substeps.reserve(n);
+        anchor_x.reserve(n); anchor_y.reserve(n);
+        island.reserve(n); buried.reserve(n);
+        ids.reserve(n); indices.reserve(n);
+    }
+
+    void clear() {
+        x.clear(); y.clear();
+        last_x.clear(); last_y.clear();
+        acceleration_x.clear(); acceleration_y.clear();
+        color.clear();
+        radius.clear();
+        sleep_state.clear(); still_substeps.clear();
+        anchor_x.clear(); anchor_y.clear();
+        island.clear(); buried.clear();
+        ids.clear(); indices.clear();
+    }
+
+    // 返回新物体的id，新物体总在数组末尾，因此此时id与下标相同
+    size_t emplace_back(glm::vec2 pos, float r = SimplePhysicalObject::defaultRadius) {
+        const uint32_t id = static_cast<uint32_t>(size());
+        x.push_back(pos.x); y.push_back(pos.y);
+        last_x.push_back(pos.x); last_y.push_back(pos.y);
+        acceleration_x.push_back(0.0f); acceleration_y.push_back(0.0f);
+        color.emplace_back(0.0f, 0.0f, 0.0f);
+        radius.push_back(r);
+        sleep_state.push_back(SleepState::Awake);
+        still_substeps.push_back(0);
+        anchor_x.push_back(pos.x); anchor_y.push_back(pos.y);
+        island.push_back(0); buried.push_back(0);
+        ids.push_back(id);
+        indices.push_back(id);
+        return id;
+    }
+
+    size_t push_back(const SimplePhysicalObject& obj) {
+        const size_t id = emplace_back(obj.position, obj.radius);
+        last_x[id] = obj.last_position.x;
+        last_y[id] = obj.last_position.y;
+        acceleration_x[id] = obj.acceleration.x;
+        acceleration_y[id] = obj.acceleration.y;
+        color[id] = obj.color;
+        return id;
+    }
+
+    // 按下标访问
+    Handle operator[](size_t i) {
+        return Handle(*this, i);
+    }
+
+    // 按创建时返回的id访问，重排之后仍然指向同一个物体
+    Handle byId(size_t id) {
+        return Handle(*this, indices[id]);
+    }
+
+    size_t indexOf(size_t id) const {
+        return indices[id];
+    }
+
+    // 按order重排所有数组：新下标i处放原来第order[i]个物体
+    void reorder(const std::vector<uint32_t>& order) {
+        permute(x, order); permute(y, order);
+        permute(last_x, order); permute(last_y, order);
+        permute(acceleration_x, order); permute(acceleration_y, order);
+        permute(color, order);
+        permute(radius, order);
+        permute(sleep_state, order); permute(still_substeps, order);
+        permute(anchor_x, order); permute(anchor_y, order);
+        permute(island, order); permute(buried, order);
+        permute(ids, order);
+        for (size_t i = 0; i < ids.size(); ++i)
+            indices[ids[i]] = static_cast<uint32_t>(i);
+    }
+
+    void writeSnapshot(SnapshotWriter& writer) const {
+        writer.add(SnapshotSectionId::X, x); writer.add(SnapshotSectionId::Y, y);
+        writer.add(SnapshotSectionId::LastX, last_x); writer.add(SnapshotSectionId::LastY, last_y);
+        writer.add(SnapshotSectionId::AccelerationX, acceleration_x); writer.add(SnapshotSectionId::AccelerationY, acceleration_y);
+        writer.add(SnapshotSectionId::Color, color);
+        writer.add(SnapshotSectionId::Radius, radius);
+        writer.add(SnapshotSectionId::SleepState, sleep_state); writer.add(SnapshotSectionId::StillSubsteps, still_substeps);
+        writer.add(SnapshotSectionId::AnchorX, anchor_x); writer.add(SnapshotSectionId::AnchorY, anchor_y);
+        writer.add(SnapshotSectionId::Ids, ids); writer.add(SnapshotSectionId::Indices, indices);
+    }
+
+    // 数组长度与快照头中的物体数不一致，或者ids/indices不是互逆的排列时抛出异常
+    void readSnapshot(SnapshotReader& reader) {
+        reader.read(SnapshotSectionId::X, x); reader.read(SnapshotSectionId::Y, y);
+        reader.read(SnapshotSectionId::LastX, last_x); reader.read(SnapshotSectionId::LastY, last_y);
+        reader.read(SnapshotSectionId::AccelerationX, acceleration_x); reader.read(SnapshotSectionId::AccelerationY, acceleration_y);
+        reader.read(SnapshotSectionId::Color, color);
+        reader.read(SnapshotSectionId::Ids, ids); reader.read(SnapshotSectionId::Indices, indices);
+        const size_t n = reader.getHeader().object_count;
+        // 加入半径之前保存的快照中没有这一段，所有物体都是默认半径
+        if (reader.contains(SnapshotSectionId::Radius))
+            reader.read(SnapshotSectionId::Radius, radius);
+        else
+            radius.assign(n, SimplePhysicalObject::defaultRadius);
+        // 加入休眠之前保存的快照中所有物体都醒着
+        if (reader.contains(SnapshotSectionId::SleepState)) {
+            reader.read(SnapshotSectionId::SleepState, sleep_state);
+            reader.read(SnapshotSectionId::StillSubsteps, still_substeps);
+            reader.read(SnapshotSectionId::AnchorX, anchor_x); reader.read(SnapshotSectionId::AnchorY, anchor_y);
+        }
+        else {
+            sleep_state.assign(n, SleepState::Awake);
+            still_substeps.assign(n, 0);
+            anchor_x = x;
+            anchor_y = y;
+        }
+        // 载入的休眠物体都留在网格中，直到它们被唤醒、重新休眠
+        island.assign(n, 0);
+        buried.assign(n, 0);
+        if (x.size() != n || y.size() != n || last_x.size() != n || last_y.size() != n
+            || acceleration_x.size() != n || acceleration_y.size() != n
+            || color.size() != n || radius.size() != n || sleep_state.size() != n || still_substeps.size() != n
+            || anchor_x.size() != n || anchor_y.size() != n
+            || ids.size() != n || indices.size() != n)
+            throw std::runtime_error("Snapshot: object arrays have different sizes");
+        for (size_t i = 0; i < n; ++i)
+            if (ids[i] >= n || indices[ids[i]] != i)
+                throw std::runtime_error("Snapshot: ids and indices do not match");
+        for (size_t i = 0; i < n; ++i)
+            if (static_cast<uint8_t>(sleep_state[i]) > static_cast<uint8_t>(SleepState::Woken))
+                throw std::runtime_error("Snapshot: invalid sleep state");
+    }
+
+    // 按id顺序对位置与上一帧位置的二进制位做FNV-1a哈希，与物体在数组中的排列无关
+    // 用来检查两次运行（例如不同线程数）的结果是否逐位一致
+    uint64_t hash() const {
+        uint64_t h = 14695981039346656037ull;
+        const auto mix = [&h](float value) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            for (int i = 0; i < 4; ++i) {
+                h ^= (bits >> (8 * i)) & 0xff;
+                h *= 1099511628211ull;
+            }
+        };
+        for (size_t id = 0; id < indices.size(); ++id) {
+            const size_t i = indices[id];
+            mix(x[i]); mix(y[i]);
+            mix(last_x[i]); mix(last_y[i]);
+        }
+        return h;
+    }
+
+    glm::vec2 position(size_t i) const {
+        return { x[i], y[i] };
+    }
+
+    glm::vec2 lastPosition(size_t i) const {
+        return { last_x[i], last_y[i] };
+    }
+
+protected:
+    template<typename T>
+    static void permute(std::vector<T>& v, const std::vector<uint32_t>& order) {
+        std::vector<T> permuted(v.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            permuted[i] = v[order[i]];
+        v.swap(permuted);
+    }
+};
+
+// 带质量与恒定加速度的物体，对应PhysicalObject
+class MassObjectStorage : public ObjectStorage
+{
+public:
+    std::vector<float> mass;
+    std::vector<float> constant_acceleration_x, constant_acceleration_y;
+
+    class Handle : public ObjectStorage::Handle
+    {
+    public:
+        float& mass;
+        Vec2Ref constantAcceleration;
+
+        Handle(MassObjectStorage& s, size_t i) :
+            ObjectStorage::Handle(s, i),
+            mass(s.mass[i]),
+            constantAcceleration(s.constant_acceleration_x[i], s.constant_acceleration_y[i]) {}
+    };
+
+    void reserve(size_t n) {
+        ObjectStorage::reserve(n);
+        mass.reserve(n);
+        constant_acceleration_x.reserve(n);
+        constant_acceleration_y.reserve(n);
+    }
+
+    void clear() {
+        ObjectStorage::clear();
+        mass.clear();
+        constant_acceleration_x.clear();
+        constant_acceleration_y.clear();
+    }
+
+    size_t emplace_back(glm::vec2 pos, float m = 1.0f, glm::vec2 constAcce = { 0.0f, 0.0f }, float r = SimplePhysicalObject::defaultRadius) {
+        mass.push_back(m);
+        constant_acceleration_x.push_back(constAcce.x);
+        constant_acceleration_y.push_back(constAcce.y);
+        return ObjectStorage::emplace_back(pos, r);
+    }
+
+    size_t push_back(const PhysicalObject& obj) {
+        const size_t id = emplace_back(obj.position, obj.mass, obj.constantAcceleration, obj.radius);
+        last_x[id] = obj.last_position.x;
+        last_y[id] = obj.last_position.y;
+        acceleration_x[id] = obj.acceleration.x;
+        acceleration_y[id] = obj.acceleration.y;
+        color[id] = obj.color;
+        return id;
+    }
+
+    Handle operator[](size_t i) {
+        return Handle(*this, i);
+    }
+
+    Handle byId(size_t id) {
+        return Handle(*this, indices[id]);
+    }
+
+    void writeSnapshot(SnapshotWriter& writer) const {
+        ObjectStorage::writeSnapshot(writer);
+        writer.add(SnapshotSectionId::Mass, mass);
+        writer.add(SnapshotSectionId::ConstantAccelerationX, constant_acceleration_x);
+        writer.add(SnapshotSectionId::ConstantAccelerationY, constant_acceleration_y);
+    }
+
+    void readSnapshot(SnapshotReader& reader) {
+        ObjectStorage::readSnapshot(reader);
+        reader.read(SnapshotSectionId::Mass, mass);
+        reader.read(SnapshotSectionId::ConstantAccelerationX, constant_acceleration_x);
+        reader.read(SnapshotSectionId::ConstantAccelerationY, constant_acceleration_y);
+        const size_t n = size();
+        if (mass.size() != n || constant_acceleration_x.size() != n || constant_acceleration_y.size() != n)
+            throw std::runtime_error("Snapshot: object arrays have different sizes");
+    }
+
+    void reorder(const std::vector<uint32_t>& order) {
+        ObjectStorage::reorder(order);
+        permute(mass, order);
+        permute(constant_acceleration_x, order);
+        permute(constant_acceleration_y, order);
+    }
+};
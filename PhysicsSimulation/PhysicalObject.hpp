@@ -1,7 +1,16 @@
 #pragma once
 
+#include <cstdint>
 #include <glm/glm.hpp>
 
+// ״̬SleepTracker
+enum class SleepState : uint8_t
+{
+    Awake,
+    Asleep,
+    Woken // ӲѣԺڵӴ
+};
+
 class SimplePhysicalObject
 {
 private:
@@ -10,6 +19,8 @@ public:
     glm::vec3 color{ 0.0f, 0.0f, 0.0f };
 
     static constexpr glm::vec2 size = { 1.0f, 1.0f };
+    static constexpr float defaultRadius = 0.5f; // sizeӦcell߳Ĭֱ
+    float radius = defaultRadius;
     static constexpr float movementDamping = 40.0f; // ˶ʱСٶȳҴٶȷķdeltaTime̶ĳϣ䵥λΪ/s^2Ӷȷٶ
 
     SimplePhysicalObject() = default;
@@ -37,6 +48,7 @@ public:
     glm::vec2 position{ 0.0f, 0.0f } /* m */, acceleration{0.0f, 0.0f}/* m/(s^2) */;
     glm::vec2 last_position{ 0.0f, 0.0f };
     float mass = 1.0f; // KG
+    float radius = SimplePhysicalObject::defaultRadius; // m
     glm::vec3 color{ 0.0f, 0.0f, 0.0f };
     static constexpr float movementDamping = 0.04f; // /s
 
@@ -1,161 +1,623 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <algorithm>
 #include <shared_mutex>
 
 #include "ThreadPool.h"
 #include "Grid.hpp"
+#include "CompactGrid.hpp"
+#include "HashGrid.hpp"
+#include "GridHierarchy.hpp"
 #include "PhysicalObject.hpp"
+#include "ObjectStorage.hpp"
+#include "Integrator.hpp"
+#include "NarrowPhase.hpp"
+#include "SpatialOrder.hpp"
+#include "SlicePartition.hpp"
+#include "BlockTiling.hpp"
+#include "Sleep.hpp"
+#include "JacobiSolver.hpp"
+#include "Profiler.h"
 
+// GridTypeGridÿcell̶CompactGridޣHashGridϡ裬ڴС޹أ
+template<typename GridType = Grid>
 class PhysicsSolver
 {
 public:
+    using Cell = typename GridType::Cell;
+
     //std::shared_mutex mtx; // Ҫô߳Ⱦ߳Ӧһ
 
-    std::vector<SimplePhysicalObject> objects;
-    //std::vector<PhysicalObject> objects;
+    //std::vector<SimplePhysicalObject> objects;
+    ObjectStorage objects;
 
-    SafeSimpleThreadPool& threadPool;
+    WorkStealingThreadPool& threadPool;
+    //SafeSimpleThreadPool& threadPool;
     //FastThreadPool& threadPool;
-    Grid grid;
+    GridType grid;
     glm::vec2 world_size;
     glm::vec2 gravity = { 0.0f, 5.0f };
 
-    std::vector<std::future<void>> rets;
-
     size_t sub_steps;
 
-    PhysicsSolver(glm::vec2 size, SafeSimpleThreadPool& threadPool) :
+    IntegratorKind integrator = IntegratorKind::Auto; // ʱлʵ
+    GridUpdate gridUpdate = GridUpdate::Rebuild; // ֻGridЧCompactGridHashGridÿӲؽ
+    NarrowPhaseKind narrowPhase = NarrowPhaseKind::Scalar;
+
+    // ÿreorderInterval֡ռһ壬Ϊ0ʱ
+    size_t reorderInterval = 0;
+    SpatialCurve reorderCurve = SpatialCurve::Hilbert;
+    size_t framesSinceReorder = 0;
+    std::vector<uint32_t> reorderKeys, reorderOrder;
+
+    // ײΪ߳ * 2 * slicesPerThread1ʱ̶߳࣬ɹȡƽ⸺
+    size_t slicesPerThread = 1;
+    SliceBalance sliceBalance = SliceBalance::Columns;
+    SlicePartition slices;
+
+    // ΪTiles4Tiles9ʱײñ߳ΪtileSizecellĶάɫ飬BlockTilingϡǰ
+    CollisionSchedule collisionSchedule = CollisionSchedule::Slices;
+    uint32_t tileSize = 32;
+    BlockTiling tiles;
+
+    // ȷģʽ̶ΪdeterministicSliceColumnsп߳仯CompactGridcellڰ±
+    // ͬһֵصÿڲдͬĳʼ״̬߳µõλͬĽ
+    bool deterministic = false;
+    size_t deterministicSliceColumns = 4;
+
+    // а뾶ĬֵʱΪtrueʱ뾶0.5񣬽ӴΪ߰뾶֮
+    // ΪfalseʱԭľȰ뾶·ɱ뾶֮ǰȫͬ
+    bool variableRadius = false;
+    GridHierarchy<GridType> hierarchy;
+
+    // ֹĽӴߣٻײSleepTrackerĬϹر
+    SleepTracker sleep;
+
+    // ΪJacobiʱ0ĽӴٷɫ飬ɳϵJacobiSolverĬϰ뾶ĽӴ԰Gauss-Seidel
+    ContactSolver contactSolver = ContactSolver::GaussSeidel;
+    JacobiSolver jacobi;
+
+    PhysicsSolver(glm::vec2 size, WorkStealingThreadPool& threadPool) :
         grid(static_cast<int32_t>(size.x), static_cast<int32_t>(size.y)),
         world_size(size.x, size.y),
         sub_steps(8),
-        threadPool(threadPool) {
+        threadPool(threadPool),
+        hierarchy(size.x, size.y) {
         grid.clear();
-        rets.reserve(threadPool.getThreadCount());
     }
 
+    // ÿӲؽԲ
+    // compressΪtrueʱñѹдʧ׳std::runtime_error
+    void save(const std::string& path, bool compress = false) const {
+        SnapshotWriter writer(compress);
+        writer.header.solver = SnapshotSolverKind::Simple;
+        writer.header.object_count = objects.size();
+        writer.header.world_width = world_size.x;
+        writer.header.world_height = world_size.y;
+        writer.header.gravity_x = gravity.x;
+        writer.header.gravity_y = gravity.y;
+        writer.header.sub_steps = sub_steps;
+        writer.header.frames_since_reorder = framesSinceReorder;
+        objects.writeSnapshot(writer);
+        writer.write(path);
+    }
+
+    // ָsave״̬֮ģ뱣ʱȫһ
+    // յС뵱ǰͬڹʱС䣩
+    void load(const std::string& path) {
+        SnapshotReader reader(path);
+        const SnapshotHeader& header = reader.getHeader();
+        if (header.solver != SnapshotSolverKind::Simple)
+            throw std::runtime_error("Snapshot: " + path + " was saved by another solver");
+        if (header.world_width != world_size.x || header.world_height != world_size.y)
+            throw std::runtime_error("Snapshot: world size of " + path + " does not match");
+        objects.readSnapshot(reader);
+        gravity = { header.gravity_x, header.gravity_y };
+        sub_steps = static_cast<size_t>(header.sub_steps);
+        framesSinceReorder = static_cast<size_t>(header.frames_since_reorder);
+        updateVariableRadius();
+        sleep.recount(objects);
+        grid.clear();
+    }
+
+    // VariableRadiusΪtrueʱӴΪ߰뾶֮ͣλư뾶ƽȷָ壬뾶ʱĬͬ
+    template<bool VariableRadius = false>
     void solveContact(size_t atom1_id, size_t atom2_id) {
         constexpr float response_coef = 1.0f;
         constexpr float eps = 0.0001f;
-        SimplePhysicalObject* obj1, * obj2;
-        glm::vec2 o2_to_o1;
-        float dist2;
-        {
-            //std::shared_lock<std::shared_mutex> lk(mtx);
-            obj1 = &objects[atom1_id];
-            obj2 = &objects[atom2_id];
-            o2_to_o1 = obj1->position - obj2->position;
-            dist2 = o2_to_o1.x * o2_to_o1.x + o2_to_o1.y * o2_to_o1.y;
-        }
-        if (dist2 < 1.0f && dist2 > eps) {
-            //std::unique_lock<std::shared_mutex> lk(mtx);
+        float* const x = objects.x.data();
+        float* const y = objects.y.data();
+        const glm::vec2 o2_to_o1 = { x[atom1_id] - x[atom2_id], y[atom1_id] - y[atom2_id] };
+        const float dist2 = o2_to_o1.x * o2_to_o1.x + o2_to_o1.y * o2_to_o1.y;
+        if constexpr (VariableRadius) {
+            const float r1 = objects.radius[atom1_id], r2 = objects.radius[atom2_id];
+            const float min_dist = r1 + r2;
+            if (dist2 < min_dist * min_dist && dist2 > eps) {
+                const float dist = sqrt(dist2);
+                const float delta = response_coef * (min_dist - dist);
+                const float ratio1 = r2 * r2 / (r1 * r1 + r2 * r2);
+                const glm::vec2 n = o2_to_o1 / dist;
+                x[atom1_id] += n.x * delta * ratio1;
+                y[atom1_id] += n.y * delta * ratio1;
+                x[atom2_id] -= n.x * delta * (1.0f - ratio1);
+                y[atom2_id] -= n.y * delta * (1.0f - ratio1);
+            }
+        }
+        else if (dist2 < 1.0f && dist2 > eps) {
             const float dist = sqrt(dist2);
             const float delta = response_coef * 0.5f * (1.0f - dist); // һ
             const glm::vec2 col_vec = (o2_to_o1 / dist) * delta; // 
-            obj1->position += col_vec;
-            obj2->position -= col_vec;
+            x[atom1_id] += col_vec.x;
+            y[atom1_id] += col_vec.y;
+            x[atom2_id] -= col_vec.x;
+            y[atom2_id] -= col_vec.y;
         }
     }
     
-    void checkAtomCellCollisions(size_t atom_id, const CollisionCell& c) {
+    template<bool VariableRadius = false>
+    void checkAtomCellCollisions(size_t atom_id, const Cell& c) {
         for (size_t i = 0; i < c.objects_count; ++i) {
-            solveContact(atom_id, c.objects[i]);
+            solveContact<VariableRadius>(atom_id, c.objects[i]);
         }
     }
 
-    void checkCellCollision(const CollisionCell& c, size_t index) {
+    // ʱǷ
+    bool asleep(size_t i) const {
+        return sleep.enabled && objects.sleep_state[i] == SleepState::Asleep;
+    }
+
+    template<bool VariableRadius = false>
+    void checkCellCollision(const Cell& c, size_t index) {
         for (size_t i = 0; i < c.objects_count; ++i) {
             const size_t atom_idx = c.objects[i];
+            // ߵ岻ΪŵĽӴɶԷ
+            if (asleep(atom_idx))
+                continue;
             // ǰgridԼܱ8gridײ
-            checkAtomCellCollisions(atom_idx, grid.data[index - 1]); // 
-            checkAtomCellCollisions(atom_idx, grid.data[index]);
-            checkAtomCellCollisions(atom_idx, grid.data[index + 1]); // 
-            checkAtomCellCollisions(atom_idx, grid.data[index + grid.height - 1]);
-            checkAtomCellCollisions(atom_idx, grid.data[index + grid.height]); // 
-            checkAtomCellCollisions(atom_idx, grid.data[index + grid.height + 1]);
-            checkAtomCellCollisions(atom_idx, grid.data[index - grid.height - 1]);
-            checkAtomCellCollisions(atom_idx, grid.data[index - grid.height]); // 
-            checkAtomCellCollisions(atom_idx, grid.data[index - grid.height + 1]);
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index - 1)); // 
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index + 1)); // 
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index + grid.height - 1));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index + grid.height)); // 
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index + grid.height + 1));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index - grid.height - 1));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index - grid.height)); // 
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index - grid.height + 1));
+        }
+    }
+
+    // ϡcolumnǿеcellHashGrid::forEachCell˳checkCellCollisionͬ
+    template<bool VariableRadius = false>
+    void checkSparseColumnCollision(size_t column) {
+        grid.forEachCell(column, [this](const Cell (&neighbours)[9]) {
+            const Cell& c = neighbours[1];
+            for (size_t i = 0; i < c.objects_count; ++i) {
+                if (asleep(c.objects[i]))
+                    continue;
+                for (const Cell& n : neighbours)
+                    checkAtomCellCollisions<VariableRadius>(c.objects[i], n);
+            }
+        });
+    }
+
+    // ռcellܱ8cellе壬cellǰ
+    // 峬batchʱfalse
+    bool gatherNeighbourhood(size_t index, ContactBatch& batch) {
+        const size_t neighbours[9] = {
+            index,
+            index - 1, index + 1,
+            index + grid.height - 1, index + grid.height, index + grid.height + 1,
+            index - grid.height - 1, index - grid.height, index - grid.height + 1
+        };
+        batch.count = 0;
+        for (const size_t n : neighbours) {
+            const Cell& c = grid.cell(n);
+            if (batch.count + c.objects_count > ContactBatch::capacity)
+                return false;
+            for (uint32_t i = 0; i < c.objects_count; ++i) {
+                const uint32_t id = c.objects[i];
+                batch.add(id, objects.x[id], objects.y[id]);
+            }
+        }
+        return true;
+    }
+
+    // ͬһcellеԭӹͬһÿcellֻռһΣ֮ÿԭһSIMD
+    void checkCellCollisionBatched(const Cell& c, size_t index, ContactBatch& batch, SimdLevel level) {
+        if (c.objects_count == 0)
+            return;
+        if (sleep.enabled && std::all_of(c.objects, c.objects + c.objects_count, [this](uint32_t id) { return asleep(id); }))
+            return;
+        if (!gatherNeighbourhood(index, batch)) {
+            checkCellCollision(c, index);
+            return;
+        }
+        float* const x = objects.x.data();
+        float* const y = objects.y.data();
+        for (uint32_t i = 0; i < c.objects_count; ++i) {
+            if (asleep(batch.ids[i]))
+                continue;
+            // batchеiѡԭ
+            float sum_x, sum_y;
+            NarrowPhase::solve(level, batch.x[i], batch.y[i], batch, sum_x, sum_y);
+            // batchеλȫͬ£ͬһcellкԭʹ
+            for (uint64_t hits = batch.hits; hits; hits &= hits - 1) {
+                const uint32_t j = countTrailingZeros(hits);
+                const uint32_t id = batch.ids[j];
+                x[id] -= batch.correction_x[j];
+                y[id] -= batch.correction_y[j];
+                batch.x[j] -= batch.correction_x[j];
+                batch.y[j] -= batch.correction_y[j];
+            }
+            x[batch.ids[i]] += sum_x;
+            y[batch.ids[i]] += sum_y;
+            batch.x[i] += sum_x;
+            batch.y[i] += sum_y;
+        }
+    }
+
+    void solveCollisionSingleThread(size_t i) {
+        PROFILE_WORK(i % 2 ? ProfilePhase::CollisionPass2 : ProfilePhase::CollisionPass1);
+        if constexpr (requires { GridType::sparse; }) {
+            // ϡǿлֻ֣
+            for (size_t column = slices.begin(i, 1); column < slices.end(i, 1); ++column) {
+                if (variableRadius)
+                    checkSparseColumnCollision<true>(column);
+                else
+                    checkSparseColumnCollision(column);
+            }
+            return;
         }
+        solveCellRange(slices.begin(i, grid.height), slices.end(i, grid.height));
     }
 
-    void solveCollisionSingleThread(size_t i, size_t slice_size) {
-        const size_t start = i * slice_size;
-        const size_t end = (i + 1) * slice_size;
+    // ±[start, end)еcellɫ鹲
+    void solveCellRange(size_t start, size_t end) {
+        if (variableRadius) {
+            // Ӵ̶Ϊ1ɱ뾶ʱ˻
+            for (size_t idx = start; idx < end; ++idx) {
+                checkCellCollision<true>(grid.cell(idx), idx);
+            }
+            return;
+        }
+        if (narrowPhase == NarrowPhaseKind::Batched) {
+            ContactBatch batch;
+            const SimdLevel level = detectSimdLevel();
+            for (size_t idx = start; idx < end; ++idx) {
+                checkCellCollisionBatched(grid.cell(idx), idx, batch, level);
+            }
+            return;
+        }
         for (size_t idx = start; idx < end; ++idx) {
-            checkCellCollision(grid.data[idx], idx);
+            checkCellCollision(grid.cell(idx), idx);
         }
     }
 
-    void solveCollisions() {
-        const size_t thread_count = static_cast<size_t>(threadPool.getThreadCount());
-        const size_t slice_count = thread_count * 2;
-        const size_t slice_size = (grid.width / slice_count) * grid.height;
-        //std::vector<std::future<void>> rets;
-        //rets.reserve(thread_count);
-        rets.clear();
-        for (size_t i = 0; i < thread_count; ++i) {
-            rets.emplace_back(
-                threadPool.enqueue(
-                    [this, i, slice_size]() {
-                        solveCollisionSingleThread(2 * i, slice_size);
+    // ÿһҲ
+    void partitionSlices(SlicePartition& partition, const GridType& g) {
+        if (deterministic) {
+            partition.uniform(static_cast<uint32_t>(g.width), g.width / std::max<size_t>(deterministicSliceColumns, SlicePartition::min_columns));
+            return;
+        }
+        const size_t slice_count = threadPool.getThreadCount() * 2 * std::max<size_t>(slicesPerThread, 1);
+        if (sliceBalance == SliceBalance::Objects)
+            partition.balance(g, slice_count, threadPool);
+        else
+            partition.uniform(static_cast<uint32_t>(g.width), slice_count);
+    }
+
+    // ʹöάɫʱΪtrue
+    bool tiled() const {
+        if constexpr (requires { GridType::sparse; })
+            return false;
+        return collisionSchedule != CollisionSchedule::Slices;
+    }
+
+    // ɫβдͬɫĿ飬ÿһǰһɫCollisionPass1CollisionPass2
+    template<typename F>
+    void solveTiles(F&& solveRange) {
+        tiles.tile(static_cast<uint32_t>(grid.width), static_cast<uint32_t>(grid.height), tileSize, collisionSchedule);
+        const size_t colors = tiles.colorCount();
+        for (size_t color = 0; color < colors; ++color) {
+            const ProfilePhase phase = color < colors / 2 ? ProfilePhase::CollisionPass1 : ProfilePhase::CollisionPass2;
+            PROFILE_PHASE(phase);
+            threadPool.parallelFor(
+                0, tiles.colorBlockCount(color), 1,
+                [this, color, phase, &solveRange](size_t start, size_t end) {
+                    static_cast<void>(phase);
+                    for (size_t i = start; i < end; ++i) {
+                        PROFILE_WORK(phase);
+                        tiles.forEachColumn(color, i, grid.height, solveRange);
                     }
-                )
+                }
             );
         }
-        //threadPool.waitForCompletion();
-        for (auto& ret : rets)
-            ret.wait();
-        rets.clear();
-        for (size_t i = 0; i < thread_count; ++i) {
-            rets.emplace_back(
-                threadPool.enqueue(
-                    [this, i, slice_size]() {
-                        solveCollisionSingleThread(2 * i + 1, slice_size);
+    }
+
+    // atom_idcell cĽӴֻۼatom_idԼߵֻŵƶGauss-SeidelΪһ
+    template<bool VariableRadius = false>
+    void gatherAtomCell(size_t atom_id, bool sleeping, const Cell& c, float& sum_x, float& sum_y) const {
+        for (size_t i = 0; i < c.objects_count; ++i) {
+            const size_t other = c.objects[i];
+            if (!sleeping || !asleep(other))
+                JacobiSolver::contact<VariableRadius>(objects.x.data(), objects.y.data(), objects.radius.data(), atom_id, other, sum_x, sum_y);
+        }
+    }
+
+    template<bool VariableRadius = false>
+    void gatherCell(const Cell& c, size_t index) {
+        const size_t neighbours[9] = {
+            index - 1, index, index + 1,
+            index + grid.height - 1, index + grid.height, index + grid.height + 1,
+            index - grid.height - 1, index - grid.height, index - grid.height + 1
+        };
+        for (size_t i = 0; i < c.objects_count; ++i) {
+            const size_t atom_id = c.objects[i];
+            const bool sleeping = asleep(atom_id);
+            float sum_x = 0.0f, sum_y = 0.0f;
+            for (const size_t n : neighbours)
+                gatherAtomCell<VariableRadius>(atom_id, sleeping, grid.cell(n), sum_x, sum_y);
+            jacobi.correctionX[atom_id] = sum_x;
+            jacobi.correctionY[atom_id] = sum_y;
+        }
+    }
+
+    // ϡcolumnǿеcellͬgatherCell
+    template<bool VariableRadius = false>
+    void gatherSparseColumn(size_t column) {
+        grid.forEachCell(column, [this](const Cell (&neighbours)[9]) {
+            const Cell& c = neighbours[1];
+            for (size_t i = 0; i < c.objects_count; ++i) {
+                const size_t atom_id = c.objects[i];
+                const bool sleeping = asleep(atom_id);
+                float sum_x = 0.0f, sum_y = 0.0f;
+                for (const Cell& n : neighbours)
+                    gatherAtomCell<VariableRadius>(atom_id, sleeping, n, sum_x, sum_y);
+                jacobi.correctionX[atom_id] = sum_x;
+                jacobi.correctionY[atom_id] = sum_y;
+            }
+        });
+    }
+
+    // ռ[start, end)
+    template<bool VariableRadius = false>
+    void gatherColumns(size_t start, size_t end) {
+        if constexpr (requires { GridType::sparse; }) {
+            for (size_t column = start; column < end; ++column)
+                gatherSparseColumn<VariableRadius>(column);
+        }
+        else {
+            for (size_t idx = start * grid.height; idx < end * grid.height; ++idx)
+                gatherCell<VariableRadius>(grid.cell(idx), idx);
+        }
+    }
+
+    // 0ĽӴJacobi⣺ÿεȲռе˳⣩SIMDͳһӵλϣ
+    void solveJacobi() {
+        PROFILE_PHASE(ProfilePhase::CollisionPass1);
+        jacobi.resize(objects.size());
+        const SimdLevel level = detectSimdLevel();
+        for (uint32_t iteration = 0; iteration < jacobi.iterations; ++iteration) {
+            threadPool.parallelFor(
+                0, static_cast<size_t>(grid.width), JacobiSolver::columnGrain,
+                [this](size_t start, size_t end) {
+                    PROFILE_WORK(ProfilePhase::CollisionPass1);
+                    if (variableRadius)
+                        gatherColumns<true>(start, end);
+                    else
+                        gatherColumns(start, end);
+                }
+            );
+            threadPool.dispatch(
+                objects.size(),
+                [this, level](size_t start, size_t end) {
+                    jacobi.apply(level, objects.x.data(), objects.y.data(), start, end);
+                }
+            );
+        }
+    }
+
+    void solveCollisions() {
+        if (contactSolver == ContactSolver::Jacobi) {
+            solveJacobi();
+        }
+        else if (tiled()) {
+            solveTiles([this](size_t start, size_t end) { solveCellRange(start, end); });
+        }
+        else {
+            partitionSlices(slices, grid);
+            // ȴżٴͬһֵڣÿһ񣬲Ҫfuture
+            for (size_t phase = 0; phase < 2; ++phase) {
+                PROFILE_PHASE(phase ? ProfilePhase::CollisionPass2 : ProfilePhase::CollisionPass1);
+                threadPool.parallelFor(
+                    0, slices.phaseSliceCount(phase), 1,
+                    [this, phase](size_t start, size_t end) {
+                        for (size_t i = start; i < end; ++i)
+                            solveCollisionSingleThread(2 * i + phase);
                     }
-                )
+                );
+            }
+        }
+        if (variableRadius) {
+            PROFILE_PHASE(ProfilePhase::CollisionPass2);
+            hierarchy.solve(
+                grid, objects.x.data(), objects.y.data(), objects.radius.data(), threadPool,
+                [this](SlicePartition& partition, const GridType& g) { partitionSlices(partition, g); },
+                [this](size_t atom1_id, size_t atom2_id) {
+                    // С֮ĽӴֻӴߴһΣֻߵ
+                    if (!asleep(atom1_id) || !asleep(atom2_id))
+                        solveContact<true>(atom1_id, atom2_id);
+                }
             );
         }
-        //threadPool.waitForCompletion();
-        for (auto& ret : rets)
-            ret.wait();
     }
 
     size_t add(const SimplePhysicalObject& obj) {
         //std::unique_lock<std::shared_mutex> lk(mtx);
-        objects.push_back(obj);
-        return objects.size() - 1;
+        SimplePhysicalObject o = obj;
+        o.radius = clampRadius(obj.radius);
+        sleep.wakeAround(o.position.x, o.position.y, o.radius + SleepTracker::contactMargin);
+        sleep.awake.fetch_add(1, std::memory_order_relaxed);
+        return objects.push_back(o);
     }
 
-    size_t create(glm::vec2 pos) {
+    // 뾶Ĭϰ뾶0.58֮
+    size_t create(glm::vec2 pos, float radius = SimplePhysicalObject::defaultRadius) {
         //std::unique_lock<std::shared_mutex> lk(mtx);
-        objects.emplace_back(pos);
-        return objects.size() - 1;
+        radius = clampRadius(radius);
+        sleep.wakeAround(pos.x, pos.y, radius + SleepTracker::contactMargin);
+        sleep.awake.fetch_add(1, std::memory_order_relaxed);
+        return objects.emplace_back(pos, radius);
+    }
+
+    float clampRadius(float radius) {
+        radius = std::clamp(radius, 0.5f * SimplePhysicalObject::defaultRadius, GridHierarchy<GridType>::max_radius);
+        variableRadius |= radius != SimplePhysicalObject::defaultRadius;
+        return radius;
+    }
+
+    void updateVariableRadius() {
+        variableRadius = std::any_of(objects.radius.begin(), objects.radius.end(),
+            [](float r) { return r != SimplePhysicalObject::defaultRadius; });
+    }
+
+    // aӴС߰뾶֮ͼSleepTracker::contactMargin壬ڻߵĽӴ
+    template<typename F>
+    void forEachTouching(uint32_t a, F&& f) const {
+        const float* const x = objects.x.data();
+        const float* const y = objects.y.data();
+        const float* const radius = objects.radius.data();
+        auto contact = [&](size_t, size_t b) {
+            const float dx = x[a] - x[b], dy = y[a] - y[b];
+            const float reach = radius[a] + radius[b] + SleepTracker::contactMargin;
+            if (dx * dx + dy * dy < reach * reach)
+                f(static_cast<uint32_t>(b));
+        };
+        const uint32_t levels = variableRadius ? GridHierarchy<GridType>::max_level : 0;
+        for (uint32_t m = 0; m <= levels; ++m)
+            hierarchy.query(grid, m, a, x[a], y[a], radius[a] + SleepTracker::contactMargin, contact);
+    }
+
+    // ÿSleepTracker::checkInterval֡жһЩӴߣõһӲ񣻹ر֮
+    void updateSleep() {
+        if (!sleep.enabled) {
+            if (sleep.awake.load(std::memory_order_relaxed) != objects.size())
+                sleep.wakeAll(objects);
+            return;
+        }
+        if (sleep.awake.load(std::memory_order_relaxed) == 0 || !sleep.checkDue())
+            return;
+        PROFILE_PHASE(ProfilePhase::Integration);
+        sleep.sleepIslands(objects, [this](uint32_t a, auto&& f) { forEachTouching(a, f); }, !variableRadius);
+    }
+
+    // Ŀռ߼ֵ壬ʹռڵҲڣײʱһЩȱʧ
+    // ź±䣬ⲿӦcreate/addصidͨobjects.byId
+    void reorderObjects() {
+        // ССȡ߱߳ϡwidthֻǷǿ
+        const uint32_t side = SpatialOrder::curveSide(static_cast<int32_t>(world_size.x), static_cast<int32_t>(world_size.y));
+        const float* const x = objects.x.data();
+        const float* const y = objects.y.data();
+        reorderKeys.resize(objects.size());
+        threadPool.dispatch(
+            objects.size(),
+            [&](size_t start, size_t end) {
+                for (size_t i = start; i < end; ++i)
+                    reorderKeys[i] = SpatialOrder::key(reorderCurve, x[i], y[i], side);
+            }
+        );
+        SpatialOrder::sortByKey(reorderKeys, reorderOrder);
+        objects.reorder(reorderOrder);
+    }
+
+    // ǰ״̬Ĺϣÿupdate֮üõ֡Уֵ֤Żûиı߶λһγֲ֡
+    uint64_t stateHash() const {
+        return objects.hash();
+    }
+
+    // С߰뾶֮͵Եƽ͸ȣӴжԶ
+    // õǵǰƶ֮ҪȵaddObjectsToGrid
+    ContactError contactError() const {
+        ContactError error;
+        double sum = 0.0;
+        const float* const x = objects.x.data();
+        const float* const y = objects.y.data();
+        const float* const radius = objects.radius.data();
+        const uint32_t levels = variableRadius ? GridHierarchy<GridType>::max_level : 0;
+        for (uint32_t a = 0; a < objects.size(); ++a) {
+            auto contact = [&](size_t, size_t b) {
+                const float dx = x[a] - x[b], dy = y[a] - y[b];
+                const float min_dist = radius[a] + radius[b];
+                const float dist2 = dx * dx + dy * dy;
+                // ÿֻһ
+                if (b > a && dist2 < min_dist * min_dist) {
+                    const float overlap = min_dist - std::sqrt(dist2);
+                    sum += overlap;
+                    error.max = std::max(error.max, overlap);
+                    ++error.contacts;
+                }
+            };
+            for (uint32_t m = 0; m <= levels; ++m)
+                hierarchy.query(grid, m, a, x[a], y[a], radius[a], contact);
+        }
+        error.mean = error.contacts ? static_cast<float>(sum / static_cast<double>(error.contacts)) : 0.0f;
+        return error;
     }
 
     void update(float deltaTime) {
+        // һ֮֡½ߵĵе壬Ҫڽ֮ǰSleepTracker::wakeAround֮е±ʧЧ
+        if (sleep.enabled)
+            sleep.wakeIslands(objects, [this](uint32_t a, auto&& f) { forEachTouching(a, f); });
+        if (reorderInterval && ++framesSinceReorder >= reorderInterval) {
+            reorderObjects();
+            framesSinceReorder = 0;
+        }
         const float sub_dt = deltaTime / static_cast<float>(sub_steps);
         using namespace std::chrono;
         for (size_t i = sub_steps; i > 0; --i) {
+            // 嶼ʱӲҪ
+            if (sleep.enabled && sleep.awake.load(std::memory_order_relaxed) == 0)
+                break;
             addObjectsToGrid();
             solveCollisions();
             updateObjects_multi(sub_dt);
         }
+        updateSleep();
     }
 
     void addObjectsToGrid() {
-        grid.clear();
-        size_t i = 0;
-        for (const auto& obj : objects) {
-            if (obj.position.x > 1.0f && obj.position.x < world_size.x - 1.0f
-                && obj.position.y > 1.0f && obj.position.y < world_size.y - 1.0f) {
-                grid.add(static_cast<size_t>(obj.position.x), static_cast<size_t>(obj.position.y), i);
-            }
-            i++;
+        PROFILE_PHASE(ProfilePhase::GridBuild);
+        if constexpr (requires { grid.deterministic; })
+            grid.deterministic = deterministic;
+        if (!variableRadius) {
+            // ߵĵΧ岻񣬼SleepTracker::buryContacts
+            if (sleep.enabled && sleep.buried != 0)
+                buildGrid([buried = objects.buried.data()](size_t i) { return !buried[i]; });
+            else
+                buildGrid();
+            return;
+        }
+        // 0ֻŲĬϰ뾶壬ķ
+        const float* const radius = objects.radius.data();
+        buildGrid([radius](size_t i) { return radius[i] <= SimplePhysicalObject::defaultRadius; });
+        hierarchy.build(objects.x.data(), objects.y.data(), radius, objects.size(), threadPool, deterministic);
+    }
+
+    // GridֻƶcellؽGrid::update
+    template<typename Filter = InsertAll>
+    void buildGrid(Filter filter = {}) {
+        if constexpr (requires { grid.incremental; }) {
+            grid.incremental = gridUpdate == GridUpdate::Incremental;
+            grid.update(objects.x.data(), objects.y.data(), objects.size(), threadPool, filter);
+        }
+        else {
+            grid.build(objects.x.data(), objects.y.data(), objects.size(), threadPool, filter);
         }
     }
 
     void updateObjects_multi(float deltaTime) {
+        PROFILE_PHASE(ProfilePhase::Integration);
         /*
         static std::function<void(size_t, size_t)> func = [this, deltaTime](size_t start, size_t end) {
             for (size_t i = start; i < end; ++i) {
@@ -200,209 +662,493 @@ public:
             ret.wait();
         */
 
-        
+        const IntegratorKind kind = resolveIntegrator(integrator);
+        const float margin = 2.0f;
+        const VerletStreams streams{
+            objects.x.data(), objects.y.data(),
+            objects.last_x.data(), objects.last_y.data(),
+            objects.acceleration_x.data(), objects.acceleration_y.data()
+        };
+        const IntegratorParams params{
+            gravity.x, gravity.y,
+            SimplePhysicalObject::movementDamping,
+            deltaTime,
+            margin, world_size.x - margin,
+            margin, world_size.y - margin,
+            1.0f
+        };
+        if (sleep.enabled)
+            sleep.awake.store(0, std::memory_order_relaxed);
         threadPool.dispatch
         (
             objects.size(),
             [&](size_t start, size_t end) {
-                for (size_t i = start; i < end; ++i) {
-                    SimplePhysicalObject& obj = objects[i];
-                    //PhysicalObject& obj = objects[i];
-                    obj.acceleration += gravity;
-                    obj.Update(deltaTime);
-                    const float margin = 2.0f;
-                    if (obj.position.x > world_size.x - margin) {
-                        obj.position.x = world_size.x - margin;
-                    }
-                    else if (obj.position.x < margin) {
-                        obj.position.x = margin;
-                    }
-                    if (obj.position.y > world_size.y - margin) {
-                        obj.position.y = world_size.y - margin;
-                    }
-                    else if (obj.position.y < margin) {
-                        obj.position.y = margin;
-                    }
+                if (!sleep.enabled) {
+                    Integrator::simple(kind, streams, start, end, params);
+                    return;
                 }
+                sleep.updateActivity(objects, start, end, deltaTime);
+                SleepTracker::forEachAwakeRun(objects, start, end, [&](size_t first, size_t last) {
+                    Integrator::simple(kind, streams, first, last, params);
+                });
             }
         );
-        
+        if (variableRadius)
+            hierarchy.clampToWorld(objects.x.data(), objects.y.data(), objects.radius.data(), world_size.x, world_size.y);
+        if (sleep.enabled)
+            sleep.wakeIslands(objects, [this](uint32_t a, auto&& f) { forEachTouching(a, f); });
     }
 };
 
+// GridTypeGridÿcell̶CompactGridޣHashGridϡ裬ڴС޹أ
+template<typename GridType = Grid>
 class NewPhysicsSolver
 {
 public:
+    using Cell = typename GridType::Cell;
+
     //std::shared_mutex mtx; // Ҫô߳Ⱦ߳Ӧһ
 
-    //std::vector<SimplePhysicalObject> objects;
-    std::vector<PhysicalObject> objects;
+    //std::vector<PhysicalObject> objects;
+    MassObjectStorage objects;
 
-    SafeSimpleThreadPool& threadPool;
+    WorkStealingThreadPool& threadPool;
+    //SafeSimpleThreadPool& threadPool;
     //FastThreadPool& threadPool;
-    Grid grid;
+    GridType grid;
     glm::vec2 world_size;
     glm::vec2 gravity = { 0.0f, 9.8f };
 
-    std::vector<std::future<void>> rets;
-
     static constexpr float energyLossRate = 0.1f;
 
+    static constexpr float firstMass = 1.0f;
+    float nextMass = firstMass; // create()״̬ձ
+
     size_t sub_steps;
 
-    NewPhysicsSolver(glm::vec2 size, SafeSimpleThreadPool& threadPool) :
+    IntegratorKind integrator = IntegratorKind::Auto; // ʱлʵ
+    GridUpdate gridUpdate = GridUpdate::Rebuild; // ֻGridЧCompactGridHashGridÿӲؽ
+
+    // ÿreorderInterval֡ռһ壬Ϊ0ʱ
+    size_t reorderInterval = 0;
+    SpatialCurve reorderCurve = SpatialCurve::Hilbert;
+    size_t framesSinceReorder = 0;
+    std::vector<uint32_t> reorderKeys, reorderOrder;
+
+    // ײΪ߳ * 2 * slicesPerThread1ʱ̶߳࣬ɹȡƽ⸺
+    size_t slicesPerThread = 1;
+    SliceBalance sliceBalance = SliceBalance::Columns;
+    SlicePartition slices;
+
+    // ΪTiles4Tiles9ʱײñ߳ΪtileSizecellĶάɫ飬BlockTilingϡǰ
+    CollisionSchedule collisionSchedule = CollisionSchedule::Slices;
+    uint32_t tileSize = 32;
+    BlockTiling tiles;
+
+    // ȷģʽ̶ΪdeterministicSliceColumnsп߳仯CompactGridcellڰ±
+    // ͬһֵصÿڲдͬĳʼ״̬߳µõλͬĽ
+    bool deterministic = false;
+    size_t deterministicSliceColumns = 4;
+
+    // а뾶ĬֵʱΪtrueʱ뾶0.5񣬽ӴΪ߰뾶֮
+    // ΪfalseʱԭľȰ뾶·ɱ뾶֮ǰȫͬ
+    bool variableRadius = false;
+    GridHierarchy<GridType> hierarchy;
+
+    // ֹĽӴߣٻײSleepTrackerĬϹر
+    SleepTracker sleep;
+
+    NewPhysicsSolver(glm::vec2 size, WorkStealingThreadPool& threadPool) :
         grid(static_cast<int32_t>(size.x), static_cast<int32_t>(size.y)),
         world_size(size.x, size.y),
         sub_steps(8),
-        threadPool(threadPool) {
+        threadPool(threadPool),
+        hierarchy(size.x, size.y) {
         grid.clear();
-        rets.reserve(threadPool.getThreadCount());
     }
 
+    // ÿӲؽԲ
+    // compressΪtrueʱñѹдʧ׳std::runtime_error
+    void save(const std::string& path, bool compress = false) const {
+        SnapshotWriter writer(compress);
+        writer.header.solver = SnapshotSolverKind::Mass;
+        writer.header.object_count = objects.size();
+        writer.header.world_width = world_size.x;
+        writer.header.world_height = world_size.y;
+        writer.header.gravity_x = gravity.x;
+        writer.header.gravity_y = gravity.y;
+        writer.header.sub_steps = sub_steps;
+        writer.header.frames_since_reorder = framesSinceReorder;
+        writer.header.next_mass = nextMass;
+        objects.writeSnapshot(writer);
+        writer.write(path);
+    }
+
+    // ָsave״̬֮ģ뱣ʱȫһ
+    // յС뵱ǰͬڹʱС䣩
+    void load(const std::string& path) {
+        SnapshotReader reader(path);
+        const SnapshotHeader& header = reader.getHeader();
+        if (header.solver != SnapshotSolverKind::Mass)
+            throw std::runtime_error("Snapshot: " + path + " was saved by another solver");
+        if (header.world_width != world_size.x || header.world_height != world_size.y)
+            throw std::runtime_error("Snapshot: world size of " + path + " does not match");
+        objects.readSnapshot(reader);
+        gravity = { header.gravity_x, header.gravity_y };
+        sub_steps = static_cast<size_t>(header.sub_steps);
+        framesSinceReorder = static_cast<size_t>(header.frames_since_reorder);
+        // 汾1Ŀûб棬뵱ʱһfirstMassʼ
+        nextMass = header.version >= 2 ? header.next_mass : firstMass;
+        updateVariableRadius();
+        sleep.recount(objects);
+        grid.clear();
+    }
+
+    // VariableRadiusΪtrueʱӴΪ߰뾶֮ͣλư뾶ƽȷָ壬뾶ʱĬͬ
+    template<bool VariableRadius = false>
     void solveContact(size_t atom1_id, size_t atom2_id, const float& deltaTime) {
         constexpr float response_coef = 1.0f;
         constexpr float eps = 0.0001f;
 
         //if (atom1_id == atom2_id)return;
 
-        PhysicalObject* obj1, * obj2;
-        glm::vec2 o2_to_o1;
-        float dist2;
-        {
-            //std::shared_lock<std::shared_mutex> lk(mtx);
-            obj1 = &objects[atom1_id];
-            obj2 = &objects[atom2_id];
-            o2_to_o1 = obj1->position - obj2->position;
-            dist2 = o2_to_o1.x * o2_to_o1.x + o2_to_o1.y * o2_to_o1.y;
-        }
-        if (dist2 < 1.0f && dist2 > eps) {
-            //std::unique_lock<std::shared_mutex> lk(mtx);
+        float* const x = objects.x.data();
+        float* const y = objects.y.data();
+        const glm::vec2 o2_to_o1 = { x[atom1_id] - x[atom2_id], y[atom1_id] - y[atom2_id] };
+        const float dist2 = o2_to_o1.x * o2_to_o1.x + o2_to_o1.y * o2_to_o1.y;
+        float min_dist = 1.0f;
+        if constexpr (VariableRadius)
+            min_dist = objects.radius[atom1_id] + objects.radius[atom2_id];
+        if (dist2 < min_dist * min_dist && dist2 > eps) {
             const float dist = sqrt(dist2);
-            const float delta = response_coef * 0.5f * (1.0f - dist); // һ
-            const glm::vec2 col_vec = (o2_to_o1 / dist) * delta; // 
-            obj1->position += col_vec;
-            obj2->position -= col_vec;
+            if constexpr (VariableRadius) {
+                const float r1 = objects.radius[atom1_id], r2 = objects.radius[atom2_id];
+                const float delta = response_coef * (min_dist - dist);
+                const float ratio1 = r2 * r2 / (r1 * r1 + r2 * r2);
+                const glm::vec2 n = o2_to_o1 / dist;
+                x[atom1_id] += n.x * delta * ratio1;
+                y[atom1_id] += n.y * delta * ratio1;
+                x[atom2_id] -= n.x * delta * (1.0f - ratio1);
+                y[atom2_id] -= n.y * delta * (1.0f - ratio1);
+            }
+            else {
+                const float delta = response_coef * 0.5f * (1.0f - dist); // һ
+                const glm::vec2 col_vec = (o2_to_o1 / dist) * delta; // 
+                x[atom1_id] += col_vec.x;
+                y[atom1_id] += col_vec.y;
+                x[atom2_id] -= col_vec.x;
+                y[atom2_id] -= col_vec.y;
+            }
 
             // غ
-            const float& m1 = obj1->mass, & m2 = obj2->mass;
-            const glm::vec2&& v1 = obj1->GetVelocity(deltaTime), && v2 = obj2->GetVelocity(deltaTime);
+            const float& m1 = objects.mass[atom1_id], & m2 = objects.mass[atom2_id];
+            const glm::vec2&& v1 = getVelocity(atom1_id, deltaTime), && v2 = getVelocity(atom2_id, deltaTime);
             if (glm::length(v1) > 1.0e-2f && glm::length(v2) > 1.0e-2f) {
                 const glm::vec2&& newVel1 = (m1 - m2) / (m1 + m2) * v1 + 2.0f * m2 / (m1 + m2) * v2;
                 const glm::vec2&& newVel2 = 2.0f * m1 / (m1 + m2) * v1 + (m2 - m1) / (m1 + m2) * v2;
 
                 const glm::vec2 I1 = m1 * (newVel1 - v1), I2 = m2 * (newVel2 - v2);
-                obj1->OnForce(I1 / deltaTime * (1.0f - energyLossRate), deltaTime);
-                obj2->OnForce(I2 / deltaTime * (1.0f - energyLossRate), deltaTime);
+                onForce(atom1_id, I1 / deltaTime * (1.0f - energyLossRate));
+                onForce(atom2_id, I2 / deltaTime * (1.0f - energyLossRate));
             }
         }
     }
 
+    // ӦPhysicalObject::GetVelocity
+    glm::vec2 getVelocity(size_t id, float deltaTime) const {
+        return glm::vec2(objects.x[id] - objects.last_x[id], objects.y[id] - objects.last_y[id]) / deltaTime;
+    }
+
+    // ӦPhysicalObject::OnForce
+    void onForce(size_t id, glm::vec2 force) {
+        objects.acceleration_x[id] += force.x / objects.mass[id];
+        objects.acceleration_y[id] += force.y / objects.mass[id];
+    }
+
     template<typename F>
-    void checkAtomCellCollisions(size_t atom_id, const CollisionCell& c, F&& f) {
+    void checkAtomCellCollisions(size_t atom_id, const Cell& c, F&& f) {
         for (size_t i = 0; i < c.objects_count; ++i) {
             f(atom_id, c.objects[i]);
         }
     }
 
+    // ʱǷ
+    bool asleep(size_t i) const {
+        return sleep.enabled && objects.sleep_state[i] == SleepState::Asleep;
+    }
+
     template<typename F>
-    void checkCellCollision(const CollisionCell& c, size_t index, F&& f) {
+    void checkCellCollision(const Cell& c, size_t index, F&& f) {
         for (size_t i = 0; i < c.objects_count; ++i) {
             const size_t atom_idx = c.objects[i];
+            // ߵ岻ΪŵĽӴɶԷ
+            if (asleep(atom_idx))
+                continue;
             // ǰgridԼܱ8gridײ
-            checkAtomCellCollisions(atom_idx, grid.data[index - 1], std::forward<F>(f)); // 
-            checkAtomCellCollisions(atom_idx, grid.data[index], std::forward<F>(f));
-            checkAtomCellCollisions(atom_idx, grid.data[index + 1], std::forward<F>(f)); // 
-            checkAtomCellCollisions(atom_idx, grid.data[index + grid.height - 1], std::forward<F>(f));
-            checkAtomCellCollisions(atom_idx, grid.data[index + grid.height], std::forward<F>(f)); // 
-            checkAtomCellCollisions(atom_idx, grid.data[index + grid.height + 1], std::forward<F>(f));
-            checkAtomCellCollisions(atom_idx, grid.data[index - grid.height - 1], std::forward<F>(f));
-            checkAtomCellCollisions(atom_idx, grid.data[index - grid.height], std::forward<F>(f)); // 
-            checkAtomCellCollisions(atom_idx, grid.data[index - grid.height + 1], std::forward<F>(f));
+            checkAtomCellCollisions(atom_idx, grid.cell(index - 1), std::forward<F>(f)); // 
+            checkAtomCellCollisions(atom_idx, grid.cell(index), std::forward<F>(f));
+            checkAtomCellCollisions(atom_idx, grid.cell(index + 1), std::forward<F>(f)); // 
+            checkAtomCellCollisions(atom_idx, grid.cell(index + grid.height - 1), std::forward<F>(f));
+            checkAtomCellCollisions(atom_idx, grid.cell(index + grid.height), std::forward<F>(f)); // 
+            checkAtomCellCollisions(atom_idx, grid.cell(index + grid.height + 1), std::forward<F>(f));
+            checkAtomCellCollisions(atom_idx, grid.cell(index - grid.height - 1), std::forward<F>(f));
+            checkAtomCellCollisions(atom_idx, grid.cell(index - grid.height), std::forward<F>(f)); // 
+            checkAtomCellCollisions(atom_idx, grid.cell(index - grid.height + 1), std::forward<F>(f));
         }
     }
 
+    // ϡcolumnǿеcellHashGrid::forEachCell˳checkCellCollisionͬ
     template<typename F>
-    void solveCollisionSingleThread(size_t i, size_t slice_size, F&& f) {
-        const size_t start = i * slice_size;
-        const size_t end = (i + 1) * slice_size;
+    void checkSparseColumnCollision(size_t column, F&& f) {
+        grid.forEachCell(column, [this, &f](const Cell (&neighbours)[9]) {
+            const Cell& c = neighbours[1];
+            for (size_t i = 0; i < c.objects_count; ++i) {
+                if (asleep(c.objects[i]))
+                    continue;
+                for (const Cell& n : neighbours)
+                    checkAtomCellCollisions(c.objects[i], n, f);
+            }
+        });
+    }
+
+    template<typename F>
+    void solveCollisionSingleThread(size_t i, F&& f) {
+        PROFILE_WORK(i % 2 ? ProfilePhase::CollisionPass2 : ProfilePhase::CollisionPass1);
+        if constexpr (requires { GridType::sparse; }) {
+            // ϡǿл
+            for (size_t column = slices.begin(i, 1); column < slices.end(i, 1); ++column)
+                checkSparseColumnCollision(column, std::forward<F>(f));
+            return;
+        }
+        solveCellRange(slices.begin(i, grid.height), slices.end(i, grid.height), std::forward<F>(f));
+    }
+
+    // ±[start, end)еcellɫ鹲
+    template<typename F>
+    void solveCellRange(size_t start, size_t end, F&& f) {
         for (size_t idx = start; idx < end; ++idx) {
-            checkCellCollision(grid.data[idx], idx, std::forward<F>(f));
+            checkCellCollision(grid.cell(idx), idx, std::forward<F>(f));
+        }
+    }
+
+    // ÿһҲ
+    void partitionSlices(SlicePartition& partition, const GridType& g) {
+        if (deterministic) {
+            partition.uniform(static_cast<uint32_t>(g.width), g.width / std::max<size_t>(deterministicSliceColumns, SlicePartition::min_columns));
+            return;
         }
+        const size_t slice_count = threadPool.getThreadCount() * 2 * std::max<size_t>(slicesPerThread, 1);
+        if (sliceBalance == SliceBalance::Objects)
+            partition.balance(g, slice_count, threadPool);
+        else
+            partition.uniform(static_cast<uint32_t>(g.width), slice_count);
     }
 
+    // ʹöάɫʱΪtrue
+    bool tiled() const {
+        if constexpr (requires { GridType::sparse; })
+            return false;
+        return collisionSchedule != CollisionSchedule::Slices;
+    }
+
+    // ɫβдͬɫĿ飬ÿһǰһɫCollisionPass1CollisionPass2
     template<typename F>
-    void solveCollisions(F&& collisionCheck) {
-        const size_t thread_count = static_cast<size_t>(threadPool.getThreadCount());
-        const size_t slice_count = thread_count * 2;
-        const size_t slice_size = (grid.width / slice_count) * grid.height;
-        //std::vector<std::future<void>> rets;
-        //rets.reserve(thread_count);
-        rets.clear();
-        for (size_t i = 0; i < thread_count; ++i) {
-            rets.emplace_back(
-                threadPool.enqueue(
-                    [this, i, slice_size, &collisionCheck]() {
-                        solveCollisionSingleThread(2 * i, slice_size, std::forward<F>(collisionCheck));
+    void solveTiles(F&& solveRange) {
+        tiles.tile(static_cast<uint32_t>(grid.width), static_cast<uint32_t>(grid.height), tileSize, collisionSchedule);
+        const size_t colors = tiles.colorCount();
+        for (size_t color = 0; color < colors; ++color) {
+            const ProfilePhase phase = color < colors / 2 ? ProfilePhase::CollisionPass1 : ProfilePhase::CollisionPass2;
+            PROFILE_PHASE(phase);
+            threadPool.parallelFor(
+                0, tiles.colorBlockCount(color), 1,
+                [this, color, phase, &solveRange](size_t start, size_t end) {
+                    static_cast<void>(phase);
+                    for (size_t i = start; i < end; ++i) {
+                        PROFILE_WORK(phase);
+                        tiles.forEachColumn(color, i, grid.height, solveRange);
                     }
-                )
+                }
             );
         }
-        //threadPool.waitForCompletion();
-        for (auto& ret : rets)
-            ret.wait();
-        rets.clear();
-        for (size_t i = 0; i < thread_count; ++i) {
-            rets.emplace_back(
-                threadPool.enqueue(
-                    [this, i, slice_size, &collisionCheck]() {
-                        solveCollisionSingleThread(2 * i + 1, slice_size, std::forward<F>(collisionCheck));
+    }
+
+    template<typename F>
+    void solveCollisions(F&& collisionCheck) {
+        if (tiled()) {
+            solveTiles([this, &collisionCheck](size_t start, size_t end) { solveCellRange(start, end, collisionCheck); });
+        }
+        else {
+            partitionSlices(slices, grid);
+            // ȴżٴͬһֵڣÿһ񣬲Ҫfuture
+            for (size_t phase = 0; phase < 2; ++phase) {
+                PROFILE_PHASE(phase ? ProfilePhase::CollisionPass2 : ProfilePhase::CollisionPass1);
+                threadPool.parallelFor(
+                    0, slices.phaseSliceCount(phase), 1,
+                    [this, phase, &collisionCheck](size_t start, size_t end) {
+                        for (size_t i = start; i < end; ++i)
+                            solveCollisionSingleThread(2 * i + phase, collisionCheck);
                     }
-                )
+                );
+            }
+        }
+        if (variableRadius) {
+            PROFILE_PHASE(ProfilePhase::CollisionPass2);
+            hierarchy.solve(
+                grid, objects.x.data(), objects.y.data(), objects.radius.data(), threadPool,
+                [this](SlicePartition& partition, const GridType& g) { partitionSlices(partition, g); },
+                [this, &collisionCheck](size_t atom1_id, size_t atom2_id) {
+                    // ĽӴֻӴߴһΣֻߵ
+                    if (!asleep(atom1_id) || !asleep(atom2_id))
+                        collisionCheck(atom1_id, atom2_id);
+                }
             );
         }
-        //threadPool.waitForCompletion();
-        for (auto& ret : rets)
-            ret.wait();
     }
 
     size_t add(const PhysicalObject& obj) {
-        objects.push_back(obj);
-        return objects.size() - 1;
+        PhysicalObject o = obj;
+        o.radius = clampRadius(obj.radius);
+        sleep.wakeAround(o.position.x, o.position.y, o.radius + SleepTracker::contactMargin);
+        sleep.awake.fetch_add(1, std::memory_order_relaxed);
+        return objects.push_back(o);
     }
 
-    size_t create(glm::vec2 pos) {
+    // 뾶Ĭϰ뾶0.58֮
+    size_t create(glm::vec2 pos, float radius = SimplePhysicalObject::defaultRadius) {
         //std::unique_lock<std::shared_mutex> lk(mtx);
-        static float weight = 1.0f;
-        objects.emplace_back(pos, weight, gravity);
-        weight += 0.01f;
-        return objects.size() - 1;
+        radius = clampRadius(radius);
+        sleep.wakeAround(pos.x, pos.y, radius + SleepTracker::contactMargin);
+        sleep.awake.fetch_add(1, std::memory_order_relaxed);
+        const size_t id = objects.emplace_back(pos, nextMass, { 0.0f, 0.0f }, radius);
+        nextMass += 0.01f;
+        return id;
+    }
+
+    float clampRadius(float radius) {
+        radius = std::clamp(radius, 0.5f * SimplePhysicalObject::defaultRadius, GridHierarchy<GridType>::max_radius);
+        variableRadius |= radius != SimplePhysicalObject::defaultRadius;
+        return radius;
+    }
+
+    void updateVariableRadius() {
+        variableRadius = std::any_of(objects.radius.begin(), objects.radius.end(),
+            [](float r) { return r != SimplePhysicalObject::defaultRadius; });
+    }
+
+    // aӴС߰뾶֮ͼSleepTracker::contactMargin壬ڻߵĽӴ
+    template<typename F>
+    void forEachTouching(uint32_t a, F&& f) const {
+        const float* const x = objects.x.data();
+        const float* const y = objects.y.data();
+        const float* const radius = objects.radius.data();
+        auto contact = [&](size_t, size_t b) {
+            const float dx = x[a] - x[b], dy = y[a] - y[b];
+            const float reach = radius[a] + radius[b] + SleepTracker::contactMargin;
+            if (dx * dx + dy * dy < reach * reach)
+                f(static_cast<uint32_t>(b));
+        };
+        const uint32_t levels = variableRadius ? GridHierarchy<GridType>::max_level : 0;
+        for (uint32_t m = 0; m <= levels; ++m)
+            hierarchy.query(grid, m, a, x[a], y[a], radius[a] + SleepTracker::contactMargin, contact);
+    }
+
+    // ÿSleepTracker::checkInterval֡жһЩӴߣõһӲ񣻹ر֮
+    void updateSleep() {
+        if (!sleep.enabled) {
+            if (sleep.awake.load(std::memory_order_relaxed) != objects.size())
+                sleep.wakeAll(objects);
+            return;
+        }
+        if (sleep.awake.load(std::memory_order_relaxed) == 0 || !sleep.checkDue())
+            return;
+        PROFILE_PHASE(ProfilePhase::Integration);
+        sleep.sleepIslands(objects, [this](uint32_t a, auto&& f) { forEachTouching(a, f); }, !variableRadius);
+    }
+
+    // Ŀռ߼ֵ壬ʹռڵҲڣײʱһЩȱʧ
+    // ź±䣬ⲿӦcreate/addصidͨobjects.byId
+    void reorderObjects() {
+        // ССȡ߱߳ϡwidthֻǷǿ
+        const uint32_t side = SpatialOrder::curveSide(static_cast<int32_t>(world_size.x), static_cast<int32_t>(world_size.y));
+        const float* const x = objects.x.data();
+        const float* const y = objects.y.data();
+        reorderKeys.resize(objects.size());
+        threadPool.dispatch(
+            objects.size(),
+            [&](size_t start, size_t end) {
+                for (size_t i = start; i < end; ++i)
+                    reorderKeys[i] = SpatialOrder::key(reorderCurve, x[i], y[i], side);
+            }
+        );
+        SpatialOrder::sortByKey(reorderKeys, reorderOrder);
+        objects.reorder(reorderOrder);
+    }
+
+    // ǰ״̬Ĺϣÿupdate֮üõ֡Уֵ֤Żûиı߶λһγֲ֡
+    uint64_t stateHash() const {
+        return objects.hash();
     }
 
     void update(float deltaTime) {
+        // һ֮֡½ߵĵе壬Ҫڽ֮ǰSleepTracker::wakeAround֮е±ʧЧ
+        if (sleep.enabled)
+            sleep.wakeIslands(objects, [this](uint32_t a, auto&& f) { forEachTouching(a, f); });
+        if (reorderInterval && ++framesSinceReorder >= reorderInterval) {
+            reorderObjects();
+            framesSinceReorder = 0;
+        }
         const float sub_dt = deltaTime / static_cast<float>(sub_steps);
         using namespace std::chrono;
         for (size_t i = sub_steps; i > 0; --i) {
+            // 嶼ʱӲҪ
+            if (sleep.enabled && sleep.awake.load(std::memory_order_relaxed) == 0)
+                break;
             addObjectsToGrid();
-            solveCollisions([this, deltaTime](size_t atom1_id, size_t atom2_id) {
-                solveContact(atom1_id, atom2_id, deltaTime);
-                            });
+            if (variableRadius)
+                solveCollisions([this, deltaTime](size_t atom1_id, size_t atom2_id) {
+                    solveContact<true>(atom1_id, atom2_id, deltaTime);
+                                });
+            else
+                solveCollisions([this, deltaTime](size_t atom1_id, size_t atom2_id) {
+                    solveContact(atom1_id, atom2_id, deltaTime);
+                                });
             updateObjects_multi(sub_dt);
         }
+        updateSleep();
     }
 
     void addObjectsToGrid() {
-        grid.clear();
-        size_t i = 0;
-        for (const auto& obj : objects) {
-            if (obj.position.x > 1.0f && obj.position.x < world_size.x - 1.0f
-                && obj.position.y > 1.0f && obj.position.y < world_size.y - 1.0f) {
-                grid.add(static_cast<size_t>(obj.position.x), static_cast<size_t>(obj.position.y), i);
-            }
-            i++;
+        PROFILE_PHASE(ProfilePhase::GridBuild);
+        if constexpr (requires { grid.deterministic; })
+            grid.deterministic = deterministic;
+        if (!variableRadius) {
+            // ߵĵΧ岻񣬼SleepTracker::buryContacts
+            if (sleep.enabled && sleep.buried != 0)
+                buildGrid([buried = objects.buried.data()](size_t i) { return !buried[i]; });
+            else
+                buildGrid();
+            return;
+        }
+        // 0ֻŲĬϰ뾶壬ķ
+        const float* const radius = objects.radius.data();
+        buildGrid([radius](size_t i) { return radius[i] <= SimplePhysicalObject::defaultRadius; });
+        hierarchy.build(objects.x.data(), objects.y.data(), radius, objects.size(), threadPool, deterministic);
+    }
+
+    // GridֻƶcellؽGrid::update
+    template<typename Filter = InsertAll>
+    void buildGrid(Filter filter = {}) {
+        if constexpr (requires { grid.incremental; }) {
+            grid.incremental = gridUpdate == GridUpdate::Incremental;
+            grid.update(objects.x.data(), objects.y.data(), objects.size(), threadPool, filter);
+        }
+        else {
+            grid.build(objects.x.data(), objects.y.data(), objects.size(), threadPool, filter);
         }
     }
 
     void updateObjects_multi(float deltaTime) {
+        PROFILE_PHASE(ProfilePhase::Integration);
         /*
         static std::function<void(size_t, size_t)> func = [this, deltaTime](size_t start, size_t end) {
             for (size_t i = start; i < end; ++i) {
@@ -447,43 +1193,44 @@ public:
             ret.wait();
         */
 
-
+        const IntegratorKind kind = resolveIntegrator(integrator);
+        const float margin = 2.0f;
+        const MassVerletStreams streams{
+            {
+                objects.x.data(), objects.y.data(),
+                objects.last_x.data(), objects.last_y.data(),
+                objects.acceleration_x.data(), objects.acceleration_y.data()
+            },
+            objects.mass.data(),
+            objects.constant_acceleration_x.data(), objects.constant_acceleration_y.data()
+        };
+        const IntegratorParams params{
+            gravity.x, gravity.y,
+            PhysicalObject::movementDamping,
+            deltaTime,
+            margin, world_size.x - margin,
+            margin, world_size.y - margin,
+            1.0f - energyLossRate
+        };
+        if (sleep.enabled)
+            sleep.awake.store(0, std::memory_order_relaxed);
         threadPool.dispatch
         (
             objects.size(),
             [&](size_t start, size_t end) {
-                for (size_t i = start; i < end; ++i) {
-                    PhysicalObject& obj = objects[i];
-                    obj.acceleration += gravity;
-                    obj.Update(deltaTime);
-                    const float margin = 2.0f;
-                    if (obj.position.x > world_size.x - margin) {
-                        obj.position.x = world_size.x - margin;
-                        const glm::vec2&& velocity = obj.GetVelocity(deltaTime);
-                        const glm::vec2 newVel = { -velocity.x, velocity.y };
-                        obj.OnForce((newVel - velocity) * obj.mass / deltaTime * (1.0f - energyLossRate), deltaTime);
-                    }
-                    else if (obj.position.x < margin) {
-                        obj.position.x = margin;
-                        const glm::vec2&& velocity = obj.GetVelocity(deltaTime);
-                        const glm::vec2 newVel = { -velocity.x, velocity.y };
-                        obj.OnForce((newVel - velocity) * obj.mass / deltaTime * (1.0f - energyLossRate), deltaTime);
-                    }
-                    if (obj.position.y > world_size.y - margin) {
-                        obj.position.y = world_size.y - margin;
-                        const glm::vec2&& velocity = obj.GetVelocity(deltaTime);
-                        const glm::vec2 newVel = { velocity.x, -velocity.y };
-                        obj.OnForce((newVel - velocity) * obj.mass / deltaTime * (1.0f - energyLossRate), deltaTime);
-                    }
-                    else if (obj.position.y < margin) {
-                        obj.position.y = margin;
-                        const glm::vec2&& velocity = obj.GetVelocity(deltaTime);
-                        const glm::vec2 newVel = { velocity.x, -velocity.y };
-                        obj.OnForce((newVel - velocity) * obj.mass / deltaTime * (1.0f - energyLossRate), deltaTime);
-                    }
+                if (!sleep.enabled) {
+                    Integrator::mass(kind, streams, start, end, params);
+                    return;
                 }
+                sleep.updateActivity(objects, start, end, deltaTime);
+                SleepTracker::forEachAwakeRun(objects, start, end, [&](size_t first, size_t last) {
+                    Integrator::mass(kind, streams, first, last, params);
+                });
             }
         );
-
+        if (variableRadius)
+            hierarchy.clampToWorld(objects.x.data(), objects.y.data(), objects.radius.data(), world_size.x, world_size.y);
+        if (sleep.enabled)
+            sleep.wakeIslands(objects, [this](uint32_t a, auto&& f) { forEachTouching(a, f); });
     }
 };
\ No newline at end of file
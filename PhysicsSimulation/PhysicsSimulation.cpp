@@ -1,5 +1,7 @@
 ﻿
 #include <iostream>
+#define PHYSICS_ALLOCATION_COUNTER_IMPLEMENTATION
+#include "AllocationCounter.h"
 #include "PhysicalObject.hpp"
 
 //#include <GL/glu.h>
@@ -8,6 +10,9 @@
 
 #include "Physics.hpp"
 #include "Renderer.hpp"
+#include "Profiler.h"
+#include "TrajectoryRecorder.hpp"
+#include "StateExchange.hpp"
 
 constexpr int SCREEN_WIDTH = 800, SCREEN_HEIGHT = 800;
 constexpr int WORLD_WIDTH = 300, WORLD_HEIGHT = 300;
@@ -15,6 +20,12 @@ constexpr int WORLD_WIDTH = 300, WORLD_HEIGHT = 300;
 constexpr int MAX_ELEMENTS = 80000;
 
 std::atomic_bool emit = true;
+std::atomic_bool saveRequested = false, loadRequested = false;
+std::atomic_bool recordToggled = false;
+std::atomic_bool captureRequested = false;
+
+// 物体数量不变、没有读写文件、没有录制也没有采集的物理帧称为稳定帧，这些帧的update与实例数据构建都不应分配内存
+std::atomic<size_t> steadyFrames = 0, steadyAllocations = 0;
 
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
@@ -22,28 +33,43 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mode
 
     if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
         emit.store(!emit.load());
+
+    // 采集接下来120帧，写入trace.json；由物理线程在下一帧更新之前开始
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+        captureRequested.store(true);
+
+    // F5保存快照，F9恢复，在下一帧更新物理之前处理
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS)
+        saveRequested.store(true);
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS)
+        loadRequested.store(true);
+
+    // 开始/停止把每一帧的位置录制到trajectory.bin
+    if (key == GLFW_KEY_R && action == GLFW_PRESS)
+        recordToggled.store(true);
 }
 
+// fixedUpdate在单独的线程中以60Hz运行，窗口关闭后等它结束再返回
 void run(GLFWwindow* const window, std::function<void(float)> render, std::function<void(float)> fixedUpdate = nullptr) {
     using namespace std;
 
     atomic_bool running;
     running.store(true);
 
+    thread fixedUpdateThread;
     if (fixedUpdate) {
         function<void()> updateFunc = [&]() {
             static constexpr float interval = 1.0f / 60.0f;
             while (running.load()) {
                 GLfloat currentFrame = static_cast<GLfloat>(glfwGetTime());
                 fixedUpdate(interval);
-                while (static_cast<GLfloat>(glfwGetTime()) - currentFrame < interval) {
+                while (running.load() && static_cast<GLfloat>(glfwGetTime()) - currentFrame < interval) {
                     std::this_thread::yield();
                 }
             }
             };
 
-        thread fixedUpdateThread(updateFunc);
-        fixedUpdateThread.detach();
+        fixedUpdateThread = thread(updateFunc);
     }
 
     GLfloat lastFrame = 0.0f;
@@ -56,6 +82,8 @@ void run(GLFWwindow* const window, std::function<void(float)> render, std::funct
     }
 
     running.store(false);
+    if (fixedUpdateThread.joinable())
+        fixedUpdateThread.join();
 }
 
 glm::vec3 getColor(float seed) {
@@ -81,10 +109,36 @@ float getFPS() {
     return fps;
 }
 
+// 每秒输出一次帧率、物理每步各阶段的平均耗时、渲染每帧的上传耗时，以及最近一帧绘制与实际上传的实例数据量
+void printProfile(size_t frameBytes, size_t uploadBytes) {
+    static float lasttime = 0.0f;
+    const float fps = getFPS();
+    const float currenttime = static_cast<float>(glfwGetTime());
+    if (currenttime - lasttime < 1.0f)
+        return;
+    lasttime = currenttime;
+    const Profiler& profiler = Profiler::get();
+    std::cout << "FPS " << fps;
+    for (uint32_t i = 0; i < profile_phase_count; ++i) {
+        const ProfilePhase phase = static_cast<ProfilePhase>(i);
+        // 上传在渲染线程上，单独统计
+        if (phase == ProfilePhase::Upload)
+            continue;
+        std::cout << " | " << profilePhaseName(phase) << " " << profiler.phaseTime(phase) << "ms";
+        if (profiler.idleRatio(phase) > 0.0f)
+            std::cout << " (" << static_cast<int>(profiler.idleRatio(phase) * 100.0f) << "% idle)";
+    }
+    std::cout << " | Upload " << profiler.renderTime(ProfilePhase::Upload) << "ms " << frameBytes / 1024 << "KB (" << uploadBytes / 1024 << "KB copied)";
+    std::cout << " | " << steadyAllocations.load() << " allocs in " << steadyFrames.load() << " steady frames";
+    std::cout << "\r\n";
+}
+
 // 注意在Release模式下运行，否则Debug模式下的性能很低的
 int main()
 {
     glfwInit();
+    // 主线程就是渲染线程，GL驱动与输出都会分配内存，只统计物理线程与线程池
+    AllocationCounter::ignoreCurrentThread();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -101,14 +155,15 @@ int main()
 
     glfwSetKeyCallback(window, keyCallback);
 
-    SafeSimpleThreadPool threadPool(15);
+    WorkStealingThreadPool threadPool(15);
+    //SafeSimpleThreadPool threadPool(15);
     //FastThreadPool threadPool(10);
 
     const glm::vec2 world_size{ WORLD_WIDTH, WORLD_HEIGHT };
     PhysicsSolver solver{ world_size, threadPool };
     NewPhysicsSolver newsolver{ world_size, threadPool };
 
-    Renderer render(newsolver, threadPool, "./circle.png", {
+    Renderer render(threadPool, "./circle.png", {
         {GL_VERTEX_SHADER, 1, "./vertex.vert"},
         {GL_FRAGMENT_SHADER, 1, "./fragment.frag"}
                     },
@@ -123,29 +178,88 @@ int main()
                     }
     );
 
+    TrajectoryRecorder recorder(MAX_ELEMENTS);
+
+    // 物理线程每帧把位置与颜色发布到这里，渲染线程总是画最新的完整一帧，两边都不加锁也不互相等待
+    // 持久映射时三帧就是GL缓冲的三段，工作线程直接写进GPU读取的内存
+    StateExchange exchange(MAX_ELEMENTS, render.exchangeStorage());
+
     int idx = 0;
+    size_t lastCount = 0;
 
-    // 如果希望不加锁的话，就需要将物理处理放在渲染帧中
-    run(window, 
-        [&, solver = &newsolver](float deltaTime) {
-            static constexpr float physicsDeltaTime = 1.0f / 60.0f;
+    run(window,
+        [&](float deltaTime) {
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            render.render(exchange);
+            Profiler::get().endRenderFrame();
+            printProfile(render.lastFrameBytes(), render.lastUploadBytes());
+            //std::cout << getFPS() << "\r\n";
+        },
+        // 物理以固定的60Hz运行，每帧sub_steps个子步，与渲染的帧率无关；只有这个线程访问求解器与线程池
+        [&, solver = &newsolver](float physicsDeltaTime) {
+            // 两步之间没有任务在运行，可以开始采集
+            if (captureRequested.exchange(false))
+                Profiler::get().startCapture(120, "trace.json");
+            bool fileAccess = false;
+            try {
+                if (saveRequested.exchange(false)) {
+                    fileAccess = true;
+                    solver->save("snapshot.bin", true);
+                }
+                if (loadRequested.exchange(false)) {
+                    fileAccess = true;
+                    solver->load("snapshot.bin");
+                }
+            }
+            catch (const std::runtime_error& e) {
+                std::cerr << e.what() << std::endl;
+            }
             if (solver->objects.size() < MAX_ELEMENTS && emit.load()) {
                 for (size_t i = std::min(20ULL, MAX_ELEMENTS - solver->objects.size()); i--;) {
                     const auto id = solver->create({ 2.0f, 10.0f + 1.1f * i });
-                    solver->objects[id].last_position.x -= 12.0f * physicsDeltaTime;
+                    solver->objects.byId(id).last_position.x -= 12.0f * physicsDeltaTime;
                     //solver.objects[id].velocity.x += 0.2f / deltaTime;
-                    solver->objects[id].color = getColor(idx);
+                    solver->objects.byId(id).color = getColor(idx);
                 }
                 idx++;
             }
 
+            const bool steady = solver->objects.size() == lastCount && !fileAccess && !recorder.isRecording() && !Profiler::get().isCapturing();
+            size_t allocations = AllocationCounter::count();
             solver->update(physicsDeltaTime);
-            std::cout << getFPS() << "\r\n";
+            allocations = AllocationCounter::count() - allocations;
 
-            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-            glClear(GL_COLOR_BUFFER_BIT);
-            render.render(); // 应当修改为实例化渲染
-            //std::cout << getFPS() << "\r\n";
+            if (recordToggled.exchange(false)) {
+                try {
+                    if (recorder.isRecording())
+                        recorder.stop();
+                    else
+                        recorder.start("trajectory.bin", solver->world_size);
+                }
+                catch (const std::runtime_error& e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+            recorder.record(solver->objects);
+
+            {
+                PROFILE_PHASE(ProfilePhase::RenderBuild);
+                const size_t before = AllocationCounter::count();
+                exchange.commit(writeInstances(solver->objects, exchange, threadPool));
+                allocations += AllocationCounter::count() - before;
+            }
+            // 本帧开始录制时I/O线程已经在分配了
+            if (steady && !recorder.isRecording()) {
+                steadyFrames.fetch_add(1, std::memory_order_relaxed);
+                if (allocations) {
+                    steadyAllocations.fetch_add(allocations, std::memory_order_relaxed);
+                    std::cerr << allocations << " allocations in a steady physics frame" << std::endl;
+                }
+            }
+            lastCount = solver->objects.size();
+            // 等待线程池时调用线程也会执行任务；每个物理步结束一帧，采集的也是物理步
+            Profiler::get().endFrame(threadPool.getThreadCount() + 1);
         }
     );
 
@@ -0,0 +1,291 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 热路径上的作用域计时器
+// PROFILE_PHASE统计调用线程上一个完整阶段的耗时，PROFILE_WORK统计该阶段内某个工作线程执行一个任务的耗时，两者之差就是线程空等的时间
+// 每帧的耗时取最近若干帧的滑动平均；开始采集后，每个作用域还会记录为一个Chrome trace事件（chrome://tracing或ui.perfetto.dev打开）
+// 物理与渲染在不同的线程上：endFrame、startCapture只能由物理线程在两步之间调用；渲染线程用PROFILE_RENDER与endRenderFrame单独计时，不记录事件
+// 编译时定义PHYSICS_PROFILING为0即可完全去掉计时代码
+#ifndef PHYSICS_PROFILING
+#define PHYSICS_PROFILING 1
+#endif
+
+enum class ProfilePhase : uint32_t
+{
+    GridBuild,
+    CollisionPass1,
+    CollisionPass2,
+    Integration,
+    RenderBuild,
+    Upload,
+    Count
+};
+
+constexpr uint32_t profile_phase_count = static_cast<uint32_t>(ProfilePhase::Count);
+
+inline const char* profilePhaseName(ProfilePhase phase) {
+    static constexpr const char* names[profile_phase_count] = {
+        "Grid build", "Collision pass 1", "Collision pass 2", "Integration", "Render build", "Upload"
+    };
+    return names[static_cast<uint32_t>(phase)];
+}
+
+// 最近window_size个值的滑动平均
+class RollingMean
+{
+public:
+    static constexpr size_t window_size = 16;
+
+    void add(float value) {
+        sum += value - values[next];
+        values[next] = value;
+        next = (next + 1) % window_size;
+        count = std::min(count + 1, window_size);
+    }
+
+    float get() const {
+        return count ? sum / static_cast<float>(count) : 0.0f;
+    }
+
+private:
+    float values[window_size] = {};
+    float sum = 0.0f;
+    size_t next = 0, count = 0;
+};
+
+class Profiler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event
+    {
+        const char* name;
+        uint64_t start, end;
+    };
+
+    // 一个线程的事件，缓冲区预先分配好，记录时不会再分配内存
+    struct ThreadEvents
+    {
+        static constexpr size_t max_events = 1 << 16;
+
+        uint32_t id;
+        std::vector<Event> events;
+
+        explicit ThreadEvents(uint32_t id) : id(id) {
+            events.reserve(max_events);
+        }
+    };
+
+    static Profiler& get() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    uint64_t now() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - origin).count());
+    }
+
+    void addPhase(ProfilePhase phase, uint64_t start, uint64_t end) {
+        phaseNs[static_cast<uint32_t>(phase)].fetch_add(end - start, std::memory_order_relaxed);
+        record(profilePhaseName(phase), start, end);
+    }
+
+    void addWork(ProfilePhase phase, uint64_t start, uint64_t end) {
+        busyNs[static_cast<uint32_t>(phase)].fetch_add(end - start, std::memory_order_relaxed);
+        record("Job", start, end);
+    }
+
+    // 记录接下来的frame_count帧，结束后写入path；与endFrame一样只在没有任务运行时调用
+    void startCapture(uint32_t frame_count, const std::string& path) {
+        {
+            std::lock_guard<std::mutex> lk(threadsMtx);
+            for (auto& thread : threads)
+                thread->events.clear();
+        }
+        captureFrames = frame_count;
+        capturePath = path;
+        capturing.store(true, std::memory_order_relaxed);
+    }
+
+    bool isCapturing() const {
+        return capturing.load(std::memory_order_relaxed);
+    }
+
+    // 每帧在没有任务运行时调用一次，thread_count为执行任务的线程数，即线程池的线程数加上等待时也会执行任务的调用线程
+    void endFrame(size_t thread_count) {
+        for (uint32_t i = 0; i < profile_phase_count; ++i) {
+            const uint64_t phase_ns = phaseNs[i].exchange(0, std::memory_order_relaxed);
+            const uint64_t busy_ns = busyNs[i].exchange(0, std::memory_order_relaxed);
+            phaseMs[i].add(static_cast<float>(phase_ns) * 1.0e-6f);
+            phaseMean[i].store(phaseMs[i].get(), std::memory_order_relaxed);
+            if (busy_ns) {
+                const double capacity = static_cast<double>(phase_ns) * thread_count;
+                idleRatios[i].add(static_cast<float>(std::max(0.0, 1.0 - static_cast<double>(busy_ns) / capacity)));
+                idleMean[i].store(idleRatios[i].get(), std::memory_order_relaxed);
+            }
+        }
+        if (capturing.load(std::memory_order_relaxed) && captureFrames && !--captureFrames) {
+            capturing.store(false, std::memory_order_relaxed);
+            writeTrace(capturePath);
+        }
+    }
+
+    // 渲染线程上的阶段，只有渲染线程调用，线程池从不写这些计数
+    void addRenderPhase(ProfilePhase phase, uint64_t start, uint64_t end) {
+        renderNs[static_cast<uint32_t>(phase)] += end - start;
+    }
+
+    // 渲染线程每帧调用一次
+    void endRenderFrame() {
+        for (uint32_t i = 0; i < profile_phase_count; ++i) {
+            renderMs[i].add(static_cast<float>(renderNs[i]) * 1.0e-6f);
+            renderNs[i] = 0;
+        }
+    }
+
+    // 最近若干步中某个物理线程阶段的平均耗时，单位毫秒；可以在任意线程读取
+    float phaseTime(ProfilePhase phase) const {
+        return phaseMean[static_cast<uint32_t>(phase)].load(std::memory_order_relaxed);
+    }
+
+    // 最近若干步中某个阶段内线程空等时间所占的比例，只对用PROFILE_WORK统计了任务的阶段有意义
+    float idleRatio(ProfilePhase phase) const {
+        return idleMean[static_cast<uint32_t>(phase)].load(std::memory_order_relaxed);
+    }
+
+    // 最近若干帧中某个渲染线程阶段的平均耗时，只能在渲染线程读取
+    float renderTime(ProfilePhase phase) const {
+        return renderMs[static_cast<uint32_t>(phase)].get();
+    }
+
+    // Chrome trace_event格式，使用complete事件，时间单位为微秒
+    bool writeTrace(const std::string& path) {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+        std::lock_guard<std::mutex> lk(threadsMtx);
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        for (const auto& thread : threads) {
+            out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << thread->id
+                << ",\"args\":{\"name\":\"Thread " << thread->id << "\"}}";
+            first = false;
+            for (const Event& event : thread->events) {
+                out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << thread->id
+                    << ",\"ts\":" << static_cast<double>(event.start) * 1.0e-3
+                    << ",\"dur\":" << static_cast<double>(event.end - event.start) * 1.0e-3 << "}";
+            }
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return true;
+    }
+
+private:
+    Clock::time_point origin = Clock::now();
+    std::mutex threadsMtx;
+    std::vector<std::unique_ptr<ThreadEvents>> threads;
+
+    std::atomic<uint64_t> phaseNs[profile_phase_count] = {};
+    std::atomic<uint64_t> busyNs[profile_phase_count] = {};
+    RollingMean phaseMs[profile_phase_count];
+    RollingMean idleRatios[profile_phase_count];
+    // 滑动平均由物理线程更新，发布给读取它们的渲染线程
+    std::atomic<float> phaseMean[profile_phase_count] = {};
+    std::atomic<float> idleMean[profile_phase_count] = {};
+
+    uint64_t renderNs[profile_phase_count] = {};
+    RollingMean renderMs[profile_phase_count];
+
+    std::atomic<bool> capturing{ false };
+    uint32_t captureFrames = 0;
+    std::string capturePath;
+
+    ThreadEvents& threadEvents() {
+        thread_local ThreadEvents* events = nullptr;
+        if (!events) {
+            std::lock_guard<std::mutex> lk(threadsMtx);
+            threads.emplace_back(new ThreadEvents(static_cast<uint32_t>(threads.size())));
+            events = threads.back().get();
+        }
+        return *events;
+    }
+
+    // 只在采集期间记录事件，线程第一次记录时才分配它的缓冲区
+    void record(const char* name, uint64_t start, uint64_t end) {
+        if (!capturing.load(std::memory_order_relaxed))
+            return;
+        ThreadEvents& thread = threadEvents();
+        if (thread.events.size() < ThreadEvents::max_events)
+            thread.events.push_back({ name, start, end });
+    }
+};
+
+// 统计调用线程上一个阶段的耗时
+class PhaseScope
+{
+public:
+    explicit PhaseScope(ProfilePhase phase) : phase(phase), start(Profiler::get().now()) {}
+
+    ~PhaseScope() {
+        Profiler& profiler = Profiler::get();
+        profiler.addPhase(phase, start, profiler.now());
+    }
+
+private:
+    ProfilePhase phase;
+    uint64_t start;
+};
+
+// 统计某个阶段内一个任务的耗时，可以在任意线程上使用
+class WorkScope
+{
+public:
+    explicit WorkScope(ProfilePhase phase) : phase(phase), start(Profiler::get().now()) {}
+
+    ~WorkScope() {
+        Profiler& profiler = Profiler::get();
+        profiler.addWork(phase, start, profiler.now());
+    }
+
+private:
+    ProfilePhase phase;
+    uint64_t start;
+};
+
+// 统计渲染线程上一个阶段的耗时
+class RenderScope
+{
+public:
+    explicit RenderScope(ProfilePhase phase) : phase(phase), start(Profiler::get().now()) {}
+
+    ~RenderScope() {
+        Profiler& profiler = Profiler::get();
+        profiler.addRenderPhase(phase, start, profiler.now());
+    }
+
+private:
+    ProfilePhase phase;
+    uint64_t start;
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#if PHYSICS_PROFILING
+#define PROFILE_PHASE(phase) const PhaseScope PROFILE_CONCAT(profile_scope_, __LINE__){ phase }
+#define PROFILE_WORK(phase) const WorkScope PROFILE_CONCAT(profile_scope_, __LINE__){ phase }
+#define PROFILE_RENDER(phase) const RenderScope PROFILE_CONCAT(profile_scope_, __LINE__){ phase }
+#else
+#define PROFILE_PHASE(phase) static_cast<void>(0)
+#define PROFILE_WORK(phase) static_cast<void>(0)
+#define PROFILE_RENDER(phase) static_cast<void>(0)
+#endif
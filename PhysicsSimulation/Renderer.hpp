@@ -4,6 +4,8 @@
 #include "GLTexture.h"
 #include "ThreadPool.h"
 #include "Physics.hpp"
+#include "Profiler.h"
+#include "GLInstanceSink.h"
 #ifndef STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -11,30 +13,19 @@
 
 constexpr float PI = 3.14159265358979323846;
 
-template<typename Solver>
 class Renderer
 {
 private:
-    struct arrayDeleter
-    {
-        void operator()(void* p) {
-            delete[] p; p = nullptr;
-        }
-    };
-
     MyOpenGL::MyShader shader;
     MyOpenGL::Texture2D texture;
-    Solver& solver;
-    SafeSimpleThreadPool& threadPool;
+    WorkStealingThreadPool& threadPool;
+    //SafeSimpleThreadPool& threadPool;
     //FastThreadPool& threadPool;
 
-    //std::vector<glm::mat4> modelMatrices;
-    std::unique_ptr<glm::mat4, arrayDeleter> modelMatrices;
-    //std::vector<glm::vec3> modelColors;
-    std::unique_ptr<glm::vec3, arrayDeleter> modelColors;
-    GLuint colorBuffer, buffer;
-
-    size_t max_elements;
+    // ֧ARB_buffer_storageʱΪ־ӳ壬Ϊorphaningϴ
+    std::unique_ptr<GLInstanceSink> instances;
+    // һ֡ƵʵΪϴֽ־ӳʱҪϴ
+    size_t frameBytes = 0, uploadBytes = 0;
 
     GLuint VAO;
 
@@ -101,53 +92,36 @@ private:
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         glBindVertexArray(0);
 
-        // ʵɫ
-        //GLuint colorBuffer;
-        glGenBuffers(1, &colorBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * max_elements, &(modelColors.get()[0]), GL_DYNAMIC_DRAW);
-
+        // ʵݣλ뾶ǰɫںһʵ16ֽ
         glBindVertexArray(VAO);
         glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
-
-        glVertexAttribDivisor(1, 1);
-
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
-
-        // ʵ
-        //GLuint buffer;
-        glGenBuffers(1, &buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * max_elements, &(modelMatrices.get()[0]), GL_DYNAMIC_DRAW);
-
-        glBindVertexArray(VAO);
         glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4)));
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-        glEnableVertexAttribArray(5);
-        glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-
+        glVertexAttribDivisor(1, 1);
         glVertexAttribDivisor(2, 1);
-        glVertexAttribDivisor(3, 1);
-        glVertexAttribDivisor(4, 1);
-        glVertexAttribDivisor(5, 1);
-
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        bindInstances();
         glBindVertexArray(0);
         //glBindBuffer(GL_ARRAY_BUFFER, VBO);
     }
 
+    // ʵָslot֡ݣʱÿ֡ƫƲͬҪȰVAO
+    void bindInstances(uint32_t slot = 0) {
+        const size_t offset = instances->offset(slot);
+        glBindBuffer(GL_ARRAY_BUFFER, instances->buffer());
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(InstanceData), (void*)(offset + offsetof(InstanceData, color)));
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + offsetof(InstanceData, x)));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
 
 
 public:
 
-    explicit Renderer(Solver& solver, SafeSimpleThreadPool& threadPool, std::string textureFilePath, std::initializer_list<MyOpenGL::MyShaderInfo> shaderInfos, size_t max_elements, std::function<void(MyOpenGL::MyShader&)> externalInit = nullptr) : solver(solver), threadPool(threadPool), shader(shaderInfos), max_elements(max_elements), modelMatrices(new glm::mat4[max_elements]), modelColors(new glm::vec3[max_elements])
+    explicit Renderer(WorkStealingThreadPool& threadPool, std::string textureFilePath, std::initializer_list<MyOpenGL::MyShaderInfo> shaderInfos, size_t max_elements, std::function<void(MyOpenGL::MyShader&)> externalInit = nullptr) : threadPool(threadPool), shader(shaderInfos)
     {
+        if (PersistentInstanceSink::available())
+            instances = std::make_unique<PersistentInstanceSink>(max_elements);
+        else
+            instances = std::make_unique<OrphanInstanceSink>(max_elements);
         texture = loadTextureFromFile(textureFilePath.c_str());
         initRenderData();
         if (externalInit)
@@ -158,91 +132,43 @@ public:
         glDeleteVertexArrays(1, &VAO);
     }
 
-    void render() {
-        static std::function<void(size_t, size_t)> func = [this](size_t start, size_t end) {
-            //std::shared_lock<std::shared_mutex> lk(solver.mtx);
-            for (size_t i = start; i < end; ++i) {
-                const auto& object = solver.objects[i];
-                glm::mat4 model = glm::mat4(1.0f);
-                model = glm::translate(model, glm::vec3(object.position, 1.0f));
-                model = glm::scale(model, glm::vec3(SimplePhysicalObject::size, 1.0f));
-                modelMatrices.get()[i] = model;
-                modelColors.get()[i] = solver.objects[i].color;
-            }
-            };
+    // StateExchange֡Ĵ洢GLInstanceSink::storage
+    InstanceData* exchangeStorage() {
+        return instances->storage();
+    }
 
-        // ʹʵȾʱӦλȫmodelMatrices
-        // ʹ̳߳ؼӹ
-        {
-            /*
-            const size_t count = solver.objects.size();
-            const size_t batch_size = count / threadPool.getThreadCount();
-            std::vector<std::future<void>> rets;
-            for (size_t i = 0; i < threadPool.getThreadCount(); ++i) {
-                const size_t start = batch_size * i;
-                const size_t end = start + batch_size;
-                rets.emplace_back(
-                    threadPool.enqueue(
-                        std::bind(func, start, end)
-                    )
-                );
-            }
+    size_t lastFrameBytes() const {
+        return frameBytes;
+    }
 
-            if (batch_size * threadPool.getThreadCount() < count) {
-                const size_t start = batch_size * threadPool.getThreadCount();
-                func(start, count);
-            }
+    size_t lastUploadBytes() const {
+        return uploadBytes;
+    }
 
-            for (auto& ret : rets)ret.wait();
-            */
-            
-            threadPool.dispatch
-            (
-                solver.objects.size(),
-                func
-            );
-            
-        }
+    // ̷߳һ֡StateExchange־ӳʱֱӻ߳дõһΣ
+    void render(StateExchange& exchange) {
+        exchange.consume([this](uint32_t slot) {
+            instances->retire(slot);
+        });
+        const uint32_t slot = exchange.frontSlot();
+        const size_t count = std::min(exchange.frameSize(), instances->capacity());
 
         shader.use();
 
         glActiveTexture(GL_TEXTURE0);
         texture.Bind();
 
-        // ʹGL_DYNAMIC_DRAWʱӦÿλʱ¸Bufferе
-        glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * max_elements, &(modelColors.get()[0]), GL_DYNAMIC_DRAW);
-
-        glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * max_elements, &(modelMatrices.get()[0]), GL_DYNAMIC_DRAW);
+        {
+            PROFILE_RENDER(ProfilePhase::Upload);
+            uploadBytes = instances->prepare(slot, exchange.data(), count);
+        }
+        frameBytes = count * sizeof(InstanceData);
 
         glBindVertexArray(VAO);
-        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, solver.objects.size());
+        bindInstances(slot);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, static_cast<GLsizei>(count));
         glBindVertexArray(0);
-
-        /*
-        shader.use();
-        for (const auto& obj : solver.objects) {
-            const auto& position = obj.position;
-            const auto& color = obj.color;
-            
-            using namespace glm;
-            mat4 model(1.0f);
-
-            model = translate(model, vec3(position, 0.0f));
-            model = scale(model, vec3(SimplePhysicalObject::size, 1.0f));
-
-            shader.setMatrix("model", model);
-            shader.setVecf("fragmentColor", color);
-
-            glActiveTexture(GL_TEXTURE0);
-            texture.Bind();
-
-            glBindVertexArray(VAO);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-            glBindVertexArray(0);
-        }
-*/
+        instances->submitted(slot);
     }
 
 };
\ No newline at end of file
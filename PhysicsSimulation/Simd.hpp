@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PHYSICS_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC/Clang需要为AVX2函数单独打开指令集，MSVC可以直接使用intrinsic
+#if defined(PHYSICS_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PHYSICS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define PHYSICS_TARGET_AVX2
+#endif
+
+inline bool cpuSupportsAVX2() {
+#if defined(PHYSICS_SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(PHYSICS_SIMD_X86)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+enum class SimdLevel
+{
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// 当前CPU支持的最高指令集，只检测一次
+inline SimdLevel detectSimdLevel() {
+#if defined(PHYSICS_SIMD_X86)
+    static const SimdLevel level = cpuSupportsAVX2() ? SimdLevel::AVX2 : SimdLevel::SSE2;
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+// bits不能为0
+inline uint32_t countTrailingZeros(uint64_t bits) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return static_cast<uint32_t>(index);
+#else
+    return static_cast<uint32_t>(__builtin_ctzll(bits));
+#endif
+}
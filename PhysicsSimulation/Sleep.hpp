@@ -0,0 +1,297 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "ObjectStorage.hpp"
+
+// 物体休眠与接触岛
+// 最近substeps个子步的平均速度低于speed（单位/秒）的物体才有资格休眠：物体离开anchor超过speed * substeps * deltaTime时
+// anchor移到当前位置并重新计数，所以堆底受压的物体每个子步来回抖动也不影响判断
+// 只有整个接触岛都满足条件时才一起休眠，否则一堆物体中最下面的那个被移走后，上面已经休眠的物体会悬在空中
+// 休眠的物体不积分、在碰撞检测中不作为主动方（与醒着的物体之间的接触由对方处理），一个子步内被推动的速度小于wakeSpeed时复位到原处；
+// 超过时它被唤醒，随后沿接触把它所在的整个岛唤醒
+// 接触岛由距离小于两者半径之和加contactMargin的物体对连成，由求解器提供的touching(a, f)枚举
+// 被同一个岛的buryContacts个物体包围的物体标记为buried，求解器不把它们插入网格：醒着的物体要先推动岛的边界才能碰到它们，
+// 边界被推醒时按岛编号把整个岛（包括不在网格中、touching找不到的物体）一起唤醒；在这样的岛的包围盒内新建物体时也唤醒整个岛
+class SleepTracker
+{
+public:
+    static constexpr float contactMargin = 0.1f;
+    // 等半径的圆最多与6个圆相切，6个接触都来自同一个岛时物体被完全包围；半径不同时不成立，求解器此时不标记buried
+    static constexpr size_t buryContacts = 6;
+
+    bool enabled = false; // 为false时所有物体始终醒着，求解器的结果与加入休眠之前完全相同
+    float speed = 0.1f; // 应低于重力与阻尼决定的下落终端速度，否则空中缓慢下落的孤立物体也会休眠；没有摩擦的物体堆会一直缓慢摊开，摊开停止之前不会休眠
+    uint16_t substeps = 120;
+    float wakeSpeed = 5.0f;
+    uint32_t checkInterval = 8; // 每隔多少帧划分一次接触岛，划分要遍历所有醒着的物体
+
+    std::atomic<size_t> awake{ 0 }; // 醒着的物体数，每个子步积分时重新统计，为0时求解器跳过整个子步
+    size_t buried = 0; // 不插入网格的物体数，为0时求解器建网格不必过滤
+
+    // 醒着的物体所占的比例
+    float activeFraction(size_t total) const {
+        return total ? static_cast<float>(awake.load(std::memory_order_relaxed)) / static_cast<float>(total) : 1.0f;
+    }
+
+    // 求解器每帧调用一次，为true时这一帧划分接触岛
+    bool checkDue() {
+        if (++framesSinceCheck < checkInterval)
+            return false;
+        framesSinceCheck = 0;
+        return true;
+    }
+
+    // 在积分之前对[start, end)调用：醒着的物体更新静止的子步数，休眠的物体被推动很小时复位，超过阈值时标记为Woken
+    // 每个物体只写自己，可以在线程池中分段并行
+    void updateActivity(ObjectStorage& s, size_t start, size_t end, float deltaTime) {
+        const float range = speed * deltaTime * static_cast<float>(substeps);
+        const float range2 = range * range;
+        const float push = wakeSpeed * deltaTime;
+        const float push2 = push * push;
+        size_t count = 0;
+        bool woken = false;
+        for (size_t i = start; i < end; ++i) {
+            if (s.sleep_state[i] == SleepState::Awake) {
+                const float dx = s.x[i] - s.anchor_x[i];
+                const float dy = s.y[i] - s.anchor_y[i];
+                if (dx * dx + dy * dy < range2) {
+                    s.still_substeps[i] = static_cast<uint16_t>(std::min<uint32_t>(s.still_substeps[i] + 1u, UINT16_MAX));
+                }
+                else {
+                    s.still_substeps[i] = 0;
+                    s.anchor_x[i] = s.x[i];
+                    s.anchor_y[i] = s.y[i];
+                }
+                ++count;
+                continue;
+            }
+            const float dx = s.x[i] - s.last_x[i];
+            const float dy = s.y[i] - s.last_y[i];
+            if (dx * dx + dy * dy < push2) {
+                s.x[i] = s.last_x[i];
+                s.y[i] = s.last_y[i];
+            }
+            else {
+                s.sleep_state[i] = SleepState::Woken;
+                wake(s, i);
+                woken = true;
+                ++count;
+            }
+        }
+        awake.fetch_add(count, std::memory_order_relaxed);
+        if (woken)
+            wakePending.store(true, std::memory_order_relaxed);
+    }
+
+    // 在updateActivity之后对[start, end)调用：对其中连续的非休眠物体段调用integrate(first, last)，休眠的物体不积分，
+    // 施加在它们身上的加速度丢弃；积分器逐个物体独立计算，分段不影响结果
+    template<typename Integrate>
+    static void forEachAwakeRun(ObjectStorage& s, size_t start, size_t end, Integrate&& integrate) {
+        size_t i = start;
+        while (i < end) {
+            const size_t first = i;
+            while (i < end && s.sleep_state[i] != SleepState::Asleep)
+                ++i;
+            if (first < i)
+                integrate(first, i);
+            for (; i < end && s.sleep_state[i] == SleepState::Asleep; ++i) {
+                s.acceleration_x[i] = 0.0f;
+                s.acceleration_y[i] = 0.0f;
+            }
+        }
+    }
+
+    // 从本子步被推醒的物体出发，沿接触唤醒休眠的物体，唤醒的物体重新开始计算静止的子步数
+    // 有buried的物体时，唤醒的物体所在的岛整个唤醒，它们再沿接触继续唤醒相邻的岛
+    template<typename Touching>
+    void wakeIslands(ObjectStorage& s, Touching&& touching) {
+        if (!wakePending.exchange(false, std::memory_order_relaxed))
+            return;
+        stack.clear();
+        for (size_t i = 0; i < s.size(); ++i) {
+            if (s.sleep_state[i] == SleepState::Woken) {
+                s.sleep_state[i] = SleepState::Awake;
+                stack.push_back(static_cast<uint32_t>(i));
+            }
+        }
+        size_t count = 0;
+        while (!stack.empty() || !wokenIslands.empty()) {
+            while (!stack.empty()) {
+                const uint32_t a = stack.back();
+                stack.pop_back();
+                leaveIsland(s, a);
+                touching(a, [&](uint32_t b) {
+                    if (s.sleep_state[b] != SleepState::Asleep)
+                        return;
+                    s.sleep_state[b] = SleepState::Awake;
+                    wake(s, b);
+                    stack.push_back(b);
+                    ++count;
+                });
+            }
+            if (wokenIslands.empty())
+                break;
+            for (size_t i = 0; i < s.size(); ++i) {
+                if (s.sleep_state[i] != SleepState::Asleep
+                    || std::find(wokenIslands.begin(), wokenIslands.end(), s.island[i]) == wokenIslands.end())
+                    continue;
+                s.sleep_state[i] = SleepState::Awake;
+                wake(s, i);
+                stack.push_back(static_cast<uint32_t>(i));
+                ++count;
+            }
+            std::erase_if(buriedIslands, [this](const IslandBounds& b) {
+                return std::find(wokenIslands.begin(), wokenIslands.end(), b.id) != wokenIslands.end();
+            });
+            wokenIslands.clear();
+        }
+        awake.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    // 在(x, y)附近reach以内新建物体之前调用：包围盒与之相交、有buried物体的岛在下一次wakeIslands时整个唤醒，
+    // 否则新物体可能落在不在网格中的物体上
+    void wakeAround(float x, float y, float reach) {
+        for (const IslandBounds& b : buriedIslands) {
+            if (x + reach < b.min_x || x - reach > b.max_x || y + reach < b.min_y || y - reach > b.max_y)
+                continue;
+            if (std::find(wokenIslands.begin(), wokenIslands.end(), b.id) == wokenIslands.end())
+                wokenIslands.push_back(b.id);
+            wakePending.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    // 找出醒着的物体之间的接触岛，岛内所有物体都静止了足够久时整个岛一起休眠，速度清零
+    // 休眠的物体是岛的边界，醒着的物体静止在休眠的物体上时也可以休眠
+    // bury为true时（所有物体半径相同）标记被同一个岛包围的物体，见buryContacts
+    template<typename Touching>
+    void sleepIslands(ObjectStorage& s, Touching&& touching, bool bury) {
+        const size_t n = s.size();
+        if (visited.size() < n)
+            visited.resize(n, 0);
+        if (++epoch == 0) {
+            std::fill(visited.begin(), visited.end(), 0);
+            epoch = 1;
+        }
+        size_t count = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (s.sleep_state[i] != SleepState::Awake || s.still_substeps[i] < substeps || visited[i] == epoch)
+                continue;
+            island.clear();
+            stack.assign(1, static_cast<uint32_t>(i));
+            visited[i] = epoch;
+            bool still = true;
+            while (!stack.empty()) {
+                const uint32_t a = stack.back();
+                stack.pop_back();
+                island.push_back(a);
+                still &= s.still_substeps[a] >= substeps;
+                touching(a, [&](uint32_t b) {
+                    if (s.sleep_state[b] == SleepState::Awake && visited[b] != epoch) {
+                        visited[b] = epoch;
+                        stack.push_back(b);
+                    }
+                });
+            }
+            if (!still)
+                continue;
+            if (++islandId == 0)
+                islandId = 1;
+            for (const uint32_t a : island) {
+                s.sleep_state[a] = SleepState::Asleep;
+                s.last_x[a] = s.x[a];
+                s.last_y[a] = s.y[a];
+                s.island[a] = islandId;
+            }
+            count += island.size();
+            if (!bury)
+                continue;
+            // 网格是这个子步建的，岛内的物体此时都还在网格中
+            const size_t before = buried;
+            IslandBounds bounds{ islandId, s.x[island[0]], s.y[island[0]], s.x[island[0]], s.y[island[0]] };
+            for (const uint32_t a : island) {
+                bounds.min_x = std::min(bounds.min_x, s.x[a] - s.radius[a]);
+                bounds.min_y = std::min(bounds.min_y, s.y[a] - s.radius[a]);
+                bounds.max_x = std::max(bounds.max_x, s.x[a] + s.radius[a]);
+                bounds.max_y = std::max(bounds.max_y, s.y[a] + s.radius[a]);
+                size_t contacts = 0;
+                bool enclosed = true;
+                touching(a, [&](uint32_t b) {
+                    if (b == a)
+                        return;
+                    ++contacts;
+                    enclosed &= s.island[b] == islandId;
+                });
+                if (enclosed && contacts >= buryContacts) {
+                    s.buried[a] = 1;
+                    ++buried;
+                }
+            }
+            if (buried != before)
+                buriedIslands.push_back(bounds);
+        }
+        awake.fetch_sub(count, std::memory_order_relaxed);
+    }
+
+    // 唤醒所有物体，关闭休眠或者从外部移动了休眠的物体之后调用
+    void wakeAll(ObjectStorage& s) {
+        std::fill(s.sleep_state.begin(), s.sleep_state.end(), SleepState::Awake);
+        std::fill(s.still_substeps.begin(), s.still_substeps.end(), uint16_t{ 0 });
+        s.anchor_x = s.x;
+        s.anchor_y = s.y;
+        std::fill(s.island.begin(), s.island.end(), 0u);
+        std::fill(s.buried.begin(), s.buried.end(), uint8_t{ 0 });
+        awake.store(s.size(), std::memory_order_relaxed);
+        buried = 0;
+        buriedIslands.clear();
+        wokenIslands.clear();
+    }
+
+    // 重新统计醒着的物体，载入快照之后调用；快照不保存岛，载入的物体都不是buried
+    void recount(const ObjectStorage& s) {
+        awake.store(static_cast<size_t>(std::count(s.sleep_state.begin(), s.sleep_state.end(), SleepState::Awake)), std::memory_order_relaxed);
+        buried = static_cast<size_t>(std::count(s.buried.begin(), s.buried.end(), uint8_t{ 1 }));
+        buriedIslands.clear();
+        wokenIslands.clear();
+    }
+
+private:
+    struct IslandBounds
+    {
+        uint32_t id;
+        float min_x, min_y, max_x, max_y;
+    };
+
+    // 唤醒的物体从当前位置重新开始计数
+    static void wake(ObjectStorage& s, size_t i) {
+        s.still_substeps[i] = 0;
+        s.anchor_x[i] = s.x[i];
+        s.anchor_y[i] = s.y[i];
+    }
+
+    // 唤醒的物体离开所在的岛；岛中有buried的物体时记下岛编号，wakeIslands随后唤醒整个岛
+    void leaveIsland(ObjectStorage& s, size_t i) {
+        const uint32_t id = s.island[i];
+        s.island[i] = 0;
+        if (s.buried[i]) {
+            s.buried[i] = 0;
+            --buried;
+        }
+        if (id == 0 || std::find(wokenIslands.begin(), wokenIslands.end(), id) != wokenIslands.end())
+            return;
+        if (std::any_of(buriedIslands.begin(), buriedIslands.end(), [id](const IslandBounds& b) { return b.id == id; }))
+            wokenIslands.push_back(id);
+    }
+
+    std::atomic<bool> wakePending{ false };
+    std::vector<uint32_t> visited; // visited[i] == epoch表示本次sleepIslands已经访问过，不必每次清零
+    uint32_t epoch = 0;
+    uint32_t framesSinceCheck = 0;
+    uint32_t islandId = 0; // 上一个休眠的岛的编号
+    std::vector<uint32_t> stack, island;
+    std::vector<uint32_t> wokenIslands; // 本次wakeIslands中要整个唤醒的岛
+    std::vector<IslandBounds> buriedIslands; // 有buried物体的岛的包围盒
+};
@@ -0,0 +1,91 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+enum class SliceBalance
+{
+    Columns, // 每个条带的列数大致相同
+    Objects  // 每个条带中的物体数大致相同，适合物体堆积在一侧的场景
+};
+
+// 碰撞检测的条带划分：网格按列切成若干条带，先并行处理偶数条带，再并行处理奇数条带
+// 处理一个cell会读写左右相邻的列，因此每个条带至少要有2列，同一轮的两个条带之间才隔着至少2列，不会同时写到同一列
+// 划分总是覆盖全部列，与线程数能否整除网格宽度无关；条带数可以多于线程数，多出的条带由线程池的工作窃取来平衡负载
+class SlicePartition
+{
+public:
+    // 第i个条带包含[bounds[i], bounds[i + 1])列，bounds.front()为0，bounds.back()为网格宽度
+    std::vector<uint32_t> bounds;
+    std::vector<uint32_t> columnWeights;
+
+    static constexpr uint32_t min_columns = 2;
+
+    size_t sliceCount() const {
+        return bounds.size() - 1;
+    }
+
+    // 第phase轮（0或1）要处理的条带数，这些条带的下标为2 * i + phase
+    size_t phaseSliceCount(size_t phase) const {
+        return (sliceCount() + 1 - phase) / 2;
+    }
+
+    size_t begin(size_t slice, size_t height) const {
+        return static_cast<size_t>(bounds[slice]) * height;
+    }
+
+    size_t end(size_t slice, size_t height) const {
+        return static_cast<size_t>(bounds[slice + 1]) * height;
+    }
+
+    // 按列数均分，网格太窄时减少条带数，保证每个条带至少min_columns列
+    void uniform(uint32_t width, size_t slice_count) {
+        const size_t count = clampSliceCount(width, slice_count);
+        bounds.resize(count + 1);
+        for (size_t i = 0; i <= count; ++i)
+            bounds[i] = static_cast<uint32_t>(i * width / count);
+    }
+
+    // 按每列的物体数均分，每列额外算1的权重，这样空的区域也会被分开
+    template<typename GridType, typename Pool>
+    void balance(const GridType& grid, size_t slice_count, Pool& pool) {
+        const uint32_t width = static_cast<uint32_t>(grid.width);
+        const size_t height = static_cast<size_t>(grid.height);
+        columnWeights.resize(width);
+        pool.dispatch(width, [&](size_t first, size_t last) {
+            for (size_t x = first; x < last; ++x) {
+                uint32_t weight = 1;
+                if constexpr (requires { grid.columnObjectCount(x); })
+                    weight += grid.columnObjectCount(x); // 稀疏网格直接给出每列的物体数
+                else
+                    for (size_t y = 0; y < height; ++y)
+                        weight += grid.cell(x * height + y).objects_count;
+                columnWeights[x] = weight;
+            }
+        });
+        // 原地转换为前缀和，columnWeights[x]为前x + 1列的权重之和
+        for (uint32_t x = 1; x < width; ++x)
+            columnWeights[x] += columnWeights[x - 1];
+
+        const size_t count = clampSliceCount(width, slice_count);
+        const uint64_t total = width ? columnWeights[width - 1] : 0;
+        bounds.resize(count + 1);
+        bounds[0] = 0;
+        bounds[count] = width;
+        for (size_t i = 1; i < count; ++i) {
+            const uint64_t target = total * i / count;
+            // 第一个使前缀和达到目标值的列作为条带的结束
+            const uint32_t x = static_cast<uint32_t>(
+                std::lower_bound(columnWeights.begin(), columnWeights.end(), target) - columnWeights.begin()) + 1;
+            const uint32_t lowest = bounds[i - 1] + min_columns;
+            const uint32_t highest = width - static_cast<uint32_t>(count - i) * min_columns;
+            bounds[i] = std::clamp(x, lowest, highest);
+        }
+    }
+
+private:
+    static size_t clampSliceCount(uint32_t width, size_t slice_count) {
+        return std::max<size_t>(1, std::min<size_t>(slice_count, width / min_columns));
+    }
+};
@@ -0,0 +1,443 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 快照文件格式（小端序），用于保存/恢复求解器的完整状态：
+// SnapshotHeader | SnapshotSection * section_count | 各段数据（按16字节对齐）
+// 每段是一个数组（x、y、last_x……）的原始字节，可选用内置的压缩编码
+// 网格每个子步都会从物体位置重建，因此不保存
+// 版本1的文件头到frames_since_reorder为止，没有next_mass，仍然可以读取；比snapshot_version新的文件不能读取
+constexpr char snapshot_magic[4] = { 'P', 'S', 'N', 'P' };
+constexpr uint32_t snapshot_version = 2;
+
+// 写入快照的求解器类型
+enum class SnapshotSolverKind : uint32_t
+{
+    Simple, // PhysicsSolver
+    Mass    // NewPhysicsSolver
+};
+
+// 每个数组对应一段
+enum class SnapshotSectionId : uint32_t
+{
+    X, Y,
+    LastX, LastY,
+    AccelerationX, AccelerationY,
+    Color,
+    Ids, Indices,
+    Mass,
+    ConstantAccelerationX, ConstantAccelerationY,
+    Radius,
+    SleepState, StillSubsteps, AnchorX, AnchorY
+};
+
+enum class SnapshotCodecKind : uint32_t
+{
+    Raw,
+    ShuffleLZ // 先按元素大小做字节重排，再做LZ4式的LZ77压缩
+};
+
+struct SnapshotHeader
+{
+    char magic[4];
+    uint32_t version;
+    SnapshotSolverKind solver; // 不同求解器的快照不能混用
+    uint32_t section_count;
+    uint64_t object_count;
+    float world_width, world_height;
+    float gravity_x, gravity_y;
+    uint64_t sub_steps;
+    uint64_t frames_since_reorder;
+    float next_mass;         // NewPhysicsSolver下一个新物体的质量
+    uint32_t reserved;
+};
+
+struct SnapshotSection
+{
+    SnapshotSectionId id;
+    uint32_t element_size;
+    SnapshotCodecKind codec;
+    uint32_t reserved;
+    uint64_t raw_size;       // 解压后的字节数
+    uint64_t stored_size;    // 文件中的字节数
+    uint64_t offset;         // 相对文件开头的偏移
+};
+
+static_assert(std::is_trivially_copyable_v<SnapshotHeader> && std::is_trivially_copyable_v<SnapshotSection>);
+
+// 版本1的文件头大小，段表紧跟在文件头之后
+constexpr size_t snapshot_header_size_v1 = offsetof(SnapshotHeader, next_mass);
+
+// 内置的压缩编码
+// 浮点数组直接做LZ压缩效果很差，先把每个元素的第0个字节放在一起、第1个字节放在一起……（与blosc的shuffle相同），
+// 高位字节（符号、指数）在相邻物体之间几乎一样，重排后就有大量重复
+// LZ部分采用LZ4的块格式：token高4位为字面量长度，低4位为匹配长度-4，超过15时用255续接，偏移为2字节
+class SnapshotCodec
+{
+public:
+    static void shuffle(const uint8_t* src, size_t size, size_t element_size, uint8_t* dst) {
+        const size_t count = size / element_size;
+        for (size_t b = 0; b < element_size; ++b)
+            for (size_t i = 0; i < count; ++i)
+                dst[b * count + i] = src[i * element_size + b];
+        std::memcpy(dst + count * element_size, src + count * element_size, size - count * element_size);
+    }
+
+    static void unshuffle(const uint8_t* src, size_t size, size_t element_size, uint8_t* dst) {
+        const size_t count = size / element_size;
+        for (size_t b = 0; b < element_size; ++b)
+            for (size_t i = 0; i < count; ++i)
+                dst[i * element_size + b] = src[b * count + i];
+        std::memcpy(dst + count * element_size, src + count * element_size, size - count * element_size);
+    }
+
+    static void compress(const uint8_t* src, size_t size, std::vector<uint8_t>& out) {
+        static constexpr size_t hash_bits = 16;
+        static constexpr size_t min_match = 4;
+        static constexpr size_t last_literals = 5; // 与LZ4一样，末尾几个字节总是作为字面量
+        std::vector<uint32_t> table(size_t(1) << hash_bits, 0); // 保存位置+1，0表示空
+        out.clear();
+        out.reserve(size + size / 255 + 16);
+        size_t anchor = 0;
+        size_t i = 0;
+        while (size >= min_match + last_literals && i + min_match + last_literals <= size) {
+            const uint32_t sequence = read32(src + i);
+            const uint32_t hash = (sequence * 2654435761u) >> (32 - hash_bits);
+            const size_t candidate = table[hash];
+            table[hash] = static_cast<uint32_t>(i + 1);
+            if (candidate == 0 || i - (candidate - 1) > 0xffff || read32(src + candidate - 1) != sequence) {
+                ++i;
+                continue;
+            }
+            const size_t match = candidate - 1;
+            size_t length = min_match;
+            while (i + length + last_literals < size && src[match + length] == src[i + length])
+                ++length;
+            writeSequence(out, src + anchor, i - anchor, i - match, length);
+            i += length;
+            anchor = i;
+        }
+        // 最后一段只有字面量
+        const size_t literals = size - anchor;
+        out.push_back(static_cast<uint8_t>(std::min<size_t>(literals, 15) << 4));
+        writeLength(out, literals);
+        out.insert(out.end(), src + anchor, src + size);
+    }
+
+    // 数据不完整或者长度不符时返回false
+    static bool decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t raw_size) {
+        const uint8_t* const src_end = src + size;
+        size_t written = 0;
+        while (src < src_end) {
+            const uint8_t token = *src++;
+            size_t literals = token >> 4;
+            if (!readLength(src, src_end, literals))
+                return false;
+            if (literals > static_cast<size_t>(src_end - src) || literals > raw_size - written)
+                return false;
+            std::memcpy(dst + written, src, literals);
+            src += literals;
+            written += literals;
+            if (src == src_end)
+                break;
+            if (src_end - src < 2)
+                return false;
+            const size_t offset = src[0] | (size_t(src[1]) << 8);
+            src += 2;
+            size_t length = token & 0x0f;
+            if (!readLength(src, src_end, length))
+                return false;
+            length += 4;
+            if (offset == 0 || offset > written || length > raw_size - written)
+                return false;
+            // 匹配可能与输出重叠，只能逐字节复制
+            const uint8_t* from = dst + written - offset;
+            for (size_t k = 0; k < length; ++k)
+                dst[written + k] = from[k];
+            written += length;
+        }
+        return written == raw_size;
+    }
+
+private:
+    static uint32_t read32(const uint8_t* p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static void writeLength(std::vector<uint8_t>& out, size_t length) {
+        if (length < 15)
+            return;
+        length -= 15;
+        while (length >= 255) {
+            out.push_back(255);
+            length -= 255;
+        }
+        out.push_back(static_cast<uint8_t>(length));
+    }
+
+    static bool readLength(const uint8_t*& src, const uint8_t* src_end, size_t& length) {
+        if (length != 15)
+            return true;
+        uint8_t b;
+        do {
+            if (src == src_end)
+                return false;
+            b = *src++;
+            length += b;
+        } while (b == 255);
+        return true;
+    }
+
+    static void writeSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literal_count, size_t offset, size_t length) {
+        const size_t match_code = length - 4;
+        out.push_back(static_cast<uint8_t>((std::min<size_t>(literal_count, 15) << 4) | std::min<size_t>(match_code, 15)));
+        writeLength(out, literal_count);
+        out.insert(out.end(), literals, literals + literal_count);
+        out.push_back(static_cast<uint8_t>(offset & 0xff));
+        out.push_back(static_cast<uint8_t>(offset >> 8));
+        writeLength(out, match_code);
+    }
+};
+
+// 只读的内存映射文件，读取快照时不需要先把整个文件读进缓冲区
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+            return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+            return;
+        bytes = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (bytes)
+            length = static_cast<size_t>(file_size.QuadPart);
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+            return;
+        void* const p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+            return;
+        bytes = static_cast<const uint8_t*>(p);
+        length = static_cast<size_t>(st.st_size);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (bytes)
+            UnmapViewOfFile(bytes);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (bytes)
+            munmap(const_cast<uint8_t*>(bytes), length);
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool valid() const {
+        return bytes != nullptr;
+    }
+
+    const uint8_t* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// 先登记各段数组，再一次性写出；登记时只保存指针，写出前数组不能被修改
+class SnapshotWriter
+{
+public:
+    SnapshotHeader header{};
+
+    explicit SnapshotWriter(bool compress) : compressed(compress) {
+        std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+        header.version = snapshot_version;
+    }
+
+    template<typename T>
+    void add(SnapshotSectionId id, const std::vector<T>& values) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        sources.push_back({ id, sizeof(T), reinterpret_cast<const uint8_t*>(values.data()), values.size() * sizeof(T) });
+    }
+
+    void write(const std::string& path) {
+        header.section_count = static_cast<uint32_t>(sources.size());
+        std::vector<SnapshotSection> sections(sources.size());
+        std::vector<std::vector<uint8_t>> encoded(sources.size());
+        uint64_t offset = align(sizeof(SnapshotHeader) + sizeof(SnapshotSection) * sections.size());
+        for (size_t i = 0; i < sources.size(); ++i) {
+            const Source& source = sources[i];
+            SnapshotSection& section = sections[i];
+            section.id = source.id;
+            section.element_size = source.element_size;
+            section.codec = SnapshotCodecKind::Raw;
+            section.raw_size = source.size;
+            section.stored_size = source.size;
+            if (compressed && source.size) {
+                std::vector<uint8_t> shuffled(source.size);
+                SnapshotCodec::shuffle(source.bytes, source.size, source.element_size, shuffled.data());
+                SnapshotCodec::compress(shuffled.data(), shuffled.size(), encoded[i]);
+                // 压缩后反而变大的段按原样保存
+                if (encoded[i].size() < source.size) {
+                    section.codec = SnapshotCodecKind::ShuffleLZ;
+                    section.stored_size = encoded[i].size();
+                }
+            }
+            section.offset = offset;
+            offset = align(offset + section.stored_size);
+        }
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("Snapshot: cannot open " + path + " for writing");
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(sections.data()), sizeof(SnapshotSection) * sections.size());
+        for (size_t i = 0; i < sections.size(); ++i) {
+            pad(out, sections[i].offset);
+            const uint8_t* const bytes = sections[i].codec == SnapshotCodecKind::Raw ? sources[i].bytes : encoded[i].data();
+            out.write(reinterpret_cast<const char*>(bytes), static_cast<std::streamsize>(sections[i].stored_size));
+        }
+        if (!out)
+            throw std::runtime_error("Snapshot: failed to write " + path);
+    }
+
+private:
+    struct Source
+    {
+        SnapshotSectionId id;
+        uint32_t element_size;
+        const uint8_t* bytes;
+        size_t size;
+    };
+
+    bool compressed;
+    std::vector<Source> sources;
+
+    static uint64_t align(uint64_t offset) {
+        return (offset + 15) & ~uint64_t(15);
+    }
+
+    static void pad(std::ofstream& out, uint64_t offset) {
+        static constexpr char zeros[16] = {};
+        const uint64_t position = static_cast<uint64_t>(out.tellp());
+        out.write(zeros, static_cast<std::streamsize>(offset - position));
+    }
+};
+
+// 通过内存映射读取快照，未压缩的段直接从映射区复制到数组中
+class SnapshotReader
+{
+public:
+    explicit SnapshotReader(const std::string& path) : file(path) {
+        if (!file.valid() || file.size() < snapshot_header_size_v1)
+            throw std::runtime_error("Snapshot: cannot map " + path);
+        std::memcpy(&header, file.data(), snapshot_header_size_v1);
+        if (std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0)
+            throw std::runtime_error("Snapshot: " + path + " is not a snapshot");
+        if (header.version == 0 || header.version > snapshot_version)
+            throw std::runtime_error("Snapshot: unsupported version " + std::to_string(header.version));
+        // 版本1的文件头中没有的字段保持为0，由求解器换成默认值
+        const uint64_t header_size = header.version == 1 ? snapshot_header_size_v1 : sizeof(SnapshotHeader);
+        if (file.size() < header_size + sizeof(SnapshotSection) * uint64_t(header.section_count))
+            throw std::runtime_error("Snapshot: truncated section table");
+        std::memcpy(&header, file.data(), header_size);
+        sections.resize(header.section_count);
+        std::memcpy(sections.data(), file.data() + header_size, sizeof(SnapshotSection) * sections.size());
+    }
+
+    const SnapshotHeader& getHeader() const {
+        return header;
+    }
+
+    bool contains(SnapshotSectionId id) const {
+        return std::any_of(sections.begin(), sections.end(), [id](const SnapshotSection& s) { return s.id == id; });
+    }
+
+    template<typename T>
+    void read(SnapshotSectionId id, std::vector<T>& values) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        for (const SnapshotSection& section : sections) {
+            if (section.id != id)
+                continue;
+            if (section.element_size != sizeof(T) || section.raw_size % sizeof(T) != 0
+                || section.offset > file.size() || section.stored_size > file.size() - section.offset)
+                throw std::runtime_error("Snapshot: corrupted section " + std::to_string(static_cast<uint32_t>(id)));
+            values.resize(section.raw_size / sizeof(T));
+            uint8_t* const dst = reinterpret_cast<uint8_t*>(values.data());
+            const uint8_t* const src = file.data() + section.offset;
+            if (section.codec == SnapshotCodecKind::Raw) {
+                if (section.stored_size != section.raw_size)
+                    throw std::runtime_error("Snapshot: corrupted section " + std::to_string(static_cast<uint32_t>(id)));
+                std::memcpy(dst, src, section.raw_size);
+                return;
+            }
+            std::vector<uint8_t> shuffled(section.raw_size);
+            if (!SnapshotCodec::decompress(src, section.stored_size, shuffled.data(), shuffled.size()))
+                throw std::runtime_error("Snapshot: cannot decompress section " + std::to_string(static_cast<uint32_t>(id)));
+            SnapshotCodec::unshuffle(shuffled.data(), shuffled.size(), sizeof(T), dst);
+            return;
+        }
+        throw std::runtime_error("Snapshot: missing section " + std::to_string(static_cast<uint32_t>(id)));
+    }
+
+private:
+    MappedFile file;
+    SnapshotHeader header{};
+    std::vector<SnapshotSection> sections;
+};
@@ -0,0 +1,76 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+enum class SpatialCurve
+{
+    Morton,  // Z序曲线，计算最快
+    Hilbert  // 相邻的键在空间上一定相邻，局部性更好
+};
+
+// 空间填充曲线的键值计算与排序，用于把空间上相邻的物体在数组中也排到一起
+class SpatialOrder
+{
+public:
+    // 曲线覆盖的正方形边长，取不小于网格宽高的2的幂
+    static uint32_t curveSide(int32_t width, int32_t height) {
+        uint32_t side = 1;
+        while (side < static_cast<uint32_t>(std::max(width, height)))
+            side <<= 1;
+        return side;
+    }
+
+    // 把16位整数的各位间隔展开：b2 b1 b0 -> 0 b2 0 b1 0 b0
+    static uint32_t spreadBits(uint32_t v) {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
+
+    static uint32_t mortonKey(uint32_t x, uint32_t y) {
+        return spreadBits(x) | (spreadBits(y) << 1);
+    }
+
+    // side必须是2的幂
+    static uint32_t hilbertKey(uint32_t x, uint32_t y, uint32_t side) {
+        uint32_t d = 0;
+        for (uint32_t s = side / 2; s > 0; s /= 2) {
+            const uint32_t rx = (x & s) > 0;
+            const uint32_t ry = (y & s) > 0;
+            d += s * s * ((3 * rx) ^ ry);
+            // 旋转象限，使下一层的曲线与这一层首尾相接
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = side - 1 - x;
+                    y = side - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+
+    // 物体所在网格坐标的键值，超出范围的坐标夹到边界上
+    static uint32_t key(SpatialCurve curve, float x, float y, uint32_t side) {
+        const float max_coord = static_cast<float>(side - 1);
+        const uint32_t cx = static_cast<uint32_t>(std::clamp(x, 0.0f, max_coord));
+        const uint32_t cy = static_cast<uint32_t>(std::clamp(y, 0.0f, max_coord));
+        return curve == SpatialCurve::Morton ? mortonKey(cx, cy) : hilbertKey(cx, cy, side);
+    }
+
+    // 按键值排序，排序后新下标i处应当放原来第order[i]个物体，键值相同的物体保持原来的先后顺序
+    static void sortByKey(const std::vector<uint32_t>& keys, std::vector<uint32_t>& order) {
+        std::vector<uint64_t> packed(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i)
+            packed[i] = (static_cast<uint64_t>(keys[i]) << 32) | i;
+        std::sort(packed.begin(), packed.end());
+        order.resize(keys.size());
+        for (size_t i = 0; i < packed.size(); ++i)
+            order[i] = static_cast<uint32_t>(packed[i]);
+    }
+};
@@ -0,0 +1,95 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "InstanceBuffer.hpp"
+
+// 物理线程向渲染线程发布状态的无锁三缓冲，两边都不会等待对方
+// 物理线程每帧用writeInstances写进acquire()给出的后台帧再commit，commit把后台帧与中间帧原子交换并标记中间帧为新的一帧
+// 渲染线程每帧先consume，中间帧是新的就与前台帧交换，然后读data()/frameSize()；没有新的一帧时继续读上一帧，因此读到的总是完整的最新一帧
+// 物理比渲染快时中间的帧直接被覆盖，渲染比物理快时同一帧会被画多次
+// 三帧可以放在外部的存储中，比如持久映射的GL缓冲的三段（见PersistentInstanceSink），渲染线程就直接画前台帧，不需要再复制
+class StateExchange : public InstanceSink
+{
+public:
+    static constexpr uint32_t frame_count = 3;
+
+    // storage为frame_count * max_elements个实例的连续区域，第i帧在storage + i * max_elements；为空时自己分配主机内存
+    explicit StateExchange(size_t max_elements, InstanceData* storage = nullptr) : InstanceSink(max_elements) {
+        if (!storage) {
+            owned.resize(max_elements * frame_count);
+            storage = owned.data();
+        }
+        for (uint32_t i = 0; i < frame_count; ++i)
+            frames[i].instances = storage + i * max_elements;
+    }
+
+    // 物理线程：本帧写入的区域
+    InstanceData* acquire() override {
+        return frames[back].instances;
+    }
+
+    // 物理线程：发布前count个实例
+    void commit(size_t count) override {
+        InstanceSink::commit(count);
+        frames[back].count = count;
+        frames[back].sequence = ++published;
+        back = middle.exchange(back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // 渲染线程：有新发布的一帧时换到前台并返回true
+    // 原来的前台帧交还给物理线程之前先调用retire(它的下标)，比如等待读取它的绘制命令完成
+    template<typename Retire>
+    bool consume(Retire&& retire) {
+        if (!(middle.load(std::memory_order_relaxed) & fresh_bit))
+            return false;
+        retire(front);
+        front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+    bool consume() {
+        return consume([](uint32_t) {});
+    }
+
+    // 渲染线程：前台帧，consume之前为空
+    const InstanceData* data() const {
+        return frames[front].instances;
+    }
+
+    // 渲染线程：前台帧的下标，即它在存储中的第几段
+    uint32_t frontSlot() const {
+        return front;
+    }
+
+    size_t frameSize() const {
+        return frames[front].count;
+    }
+
+    // 前台帧是第几次发布的，从1开始，0表示还没有收到任何一帧
+    uint64_t frameSequence() const {
+        return frames[front].sequence;
+    }
+
+private:
+    static constexpr uint32_t index_mask = 3;
+    static constexpr uint32_t fresh_bit = 4;
+
+    struct Frame
+    {
+        InstanceData* instances = nullptr;
+        size_t count = 0;
+        uint64_t sequence = 0;
+    };
+
+    std::vector<InstanceData> owned;
+    Frame frames[frame_count];
+    uint32_t back = 0;               // 只由物理线程访问
+    uint32_t front = 2;              // 只由渲染线程访问
+    std::atomic<uint32_t> middle{ 1 }; // 中间帧的下标，fresh_bit表示还没被渲染线程取走
+    uint64_t published = 0;
+};
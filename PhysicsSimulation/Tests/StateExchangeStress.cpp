@@ -0,0 +1,70 @@
+﻿#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+#include "../StateExchange.hpp"
+
+// StateExchange的生产者/消费者压力测试，不需要OpenGL，三帧放在StateExchange自己分配的主机内存中
+// 物理线程尽快发布frame_total帧，每帧的实例个数与内容都由帧序号决定；渲染线程不停地consume并检查读到的每一帧：
+// 序号严格递增、实例个数与序号一致、没有实例被下一帧覆盖，换上来的前台帧不是retire交还的那一帧
+// 在ThreadSanitizer下构建，数据竞争会直接报告，例如：
+//   g++ -std=c++20 -O1 -g -fsanitize=thread -I<glm> Tests/StateExchangeStress.cpp -o state_exchange_stress -pthread
+// 返回0表示通过
+
+constexpr size_t max_elements = 50000;
+constexpr uint32_t frame_total = 5000;
+
+size_t frameSize(uint64_t sequence) {
+    return 1000 + sequence * 7919 % (max_elements - 1000);
+}
+
+int main() {
+    StateExchange exchange(max_elements);
+    std::atomic<bool> done{ false };
+
+    std::thread producer([&] {
+        for (uint32_t sequence = 1; sequence <= frame_total; ++sequence) {
+            InstanceData* const out = exchange.acquire();
+            const size_t count = frameSize(sequence);
+            for (size_t i = 0; i < count; ++i)
+                out[i] = { static_cast<float>(i), static_cast<float>(sequence), 0.5f, sequence };
+            exchange.commit(count);
+        }
+        done.store(true, std::memory_order_release);
+    });
+
+    uint64_t frames = 0, last = 0, errors = 0, retireErrors = 0;
+    uint32_t retired = StateExchange::frame_count;
+    const auto retire = [&](uint32_t slot) {
+        retired = slot;
+    };
+    // 生产者结束之后再consume一次，取走最后一帧
+    for (bool finished = false; !finished;) {
+        finished = done.load(std::memory_order_acquire);
+        if (!exchange.consume(retire))
+            continue;
+        if (exchange.frontSlot() == retired || exchange.frontSlot() >= StateExchange::frame_count)
+            ++retireErrors;
+        const uint64_t sequence = exchange.frameSequence();
+        if (sequence <= last || exchange.frameSize() != frameSize(sequence))
+            ++errors;
+        const InstanceData* const data = exchange.data();
+        for (size_t i = 0; i < exchange.frameSize(); ++i) {
+            if (data[i].color != sequence || data[i].x != static_cast<float>(i)) {
+                ++errors;
+                break;
+            }
+        }
+        last = sequence;
+        ++frames;
+    }
+    producer.join();
+
+    if (last != frame_total)
+        ++errors;
+    std::printf("consumed %llu of %u frames, last %llu, %llu bad frames, %llu bad retires\n",
+        static_cast<unsigned long long>(frames), frame_total, static_cast<unsigned long long>(last),
+        static_cast<unsigned long long>(errors), static_cast<unsigned long long>(retireErrors));
+    return errors || retireErrors ? 1 : 0;
+}
@@ -5,8 +5,13 @@
 #include <future>
 #include <vector>
 #include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
 #include "SafeQueue.h"
+#include "WorkStealingDeque.h"
+#include "FunctionRef.h"
 
 class SimpleThreadPool
 {
@@ -258,4 +263,335 @@ public:
     size_t getThreadCount() const {
         return m_thread_count;
     }
-};
\ No newline at end of file
+};
+
+
+// ɼ㼴ʾһȫ
+// ɵԤȳУͨջϣȴʱWorkStealingThreadPool::waitһִһߵ
+class Latch
+{
+private:
+    std::atomic<size_t> remaining;
+
+public:
+    explicit Latch(size_t count = 0) : remaining(count) {}
+
+    void reset(size_t count) {
+        remaining.store(count, std::memory_order_relaxed);
+    }
+
+    void countDown(size_t n = 1) {
+        remaining.fetch_sub(n, std::memory_order_acq_rel);
+    }
+
+    bool done() const {
+        return remaining.load(std::memory_order_acquire) == 0;
+    }
+};
+
+// ȡ̳߳أӿSafeSimpleThreadPoolͬenqueue/dispatch/getThreadCountṩparallelFor
+// ÿ߳һChase-Lev˫˶УԼӵײȡ񣬿ʱһ̴߳жȡ
+// ⲿ߳ύһעУ߳ڲύֱӽԼĶУ
+// еĹ߳óʱƬһʱ䣬Ȼû
+// parallelFor/dispatchȶ״̬²κζѷ䣻enqueueΪ˷futureȻҪ䣬Ӧÿ֡·
+class WorkStealingThreadPool
+{
+public:
+    // ָֻ룬ύ߸
+    class Job
+    {
+    public:
+        virtual void execute() = 0;
+    protected:
+        ~Job() = default;
+    };
+
+    using RangeFunction = FunctionRef<void(size_t, size_t)>;
+
+private:
+    // enqueueύִͷ
+    template<typename Callable>
+    class CallableJob final : public Job
+    {
+    public:
+        Callable func;
+
+        explicit CallableJob(Callable&& f) : func(std::move(f)) {}
+
+        void execute() override {
+            func();
+            delete this;
+        }
+    };
+
+    class ParallelFor;
+
+    class RangeJob final : public Job
+    {
+    public:
+        ParallelFor* state = nullptr;
+        size_t begin = 0, end = 0;
+
+        void execute() override;
+    };
+
+    // һparallelForĹ״̬grainʱ԰𿪣ҰΪύԼ
+    // ߳ȡǶжһ
+    // ״̬ڵߵջϣй̶ޣ֮ʣµֱӰgrainֶξ͵ִ
+    class ParallelFor
+    {
+    public:
+        static constexpr size_t max_jobs = 128;
+
+        WorkStealingThreadPool& pool;
+        RangeFunction func;
+        const size_t grain;
+        Latch latch; // ûдԪظ
+        RangeJob jobs[max_jobs];
+        std::atomic<size_t> used_jobs;
+
+        ParallelFor(WorkStealingThreadPool& pool, RangeFunction func, size_t count, size_t grain) :
+            pool(pool), func(func), grain(grain), latch(count), used_jobs(0) {}
+
+        void run(size_t begin, size_t end) {
+            while (end - begin > grain) {
+                const size_t slot = used_jobs.fetch_add(1, std::memory_order_relaxed);
+                if (slot >= max_jobs)
+                    break;
+                const size_t mid = begin + (end - begin) / 2;
+                RangeJob& right = jobs[slot];
+                right.state = this;
+                right.begin = mid;
+                right.end = end;
+                pool.submit(&right);
+                end = mid;
+            }
+            for (size_t start = begin; start < end; start += grain)
+                func(start, std::min(start + grain, end));
+            latch.countDown(end - begin);
+        }
+    };
+
+    class alignas(64) Worker
+    {
+    public:
+        WorkStealingDeque<Job> deque;
+        std::thread thread;
+        uint32_t seed;
+
+        explicit Worker(uint32_t seed) : seed(seed) {}
+    };
+
+    static constexpr size_t spin_count = 64;
+
+    inline static thread_local WorkStealingThreadPool* current_pool = nullptr;
+    inline static thread_local size_t current_index = 0;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    size_t threadCount;
+
+    // עǼĻλʱ
+    std::mutex injection_mtx;
+    std::vector<Job*> injection;
+    size_t injection_head = 0, injection_tail = 0;
+    std::atomic<size_t> injection_size{ 0 };
+
+    std::mutex park_mtx;
+    std::condition_variable park_cv;
+    std::atomic<uint64_t> epoch{ 0 };
+    std::atomic<size_t> sleepers{ 0 };
+    std::atomic<bool> stopping{ false };
+
+    static uint32_t nextRandom(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    bool isWorkerThread() const {
+        return current_pool == this;
+    }
+
+    Job* popInjection() {
+        if (injection_size.load(std::memory_order_acquire) == 0)
+            return nullptr;
+        std::lock_guard<std::mutex> lk(injection_mtx);
+        if (injection_head == injection_tail)
+            return nullptr;
+        Job* const job = injection[injection_head++ & (injection.size() - 1)];
+        injection_size.fetch_sub(1, std::memory_order_release);
+        return job;
+    }
+
+    // ʱinjection_mtx
+    void pushInjection(Job* job) {
+        const size_t capacity = injection.size();
+        if (injection_tail - injection_head == capacity) {
+            std::vector<Job*> bigger(capacity * 2);
+            for (size_t i = injection_head; i < injection_tail; ++i)
+                bigger[i - injection_head] = injection[i & (capacity - 1)];
+            injection.swap(bigger);
+            injection_tail -= injection_head;
+            injection_head = 0;
+        }
+        injection[injection_tail++ & (injection.size() - 1)] = job;
+    }
+
+    Job* stealFromOthers(size_t self, uint32_t& seed) {
+        const size_t count = workers.size();
+        const size_t start = nextRandom(seed) % count;
+        for (size_t i = 0; i < count; ++i) {
+            const size_t victim = (start + i) % count;
+            if (victim == self)
+                continue;
+            if (Job* job = workers[victim]->deque.steal())
+                return job;
+        }
+        return nullptr;
+    }
+
+    // selfΪǰ̵߳±꣬ⲿ̴߳workers.size()
+    Job* findWork(size_t self, uint32_t& seed) {
+        if (self < workers.size()) {
+            if (Job* job = workers[self]->deque.pop())
+                return job;
+        }
+        if (Job* job = popInjection())
+            return job;
+        return stealFromOthers(self, seed);
+    }
+
+    bool hasWork() const {
+        if (injection_size.load(std::memory_order_acquire) != 0)
+            return true;
+        for (const auto& worker : workers) {
+            if (!worker->deque.empty())
+                return true;
+        }
+        return false;
+    }
+
+    void wake() {
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_seq_cst) != 0) {
+            std::lock_guard<std::mutex> lk(park_mtx);
+            park_cv.notify_one();
+        }
+    }
+
+    // ȼepochټû֮ύһıepoch˲
+    void park() {
+        const uint64_t seen = epoch.load(std::memory_order_seq_cst);
+        if (hasWork() || stopping.load(std::memory_order_acquire))
+            return;
+        std::unique_lock<std::mutex> lk(park_mtx);
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        park_cv.wait(lk, [this, seen]() {
+            return epoch.load(std::memory_order_seq_cst) != seen || stopping.load(std::memory_order_acquire);
+        });
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void workerLoop(size_t index) {
+        current_pool = this;
+        current_index = index;
+        uint32_t& seed = workers[index]->seed;
+        size_t idle = 0;
+        while (true) {
+            if (Job* job = findWork(index, seed)) {
+                job->execute();
+                idle = 0;
+                continue;
+            }
+            if (stopping.load(std::memory_order_acquire))
+                return;
+            if (++idle < spin_count) {
+                std::this_thread::yield();
+                continue;
+            }
+            park();
+            idle = 0;
+        }
+    }
+
+public:
+    explicit WorkStealingThreadPool(size_t size = std::thread::hardware_concurrency()) : threadCount(size), injection(256) {
+        workers.reserve(size);
+        for (size_t i = 0; i < size; ++i)
+            workers.emplace_back(new Worker(static_cast<uint32_t>(2654435761u * (i + 1))));
+        // жж̣֮߳ȡʱworkers
+        for (size_t i = 0; i < size; ++i)
+            workers[i]->thread = std::thread([this, i]() { workerLoop(i); });
+    }
+
+    ~WorkStealingThreadPool() {
+        stopping.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lk(park_mtx);
+            epoch.fetch_add(1, std::memory_order_seq_cst);
+        }
+        park_cv.notify_all();
+        for (auto& worker : workers)
+            worker->thread.join();
+    }
+
+    // ύ񣬹߳ύʱԼĶУע
+    void submit(Job* job) {
+        if (isWorkerThread()) {
+            workers[current_index]->deque.push(job);
+        }
+        else {
+            std::lock_guard<std::mutex> lk(injection_mtx);
+            pushInjection(job);
+            injection_size.fetch_add(1, std::memory_order_release);
+        }
+        wake();
+    }
+
+    // ȴlatch㣬ڼ䵱ǰ߳Ҳȥִ񣬶Ǹɵ
+    void wait(const Latch& latch) {
+        const size_t self = isWorkerThread() ? current_index : workers.size();
+        thread_local uint32_t seed = 0x9e3779b9u;
+        uint32_t& local_seed = self < workers.size() ? workers[self]->seed : seed;
+        while (!latch.done()) {
+            if (Job* job = findWork(self, local_seed))
+                job->execute();
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    template<typename F, typename... Args>
+    auto enqueue(F&& f, Args&&...args) {
+        using return_type = std::invoke_result_t<F, Args...>;
+        using Task = std::packaged_task<return_type()>;
+        Task task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        std::future<return_type> res = task.get_future();
+        submit(new CallableJob<Task>(std::move(task)));
+        return res;
+    }
+
+    size_t getThreadCount()const {
+        return threadCount;
+    }
+
+    // [begin, end)еf(start, end)ÿεõ䳤Ȳgrain߳Ҳִ
+    void parallelFor(size_t begin, size_t end, size_t grain, RangeFunction f) {
+        if (begin >= end)
+            return;
+        ParallelFor state(*this, f, end - begin, std::max<size_t>(grain, 1));
+        state.run(begin, end);
+        wait(state.latch);
+    }
+
+    // SafeSimpleThreadPool::dispatchͬ[0, element_count)¾ָÿ߳
+    void dispatch(size_t element_count, RangeFunction f) {
+        const size_t grain = (element_count + threadCount - 1) / threadCount;
+        parallelFor(0, element_count, grain, f);
+    }
+};
+
+inline void WorkStealingThreadPool::RangeJob::execute() {
+    state->run(begin, end);
+}
\ No newline at end of file
@@ -0,0 +1,465 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "ObjectStorage.hpp"
+#include "Snapshot.hpp"
+
+// 轨迹文件格式（小端序）：
+// TrajectoryHeader | (TrajectoryChunk + 数据) * n | TrajectoryIndexEntry * n | TrajectoryFooter
+// 位置按world_size量化为16位定点数，按物体id而不是下标排列，因此重排不影响相邻帧的差分
+// 每个块的第一帧与0做差分（关键帧），其余帧与上一帧做差分，所以每个块都能单独解码
+// 块数据为若干个 TrajectoryFrame | dx[object_count] | dy[object_count]，整体用快照的编码压缩
+// 差分按uint16_t回绕相减，解码时回绕相加，不损失精度
+// 文件末尾的块索引在stop()时写入；程序异常退出没有索引时，读取端顺序扫描各个块
+constexpr char trajectory_magic[4] = { 'P', 'T', 'R', 'J' };
+constexpr char trajectory_chunk_magic[4] = { 'P', 'T', 'R', 'C' };
+constexpr char trajectory_index_magic[4] = { 'P', 'T', 'R', 'I' };
+constexpr uint32_t trajectory_version = 1;
+
+struct TrajectoryHeader
+{
+    char magic[4];
+    uint32_t version;
+    float world_width, world_height;
+};
+
+struct TrajectoryChunk
+{
+    char magic[4];
+    uint32_t frame_count;
+    uint64_t first_frame, last_frame;
+    SnapshotCodecKind codec;
+    uint32_t reserved;
+    uint64_t raw_size, stored_size;
+};
+
+struct TrajectoryFrame
+{
+    uint64_t frame;
+    uint32_t object_count;
+    uint32_t reserved;
+};
+
+struct TrajectoryIndexEntry
+{
+    uint64_t first_frame, last_frame;
+    uint64_t offset; // 块头相对文件开头的偏移
+};
+
+struct TrajectoryFooter
+{
+    uint64_t index_offset;
+    uint64_t chunk_count;
+    char magic[4];
+    uint32_t reserved;
+};
+
+inline uint16_t quantizePosition(float value, float size) {
+    const float t = std::clamp(value / size, 0.0f, 1.0f);
+    return static_cast<uint16_t>(t * 65535.0f + 0.5f);
+}
+
+inline float dequantizePosition(uint16_t value, float size) {
+    return static_cast<float>(value) / 65535.0f * size;
+}
+
+// 记录每一帧的物体位置
+// 模拟线程在update()之后调用record()，只做量化并放进有界环形缓冲区；差分、压缩与写文件都在单独的I/O线程中进行
+// 缓冲区满（磁盘跟不上）时丢弃这一帧而不是等待，丢弃的帧不会出现在文件中，可以通过droppedFrames()查询
+class TrajectoryRecorder
+{
+public:
+    static constexpr size_t ring_size = 8;
+
+    size_t chunkFrames; // 每块的帧数，越大压缩率越高，定位到某一帧时要解码的帧也越多
+
+    // capacity为预计的最大物体数，预先分配好缓冲区，使record()不再分配内存
+    explicit TrajectoryRecorder(size_t capacity = 0, size_t chunkFrames = 60) : chunkFrames(std::max<size_t>(chunkFrames, 1)) {
+        for (Slot& slot : ring) {
+            slot.x.reserve(capacity);
+            slot.y.reserve(capacity);
+        }
+    }
+
+    ~TrajectoryRecorder() {
+        stop();
+    }
+
+    TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+    TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+    // 打开文件并启动I/O线程，之后记录的第一帧编号为0；无法打开文件时抛出std::runtime_error
+    void start(const std::string& path, glm::vec2 world_size) {
+        stop();
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("TrajectoryRecorder: cannot open " + path);
+        worldSize = world_size;
+        TrajectoryHeader header{};
+        std::memcpy(header.magic, trajectory_magic, sizeof(header.magic));
+        header.version = trajectory_version;
+        header.world_width = world_size.x;
+        header.world_height = world_size.y;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        index.clear();
+        nextFrame = 0;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        dropped.store(0, std::memory_order_relaxed);
+        stopping.store(false, std::memory_order_relaxed);
+        recording = true;
+        ioThread = std::thread([this]() {
+            writeLoop();
+        });
+    }
+
+    // 写完缓冲区中剩余的帧与块索引，然后关闭文件
+    void stop() {
+        if (!recording)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping.store(true, std::memory_order_release);
+        }
+        condition.notify_one();
+        ioThread.join();
+        writeIndex();
+        out.close();
+        recording = false;
+    }
+
+    bool isRecording() const {
+        return recording;
+    }
+
+    // 仅限模拟线程；缓冲区已满时丢弃这一帧并返回false，不会阻塞
+    bool record(const ObjectStorage& objects) {
+        if (!recording)
+            return false;
+        const uint64_t frame = nextFrame++;
+        const uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == ring_size) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Slot& slot = ring[t % ring_size];
+        const size_t count = objects.size();
+        slot.frame = frame;
+        slot.x.resize(count);
+        slot.y.resize(count);
+        // 按id排列，重排之后同一个物体仍然在同一个位置
+        for (size_t id = 0; id < count; ++id) {
+            const size_t i = objects.indices[id];
+            slot.x[id] = quantizePosition(objects.x[i], worldSize.x);
+            slot.y[id] = quantizePosition(objects.y[i], worldSize.y);
+        }
+        tail.store(t + 1, std::memory_order_release);
+        condition.notify_one();
+        return true;
+    }
+
+    size_t droppedFrames() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot
+    {
+        uint64_t frame = 0;
+        std::vector<uint16_t> x, y;
+    };
+
+    Slot ring[ring_size];
+    alignas(64) std::atomic<uint64_t> head{ 0 }; // I/O线程读到的位置
+    alignas(64) std::atomic<uint64_t> tail{ 0 }; // 模拟线程写到的位置
+    std::atomic<size_t> dropped{ 0 };
+    uint64_t nextFrame = 0;
+    glm::vec2 worldSize{ 1.0f, 1.0f };
+    bool recording = false;
+
+    std::thread ioThread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::atomic<bool> stopping{ false };
+
+    // 以下只在I/O线程中使用
+    std::ofstream out;
+    std::vector<uint16_t> previousX, previousY;
+    std::vector<uint8_t> chunk, encoded, shuffled;
+    TrajectoryChunk chunkHeader{};
+    std::vector<TrajectoryIndexEntry> index;
+
+    void writeLoop() {
+        while (true) {
+            const uint64_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) {
+                if (stopping.load(std::memory_order_acquire) && h == tail.load(std::memory_order_acquire))
+                    break;
+                // record()不加锁地通知，可能错过唤醒，所以只等待一小段时间
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait_for(lock, std::chrono::milliseconds(2));
+                continue;
+            }
+            appendFrame(ring[h % ring_size]);
+            head.store(h + 1, std::memory_order_release);
+            if (chunkHeader.frame_count == chunkFrames)
+                flushChunk();
+        }
+        flushChunk();
+    }
+
+    void appendFrame(const Slot& slot) {
+        const size_t count = slot.x.size();
+        if (chunkHeader.frame_count == 0) {
+            chunkHeader.first_frame = slot.frame;
+            previousX.clear();
+            previousY.clear();
+        }
+        chunkHeader.last_frame = slot.frame;
+        ++chunkHeader.frame_count;
+        // 新出现的物体与0做差分
+        previousX.resize(count, 0);
+        previousY.resize(count, 0);
+
+        const TrajectoryFrame frame{ slot.frame, static_cast<uint32_t>(count), 0 };
+        const size_t offset = chunk.size();
+        chunk.resize(offset + sizeof(frame) + count * 2 * sizeof(uint16_t));
+        std::memcpy(chunk.data() + offset, &frame, sizeof(frame));
+        uint16_t* const dx = reinterpret_cast<uint16_t*>(chunk.data() + offset + sizeof(frame));
+        uint16_t* const dy = dx + count;
+        for (size_t i = 0; i < count; ++i) {
+            dx[i] = static_cast<uint16_t>(slot.x[i] - previousX[i]);
+            dy[i] = static_cast<uint16_t>(slot.y[i] - previousY[i]);
+        }
+        std::copy(slot.x.begin(), slot.x.end(), previousX.begin());
+        std::copy(slot.y.begin(), slot.y.end(), previousY.begin());
+    }
+
+    void flushChunk() {
+        if (chunkHeader.frame_count == 0)
+            return;
+        std::memcpy(chunkHeader.magic, trajectory_chunk_magic, sizeof(chunkHeader.magic));
+        chunkHeader.raw_size = chunk.size();
+        shuffled.resize(chunk.size());
+        SnapshotCodec::shuffle(chunk.data(), chunk.size(), sizeof(uint16_t), shuffled.data());
+        SnapshotCodec::compress(shuffled.data(), shuffled.size(), encoded);
+        const bool compressed = encoded.size() < chunk.size();
+        chunkHeader.codec = compressed ? SnapshotCodecKind::ShuffleLZ : SnapshotCodecKind::Raw;
+        chunkHeader.stored_size = compressed ? encoded.size() : chunk.size();
+
+        index.push_back({ chunkHeader.first_frame, chunkHeader.last_frame, static_cast<uint64_t>(out.tellp()) });
+        out.write(reinterpret_cast<const char*>(&chunkHeader), sizeof(chunkHeader));
+        const std::vector<uint8_t>& bytes = compressed ? encoded : chunk;
+        out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        out.flush();
+
+        chunk.clear();
+        chunkHeader = TrajectoryChunk{};
+    }
+
+    void writeIndex() {
+        TrajectoryFooter footer{};
+        footer.index_offset = static_cast<uint64_t>(out.tellp());
+        footer.chunk_count = index.size();
+        std::memcpy(footer.magic, trajectory_index_magic, sizeof(footer.magic));
+        out.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(TrajectoryIndexEntry)));
+        out.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    }
+};
+
+// 读取TrajectoryRecorder写出的文件，文件通过内存映射访问
+// seek(n)先通过块索引找到包含第n帧的块，再从块的关键帧开始累加差分；按顺序读取时用next()，每帧只解码一次
+class TrajectoryReader
+{
+public:
+    // 按物体id排列的位置
+    std::vector<float> x, y;
+
+    // 文件无效时抛出std::runtime_error
+    explicit TrajectoryReader(const std::string& path) : file(path) {
+        if (!file.valid() || file.size() < sizeof(TrajectoryHeader))
+            throw std::runtime_error("TrajectoryReader: cannot map " + path);
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, trajectory_magic, sizeof(header.magic)) != 0 || header.version != trajectory_version)
+            throw std::runtime_error("TrajectoryReader: " + path + " is not a trajectory");
+        if (!readIndex())
+            scanChunks();
+    }
+
+    glm::vec2 worldSize() const {
+        return { header.world_width, header.world_height };
+    }
+
+    size_t chunkCount() const {
+        return index.size();
+    }
+
+    // 第一帧与最后一帧的编号，中间可能有被丢弃的帧
+    uint64_t firstFrame() const {
+        return index.empty() ? 0 : index.front().first_frame;
+    }
+
+    uint64_t lastFrame() const {
+        return index.empty() ? 0 : index.back().last_frame;
+    }
+
+    // 当前帧的编号
+    uint64_t frame() const {
+        return currentFrame;
+    }
+
+    size_t objectCount() const {
+        return x.size();
+    }
+
+    // 定位到第n帧，这一帧不存在（超出范围或者录制时被丢弃）时返回false
+    bool seek(uint64_t n) {
+        const auto it = std::upper_bound(index.begin(), index.end(), n,
+            [](uint64_t f, const TrajectoryIndexEntry& e) { return f < e.first_frame; });
+        if (it == index.begin() || n > std::prev(it)->last_frame)
+            return false;
+        const size_t target = static_cast<size_t>(std::prev(it) - index.begin());
+        // 同一块中往后定位时接着当前状态累加即可，否则从关键帧重新开始
+        if (target != currentChunk || !valid || n < currentFrame) {
+            if (!loadChunk(target))
+                return false;
+        }
+        else if (n == currentFrame) {
+            return true;
+        }
+        while (cursor < chunk.size()) {
+            TrajectoryFrame next;
+            std::memcpy(&next, chunk.data() + cursor, sizeof(next));
+            if (next.frame > n)
+                return false;
+            if (!applyFrame())
+                return false;
+            if (currentFrame == n)
+                return true;
+        }
+        return false;
+    }
+
+    // 前进到下一个记录的帧，已经是最后一帧时返回false
+    bool next() {
+        if (!valid)
+            return !index.empty() && loadChunk(0) && applyFrame();
+        if (cursor < chunk.size())
+            return applyFrame();
+        return currentChunk + 1 < index.size() && loadChunk(currentChunk + 1) && applyFrame();
+    }
+
+private:
+    MappedFile file;
+    TrajectoryHeader header{};
+    std::vector<TrajectoryIndexEntry> index;
+
+    std::vector<uint8_t> chunk, shuffled;
+    std::vector<uint16_t> qx, qy;
+    size_t currentChunk = 0;
+    size_t cursor = 0;
+    uint64_t currentFrame = 0;
+    bool valid = false; // 是否已经解码出一帧
+
+    bool readIndex() {
+        if (file.size() < sizeof(TrajectoryHeader) + sizeof(TrajectoryFooter))
+            return false;
+        TrajectoryFooter footer;
+        std::memcpy(&footer, file.data() + file.size() - sizeof(footer), sizeof(footer));
+        if (std::memcmp(footer.magic, trajectory_index_magic, sizeof(footer.magic)) != 0)
+            return false;
+        const uint64_t index_end = file.size() - sizeof(footer);
+        if (footer.index_offset > index_end || (index_end - footer.index_offset) / sizeof(TrajectoryIndexEntry) != footer.chunk_count)
+            return false;
+        index.resize(footer.chunk_count);
+        std::memcpy(index.data(), file.data() + footer.index_offset, index.size() * sizeof(TrajectoryIndexEntry));
+        return true;
+    }
+
+    // 没有索引时顺序读取块头重建索引，不完整的最后一个块被忽略
+    void scanChunks() {
+        index.clear();
+        uint64_t offset = sizeof(TrajectoryHeader);
+        while (offset + sizeof(TrajectoryChunk) <= file.size()) {
+            TrajectoryChunk c;
+            std::memcpy(&c, file.data() + offset, sizeof(c));
+            if (std::memcmp(c.magic, trajectory_chunk_magic, sizeof(c.magic)) != 0
+                || c.stored_size > file.size() - offset - sizeof(TrajectoryChunk))
+                break;
+            index.push_back({ c.first_frame, c.last_frame, offset });
+            offset += sizeof(TrajectoryChunk) + c.stored_size;
+        }
+    }
+
+    bool loadChunk(size_t i) {
+        valid = false;
+        const uint64_t offset = index[i].offset;
+        if (offset > file.size() || file.size() - offset < sizeof(TrajectoryChunk))
+            return false;
+        TrajectoryChunk c;
+        std::memcpy(&c, file.data() + offset, sizeof(c));
+        const uint8_t* const src = file.data() + offset + sizeof(TrajectoryChunk);
+        if (std::memcmp(c.magic, trajectory_chunk_magic, sizeof(c.magic)) != 0
+            || c.stored_size > file.size() - offset - sizeof(TrajectoryChunk))
+            return false;
+        chunk.resize(c.raw_size);
+        if (c.codec == SnapshotCodecKind::Raw) {
+            if (c.stored_size != c.raw_size)
+                return false;
+            std::memcpy(chunk.data(), src, chunk.size());
+        }
+        else {
+            shuffled.resize(c.raw_size);
+            if (!SnapshotCodec::decompress(src, c.stored_size, shuffled.data(), shuffled.size()))
+                return false;
+            SnapshotCodec::unshuffle(shuffled.data(), shuffled.size(), sizeof(uint16_t), chunk.data());
+        }
+        currentChunk = i;
+        cursor = 0;
+        qx.clear();
+        qy.clear();
+        return true;
+    }
+
+    bool applyFrame() {
+        if (chunk.size() - cursor < sizeof(TrajectoryFrame))
+            return false;
+        TrajectoryFrame f;
+        std::memcpy(&f, chunk.data() + cursor, sizeof(f));
+        const size_t count = f.object_count;
+        if ((chunk.size() - cursor - sizeof(f)) / (2 * sizeof(uint16_t)) < count)
+            return false;
+        const uint8_t* const dx = chunk.data() + cursor + sizeof(f);
+        const uint8_t* const dy = dx + count * sizeof(uint16_t);
+        qx.resize(count, 0);
+        qy.resize(count, 0);
+        x.resize(count);
+        y.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            uint16_t deltaX, deltaY;
+            std::memcpy(&deltaX, dx + i * sizeof(uint16_t), sizeof(uint16_t));
+            std::memcpy(&deltaY, dy + i * sizeof(uint16_t), sizeof(uint16_t));
+            qx[i] = static_cast<uint16_t>(qx[i] + deltaX);
+            qy[i] = static_cast<uint16_t>(qy[i] + deltaY);
+            x[i] = dequantizePosition(qx[i], header.world_width);
+            y[i] = dequantizePosition(qy[i], header.world_height);
+        }
+        cursor += sizeof(f) + count * 2 * sizeof(uint16_t);
+        currentFrame = f.frame;
+        valid = true;
+        return true;
+    }
+};
@@ -0,0 +1,104 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Chase-Lev工作窃取双端队列，内存序按照Lê等人（PPoPP 2013）给出的C11版本
+// 只有拥有者线程可以push/pop，在底部操作；其他线程用steal从顶部取任务
+// 队列只保存指针，满了会自动扩容
+template<typename T>
+class WorkStealingDeque
+{
+private:
+    class Buffer
+    {
+    public:
+        const int64_t capacity;
+        std::unique_ptr<std::atomic<T*>[]> slots;
+
+        explicit Buffer(int64_t capacity) : capacity(capacity), slots(new std::atomic<T*>[capacity]) {}
+
+        T* get(int64_t i) const {
+            return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T* item) {
+            slots[i & (capacity - 1)].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    alignas(64) std::atomic<int64_t> top;
+    alignas(64) std::atomic<int64_t> bottom;
+    std::atomic<Buffer*> buffer;
+    // 扩容后窃取者可能仍在读旧的缓冲区，所以旧缓冲区一直保留到队列销毁
+    std::vector<std::unique_ptr<Buffer>> buffers;
+
+public:
+    // capacity必须是2的幂
+    explicit WorkStealingDeque(int64_t capacity = 256) : top(0), bottom(0) {
+        buffers.emplace_back(new Buffer(capacity));
+        buffer.store(buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // 仅限拥有者线程
+    void push(T* item) {
+        const int64_t b = bottom.load(std::memory_order_relaxed);
+        const int64_t t = top.load(std::memory_order_acquire);
+        Buffer* a = buffer.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) {
+            Buffer* const bigger = new Buffer(a->capacity * 2);
+            for (int64_t i = t; i < b; ++i)
+                bigger->put(i, a->get(i));
+            buffers.emplace_back(bigger);
+            buffer.store(bigger, std::memory_order_release);
+            a = bigger;
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // 仅限拥有者线程，队列为空时返回nullptr
+    T* pop() {
+        const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* const a = buffer.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = a->get(b);
+        if (t == b) {
+            // 只剩最后一个任务，和窃取者竞争
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                item = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // 任意线程都可以调用，队列为空或者与其他线程竞争失败时返回nullptr
+    T* steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        Buffer* const a = buffer.load(std::memory_order_acquire);
+        T* const item = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return item;
+    }
+
+    bool empty() const {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+};
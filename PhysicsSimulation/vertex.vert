@@ -1,8 +1,8 @@
 #version 330 core
 
 layout(location = 0) in vec4 vertex;
-layout(location = 1) in vec3 fColor;
-layout(location = 2) in mat4 instanceMatrix;
+layout(location = 1) in vec4 fColor;
+layout(location = 2) in vec3 instance; // xy: position, z: radius
 
 out vec2 TexCoords;
 out vec3 fragColor;
@@ -12,6 +12,8 @@ uniform mat4 projection;
 
 void main() {
 	TexCoords = vertex.zw;
-	gl_Position = projection * instanceMatrix * vec4(vertex.xy, 0.0, 1.0);
-	fragColor = fColor;
+	// Quad centered on (x + 0.5, y + 0.5), as wide as the diameter
+	vec2 corner = instance.xy + (0.5 - instance.z) + vertex.xy * (2.0 * instance.z);
+	gl_Position = projection * vec4(corner, 1.0, 1.0);
+	fragColor = fColor.rgb;
 }
\ No newline at end of file
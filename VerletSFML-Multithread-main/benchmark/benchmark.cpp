@@ -0,0 +1,584 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define ALLOCATION_COUNTER_IMPLEMENTATION
+#include "engine/common/allocation_counter.hpp"
+#include "engine/common/number_generator.hpp"
+#include "physics/physics.hpp"
+#include "renderer/particle_culler.hpp"
+#include "thread_pool/thread_pool.hpp"
+
+/* Headless benchmark of the solver, no window and no rendering.
+   Runs scripted scenarios for a fixed number of steps with every requested thread count and reports
+   the time spent in each phase of the sub steps plus the throughput in object-substeps per second.
+   The CPU side of the rendering (the culled vertex arrays) can be timed as well, see --view-zoom.
+
+   Usage: VerletBenchmark [options]
+     --scenarios a,b,...   emitter, pile, random_10k, random_80k, random_500k, mixed_1pct, mixed_10pct,
+                           mobility_low, mobility_mid, mobility_high (default: all)
+     --steps N             measured steps per run (default: 100)
+     --warmup N            steps run before measuring (default: 10)
+     --threads 1,2,4,...   thread counts (default: powers of 2 up to the hardware concurrency)
+     --grid fixed|compact|hash  collision grid (default: fixed)
+     --grid-update rebuild|incremental  fixed grid only, rebuild it or move the objects that changed cell
+                           at each sub step (default: rebuild)
+     --schedule slices|tiles4|tiles9  collision pass scheduling, two passes of column slices or 4 or 9 colors
+                           of 2D blocks (default: slices)
+     --contact-solver gauss-seidel|jacobi  contact solver of the default radius objects (default: gauss-seidel)
+     --jacobi-iterations N  Jacobi iterations per sub step (default: 1)
+     --jacobi-relaxation R  Jacobi relaxation factor (default: 1)
+     --deterministic on|off  deterministic mode, the final state hash then has to be the same for every
+                           thread count and the benchmark fails otherwise (default: off)
+     --integrator auto|scalar|sse2|avx2  integration kernel, every run is then repeated with the scalar kernel
+                           and the benchmark fails if the final state hashes differ. The compact and hash grids
+                           need --deterministic on for this (default: auto, not compared)
+     --sleep on|off        sleeping of still contact islands, the number of awake objects after the last step
+                           is reported (default: off)
+     --view-zoom Z         after each step build the vertex arrays of a 1920x1080 view centered on the world
+                           at this zoom in pixels per unit, 0 to skip (default: 0)
+     --format json|csv     output format (default: json)
+     --output path         output file (default: stdout)
+   The mean and maximum overlap of the touching pairs after the last step measure the contact convergence.
+   Measured steps that do not add objects must not allocate (update and vertex array build), the benchmark
+   fails otherwise. */
+
+using Clock = std::chrono::steady_clock;
+
+enum class ScenarioKind
+{
+    // The 20 objects per frame emitter of the interactive program
+    Emitter,
+    // Objects packed on a hexagonal lattice at the bottom of the world, then settling
+    Pile,
+    // Objects at uniformly random positions, about one object for two cells (of their size)
+    Random,
+    // Same density as Random without gravity, objects move in random directions at a given speed
+    Gas
+};
+
+struct Scenario
+{
+    std::string  name;
+    ScenarioKind kind;
+    uint32_t     object_count;
+    // Random scenarios only: share of large objects, their radius is uniform in [1, 4] (2 to 8 times the default one)
+    float        large_fraction = 0.0f;
+    // Gas scenarios only: speed in units per second, 480 is one cell per sub step
+    float        speed          = 0.0f;
+};
+
+struct Options
+{
+    std::vector<std::string> scenarios = {"emitter", "pile", "random_10k", "random_80k", "random_500k", "mixed_1pct", "mixed_10pct"};
+    std::vector<uint32_t>    threads;
+    uint32_t                 steps         = 100;
+    uint32_t                 warmup        = 10;
+    std::string              grid          = "fixed";
+    std::string              grid_update   = "rebuild";
+    std::string              schedule      = "slices";
+    std::string              contact_solver = "gauss-seidel";
+    uint32_t                 jacobi_iterations = 1;
+    float                    jacobi_relaxation = 1.0f;
+    bool                     deterministic = false;
+    // Empty when not given: the solver default, not compared to the scalar kernel
+    std::string              integrator;
+    bool                     sleep         = false;
+    float                    view_zoom     = 0.0f;
+    std::string              format        = "json";
+    std::string              output;
+};
+
+// Times are in milliseconds, summed over the measured steps
+struct Result
+{
+    std::string scenario;
+    std::string grid;
+    std::string grid_update;
+    std::string schedule;
+    std::string contact_solver;
+    std::string integrator;
+    uint32_t    threads         = 0;
+    uint32_t    steps           = 0;
+    uint32_t    sub_steps       = 0;
+    uint64_t    objects         = 0;
+    uint64_t    awake           = 0;
+    uint64_t    object_substeps = 0;
+    double      grid_build      = 0.0;
+    double      collision_pass_1 = 0.0;
+    double      collision_pass_2 = 0.0;
+    double      integration     = 0.0;
+    double      total           = 0.0;
+    // ParticleCuller::build, once per step, not part of the total
+    double      render_build    = 0.0;
+    // Quads of the last build, particles or density impostors
+    uint32_t    quads           = 0;
+    std::string detail;
+    double      speedup         = 1.0;
+    // PhysicSolver::contactError after the last step
+    double      overlap_mean    = 0.0;
+    double      overlap_max     = 0.0;
+    // PhysicSolver::stateHash after the last step
+    uint64_t    state_hash      = 0;
+    // Heap allocations of the measured steps that did not add objects, see AllocationCounter
+    uint64_t    allocations     = 0;
+    uint32_t    steady_steps    = 0;
+
+    [[nodiscard]]
+    double objectSubstepsPerSecond() const
+    {
+        return total > 0.0 ? static_cast<double>(object_substeps) / (total * 0.001) : 0.0;
+    }
+};
+
+const std::vector<Scenario> scenarios = {
+    {"emitter",     ScenarioKind::Emitter, 80000},
+    {"pile",        ScenarioKind::Pile,    40000},
+    {"random_10k",  ScenarioKind::Random,  10000},
+    {"random_80k",  ScenarioKind::Random,  80000},
+    {"random_500k", ScenarioKind::Random,  500000},
+    {"mixed_1pct",  ScenarioKind::Random,  80000, 0.01f},
+    {"mixed_10pct", ScenarioKind::Random,  80000, 0.1f},
+    // Roughly 0.3%, 3% and 15% of the objects change cell at each sub step
+    {"mobility_low",  ScenarioKind::Gas,   80000, 0.0f, 1.0f},
+    {"mobility_mid",  ScenarioKind::Gas,   80000, 0.0f, 10.0f},
+    {"mobility_high", ScenarioKind::Gas,   80000, 0.0f, 60.0f},
+};
+
+double elapsedMs(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+IVec2 worldSize(const Scenario& scenario)
+{
+    if (scenario.kind == ScenarioKind::Random || scenario.kind == ScenarioKind::Gas) {
+        // Same density as the uniform case: a large object of radius r in [1, 4] covers (2r)^2 cells, 28 on average
+        const double cells_per_object = 1.0 - scenario.large_fraction + 28.0 * scenario.large_fraction;
+        const auto side = to<int32_t>(std::ceil(std::sqrt(2.0 * scenario.object_count * cells_per_object)));
+        return {side, side};
+    }
+    return {300, 300};
+}
+
+IntegratorMode integratorMode(const std::string& name)
+{
+    return name == "scalar" ? IntegratorMode::Scalar
+         : name == "sse2"   ? IntegratorMode::SSE2
+         : name == "avx2"   ? IntegratorMode::AVX2
+                            : IntegratorMode::Auto;
+}
+
+const char* integratorName(IntegratorMode mode)
+{
+    return mode == IntegratorMode::Scalar ? "scalar"
+         : mode == IntegratorMode::SSE2   ? "sse2"
+         : mode == IntegratorMode::AVX2   ? "avx2"
+                                          : "auto";
+}
+
+template<typename TSolver>
+void populate(TSolver& solver, const Scenario& scenario)
+{
+    const float margin = 2.0f;
+    if (scenario.kind == ScenarioKind::Pile) {
+        const float spacing = 1.0f;
+        const float row_height = spacing * 0.866f;
+        uint32_t row = 0;
+        while (solver.objects.size() < scenario.object_count) {
+            const float y = solver.world_size.y - margin - 0.5f - to<float>(row) * row_height;
+            const float offset = (row % 2) ? spacing * 0.5f : 0.0f;
+            for (float x{margin + 0.5f + offset}; x < solver.world_size.x - margin && solver.objects.size() < scenario.object_count; x += spacing) {
+                solver.createObject({x, y});
+            }
+            ++row;
+        }
+    } else if (scenario.kind == ScenarioKind::Random) {
+        // Fixed seed so that every run of a scenario starts from the same state
+        RealNumberGenerator<float> rng;
+        for (uint32_t i{scenario.object_count}; i--;) {
+            const Vec2 position = {rng.getRange(margin, solver.world_size.x - margin),
+                                   rng.getRange(margin, solver.world_size.y - margin)};
+            if (scenario.large_fraction > 0.0f && rng.get() < scenario.large_fraction) {
+                solver.createObject(position, rng.getRange(1.0f, 4.0f));
+            } else {
+                solver.createObject(position);
+            }
+        }
+    } else if (scenario.kind == ScenarioKind::Gas) {
+        RealNumberGenerator<float> rng;
+        // Verlet velocities are displacements per sub step
+        const float step = scenario.speed / (60.0f * to<float>(solver.sub_steps));
+        solver.gravity = {0.0f, 0.0f};
+        for (uint32_t i{scenario.object_count}; i--;) {
+            const auto id = solver.createObject({rng.getRange(margin, solver.world_size.x - margin),
+                                                 rng.getRange(margin, solver.world_size.y - margin)});
+            const float angle = rng.getUnder(Math::TwoPI);
+            solver.objects[id].addVelocity({std::cos(angle) * step, std::sin(angle) * step});
+        }
+    }
+}
+
+template<typename TSolver>
+void emit(TSolver& solver, const Scenario& scenario)
+{
+    if (scenario.kind == ScenarioKind::Emitter && solver.objects.size() < scenario.object_count) {
+        for (uint32_t i{20}; i--;) {
+            const auto id = solver.createObject({2.0f, 10.0f + 1.1f * i});
+            solver.objects[id].last_position.x -= 0.2f;
+        }
+    } else if (scenario.kind == ScenarioKind::Gas) {
+        // Collisions quickly damp the motion, every object is set back to the scenario speed keeping its direction
+        const float step = scenario.speed / (60.0f * to<float>(solver.sub_steps));
+        for (PhysicObject& object : solver.objects) {
+            const Vec2  velocity = object.getVelocity();
+            const float length   = MathVec2::length(velocity);
+            if (length > 0.0f) {
+                object.last_position = object.position - velocity * (step / length);
+            }
+        }
+    }
+}
+
+// Same sequence as PhysicSolver::update with each phase timed
+template<typename TSolver>
+void timedUpdate(TSolver& solver, float dt, Result& result)
+{
+    const float sub_dt = dt / to<float>(solver.sub_steps);
+    if (solver.sleep.m_enabled) {
+        const Clock::time_point start = Clock::now();
+        solver.wakeIslands();
+        const double elapsed = elapsedMs(start, Clock::now());
+        result.integration += elapsed;
+        result.total       += elapsed;
+    }
+    for (uint32_t i(solver.sub_steps); i--;) {
+        if (solver.sleep.m_enabled && solver.sleep.m_awake.load(std::memory_order_relaxed) == 0) {
+            break;
+        }
+        const Clock::time_point start = Clock::now();
+        solver.addObjectsToGrid();
+        const Clock::time_point grid_built = Clock::now();
+        // The Jacobi iterations are counted in the first pass
+        const bool jacobi = solver.contact_solver == ContactSolver::Jacobi;
+        if (jacobi) {
+            solver.solveJacobi();
+        } else {
+            solver.partitionSlices();
+            solver.solveCollisionPass(0);
+        }
+        const Clock::time_point pass_1_done = Clock::now();
+        if (!jacobi) {
+            solver.solveCollisionPass(1);
+        }
+        // Large objects are counted in the second pass, as in the profiler
+        solver.solveHierarchy();
+        const Clock::time_point pass_2_done = Clock::now();
+        solver.updateObjects_multi(sub_dt);
+        const Clock::time_point end = Clock::now();
+
+        result.grid_build       += elapsedMs(start, grid_built);
+        result.collision_pass_1 += elapsedMs(grid_built, pass_1_done);
+        result.collision_pass_2 += elapsedMs(pass_1_done, pass_2_done);
+        result.integration      += elapsedMs(pass_2_done, end);
+        result.total            += elapsedMs(start, end);
+        result.object_substeps  += solver.objects.size();
+    }
+    // Island search, counted in the integration as in the profiler
+    const Clock::time_point start = Clock::now();
+    solver.updateSleep();
+    const double elapsed = elapsedMs(start, Clock::now());
+    result.integration += elapsed;
+    result.total       += elapsed;
+}
+
+template<typename TGrid>
+Result run(const Scenario& scenario, const Options& options, uint32_t thread_count, IntegratorMode integrator)
+{
+    tp::ThreadPool thread_pool(thread_count);
+    PhysicSolver<TGrid> solver{worldSize(scenario), thread_pool};
+    solver.deterministic = options.deterministic;
+    solver.integrator_mode = integrator;
+    solver.grid_update   = options.grid_update == "incremental" ? GridUpdate::Incremental : GridUpdate::Rebuild;
+    solver.collision_schedule = options.schedule == "tiles4" ? CollisionSchedule::Tiles4
+                              : options.schedule == "tiles9" ? CollisionSchedule::Tiles9
+                                                             : CollisionSchedule::Slices;
+    solver.sleep.m_enabled = options.sleep;
+    solver.contact_solver  = options.contact_solver == "jacobi" ? ContactSolver::Jacobi : ContactSolver::GaussSeidel;
+    solver.jacobi.m_iterations = options.jacobi_iterations;
+    solver.jacobi.m_relaxation = options.jacobi_relaxation;
+    populate(solver, scenario);
+
+    const float dt = 1.0f / 60.0f;
+    Result result;
+    ParticleCuller culler;
+    const ViewBounds view = ViewBounds::fromView(solver.world_size * 0.5f, {1920.0f, 1080.0f}, options.view_zoom);
+    // The first step sizes the buffers, a step that adds objects may grow them
+    size_t last_count = std::numeric_limits<size_t>::max();
+    for (uint32_t i{options.warmup}; i--;) {
+        emit(solver, scenario);
+        last_count = solver.objects.size();
+        solver.update(dt);
+        if (options.view_zoom > 0.0f) {
+            culler.build(solver, view, thread_pool);
+        }
+    }
+    for (uint32_t i{options.steps}; i--;) {
+        emit(solver, scenario);
+        const bool steady = solver.objects.size() == last_count;
+        last_count = solver.objects.size();
+        const uint64_t allocations = AllocationCounter::count();
+        timedUpdate(solver, dt, result);
+        if (options.view_zoom > 0.0f) {
+            const Clock::time_point start = Clock::now();
+            culler.build(solver, view, thread_pool);
+            result.render_build += elapsedMs(start, Clock::now());
+        }
+        if (steady) {
+            result.allocations += AllocationCounter::count() - allocations;
+            ++result.steady_steps;
+        }
+    }
+
+    result.scenario   = scenario.name;
+    result.grid       = options.grid;
+    result.grid_update = options.grid_update;
+    result.schedule    = options.schedule;
+    result.contact_solver = options.contact_solver;
+    result.integrator = integratorName(Integrator::resolve(integrator));
+    result.threads    = thread_count;
+    result.steps      = options.steps;
+    result.sub_steps  = solver.sub_steps;
+    result.objects    = solver.objects.size();
+    result.awake      = options.sleep ? solver.sleep.m_awake.load() : result.objects;
+    result.state_hash = solver.stateHash();
+    result.quads      = options.view_zoom > 0.0f ? culler.m_quad_count : 0;
+    result.detail     = options.view_zoom <= 0.0f ? "none" : culler.m_detail == ParticleDetail::Density ? "density" : "particles";
+    // The grid is from before the last integration, buried objects are inserted as well so that every pair is measured
+    if (solver.sleep.m_buried != 0) {
+        solver.buildGrid(solver.grid, InsertAll{});
+    } else {
+        solver.addObjectsToGrid();
+    }
+    const ContactError error = solver.contactError();
+    result.overlap_mean = error.m_mean;
+    result.overlap_max  = error.m_max;
+    return result;
+}
+
+std::string hex(uint64_t value)
+{
+    std::stringstream stream;
+    stream << std::hex << std::setw(16) << std::setfill('0') << value;
+    return stream.str();
+}
+
+std::vector<std::string> split(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<uint32_t> defaultThreads()
+{
+    const uint32_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint32_t> threads;
+    for (uint32_t t{1}; t < hardware; t *= 2) {
+        threads.push_back(t);
+    }
+    threads.push_back(hardware);
+    return threads;
+}
+
+bool parseOptions(int argc, char** argv, Options& options)
+{
+    for (int i{1}; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--scenarios") {
+            options.scenarios = split(value);
+        } else if (arg == "--steps") {
+            options.steps = to<uint32_t>(std::stoul(value));
+        } else if (arg == "--warmup") {
+            options.warmup = to<uint32_t>(std::stoul(value));
+        } else if (arg == "--threads") {
+            options.threads.clear();
+            for (const std::string& t : split(value)) {
+                options.threads.push_back(std::max(1u, to<uint32_t>(std::stoul(t))));
+            }
+        } else if (arg == "--grid" && (value == "fixed" || value == "compact" || value == "hash")) {
+            options.grid = value;
+        } else if (arg == "--grid-update" && (value == "rebuild" || value == "incremental")) {
+            options.grid_update = value;
+        } else if (arg == "--schedule" && (value == "slices" || value == "tiles4" || value == "tiles9")) {
+            options.schedule = value;
+        } else if (arg == "--contact-solver" && (value == "gauss-seidel" || value == "jacobi")) {
+            options.contact_solver = value;
+        } else if (arg == "--jacobi-iterations") {
+            options.jacobi_iterations = std::max(1u, to<uint32_t>(std::stoul(value)));
+        } else if (arg == "--jacobi-relaxation") {
+            options.jacobi_relaxation = std::stof(value);
+        } else if (arg == "--deterministic" && (value == "on" || value == "off")) {
+            options.deterministic = value == "on";
+        } else if (arg == "--integrator" && (value == "auto" || value == "scalar" || value == "sse2" || value == "avx2")) {
+            options.integrator = value;
+        } else if (arg == "--sleep" && (value == "on" || value == "off")) {
+            options.sleep = value == "on";
+        } else if (arg == "--view-zoom") {
+            options.view_zoom = std::max(0.0f, std::stof(value));
+        } else if (arg == "--format" && (value == "json" || value == "csv")) {
+            options.format = value;
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            std::cerr << "Invalid option " << arg << " " << value << std::endl;
+            return false;
+        }
+    }
+    if (options.threads.empty()) {
+        options.threads = defaultThreads();
+    }
+    // Without the deterministic mode these grids fill their cells in scheduling order, two runs differ anyway
+    if (!options.integrator.empty() && options.grid != "fixed" && !options.deterministic) {
+        std::cerr << "--integrator with the " << options.grid << " grid needs --deterministic on" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void writeJson(std::ostream& out, const std::vector<Result>& results)
+{
+    out << "{\n  \"results\": [";
+    for (size_t i{0}; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << (i ? "," : "") << "\n    {"
+            << "\"scenario\": \"" << r.scenario << "\", "
+            << "\"grid\": \"" << r.grid << "\", "
+            << "\"grid_update\": \"" << r.grid_update << "\", "
+            << "\"schedule\": \"" << r.schedule << "\", "
+            << "\"contact_solver\": \"" << r.contact_solver << "\", "
+            << "\"integrator\": \"" << r.integrator << "\", "
+            << "\"threads\": " << r.threads << ", "
+            << "\"steps\": " << r.steps << ", "
+            << "\"sub_steps\": " << r.sub_steps << ", "
+            << "\"objects\": " << r.objects << ", "
+            << "\"awake\": " << r.awake << ", "
+            << "\"grid_build_ms\": " << r.grid_build << ", "
+            << "\"collision_pass_1_ms\": " << r.collision_pass_1 << ", "
+            << "\"collision_pass_2_ms\": " << r.collision_pass_2 << ", "
+            << "\"integration_ms\": " << r.integration << ", "
+            << "\"total_ms\": " << r.total << ", "
+            << "\"render_build_ms\": " << r.render_build << ", "
+            << "\"quads\": " << r.quads << ", "
+            << "\"detail\": \"" << r.detail << "\", "
+            << "\"object_substeps_per_sec\": " << r.objectSubstepsPerSecond() << ", "
+            << "\"speedup\": " << r.speedup << ", "
+            << "\"overlap_mean\": " << r.overlap_mean << ", "
+            << "\"overlap_max\": " << r.overlap_max << ", "
+            << "\"state_hash\": \"" << hex(r.state_hash) << "\", "
+            << "\"steady_steps\": " << r.steady_steps << ", "
+            << "\"allocations\": " << r.allocations << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void writeCsv(std::ostream& out, const std::vector<Result>& results)
+{
+    out << "scenario,grid,grid_update,schedule,contact_solver,integrator,threads,steps,sub_steps,objects,awake,grid_build_ms,collision_pass_1_ms,collision_pass_2_ms,"
+           "integration_ms,total_ms,render_build_ms,quads,detail,object_substeps_per_sec,speedup,overlap_mean,overlap_max,state_hash,steady_steps,allocations\n";
+    for (const Result& r : results) {
+        out << r.scenario << ',' << r.grid << ',' << r.grid_update << ',' << r.schedule << ',' << r.contact_solver << ',' << r.integrator << ',' << r.threads << ',' << r.steps << ',' << r.sub_steps << ','
+            << r.objects << ',' << r.awake << ',' << r.grid_build << ',' << r.collision_pass_1 << ',' << r.collision_pass_2 << ','
+            << r.integration << ',' << r.total << ',' << r.render_build << ',' << r.quads << ',' << r.detail << ',' << r.objectSubstepsPerSecond() << ',' << r.speedup << ','
+            << r.overlap_mean << ',' << r.overlap_max << ',' << hex(r.state_hash) << ',' << r.steady_steps << ',' << r.allocations << '\n';
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    std::vector<Result> results;
+    bool failure = false;
+    const IntegratorMode integrator = integratorMode(options.integrator);
+    // Kernels are only compared when one is requested, and the scalar kernel has nothing to be compared to
+    const bool check_integrator = !options.integrator.empty() && Integrator::resolve(integrator) != IntegratorMode::Scalar;
+    const auto run_grid = [&](const Scenario& scenario, uint32_t thread_count, IntegratorMode mode) {
+        return options.grid == "compact" ? run<CompactCollisionGrid>(scenario, options, thread_count, mode)
+             : options.grid == "hash"    ? run<HashCollisionGrid>(scenario, options, thread_count, mode)
+                                         : run<CollisionGrid>(scenario, options, thread_count, mode);
+    };
+    for (const std::string& name : options.scenarios) {
+        const auto scenario = std::find_if(scenarios.begin(), scenarios.end(), [&](const Scenario& s) {
+            return s.name == name;
+        });
+        if (scenario == scenarios.end()) {
+            std::cerr << "Unknown scenario " << name << std::endl;
+            return 1;
+        }
+        // Speedups are relative to the first thread count of the list
+        const size_t first = results.size();
+        for (const uint32_t thread_count : options.threads) {
+            std::cerr << name << " with " << thread_count << " threads..." << std::endl;
+            Result result = run_grid(*scenario, thread_count, integrator);
+            result.speedup = result.total > 0.0 ? results.size() > first ? results[first].total / result.total : 1.0 : 0.0;
+            results.push_back(result);
+            if (result.allocations) {
+                std::cerr << name << " with " << thread_count << " threads: " << result.allocations << " allocations in "
+                          << result.steady_steps << " steps that did not add objects" << std::endl;
+                failure = true;
+            }
+            if (options.deterministic && result.state_hash != results[first].state_hash) {
+                std::cerr << name << " with " << thread_count << " threads diverged from " << results[first].threads << " threads" << std::endl;
+                failure = true;
+            }
+            if (check_integrator) {
+                std::cerr << name << " with " << thread_count << " threads, scalar reference..." << std::endl;
+                const Result reference = run_grid(*scenario, thread_count, IntegratorMode::Scalar);
+                if (result.state_hash != reference.state_hash) {
+                    std::cerr << name << " with " << thread_count << " threads: the " << result.integrator
+                              << " kernel diverged from the scalar one" << std::endl;
+                    failure = true;
+                }
+            }
+        }
+    }
+
+    std::ofstream file;
+    if (!options.output.empty()) {
+        file.open(options.output);
+        if (!file) {
+            std::cerr << "Cannot open " << options.output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = options.output.empty() ? std::cout : file;
+    if (options.format == "csv") {
+        writeCsv(out, results);
+    } else {
+        writeJson(out, results);
+    }
+    return failure ? 2 : 0;
+}
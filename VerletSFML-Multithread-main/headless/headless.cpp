@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "engine/common/number_generator.hpp"
+#include "physics/physics.hpp"
+#include "engine/common/color_utils.hpp"
+#include "renderer/frame_writer.hpp"
+#include "renderer/particle_culler.hpp"
+#include "renderer/software_renderer.hpp"
+#include "thread_pool/thread_pool.hpp"
+
+/* Runs the simulation without a window or a GPU and renders its frames on the CPU, see SoftwareRenderer.
+   Frames are written as images or streamed raw, the timings go to stderr.
+
+   Usage: VerletHeadless [options]
+     --scene emitter|random  emitter of the interactive program in a 300x300 world, or every object
+                           created at once at random positions (default: emitter)
+     --objects N           object count (default: 80000)
+     --frames N            simulated frames, at 60 per second (default: 600)
+     --every N             render one frame out of N (default: 1)
+     --width W             image width (default: 1920)
+     --height H            image height (default: 1080)
+     --zoom Z              pixels per world unit, the world is centered (default: the world height fits)
+     --threads N           thread pool size (default: hardware concurrency)
+     --deterministic on|off  deterministic solver, the frames are then the same for every thread count (default: off)
+     --format png|ppm|raw|none  output format, none only renders (default: ppm)
+     --output path         path_<frame>.png or .ppm, or the raw stream file, "-" for stdout (default: frame)
+     --sprite path         object sprite (default: res/circle.png)
+   Example: VerletHeadless --format raw --output - | ffmpeg -f rawvideo -pixel_format rgb24
+            -video_size 1920x1080 -framerate 60 -i - out.mp4 */
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string scene         = "emitter";
+    uint32_t    objects       = 80000;
+    uint32_t    frames        = 600;
+    uint32_t    every         = 1;
+    uint32_t    width         = 1920;
+    uint32_t    height        = 1080;
+    float       zoom          = 0.0f;
+    uint32_t    threads       = std::max(1u, std::thread::hardware_concurrency());
+    bool        deterministic = false;
+    std::string format        = "ppm";
+    std::string output        = "frame";
+    std::string sprite        = "res/circle.png";
+};
+
+double elapsedMs(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+bool parseOptions(int argc, char** argv, Options& options)
+{
+    for (int i{1}; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--scene" && (value == "emitter" || value == "random")) {
+            options.scene = value;
+        } else if (arg == "--objects") {
+            options.objects = to<uint32_t>(std::stoul(value));
+        } else if (arg == "--frames") {
+            options.frames = to<uint32_t>(std::stoul(value));
+        } else if (arg == "--every") {
+            options.every = std::max(1u, to<uint32_t>(std::stoul(value)));
+        } else if (arg == "--width") {
+            options.width = std::max(1u, to<uint32_t>(std::stoul(value)));
+        } else if (arg == "--height") {
+            options.height = std::max(1u, to<uint32_t>(std::stoul(value)));
+        } else if (arg == "--zoom") {
+            options.zoom = std::stof(value);
+        } else if (arg == "--threads") {
+            options.threads = std::max(1u, to<uint32_t>(std::stoul(value)));
+        } else if (arg == "--deterministic" && (value == "on" || value == "off")) {
+            options.deterministic = value == "on";
+        } else if (arg == "--format" && (value == "png" || value == "ppm" || value == "raw" || value == "none")) {
+            options.format = value;
+        } else if (arg == "--output") {
+            options.output = value;
+        } else if (arg == "--sprite") {
+            options.sprite = value;
+        } else {
+            std::cerr << "Invalid option " << arg << " " << value << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+IVec2 worldSize(const Options& options)
+{
+    if (options.scene == "random") {
+        // About one object for two cells, as the random benchmark scenarios
+        const auto side = to<int32_t>(std::ceil(std::sqrt(2.0 * options.objects)));
+        return {side, side};
+    }
+    return {300, 300};
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    tp::ThreadPool thread_pool(options.threads);
+    const IVec2 world_size = worldSize(options);
+    PhysicSolver solver{world_size, thread_pool};
+    solver.deterministic = options.deterministic;
+    if (options.scene == "random") {
+        const float margin = 2.0f;
+        RealNumberGenerator<float> rng;
+        for (uint32_t i{0}; i < options.objects; ++i) {
+            const auto id = solver.createObject({rng.getRange(margin, solver.world_size.x - margin),
+                                                 rng.getRange(margin, solver.world_size.y - margin)});
+            solver.objects[id].color = ColorUtils::getRainbow(to<float>(id) * 0.0001f);
+        }
+    }
+
+    const float margin = 20.0f;
+    const float zoom   = options.zoom > 0.0f ? options.zoom : (to<float>(options.height) - margin) / to<float>(world_size.y);
+    const ViewBounds view = ViewBounds::fromView(solver.world_size * 0.5f, {to<float>(options.width), to<float>(options.height)}, zoom);
+
+    ParticleCuller   culler;
+    SoftwareRenderer renderer{options.width, options.height};
+    if (!renderer.loadSprite(options.sprite)) {
+        std::cerr << "Cannot load " << options.sprite << ", drawing squares" << std::endl;
+    }
+    FrameWriter writer;
+    if (options.format != "none") {
+        const FrameFormat format = options.format == "png" ? FrameFormat::Png
+                                 : options.format == "raw" ? FrameFormat::Raw
+                                                           : FrameFormat::Ppm;
+        if (!writer.open(format, options.output, options.width, options.height)) {
+            std::cerr << "Cannot open " << options.output << std::endl;
+            return 1;
+        }
+    }
+
+    const float dt = 1.0f / 60.0f;
+    double   update_ms = 0.0, cull_ms = 0.0, raster_ms = 0.0, write_ms = 0.0;
+    uint32_t rendered  = 0;
+    const Clock::time_point begin = Clock::now();
+    for (uint32_t frame{0}; frame < options.frames; ++frame) {
+        if (options.scene == "emitter" && solver.objects.size() < options.objects) {
+            for (uint32_t i{20}; i--;) {
+                const auto id = solver.createObject({2.0f, 10.0f + 1.1f * i});
+                solver.objects[id].last_position.x -= 0.2f;
+                solver.objects[id].color = ColorUtils::getRainbow(id * 0.0001f);
+            }
+        }
+        const Clock::time_point start = Clock::now();
+        solver.update(dt);
+        const Clock::time_point updated = Clock::now();
+        update_ms += elapsedMs(start, updated);
+        if (frame % options.every) {
+            continue;
+        }
+
+        culler.build(solver, view, thread_pool);
+        const Clock::time_point culled = Clock::now();
+        renderer.render(culler, view, solver.world_size, thread_pool);
+        const Clock::time_point rasterized = Clock::now();
+        if (writer.m_open && !writer.write(renderer.m_pixels.data(), frame)) {
+            std::cerr << "Cannot write frame " << frame << std::endl;
+            return 1;
+        }
+        cull_ms   += elapsedMs(updated, culled);
+        raster_ms += elapsedMs(culled, rasterized);
+        write_ms  += elapsedMs(rasterized, Clock::now());
+        ++rendered;
+    }
+    writer.close();
+    if (writer.m_failed) {
+        std::cerr << "Cannot write " << options.output << std::endl;
+        return 1;
+    }
+
+    // Real time is 60 simulated frames per second of wall time
+    const double total_ms = elapsedMs(begin, Clock::now());
+    const double per_frame = 1.0 / std::max(rendered, 1u);
+    std::cerr << options.frames << " frames, " << rendered << " rendered, " << solver.objects.size() << " objects, "
+              << options.width << "x" << options.height << ", " << options.threads << " threads" << std::endl
+              << "  update " << update_ms / std::max(options.frames, 1u) << " ms/frame" << std::endl
+              << "  cull   " << cull_ms * per_frame << " ms/frame, " << culler.m_quad_count << " quads" << std::endl
+              << "  raster " << raster_ms * per_frame << " ms/frame" << std::endl
+              << "  write  " << write_ms * per_frame << " ms/frame (waiting for the I/O thread)" << std::endl
+              << "  total  " << total_ms << " ms, " << (options.frames * 1000.0 / 60.0) / std::max(total_ms, 1e-3) << "x real time" << std::endl;
+    return 0;
+}
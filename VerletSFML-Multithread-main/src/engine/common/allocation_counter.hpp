@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+
+/* Counts calls to the global operator new, used to check that the frame hot path does not allocate.
+   Like stb headers, define ALLOCATION_COUNTER_IMPLEMENTATION in exactly one source file before including
+   this header to replace the global operator new/delete, otherwise count() always returns 0. */
+struct AllocationCounter
+{
+    inline static std::atomic<uint64_t> allocations = 0;
+
+    static uint64_t count()
+    {
+        return allocations.load(std::memory_order_relaxed);
+    }
+};
+
+#ifdef ALLOCATION_COUNTER_IMPLEMENTATION
+
+// GCC inlines these into callers and then reports new paired with free
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+    AllocationCounter::allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    AllocationCounter::allocations.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t align = static_cast<std::size_t>(alignment);
+#ifdef _MSC_VER
+    if (void* p = _aligned_malloc(size ? size : 1, align)) {
+        return p;
+    }
+#else
+    if (void* p = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+        return p;
+    }
+#endif
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return ::operator new(size, alignment);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void operator delete[](void* p, std::align_val_t alignment) noexcept
+{
+    ::operator delete(p, alignment);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+    ::operator delete(p, alignment);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+    ::operator delete(p, alignment);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
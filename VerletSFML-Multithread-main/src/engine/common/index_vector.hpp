@@ -96,6 +96,8 @@ struct Vector : public GenericProvider
     template<typename TPredicate>
     void               remove_if(TPredicate&& f);
     void               clear();
+    // Moves the object at order[i] to i, IDs and Refs stay valid
+    void               reorder(const std::vector<uint64_t>& order);
     // Data access by ID
     T&                 operator[](ID id);
     const T&           operator[](ID id) const;
@@ -367,6 +369,26 @@ void Vector<T>::clear()
     data_size = 0;
 }
 
+template<typename T>
+void Vector<T>::reorder(const std::vector<uint64_t>& order)
+{
+    // Only live objects are moved, free slots past data_size are left untouched
+    std::vector<T>            sorted_data;
+    std::vector<SlotMetadata> sorted_metadata;
+    sorted_data.reserve(data_size);
+    sorted_metadata.reserve(data_size);
+    for (uint64_t i{0}; i < data_size; ++i) {
+        sorted_data.push_back(std::move(data[order[i]]));
+        sorted_metadata.push_back(metadata[order[i]]);
+    }
+    // The operation IDs move with the objects so IDs only need to point to the new place
+    for (uint64_t i{0}; i < data_size; ++i) {
+        data[i]     = std::move(sorted_data[i]);
+        metadata[i] = sorted_metadata[i];
+        ids[metadata[i].rid] = i;
+    }
+}
+
 template<typename T>
 template<typename TCallback>
 void Vector<T>::foreach(TCallback &&callback) {
@@ -0,0 +1,253 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "racc.hpp"
+
+/* Scoped timers around the hot path.
+   PROFILE_PHASE times a whole phase on the calling thread, PROFILE_WORK times a job executed by a worker
+   inside a phase; the difference between the two gives the time workers spend waiting.
+   Durations are averaged over the last frames for the HUD, and while a capture is running every scope is
+   also recorded as a Chrome trace event (chrome://tracing, ui.perfetto.dev).
+   Build with PROFILING_ENABLED=0 to remove the timers completely. */
+#ifndef PROFILING_ENABLED
+#define PROFILING_ENABLED 1
+#endif
+
+namespace prof
+{
+
+enum class Phase : uint32_t
+{
+    GridBuild,
+    CollisionPass1,
+    CollisionPass2,
+    Integration,
+    RenderBuild,
+    Upload,
+    Count
+};
+
+constexpr uint32_t phase_count = static_cast<uint32_t>(Phase::Count);
+
+inline const char* phaseName(Phase phase)
+{
+    static constexpr const char* names[phase_count] = {
+        "Grid build", "Collision pass 1", "Collision pass 2", "Integration", "Render build", "Upload"
+    };
+    return names[static_cast<uint32_t>(phase)];
+}
+
+using Clock = std::chrono::steady_clock;
+
+struct Event
+{
+    const char* name;
+    uint64_t    start;
+    uint64_t    end;
+};
+
+// Events of one thread, the buffer is reserved once so recording does not allocate
+struct ThreadEvents
+{
+    static constexpr uint32_t max_events = 1 << 16;
+
+    uint32_t           id;
+    std::vector<Event> events;
+
+    explicit
+    ThreadEvents(uint32_t id_)
+        : id{id_}
+    {
+        events.reserve(max_events);
+    }
+};
+
+struct Profiler
+{
+    Clock::time_point                          m_origin = Clock::now();
+    std::mutex                                 m_threads_mutex;
+    std::vector<std::unique_ptr<ThreadEvents>> m_threads;
+
+    std::atomic<uint64_t> m_phase_ns[phase_count] = {};
+    std::atomic<uint64_t> m_busy_ns[phase_count]  = {};
+    RMean<float>          m_phase_ms[phase_count];
+    RMean<float>          m_idle_ratio[phase_count];
+
+    std::atomic<bool> m_capturing      = false;
+    uint32_t          m_capture_frames = 0;
+    std::string       m_capture_path;
+
+    static Profiler& get()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    [[nodiscard]]
+    uint64_t now() const
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_origin).count());
+    }
+
+    ThreadEvents& threadEvents()
+    {
+        thread_local ThreadEvents* events = nullptr;
+        if (!events) {
+            std::lock_guard<std::mutex> lock_guard{m_threads_mutex};
+            m_threads.emplace_back(new ThreadEvents(static_cast<uint32_t>(m_threads.size())));
+            events = m_threads.back().get();
+        }
+        return *events;
+    }
+
+    void record(const char* name, uint64_t start, uint64_t end)
+    {
+        if (!m_capturing.load(std::memory_order_relaxed)) {
+            return;
+        }
+        ThreadEvents& thread = threadEvents();
+        if (thread.events.size() < ThreadEvents::max_events) {
+            thread.events.push_back({name, start, end});
+        }
+    }
+
+    void addPhase(Phase phase, uint64_t start, uint64_t end)
+    {
+        m_phase_ns[static_cast<uint32_t>(phase)].fetch_add(end - start, std::memory_order_relaxed);
+        record(phaseName(phase), start, end);
+    }
+
+    void addWork(Phase phase, uint64_t start, uint64_t end)
+    {
+        m_busy_ns[static_cast<uint32_t>(phase)].fetch_add(end - start, std::memory_order_relaxed);
+        record("Job", start, end);
+    }
+
+    // Records the next frame_count frames and writes them to path as a Chrome trace
+    void startCapture(uint32_t frame_count, const std::string& path)
+    {
+        {
+            std::lock_guard<std::mutex> lock_guard{m_threads_mutex};
+            for (auto& thread : m_threads) {
+                thread->events.clear();
+            }
+        }
+        m_capture_frames = frame_count;
+        m_capture_path   = path;
+        m_capturing.store(true, std::memory_order_relaxed);
+    }
+
+    /* Called once per frame when no job is running. thread_count is the number of threads executing jobs,
+       the pool's workers plus the calling thread that helps while waiting */
+    void endFrame(uint32_t thread_count)
+    {
+        for (uint32_t i{0}; i < phase_count; ++i) {
+            const uint64_t phase_ns = m_phase_ns[i].exchange(0, std::memory_order_relaxed);
+            const uint64_t busy_ns  = m_busy_ns[i].exchange(0, std::memory_order_relaxed);
+            m_phase_ms[i].addValue(static_cast<float>(phase_ns) * 1.0e-6f);
+            if (busy_ns) {
+                const double capacity = static_cast<double>(phase_ns) * thread_count;
+                m_idle_ratio[i].addValue(static_cast<float>(std::max(0.0, 1.0 - static_cast<double>(busy_ns) / capacity)));
+            }
+        }
+        if (m_capturing.load(std::memory_order_relaxed) && m_capture_frames && !--m_capture_frames) {
+            m_capturing.store(false, std::memory_order_relaxed);
+            writeTrace(m_capture_path);
+        }
+    }
+
+    // Mean duration of a phase over the last frames, in milliseconds
+    [[nodiscard]]
+    float phaseMs(Phase phase) const
+    {
+        return m_phase_ms[static_cast<uint32_t>(phase)].get();
+    }
+
+    // Mean share of the thread time spent waiting during a phase timed with PROFILE_WORK jobs
+    [[nodiscard]]
+    float idleRatio(Phase phase) const
+    {
+        return m_idle_ratio[static_cast<uint32_t>(phase)].get();
+    }
+
+    // Chrome trace_event format, complete events with microsecond timestamps
+    bool writeTrace(const std::string& path)
+    {
+        std::ofstream out(path);
+        if (!out) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock_guard{m_threads_mutex};
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        for (const auto& thread : m_threads) {
+            out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << thread->id
+                << ",\"args\":{\"name\":\"Thread " << thread->id << "\"}}";
+            first = false;
+            for (const Event& event : thread->events) {
+                out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << thread->id
+                    << ",\"ts\":" << static_cast<double>(event.start) * 1.0e-3
+                    << ",\"dur\":" << static_cast<double>(event.end - event.start) * 1.0e-3 << "}";
+            }
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return true;
+    }
+};
+
+// Times a phase on the calling thread
+struct PhaseScope
+{
+    Phase    phase;
+    uint64_t start;
+
+    explicit
+    PhaseScope(Phase phase_)
+        : phase{phase_}
+        , start{Profiler::get().now()}
+    {}
+
+    ~PhaseScope()
+    {
+        Profiler& profiler = Profiler::get();
+        profiler.addPhase(phase, start, profiler.now());
+    }
+};
+
+// Times a job executed inside a phase, on any thread
+struct WorkScope
+{
+    Phase    phase;
+    uint64_t start;
+
+    explicit
+    WorkScope(Phase phase_)
+        : phase{phase_}
+        , start{Profiler::get().now()}
+    {}
+
+    ~WorkScope()
+    {
+        Profiler& profiler = Profiler::get();
+        profiler.addWork(phase, start, profiler.now());
+    }
+};
+
+}
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#if PROFILING_ENABLED
+#define PROFILE_PHASE(phase) const prof::PhaseScope PROFILE_CONCAT(profile_scope_, __LINE__){phase}
+#define PROFILE_WORK(phase) const prof::WorkScope PROFILE_CONCAT(profile_scope_, __LINE__){phase}
+#else
+#define PROFILE_PHASE(phase) static_cast<void>(0)
+#define PROFILE_WORK(phase) static_cast<void>(0)
+#endif
@@ -27,6 +27,11 @@ public:
     {
         m_viewport_handler.setZoom(zoom);
     }
+
+    const ViewportHandler::State& getViewportState() const
+    {
+        return m_viewport_handler.state;
+    }
     
     void registerCallbacks(sfev::EventManager& event_manager)
     {
@@ -3,8 +3,10 @@
 #include "engine/window_context_handler.hpp"
 #include "engine/common/number_generator.hpp"
 #include "engine/common/color_utils.hpp"
+#include "engine/common/profiler.hpp"
 
 #include "physics/physics.hpp"
+#include "physics/trajectory_recorder.hpp"
 #include "thread_pool/thread_pool.hpp"
 #include "renderer/renderer.hpp"
 
@@ -17,8 +19,6 @@ int main()
     RenderContext& render_context = app.getRenderContext();
     // Initialize solver and renderer
 
-    /* The number of threads should be adjusted so that it divides the world size or some of the grid's cells
-       won't be processed */
     tp::ThreadPool thread_pool(10);
     const IVec2 world_size{300, 300};
     PhysicSolver solver{world_size, thread_pool};
@@ -41,6 +41,33 @@ int main()
         app.setFramerateLimit(target_fps);
     });
 
+    // Records the next 120 frames as a Chrome trace
+    app.getEventManager().addKeyPressedCallback(sf::Keyboard::T, [&](sfev::CstEv) {
+        prof::Profiler::get().startCapture(120, "trace.json");
+    });
+
+    // Starts or stops recording every frame in trajectory.bin
+    TrajectoryRecorder recorder{80000};
+    app.getEventManager().addKeyPressedCallback(sf::Keyboard::R, [&](sfev::CstEv) {
+        if (recorder.m_recording) {
+            recorder.stop();
+        } else if (!recorder.start("trajectory.bin", solver.world_size)) {
+            std::cout << "Cannot write trajectory.bin" << std::endl;
+        }
+    });
+
+    // F5 saves the scene, F9 restores it
+    app.getEventManager().addKeyPressedCallback(sf::Keyboard::F5, [&](sfev::CstEv) {
+        if (!solver.save("snapshot.bin", true)) {
+            std::cout << "Cannot write snapshot.bin" << std::endl;
+        }
+    });
+    app.getEventManager().addKeyPressedCallback(sf::Keyboard::F9, [&](sfev::CstEv) {
+        if (!solver.load("snapshot.bin")) {
+            std::cout << "Cannot load snapshot.bin" << std::endl;
+        }
+    });
+
     // Main loop
     const float dt = 1.0f / static_cast<float>(fps_cap);
     while (app.run()) {
@@ -53,10 +80,13 @@ int main()
         }
 
         solver.update(dt);
+        recorder.record(solver.objects);
 
         render_context.clear();
         renderer.render(render_context);
         render_context.display();
+        // The calling thread also executes jobs while waiting for the pool
+        prof::Profiler::get().endFrame(thread_pool.m_thread_count + 1);
     }
 
     return 0;
@@ -0,0 +1,100 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "engine/common/utils.hpp"
+
+
+enum class CollisionSchedule
+{
+    // Two passes of column slices, see SlicePartition
+    Slices,
+    // 2x2 colored blocks, at least 2 cells wide
+    Tiles4,
+    // 3x3 colored blocks, at least 1 cell wide
+    Tiles9
+};
+
+/* Colored 2D blocks for the collision pass: the grid is cut in blocks about block_size cells wide
+   and block (bx, by) gets the color (bx % period) + period * (by % period).
+   Processing a cell touches the cells around it, two blocks of the same color are separated by at
+   least one block of another color (two when period is 3), so by 2 cells, and can be processed in parallel.
+   Colors are processed one after the other with one small task per block: with many more blocks than
+   threads work stealing balances the load better than the two slice passes.
+   Blocks only depend on the grid size and block_size, not on the thread count, so the deterministic
+   mode can use them too. */
+struct BlockTiling
+{
+    // Block column bx covers columns [m_x_bounds[bx], m_x_bounds[bx + 1]), same for rows
+    std::vector<uint32_t> m_x_bounds;
+    std::vector<uint32_t> m_y_bounds;
+    // Block indices by * block columns + bx sorted by color
+    std::vector<uint32_t> m_order;
+    // Blocks of color c are m_order[m_color_bounds[c], m_color_bounds[c + 1])
+    std::vector<uint32_t> m_color_bounds;
+    uint32_t              m_period    = 2;
+    uint32_t              m_last_size = 0;
+
+    [[nodiscard]]
+    uint32_t colorCount() const
+    {
+        return m_period * m_period;
+    }
+
+    [[nodiscard]]
+    uint32_t colorBlockCount(uint32_t color) const
+    {
+        return m_color_bounds[color + 1] - m_color_bounds[color];
+    }
+
+    // Does nothing if the parameters did not change since the last call
+    void tile(uint32_t width, uint32_t height, uint32_t block_size, CollisionSchedule schedule)
+    {
+        const uint32_t period = schedule == CollisionSchedule::Tiles9 ? 3 : 2;
+        const uint32_t size   = std::max(block_size, period == 2 ? 2u : 1u);
+        if (period == m_period && size == m_last_size && !m_x_bounds.empty() && m_x_bounds.back() == width && m_y_bounds.back() == height) {
+            return;
+        }
+        m_period    = period;
+        m_last_size = size;
+        split(m_x_bounds, width, size);
+        split(m_y_bounds, height, size);
+        const uint32_t bx_count = to<uint32_t>(m_x_bounds.size()) - 1;
+        const uint32_t by_count = to<uint32_t>(m_y_bounds.size()) - 1;
+        m_order.clear();
+        m_color_bounds.assign(1, 0);
+        for (uint32_t cy{0}; cy < m_period; ++cy) {
+            for (uint32_t cx{0}; cx < m_period; ++cx) {
+                for (uint32_t by{cy}; by < by_count; by += m_period) {
+                    for (uint32_t bx{cx}; bx < bx_count; bx += m_period) {
+                        m_order.push_back(by * bx_count + bx);
+                    }
+                }
+                m_color_bounds.push_back(to<uint32_t>(m_order.size()));
+            }
+        }
+    }
+
+    // Calls f(start, end) for each column of the ith block of a color, [start, end) being the cell indices of the column in the block
+    template<typename TCallback>
+    void forEachColumn(uint32_t color, uint32_t i, uint32_t height, TCallback&& f) const
+    {
+        const uint32_t bx_count = to<uint32_t>(m_x_bounds.size()) - 1;
+        const uint32_t block    = m_order[m_color_bounds[color] + i];
+        const uint32_t bx       = block % bx_count;
+        const uint32_t by       = block / bx_count;
+        for (uint32_t x{m_x_bounds[bx]}; x < m_x_bounds[bx + 1]; ++x) {
+            f(x * height + m_y_bounds[by], x * height + m_y_bounds[by + 1]);
+        }
+    }
+
+    // Splits length in segments at least size long
+    static void split(std::vector<uint32_t>& bounds, uint32_t length, uint32_t size)
+    {
+        const uint32_t count = std::max(1u, length / size);
+        bounds.resize(count + 1);
+        for (uint32_t i{0}; i <= count; ++i) {
+            bounds[i] = to<uint32_t>(uint64_t{i} * length / count);
+        }
+    }
+};
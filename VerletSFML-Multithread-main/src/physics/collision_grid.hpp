@@ -1,9 +1,29 @@
 #pragma once
 #include <cstdint>
+#include <limits>
+#include <vector>
 #include "engine/common/vec.hpp"
 #include "engine/common/grid.hpp"
+#include "engine/common/utils.hpp"
 
 
+// Default build filter, every object is inserted
+struct InsertAll
+{
+    bool operator()(uint32_t) const
+    {
+        return true;
+    }
+};
+
+enum class GridUpdate
+{
+    // Every cell is cleared and every object inserted again at each sub step
+    Rebuild,
+    // Only the objects whose cell changed since the last sub step are moved, see CollisionGrid::update
+    Incremental
+};
+
 struct CollisionCell
 {
     static constexpr uint8_t cell_capacity = 4;
@@ -43,6 +63,30 @@ struct CollisionCell
 
 struct CollisionGrid : public Grid<CollisionCell>
 {
+	using Cell = CollisionCell;
+
+	// Dense grid, cell index is x * height + y
+	static constexpr bool sparse = false;
+
+	static constexpr uint32_t no_cell = std::numeric_limits<uint32_t>::max();
+
+	// Object removed from or inserted in a cell by update
+	struct CellMove
+	{
+		uint32_t cell;
+		uint32_t object;
+	};
+
+	// Parallel build bins, bins[chunk * chunk_count + block] holds the objects of a chunk that fell in a column block
+	std::vector<std::vector<uint32_t>> bins;
+	// When true build records the cell of each object so that update can move only the objects that changed cell
+	bool incremental = false;
+	// Cell holding each object, no_cell when it was filtered out, outside the grid or dropped by a full cell
+	std::vector<uint32_t> object_cells;
+	// Same layout as bins, removals from and insertions in the cells of a column block
+	std::vector<std::vector<CellMove>> removals;
+	std::vector<std::vector<CellMove>> insertions;
+
 	CollisionGrid()
 		: Grid<CollisionCell>()
 	{}
@@ -64,5 +108,172 @@ struct CollisionGrid : public Grid<CollisionCell>
 		for (auto& c : data) {
             c.objects_count = 0;
         }
+		object_cells.clear();
+	}
+
+	const CollisionCell& cell(uint32_t index) const
+	{
+		return data[index];
+	}
+
+	// Cell of an object, no_cell when it is not inserted
+	template<typename TFilter>
+	uint32_t cellOf(Vec2 position, uint32_t i, const TFilter& filter) const
+	{
+		if (!filter(i) || !contains(position)) {
+			return no_cell;
+		}
+		return to<uint32_t>(position.x) * height + to<uint32_t>(position.y);
+	}
+
+	// Column block of a cell, same split as build
+	uint32_t blockOf(uint32_t cell_idx, uint32_t chunk_count) const
+	{
+		return cell_idx / height * chunk_count / to<uint32_t>(width);
+	}
+
+	// Safety border to avoid adding object outside the grid
+	bool contains(Vec2 position) const
+	{
+		return position.x > 1.0f && position.x < to<float>(width) - 1.0f &&
+		       position.y > 1.0f && position.y < to<float>(height) - 1.0f;
+	}
+
+	/* Parallel build in two passes:
+	   1. objects are split in chunk_count chunks by index, each task bins its chunk by column block
+	   2. columns are split in chunk_count blocks, each task clears its block and inserts the objects
+	      of every chunk that fell in it, in chunk order
+	   Objects are inserted in each cell in the same order as a sequential build, so the result is
+	   deterministic and a full cell drops the same object.
+	   Objects for which filter(i) is false are not inserted */
+	template<typename TObject, typename TThreadPool, typename TFilter = InsertAll>
+	void build(const std::vector<TObject>& objects, TThreadPool& thread_pool, TFilter filter = {})
+	{
+		const uint32_t chunk_count  = thread_pool.m_thread_count;
+		const uint32_t object_count = to<uint32_t>(objects.size());
+		const uint32_t columns      = to<uint32_t>(width);
+		bins.resize(chunk_count * chunk_count);
+		object_cells.resize(incremental ? object_count : 0);
+		thread_pool.dispatch(chunk_count, [&](uint32_t first, uint32_t last) {
+			for (uint32_t chunk{first}; chunk < last; ++chunk) {
+				std::vector<uint32_t>* const chunk_bins = bins.data() + chunk * chunk_count;
+				const uint32_t start = to<uint32_t>(uint64_t{object_count} * chunk / chunk_count);
+				const uint32_t end   = to<uint32_t>(uint64_t{object_count} * (chunk + 1) / chunk_count);
+				// A bin holds at most the whole chunk, reserved once so that steps with the same object count never allocate
+				for (uint32_t block{0}; block < chunk_count; ++block) {
+					chunk_bins[block].clear();
+					chunk_bins[block].reserve(end - start);
+				}
+				for (uint32_t i{start}; i < end; ++i) {
+					const Vec2 position = objects[i].position;
+					if (filter(i) && contains(position)) {
+						chunk_bins[to<uint32_t>(position.x) * chunk_count / columns].push_back(i);
+					}
+				}
+				if (incremental) {
+					std::fill(object_cells.begin() + start, object_cells.begin() + end, no_cell);
+				}
+			}
+		});
+		thread_pool.dispatch(chunk_count, [&](uint32_t first, uint32_t last) {
+			for (uint32_t block{first}; block < last; ++block) {
+				// Block b holds every column c such that c * chunk_count / columns == b
+				const uint32_t column_start = (block * columns + chunk_count - 1) / chunk_count;
+				const uint32_t column_end   = ((block + 1) * columns + chunk_count - 1) / chunk_count;
+				for (uint32_t idx{column_start * height}; idx < column_end * height; ++idx) {
+					data[idx].objects_count = 0;
+				}
+				for (uint32_t chunk{0}; chunk < chunk_count; ++chunk) {
+					for (const uint32_t i : bins[chunk * chunk_count + block]) {
+						if (incremental) {
+							insert(cellOf(objects[i].position, i, InsertAll{}), i);
+						} else {
+							addAtom(to<int32_t>(objects[i].position.x), to<int32_t>(objects[i].position.y), i);
+						}
+					}
+				}
+			}
+		});
+	}
+
+	/* Incremental alternative to build, only the objects whose cell changed since the last build or update
+	   are removed from their old cell and inserted in the new one, the other cells are not touched.
+	   1. objects are split in chunks by index, each task compares the cell of its objects with object_cells
+	      and bins the removals and insertions by column block
+	   2. each column block task applies the removals then the insertions of its cells, in chunk order
+	   Blocks never share a cell so both passes are race free, and objects are inserted in index order so the
+	   result does not depend on the thread count. It differs from a rebuild though: objects staying in a
+	   cell keep their place instead of being sorted by index, and an object dropped by a full cell only gets
+	   in once a slot is free. Falls back to build when incremental is false or after clear, new objects
+	   (indices past the previous count) are inserted like moved ones. */
+	template<typename TObject, typename TThreadPool, typename TFilter = InsertAll>
+	void update(const std::vector<TObject>& objects, TThreadPool& thread_pool, TFilter filter = {})
+	{
+		const uint32_t object_count = to<uint32_t>(objects.size());
+		if (!incremental || object_cells.empty() || object_cells.size() > object_count) {
+			build(objects, thread_pool, filter);
+			return;
+		}
+		object_cells.resize(object_count, no_cell);
+		const uint32_t chunk_count = thread_pool.m_thread_count;
+		removals.resize(chunk_count * chunk_count);
+		insertions.resize(chunk_count * chunk_count);
+		thread_pool.dispatch(chunk_count, [&](uint32_t first, uint32_t last) {
+			for (uint32_t chunk{first}; chunk < last; ++chunk) {
+				std::vector<CellMove>* const chunk_removals   = removals.data() + chunk * chunk_count;
+				std::vector<CellMove>* const chunk_insertions = insertions.data() + chunk * chunk_count;
+				const uint32_t start = to<uint32_t>(uint64_t{object_count} * chunk / chunk_count);
+				const uint32_t end   = to<uint32_t>(uint64_t{object_count} * (chunk + 1) / chunk_count);
+				// Same bound as the build bins, a burst of moves does not allocate either
+				for (uint32_t block{0}; block < chunk_count; ++block) {
+					chunk_removals[block].clear();
+					chunk_insertions[block].clear();
+					chunk_removals[block].reserve(end - start);
+					chunk_insertions[block].reserve(end - start);
+				}
+				for (uint32_t i{start}; i < end; ++i) {
+					const uint32_t old_cell = object_cells[i];
+					const uint32_t new_cell = cellOf(objects[i].position, i, filter);
+					if (new_cell == old_cell) {
+						continue;
+					}
+					if (old_cell != no_cell) {
+						chunk_removals[blockOf(old_cell, chunk_count)].push_back({old_cell, i});
+					}
+					if (new_cell != no_cell) {
+						chunk_insertions[blockOf(new_cell, chunk_count)].push_back({new_cell, i});
+					}
+					// Set back to no_cell by the second pass if the new cell is full
+					object_cells[i] = new_cell;
+				}
+			}
+		});
+		thread_pool.dispatch(chunk_count, [&](uint32_t first, uint32_t last) {
+			for (uint32_t block{first}; block < last; ++block) {
+				for (uint32_t chunk{0}; chunk < chunk_count; ++chunk) {
+					for (const CellMove& move : removals[chunk * chunk_count + block]) {
+						data[move.cell].remove(move.object);
+					}
+				}
+				for (uint32_t chunk{0}; chunk < chunk_count; ++chunk) {
+					for (const CellMove& move : insertions[chunk * chunk_count + block]) {
+						insert(move.cell, move.object);
+					}
+				}
+			}
+		});
+	}
+
+private:
+	// Inserts an object and records its cell, a full cell drops it like addAtom would
+	void insert(uint32_t cell_idx, uint32_t atom)
+	{
+		CollisionCell& c = data[cell_idx];
+		if (c.objects_count < CollisionCell::max_cell_idx) {
+			c.addAtom(atom);
+			object_cells[atom] = cell_idx;
+		} else {
+			object_cells[atom] = no_cell;
+		}
 	}
 };
@@ -0,0 +1,122 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "engine/common/vec.hpp"
+#include "engine/common/utils.hpp"
+#include "collision_grid.hpp"
+
+
+// Read-only view over one cell of a CompactCollisionGrid, same members as CollisionCell
+struct CompactCell
+{
+    const uint32_t* objects;
+    uint32_t        objects_count;
+};
+
+/* Broad phase built with a counting sort, cells have no capacity limit.
+   ids holds every object of the grid sorted by cell and cell_end[i] is the end of cell i in ids,
+   its start being the end of the previous cell.
+   Memory is 4 bytes per object + 4 bytes per cell (CollisionCell uses 20 bytes per cell) */
+struct CompactCollisionGrid
+{
+    using Cell = CompactCell;
+
+    // Dense grid, cell index is x * height + y
+    static constexpr bool sparse = false;
+
+    int32_t                            width  = 0;
+    int32_t                            height = 0;
+    std::vector<std::atomic<uint32_t>> cell_end;
+    std::vector<uint32_t>              ids;
+    // Sort each cell by object index after the build so the result does not depend on thread scheduling
+    bool                               deterministic = false;
+
+    CompactCollisionGrid() = default;
+
+    CompactCollisionGrid(int32_t width_, int32_t height_)
+        : width{width_}
+        , height{height_}
+        , cell_end(to<size_t>(width_) * to<size_t>(height_))
+    {}
+
+    void clear()
+    {
+        for (auto& end : cell_end) {
+            end.store(0, std::memory_order_relaxed);
+        }
+        ids.clear();
+    }
+
+    CompactCell cell(uint32_t index) const
+    {
+        const uint32_t begin = index ? cell_end[index - 1].load(std::memory_order_relaxed) : 0;
+        const uint32_t end   = cell_end[index].load(std::memory_order_relaxed);
+        return {ids.data() + begin, end - begin};
+    }
+
+    // Safety border to avoid adding object outside the grid
+    bool contains(Vec2 position) const
+    {
+        return position.x > 1.0f && position.x < to<float>(width) - 1.0f &&
+               position.y > 1.0f && position.y < to<float>(height) - 1.0f;
+    }
+
+    uint32_t cellIndex(Vec2 position) const
+    {
+        return to<uint32_t>(position.x) * height + to<uint32_t>(position.y);
+    }
+
+    /* Rebuilt every sub step: parallel count, sequential prefix sum, parallel scatter.
+       During the scatter cell_end is used as a write cursor starting at the beginning of each cell,
+       once every object is written it points to the end of the cell.
+       The order of the objects inside a cell depends on thread scheduling unless deterministic is set.
+       Objects for which filter(i) is false are not inserted */
+    template<typename TObject, typename TThreadPool, typename TFilter = InsertAll>
+    void build(const std::vector<TObject>& objects, TThreadPool& thread_pool, TFilter filter = {})
+    {
+        const uint32_t cell_count   = to<uint32_t>(cell_end.size());
+        const uint32_t object_count = to<uint32_t>(objects.size());
+        thread_pool.dispatch(cell_count, [this](uint32_t start, uint32_t end) {
+            for (uint32_t i{start}; i < end; ++i) {
+                cell_end[i].store(0, std::memory_order_relaxed);
+            }
+        });
+
+        thread_pool.dispatch(object_count, [this, &objects, &filter](uint32_t start, uint32_t end) {
+            for (uint32_t i{start}; i < end; ++i) {
+                const Vec2 position = objects[i].position;
+                if (filter(i) && contains(position)) {
+                    cell_end[cellIndex(position)].fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+
+        uint32_t total = 0;
+        for (auto& end : cell_end) {
+            const uint32_t count = end.load(std::memory_order_relaxed);
+            end.store(total, std::memory_order_relaxed);
+            total += count;
+        }
+        ids.resize(total);
+
+        thread_pool.dispatch(object_count, [this, &objects, &filter](uint32_t start, uint32_t end) {
+            for (uint32_t i{start}; i < end; ++i) {
+                const Vec2 position = objects[i].position;
+                if (filter(i) && contains(position)) {
+                    ids[cell_end[cellIndex(position)].fetch_add(1, std::memory_order_relaxed)] = i;
+                }
+            }
+        });
+
+        if (deterministic) {
+            thread_pool.dispatch(cell_count, [this](uint32_t start, uint32_t end) {
+                for (uint32_t i{start}; i < end; ++i) {
+                    const uint32_t begin = i ? cell_end[i - 1].load(std::memory_order_relaxed) : 0;
+                    std::sort(ids.begin() + begin, ids.begin() + cell_end[i].load(std::memory_order_relaxed));
+                }
+            });
+        }
+    }
+};
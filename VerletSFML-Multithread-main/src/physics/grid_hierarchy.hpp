@@ -0,0 +1,195 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "slice_partition.hpp"
+#include "engine/common/vec.hpp"
+#include "engine/common/utils.hpp"
+
+
+/* Multi level grid for objects of different radius.
+   Level 0 is the solver grid (cells 1 wide, radius up to 0.5), level L (1 <= L <= max_level) has
+   cells 2^L wide and holds the objects whose diameter is in (2^(L-1), 2^L], so a few big objects
+   do not force a coarse grid on everyone.
+   Each big object queries its own level and every finer one over the cells covering
+   [p - r - s/2, p + r + s/2], s being the cell size of the queried level. Pairs of the same level are
+   solved from both sides like on level 0, pairs across levels only once from the bigger object. */
+template<typename TGrid>
+struct GridHierarchy
+{
+    static constexpr uint32_t max_level  = 3;
+    static constexpr float    max_radius = 4.0f;
+
+    // Only the position is needed to build a level grid
+    struct LevelObject
+    {
+        Vec2 position;
+    };
+
+    struct Level
+    {
+        float                    m_cell_size = 1.0f;
+        TGrid                    m_grid;
+        SlicePartition           m_slices;
+        // Level index to solver object index
+        std::vector<uint32_t>    m_ids;
+        // Positions in level cells, shifted by 1 since the grid border is kept empty
+        std::vector<LevelObject> m_objects;
+    };
+
+    Level m_levels[max_level];
+
+    GridHierarchy() = default;
+
+    GridHierarchy(Vec2 world_size)
+    {
+        for (uint32_t l{0}; l < max_level; ++l) {
+            Level& level = m_levels[l];
+            level.m_cell_size = to<float>(2u << l);
+            level.m_grid      = TGrid{to<int32_t>(std::ceil(world_size.x / level.m_cell_size)) + 2,
+                                      to<int32_t>(std::ceil(world_size.y / level.m_cell_size)) + 2};
+            level.m_grid.clear();
+        }
+    }
+
+    // Level of an object of radius r, 0 is the solver grid
+    static uint32_t levelOf(float r)
+    {
+        uint32_t l = 0;
+        while (l < max_level && r > 0.5f * to<float>(1u << l)) {
+            ++l;
+        }
+        return l;
+    }
+
+    [[nodiscard]]
+    uint32_t largeCount() const
+    {
+        uint32_t count = 0;
+        for (const Level& level : m_levels) {
+            count += to<uint32_t>(level.m_ids.size());
+        }
+        return count;
+    }
+
+    // Dispatches the objects bigger than 0.5 in their level and builds the level grids, level 0 is built by the solver
+    template<typename TObject, typename TThreadPool, typename TConfigure>
+    void build(const std::vector<TObject>& objects, TThreadPool& thread_pool, TConfigure&& configure)
+    {
+        for (Level& level : m_levels) {
+            level.m_ids.clear();
+            level.m_objects.clear();
+        }
+        const uint32_t count = to<uint32_t>(objects.size());
+        for (uint32_t i{0}; i < count; ++i) {
+            const uint32_t l = levelOf(objects[i].radius);
+            if (l == 0) {
+                continue;
+            }
+            Level& level = m_levels[l - 1];
+            level.m_ids.push_back(i);
+            level.m_objects.push_back({objects[i].position / level.m_cell_size + Vec2{1.0f, 1.0f}});
+        }
+        for (Level& level : m_levels) {
+            configure(level.m_grid);
+            level.m_grid.build(level.m_objects, thread_pool);
+        }
+    }
+
+    /* Solves the contacts of the big objects level by level, each level in two passes of column slices
+       like level 0. Slices are at least 2 columns wide so two slices of the same pass are at least 2
+       coarse cells apart, and an object only moves objects closer than one coarse cell, so no object is
+       written by two tasks. partition(slices, grid) splits the level, contact(a, b) solves a pair, a being the big one */
+    template<typename TObject, typename TThreadPool, typename TPartition, typename TContact>
+    void solve(const TGrid& base, const std::vector<TObject>& objects, TThreadPool& thread_pool, TPartition&& partition, TContact&& contact)
+    {
+        for (uint32_t l{1}; l <= max_level; ++l) {
+            Level& level = m_levels[l - 1];
+            if (level.m_ids.empty()) {
+                continue;
+            }
+            partition(level.m_slices, level.m_grid);
+            const uint32_t height = to<uint32_t>(level.m_grid.height);
+            for (uint32_t pass{0}; pass < 2; ++pass) {
+                thread_pool.parallelFor(0, level.m_slices.passSliceCount(pass), 1, [&, l, pass, height](uint32_t start, uint32_t end)
+                {
+                    for (uint32_t i{start}; i < end; ++i) {
+                        const uint32_t slice = 2 * i + pass;
+                        uint32_t first = level.m_slices.begin(slice, height);
+                        uint32_t last  = level.m_slices.end(slice, height);
+                        if constexpr (TGrid::sparse) {
+                            // Slices of a sparse grid are made of occupied columns
+                            first = level.m_grid.columnBegin(level.m_slices.begin(slice, 1));
+                            last  = level.m_grid.columnBegin(level.m_slices.end(slice, 1));
+                        }
+                        for (uint32_t idx{first}; idx < last; ++idx) {
+                            const auto c = level.m_grid.cell(idx);
+                            for (uint32_t k{0}; k < c.objects_count; ++k) {
+                                const uint32_t a = level.m_ids[c.objects[k]];
+                                for (uint32_t m{0}; m <= l; ++m) {
+                                    query(base, m, a, objects[a].position, objects[a].radius, contact);
+                                }
+                            }
+                        }
+                    }
+                });
+            }
+        }
+    }
+
+    // Big objects have to stay further than the default 2 units margin from the walls
+    template<typename TObject>
+    void clampToWorld(std::vector<TObject>& objects, Vec2 world_size) const
+    {
+        for (const Level& level : m_levels) {
+            for (const uint32_t id : level.m_ids) {
+                TObject& object = objects[id];
+                const float margin = std::max(2.0f, object.radius);
+                object.position.x = std::clamp(object.position.x, margin, world_size.x - margin);
+                object.position.y = std::clamp(object.position.y, margin, world_size.y - margin);
+            }
+        }
+    }
+
+    // Sparse grids are looked up by coordinates, cells outside a sparse grid are empty
+    static typename TGrid::Cell cellAt(const TGrid& grid, int32_t x, int32_t y)
+    {
+        if constexpr (TGrid::sparse) {
+            return grid.find(x, y);
+        } else {
+            return grid.cell(to<uint32_t>(x * grid.height + y));
+        }
+    }
+
+    // Objects of level m that may touch object a, their radius is at most half the level cell size. Also used to build the sleeping islands
+    template<typename TContact>
+    void query(const TGrid& base, uint32_t m, uint32_t a, Vec2 position, float radius, TContact& contact) const
+    {
+        const TGrid&  grid      = m ? m_levels[m - 1].m_grid : base;
+        const float   cell_size = m ? m_levels[m - 1].m_cell_size : 1.0f;
+        const float   offset    = m ? 1.0f : 0.0f;
+        const float   reach     = radius + 0.5f * cell_size;
+        int32_t x0 = to<int32_t>(std::floor((position.x - reach) / cell_size + offset));
+        int32_t x1 = to<int32_t>(std::floor((position.x + reach) / cell_size + offset));
+        int32_t y0 = to<int32_t>(std::floor((position.y - reach) / cell_size + offset));
+        int32_t y1 = to<int32_t>(std::floor((position.y + reach) / cell_size + offset));
+        if constexpr (!TGrid::sparse) {
+            x0 = std::max(x0, 0);
+            x1 = std::min(x1, grid.width - 1);
+            y0 = std::max(y0, 0);
+            y1 = std::min(y1, grid.height - 1);
+        }
+        for (int32_t x{x0}; x <= x1; ++x) {
+            for (int32_t y{y0}; y <= y1; ++y) {
+                const auto c = cellAt(grid, x, y);
+                for (uint32_t k{0}; k < c.objects_count; ++k) {
+                    const uint32_t b = m ? m_levels[m - 1].m_ids[c.objects[k]] : c.objects[k];
+                    if (b != a) {
+                        contact(a, b);
+                    }
+                }
+            }
+        }
+    }
+};
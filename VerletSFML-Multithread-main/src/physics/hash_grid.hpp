@@ -0,0 +1,359 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "engine/common/vec.hpp"
+#include "engine/common/utils.hpp"
+#include "compact_grid.hpp"
+
+
+/* Sparse broad phase: only occupied cells are stored, memory is proportional to the object count
+   whatever the world size and objects outside the world bounds are not dropped.
+   Rebuilt every sub step: parallel insertion of the object cells in an open addressing hash table
+   with a count per cell, radix sort of the occupied cells by (x, y) and prefix sum, parallel scatter.
+   Sorted cells are column major like CompactCollisionGrid, cell_end[p] is the end of cell p in ids.
+   Slices are made of occupied columns: width is the number of occupied columns after the build and
+   occupied column k holds the cells [column_begin[k], column_begin[k + 1]). Two occupied columns are
+   at least as far apart as their indexes so two slices of the same pass are still 2 columns apart */
+struct HashCollisionGrid
+{
+    using Cell = CompactCell;
+
+    static constexpr bool     sparse    = true;
+    static constexpr uint64_t empty_key = ~0ull;
+    static constexpr uint32_t no_slot   = ~0u;
+
+    // Occupied column count
+    int32_t width  = 0;
+    // Meaningless, only there to match the dense grids
+    int32_t height = 1;
+    // Sort each cell by object index after the build so the result does not depend on thread scheduling
+    bool    deterministic = false;
+
+    // Power of 2 capacity, at most half full
+    std::vector<std::atomic<uint64_t>> table_keys;
+    // Object count of the cell, then scatter cursor
+    std::vector<std::atomic<uint32_t>> table_counts;
+    // Slot to sorted cell index
+    std::vector<uint32_t>              table_cells;
+    uint32_t                           table_shift = 64;
+
+    // Object to slot, no_slot for objects not inserted
+    std::vector<uint32_t>                      object_slots;
+    // (sort key, slot)
+    std::vector<std::pair<uint64_t, uint32_t>> sorted_cells;
+    std::vector<std::pair<uint64_t, uint32_t>> sort_buffer;
+    std::vector<uint64_t>                      cell_keys;
+    std::vector<uint32_t>                      cell_end;
+    std::vector<uint32_t>                      column_begin;
+    std::vector<uint32_t>                      ids;
+
+    HashCollisionGrid()
+    {
+        clear();
+    }
+
+    // Same arguments as the dense grids but nothing is allocated for the world size
+    HashCollisionGrid(int32_t, int32_t)
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for (auto& key : table_keys) {
+            key.store(empty_key, std::memory_order_relaxed);
+        }
+        cell_keys.clear();
+        cell_end.clear();
+        column_begin.assign(1, 0);
+        ids.clear();
+        width = 0;
+    }
+
+    // Cell coordinates packed so that unsigned order is signed order, x in the high bits so the key order is column major
+    static uint64_t packKey(int32_t x, int32_t y)
+    {
+        return (uint64_t{static_cast<uint32_t>(x) ^ 0x80000000u} << 32) | (static_cast<uint32_t>(y) ^ 0x80000000u);
+    }
+
+    static uint64_t cellKey(Vec2 position)
+    {
+        return packKey(to<int32_t>(std::floor(position.x)), to<int32_t>(std::floor(position.y)));
+    }
+
+    // Coordinates have to fit in an int32, NaN and infinities are not inserted
+    bool contains(Vec2 position) const
+    {
+        const float limit = 2.0e9f;
+        return std::abs(position.x) < limit && std::abs(position.y) < limit;
+    }
+
+    CompactCell cell(uint32_t p) const
+    {
+        const uint32_t begin = p ? cell_end[p - 1] : 0;
+        return {ids.data() + begin, cell_end[p] - begin};
+    }
+
+    int32_t cellX(uint32_t p) const
+    {
+        return static_cast<int32_t>(static_cast<uint32_t>(cell_keys[p] >> 32) ^ 0x80000000u);
+    }
+
+    int32_t cellY(uint32_t p) const
+    {
+        return static_cast<int32_t>(static_cast<uint32_t>(cell_keys[p]) ^ 0x80000000u);
+    }
+
+    // First cell of an occupied column, the cell count for column == width
+    uint32_t columnBegin(uint32_t column) const
+    {
+        return column_begin[column];
+    }
+
+    uint32_t columnObjectCount(uint32_t column) const
+    {
+        const uint32_t first = column_begin[column];
+        const uint32_t last  = column_begin[column + 1];
+        return first == last ? 0 : cell_end[last - 1] - (first ? cell_end[first - 1] : 0);
+    }
+
+    // Cell at (x, y), empty if it holds no object
+    CompactCell find(int32_t x, int32_t y) const
+    {
+        if (table_keys.empty()) {
+            return {nullptr, 0};
+        }
+        const uint64_t key  = packKey(x, y);
+        const size_t   mask = table_keys.size() - 1;
+        for (size_t slot{hash(key)};; slot = (slot + 1) & mask) {
+            const uint64_t k = table_keys[slot].load(std::memory_order_relaxed);
+            if (k == key) {
+                return cell(table_cells[slot]);
+            }
+            if (k == empty_key) {
+                return {nullptr, 0};
+            }
+        }
+    }
+
+    /* Calls f(neighbours) for each cell of an occupied column, neighbours[1] is the cell itself and the
+       other ones are in the same order as the dense grid neighbourhood: above, itself, below, then the
+       right column and the left column from top to bottom. The column and its neighbours are sorted by y
+       so three cursors are enough, the hash table is not used */
+    template<typename TCallback>
+    void forEachCell(uint32_t column, TCallback&& f) const
+    {
+        const uint32_t begin = column_begin[column];
+        const uint32_t end   = column_begin[column + 1];
+        const int32_t  x     = cellX(begin);
+        // Empty cursor ranges when the side columns hold no object
+        uint32_t left = 0, left_end = 0, right = 0, right_end = 0;
+        if (column > 0 && cellX(column_begin[column - 1]) == x - 1) {
+            left     = column_begin[column - 1];
+            left_end = begin;
+        }
+        if (column + 1 < to<uint32_t>(width) && cellX(end) == x + 1) {
+            right     = end;
+            right_end = column_begin[column + 2];
+        }
+        const CompactCell empty{nullptr, 0};
+        for (uint32_t p{begin}; p < end; ++p) {
+            const int32_t y = cellY(p);
+            while (left < left_end && cellY(left) < y - 1) {
+                ++left;
+            }
+            while (right < right_end && cellY(right) < y - 1) {
+                ++right;
+            }
+            const CompactCell neighbours[9] = {
+                p > begin && cellY(p - 1) == y - 1 ? cell(p - 1) : empty,
+                cell(p),
+                p + 1 < end && cellY(p + 1) == y + 1 ? cell(p + 1) : empty,
+                row(right, right_end, y - 1), row(right, right_end, y), row(right, right_end, y + 1),
+                row(left, left_end, y - 1), row(left, left_end, y), row(left, left_end, y + 1)
+            };
+            f(neighbours);
+        }
+    }
+
+    // Objects for which filter(i) is false are not inserted
+    template<typename TObject, typename TThreadPool, typename TFilter = InsertAll>
+    void build(const std::vector<TObject>& objects, TThreadPool& thread_pool, TFilter filter = {})
+    {
+        const uint32_t object_count = to<uint32_t>(objects.size());
+        size_t   capacity = 16;
+        uint32_t shift    = 60;
+        while (capacity < 2 * size_t{object_count}) {
+            capacity <<= 1;
+            --shift;
+        }
+        if (table_keys.size() != capacity) {
+            table_keys   = std::vector<std::atomic<uint64_t>>(capacity);
+            table_counts = std::vector<std::atomic<uint32_t>>(capacity);
+            table_cells.resize(capacity);
+        }
+        table_shift = shift;
+        object_slots.resize(object_count);
+        // There are at most as many occupied cells as objects, reserved once so that builds with the same
+        // object count do not allocate when the occupied area grows
+        if (sorted_cells.capacity() < object_count) {
+            sorted_cells.reserve(object_count);
+            sort_buffer.reserve(object_count);
+            cell_keys.reserve(object_count);
+            cell_end.reserve(object_count);
+            column_begin.reserve(size_t{object_count} + 1);
+            ids.reserve(object_count);
+        }
+
+        thread_pool.dispatch(to<uint32_t>(capacity), [this](uint32_t start, uint32_t end) {
+            for (uint32_t i{start}; i < end; ++i) {
+                table_keys[i].store(empty_key, std::memory_order_relaxed);
+                table_counts[i].store(0, std::memory_order_relaxed);
+            }
+        });
+
+        thread_pool.dispatch(object_count, [this, &objects, &filter](uint32_t start, uint32_t end) {
+            for (uint32_t i{start}; i < end; ++i) {
+                const Vec2 position = objects[i].position;
+                if (filter(i) && contains(position)) {
+                    const uint32_t slot = insert(cellKey(position));
+                    table_counts[slot].fetch_add(1, std::memory_order_relaxed);
+                    object_slots[i] = slot;
+                } else {
+                    object_slots[i] = no_slot;
+                }
+            }
+        });
+
+        sortCells();
+
+        const uint32_t cell_count = to<uint32_t>(sorted_cells.size());
+        cell_keys.resize(cell_count);
+        cell_end.resize(cell_count);
+        column_begin.clear();
+        uint32_t total = 0;
+        for (uint32_t p{0}; p < cell_count; ++p) {
+            const uint32_t slot = sorted_cells[p].second;
+            const uint64_t key  = table_keys[slot].load(std::memory_order_relaxed);
+            if (p == 0 || (key >> 32) != (cell_keys[p - 1] >> 32)) {
+                column_begin.push_back(p);
+            }
+            cell_keys[p]      = key;
+            table_cells[slot] = p;
+            const uint32_t count = table_counts[slot].load(std::memory_order_relaxed);
+            table_counts[slot].store(total, std::memory_order_relaxed);
+            total      += count;
+            cell_end[p] = total;
+        }
+        column_begin.push_back(cell_count);
+        width = to<int32_t>(column_begin.size() - 1);
+        ids.resize(total);
+
+        thread_pool.dispatch(object_count, [this](uint32_t start, uint32_t end) {
+            for (uint32_t i{start}; i < end; ++i) {
+                const uint32_t slot = object_slots[i];
+                if (slot != no_slot) {
+                    ids[table_counts[slot].fetch_add(1, std::memory_order_relaxed)] = i;
+                }
+            }
+        });
+
+        if (deterministic) {
+            thread_pool.dispatch(cell_count, [this](uint32_t start, uint32_t end) {
+                for (uint32_t p{start}; p < end; ++p) {
+                    std::sort(ids.begin() + (p ? cell_end[p - 1] : 0), ids.begin() + cell_end[p]);
+                }
+            });
+        }
+    }
+
+    /* Gathers the occupied cells of the table and sorts them by (x, y). Coordinates are moved to start
+       at 0 before being packed in the sort key, then sorted with an 11 bits LSD radix sort, so the pass
+       count depends on the extent of the occupied area and not on the world size */
+    void sortCells()
+    {
+        sorted_cells.clear();
+        uint32_t min_x = ~0u, max_x = 0, min_y = ~0u, max_y = 0;
+        for (size_t slot{0}; slot < table_keys.size(); ++slot) {
+            const uint64_t key = table_keys[slot].load(std::memory_order_relaxed);
+            if (key == empty_key) {
+                continue;
+            }
+            const uint32_t kx = static_cast<uint32_t>(key >> 32);
+            const uint32_t ky = static_cast<uint32_t>(key);
+            min_x = std::min(min_x, kx);
+            max_x = std::max(max_x, kx);
+            min_y = std::min(min_y, ky);
+            max_y = std::max(max_y, ky);
+            sorted_cells.emplace_back(key, to<uint32_t>(slot));
+        }
+        if (sorted_cells.empty()) {
+            return;
+        }
+        uint32_t y_bits = 0;
+        while (y_bits < 32 && (max_y - min_y) >> y_bits) {
+            ++y_bits;
+        }
+        uint32_t x_bits = 0;
+        while (x_bits < 32 && (max_x - min_x) >> x_bits) {
+            ++x_bits;
+        }
+        for (auto& cell : sorted_cells) {
+            const uint32_t kx = static_cast<uint32_t>(cell.first >> 32) - min_x;
+            const uint32_t ky = static_cast<uint32_t>(cell.first) - min_y;
+            cell.first = (uint64_t{kx} << y_bits) | ky;
+        }
+
+        constexpr uint32_t radix_bits = 11;
+        constexpr uint32_t radix      = 1u << radix_bits;
+        sort_buffer.resize(sorted_cells.size());
+        for (uint32_t shift{0}; shift < x_bits + y_bits; shift += radix_bits) {
+            uint32_t offsets[radix] = {};
+            for (const auto& cell : sorted_cells) {
+                ++offsets[(cell.first >> shift) & (radix - 1)];
+            }
+            uint32_t sum = 0;
+            for (uint32_t& offset : offsets) {
+                const uint32_t count = offset;
+                offset = sum;
+                sum   += count;
+            }
+            for (const auto& cell : sorted_cells) {
+                sort_buffer[offsets[(cell.first >> shift) & (radix - 1)]++] = cell;
+            }
+            sorted_cells.swap(sort_buffer);
+        }
+    }
+
+    // Cell at y in [first, last), the y of first is at least y - 2 so at most 3 cells are read
+    CompactCell row(uint32_t first, uint32_t last, int32_t y) const
+    {
+        for (uint32_t k{first}; k < last && cellY(k) <= y; ++k) {
+            if (cellY(k) == y) {
+                return cell(k);
+            }
+        }
+        return {nullptr, 0};
+    }
+
+    size_t hash(uint64_t key) const
+    {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> table_shift);
+    }
+
+    // Linear probing, when several threads insert the same key only one writes it and the others read it
+    uint32_t insert(uint64_t key)
+    {
+        const size_t mask = table_keys.size() - 1;
+        for (size_t slot{hash(key)};; slot = (slot + 1) & mask) {
+            uint64_t expected = empty_key;
+            if (table_keys[slot].compare_exchange_strong(expected, key, std::memory_order_relaxed) || expected == key) {
+                return to<uint32_t>(slot);
+            }
+        }
+    }
+};
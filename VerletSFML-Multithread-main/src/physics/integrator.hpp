@@ -0,0 +1,196 @@
+#pragma once
+#include <cstdint>
+#include "physic_object.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define VERLET_SIMD_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+#endif
+
+#if defined(VERLET_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+    #define VERLET_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+    #define VERLET_TARGET_AVX2
+#endif
+
+
+/* Verlet integration + border clamping over a range of objects.
+   The SIMD paths work directly on the AoS objects: each register holds the (x, y) pairs
+   of 2 (SSE2) or 4 (AVX2) consecutive objects, so the same operations are applied to both components.
+   They perform the exact same IEEE operations in the same order as the scalar path and the
+   min/max clamp is equivalent to the branches, so results are bit-identical. The only expected
+   difference is when the compiler fuses multiply-adds in the scalar path (-ffp-contract=fast with FMA
+   enabled, /fp:fast), which is bounded by 1 ulp per sub step. NaN positions are not handled the same way. */
+enum class IntegratorMode
+{
+    Auto,
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+struct IntegratorParams
+{
+    Vec2  gravity;
+    float dt;
+    // Objects are clamped in [min, max]
+    Vec2  min;
+    Vec2  max;
+};
+
+struct Integrator
+{
+    static bool cpuSupportsAVX2()
+    {
+#if defined(VERLET_SIMD_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx     = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#elif defined(VERLET_SIMD_X86)
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    // Returns the implementation that will actually run on this CPU
+    static IntegratorMode resolve(IntegratorMode mode)
+    {
+#if defined(VERLET_SIMD_X86)
+        static const bool avx2 = cpuSupportsAVX2();
+        if (mode == IntegratorMode::Auto || mode == IntegratorMode::AVX2) {
+            return avx2 ? IntegratorMode::AVX2 : IntegratorMode::SSE2;
+        }
+        return mode;
+#else
+        (void)mode;
+        return IntegratorMode::Scalar;
+#endif
+    }
+
+    static void integrate(IntegratorMode mode, PhysicObject* objects, uint32_t start, uint32_t end, const IntegratorParams& params)
+    {
+#if defined(VERLET_SIMD_X86)
+        if (mode == IntegratorMode::AVX2) {
+            integrateAVX2(objects, start, end, params);
+            return;
+        }
+        if (mode == IntegratorMode::SSE2) {
+            integrateSSE2(objects, start, end, params);
+            return;
+        }
+#endif
+        integrateScalar(objects, start, end, params);
+    }
+
+    static void integrateScalar(PhysicObject* objects, uint32_t start, uint32_t end, const IntegratorParams& params)
+    {
+        for (uint32_t i{start}; i < end; ++i) {
+            PhysicObject& obj = objects[i];
+            // Add gravity
+            obj.acceleration += params.gravity;
+            // Apply Verlet integration
+            obj.update(params.dt);
+            // Apply map borders collisions
+            if (obj.position.x > params.max.x) {
+                obj.position.x = params.max.x;
+            } else if (obj.position.x < params.min.x) {
+                obj.position.x = params.min.x;
+            }
+            if (obj.position.y > params.max.y) {
+                obj.position.y = params.max.y;
+            } else if (obj.position.y < params.min.y) {
+                obj.position.y = params.min.y;
+            }
+        }
+    }
+
+#if defined(VERLET_SIMD_X86)
+    static __m128 loadPair(const Vec2& v_1, const Vec2& v_2)
+    {
+        const __m128 low = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(&v_1));
+        return _mm_loadh_pi(low, reinterpret_cast<const __m64*>(&v_2));
+    }
+
+    static void storePair(__m128 v, Vec2& v_1, Vec2& v_2)
+    {
+        _mm_storel_pi(reinterpret_cast<__m64*>(&v_1), v);
+        _mm_storeh_pi(reinterpret_cast<__m64*>(&v_2), v);
+    }
+
+    static void integrateSSE2(PhysicObject* objects, uint32_t start, uint32_t end, const IntegratorParams& params)
+    {
+        const __m128 gravity = _mm_setr_ps(params.gravity.x, params.gravity.y, params.gravity.x, params.gravity.y);
+        const __m128 min     = _mm_setr_ps(params.min.x, params.min.y, params.min.x, params.min.y);
+        const __m128 max     = _mm_setr_ps(params.max.x, params.max.y, params.max.x, params.max.y);
+        const __m128 damping = _mm_set1_ps(PhysicObject::damping);
+        const __m128 dt2     = _mm_set1_ps(params.dt * params.dt);
+        uint32_t i{start};
+        for (; i + 2 <= end; i += 2) {
+            PhysicObject& obj_1 = objects[i];
+            PhysicObject& obj_2 = objects[i + 1];
+            const __m128 position      = loadPair(obj_1.position, obj_2.position);
+            const __m128 last_position = loadPair(obj_1.last_position, obj_2.last_position);
+            const __m128 acceleration  = _mm_add_ps(loadPair(obj_1.acceleration, obj_2.acceleration), gravity);
+            const __m128 move          = _mm_sub_ps(position, last_position);
+            __m128 new_position = _mm_add_ps(_mm_add_ps(position, move), _mm_mul_ps(_mm_sub_ps(acceleration, _mm_mul_ps(move, damping)), dt2));
+            new_position = _mm_min_ps(_mm_max_ps(new_position, min), max);
+            storePair(position, obj_1.last_position, obj_2.last_position);
+            storePair(new_position, obj_1.position, obj_2.position);
+            storePair(_mm_setzero_ps(), obj_1.acceleration, obj_2.acceleration);
+        }
+        integrateScalar(objects, i, end, params);
+    }
+
+    VERLET_TARGET_AVX2
+    static __m256 loadQuad(const PhysicObject* objects, const Vec2 PhysicObject::* member)
+    {
+        const __m128 low  = loadPair(objects[0].*member, objects[1].*member);
+        const __m128 high = loadPair(objects[2].*member, objects[3].*member);
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+    }
+
+    VERLET_TARGET_AVX2
+    static void storeQuad(__m256 v, PhysicObject* objects, Vec2 PhysicObject::* member)
+    {
+        storePair(_mm256_castps256_ps128(v), objects[0].*member, objects[1].*member);
+        storePair(_mm256_extractf128_ps(v, 1), objects[2].*member, objects[3].*member);
+    }
+
+    VERLET_TARGET_AVX2
+    static void integrateAVX2(PhysicObject* objects, uint32_t start, uint32_t end, const IntegratorParams& params)
+    {
+        const __m256 gravity = _mm256_setr_ps(params.gravity.x, params.gravity.y, params.gravity.x, params.gravity.y,
+                                              params.gravity.x, params.gravity.y, params.gravity.x, params.gravity.y);
+        const __m256 min     = _mm256_setr_ps(params.min.x, params.min.y, params.min.x, params.min.y,
+                                              params.min.x, params.min.y, params.min.x, params.min.y);
+        const __m256 max     = _mm256_setr_ps(params.max.x, params.max.y, params.max.x, params.max.y,
+                                              params.max.x, params.max.y, params.max.x, params.max.y);
+        const __m256 damping = _mm256_set1_ps(PhysicObject::damping);
+        const __m256 dt2     = _mm256_set1_ps(params.dt * params.dt);
+        uint32_t i{start};
+        for (; i + 4 <= end; i += 4) {
+            PhysicObject* const batch = objects + i;
+            const __m256 position      = loadQuad(batch, &PhysicObject::position);
+            const __m256 last_position = loadQuad(batch, &PhysicObject::last_position);
+            const __m256 acceleration  = _mm256_add_ps(loadQuad(batch, &PhysicObject::acceleration), gravity);
+            const __m256 move          = _mm256_sub_ps(position, last_position);
+            __m256 new_position = _mm256_add_ps(_mm256_add_ps(position, move), _mm256_mul_ps(_mm256_sub_ps(acceleration, _mm256_mul_ps(move, damping)), dt2));
+            new_position = _mm256_min_ps(_mm256_max_ps(new_position, min), max);
+            storeQuad(position, batch, &PhysicObject::last_position);
+            storeQuad(new_position, batch, &PhysicObject::position);
+            storeQuad(_mm256_setzero_ps(), batch, &PhysicObject::acceleration);
+        }
+        integrateScalar(objects, i, end, params);
+    }
+#endif
+};
@@ -0,0 +1,133 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "physic_object.hpp"
+#include "integrator.hpp"
+#include "engine/common/utils.hpp"
+
+
+enum class ContactSolver
+{
+    // Contacts move both objects in place, one after the other, see PhysicSolver::solveContact
+    GaussSeidel,
+    // Contacts only read positions, each object sums its own corrections which are applied afterwards, see JacobiSolver
+    Jacobi
+};
+
+/* Jacobi contact solving: during an iteration positions are only read, each object sums the corrections
+   of all its contacts into m_corrections and only writes its own entry. Cells can then be processed in
+   parallel in any order, with no slices, and the result does not depend on the thread count as long as
+   the cells content does not (always the case with CollisionGrid, deterministic mode for the others).
+   Once every contact has been gathered, position += m_relaxation * correction for every object.
+   Each contact is only seen through half of its correction per side as in the Gauss-Seidel solver, but
+   nothing propagates within an iteration, so packed objects converge slower: m_iterations adds passes
+   per sub step and m_relaxation below 1 damps the jitter of objects pushed from several sides at once. */
+struct JacobiSolver
+{
+    // Columns per task of the gather pass
+    static constexpr uint32_t column_grain = 8;
+
+    uint32_t          m_iterations = 1;
+    float             m_relaxation = 1.0f;
+    // Summed corrections, same indexing as the objects, zeroed by apply
+    std::vector<Vec2> m_corrections;
+
+    void resize(uint64_t count)
+    {
+        m_corrections.resize(count, Vec2{0.0f, 0.0f});
+    }
+
+    // Correction of obj_1 for its contact with obj_2, same displacement as PhysicSolver::solveContact
+    template<bool VariableRadius = false>
+    static Vec2 contact(const PhysicObject& obj_1, const PhysicObject& obj_2)
+    {
+        constexpr float response_coef = 1.0f;
+        constexpr float eps = 0.0001f;
+        const Vec2 o2_o1 = obj_1.position - obj_2.position;
+        const float dist2 = o2_o1.x * o2_o1.x + o2_o1.y * o2_o1.y;
+        if constexpr (VariableRadius) {
+            const float min_dist = obj_1.radius + obj_2.radius;
+            if (dist2 < min_dist * min_dist && dist2 > eps) {
+                const float dist    = std::sqrt(dist2);
+                const float delta   = response_coef * (min_dist - dist);
+                const float r1_2    = obj_1.radius * obj_1.radius;
+                const float r2_2    = obj_2.radius * obj_2.radius;
+                const float ratio_1 = r2_2 / (r1_2 + r2_2);
+                return (o2_o1 / dist) * (delta * ratio_1);
+            }
+        } else if (dist2 < 1.0f && dist2 > eps) {
+            const float dist  = std::sqrt(dist2);
+            const float delta = response_coef * 0.5f * (1.0f - dist);
+            return (o2_o1 / dist) * delta;
+        }
+        return {0.0f, 0.0f};
+    }
+
+    /* position += m_relaxation * correction and correction = 0 for the objects [start, end).
+       Same SIMD layout and bit-identical results as the integrator, see Integrator */
+    void apply(IntegratorMode mode, PhysicObject* objects, uint32_t start, uint32_t end)
+    {
+        Vec2* const corrections = m_corrections.data();
+#if defined(VERLET_SIMD_X86)
+        if (mode == IntegratorMode::AVX2) {
+            applyAVX2(objects, corrections, start, end, m_relaxation);
+            return;
+        }
+        if (mode == IntegratorMode::SSE2) {
+            applySSE2(objects, corrections, start, end, m_relaxation);
+            return;
+        }
+#else
+        static_cast<void>(mode);
+#endif
+        applyScalar(objects, corrections, start, end, m_relaxation);
+    }
+
+    static void applyScalar(PhysicObject* objects, Vec2* corrections, uint32_t start, uint32_t end, float relaxation)
+    {
+        for (uint32_t i{start}; i < end; ++i) {
+            objects[i].position += corrections[i] * relaxation;
+            corrections[i] = {0.0f, 0.0f};
+        }
+    }
+
+#if defined(VERLET_SIMD_X86)
+    static void applySSE2(PhysicObject* objects, Vec2* corrections, uint32_t start, uint32_t end, float relaxation)
+    {
+        const __m128 factor = _mm_set1_ps(relaxation);
+        uint32_t i{start};
+        for (; i + 2 <= end; i += 2) {
+            float* const correction = &corrections[i].x;
+            const __m128 position   = Integrator::loadPair(objects[i].position, objects[i + 1].position);
+            Integrator::storePair(_mm_add_ps(position, _mm_mul_ps(_mm_loadu_ps(correction), factor)), objects[i].position, objects[i + 1].position);
+            _mm_storeu_ps(correction, _mm_setzero_ps());
+        }
+        applyScalar(objects, corrections, i, end, relaxation);
+    }
+
+    VERLET_TARGET_AVX2
+    static void applyAVX2(PhysicObject* objects, Vec2* corrections, uint32_t start, uint32_t end, float relaxation)
+    {
+        const __m256 factor = _mm256_set1_ps(relaxation);
+        uint32_t i{start};
+        for (; i + 4 <= end; i += 4) {
+            PhysicObject* const batch      = objects + i;
+            float* const        correction = &corrections[i].x;
+            const __m256 position = Integrator::loadQuad(batch, &PhysicObject::position);
+            Integrator::storeQuad(_mm256_add_ps(position, _mm256_mul_ps(_mm256_loadu_ps(correction), factor)), batch, &PhysicObject::position);
+            _mm256_storeu_ps(correction, _mm256_setzero_ps());
+        }
+        applyScalar(objects, corrections, i, end, relaxation);
+    }
+#endif
+};
+
+// Penetration depth of the overlapping pairs, in world units (the default diameter is 1)
+struct ContactError
+{
+    uint64_t m_contacts = 0;
+    float    m_mean     = 0.0f;
+    float    m_max      = 0.0f;
+};
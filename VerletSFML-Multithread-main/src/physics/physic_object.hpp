@@ -1,8 +1,26 @@
 #pragma once
+#include <SFML/Graphics/Color.hpp>
 #include "collision_grid.hpp"
 #include "engine/common/utils.hpp"
 #include "engine/common/math.hpp"
 
+enum class SleepState : uint8_t
+{
+    Awake,
+    Asleep,
+    // Pushed awake during the current sub step, its island is woken up after the integration
+    Woken
+};
+
+// Fields of PhysicObject stored in the Objects snapshot section, the layout of version 1. Fields added since have their own sections
+struct SnapshotObject
+{
+    Vec2 position;
+    Vec2 last_position;
+    Vec2 acceleration;
+    sf::Color color;
+};
+
 struct PhysicObject
 {
     // Verlet
@@ -10,11 +28,25 @@ struct PhysicObject
     Vec2 last_position = {0.0f, 0.0f};
     Vec2 acceleration = {0.0f, 0.0f};
     sf::Color color;
+    // Cells are 1 wide, the size of an object of default radius
+    float radius = default_radius;
+    // Sleeping, see SleepTracker
+    Vec2 sleep_anchor = {0.0f, 0.0f};
+    uint16_t still_substeps = 0;
+    SleepState sleep_state = SleepState::Awake;
+    // Enclosed by its sleeping island, kept out of the grid
+    bool buried = false;
+    // Island the object fell asleep with, 0 when it is not part of one
+    uint32_t sleep_island = 0;
+
+    // Velocity damping applied during integration
+    static constexpr float damping = 40.0f;
+    static constexpr float default_radius = 0.5f;
 
     PhysicObject() = default;
 
     explicit PhysicObject(Vec2 position_)
-        : position(position_), last_position(position_)
+        : position(position_), last_position(position_), sleep_anchor(position_)
     {
     }
 
@@ -27,7 +59,7 @@ struct PhysicObject
     void update(float dt)
     {
         const Vec2 last_update_move = position - last_position;
-        const Vec2 new_position = position + last_update_move + (acceleration - last_update_move * 40.0f) * (dt * dt);
+        const Vec2 new_position = position + last_update_move + (acceleration - last_update_move * damping) * (dt * dt);
         last_position = position;
         position = new_position;
         acceleration = {0.0f, 0.0f};
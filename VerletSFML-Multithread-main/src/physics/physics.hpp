@@ -1,28 +1,79 @@
 #pragma once
 #include "collision_grid.hpp"
+#include "compact_grid.hpp"
+#include "hash_grid.hpp"
+#include "grid_hierarchy.hpp"
 #include "physic_object.hpp"
+#include "integrator.hpp"
+#include "spatial_order.hpp"
+#include "slice_partition.hpp"
+#include "block_tiling.hpp"
+#include "snapshot.hpp"
+#include "sleep.hpp"
+#include "jacobi.hpp"
 #include "engine/common/utils.hpp"
 #include "engine/common/index_vector.hpp"
+#include "engine/common/profiler.hpp"
 #include "thread_pool/thread_pool.hpp"
 
+// TGrid is either CollisionGrid (fixed capacity cells), CompactCollisionGrid (counting sort, no capacity limit)
+// or HashCollisionGrid (only occupied cells are stored, for sparse or unbounded worlds)
+template<typename TGrid = CollisionGrid>
 struct PhysicSolver
 {
+    using Cell = typename TGrid::Cell;
+
     CIVector<PhysicObject> objects;
-    CollisionGrid grid;
+    TGrid grid;
     Vec2 world_size;
     Vec2 gravity = {0.0f, 10.0f};
 
     // Simulation solving pass count
     uint32_t sub_steps;
     tp::ThreadPool &thread_pool;
+    // Integration kernel, can be changed at runtime
+    IntegratorMode integrator_mode = IntegratorMode::Auto;
+    // Only used by CollisionGrid, the compact and hash grids are always rebuilt
+    GridUpdate     grid_update     = GridUpdate::Rebuild;
+    // Objects are sorted along a space filling curve every reorder_interval frames, 0 disables it
+    uint32_t              reorder_interval            = 0;
+    SpatialCurve          reorder_curve               = SpatialCurve::Hilbert;
+    uint32_t              frames_since_reorder        = 0;
+    std::vector<uint32_t> reorder_keys;
+    std::vector<uint64_t> reorder_order;
+    // The collision pass uses thread count * 2 * slices_per_thread slices, more than 1 lets work stealing balance the load
+    uint32_t              slices_per_thread           = 1;
+    SliceBalance          slice_balance               = SliceBalance::Columns;
+    SlicePartition        slices;
+    // Tiles4 or Tiles9 switch the collision pass to colored blocks tile_size cells wide, see BlockTiling. Sparse grids always use slices
+    CollisionSchedule     collision_schedule          = CollisionSchedule::Slices;
+    uint32_t              tile_size                   = 32;
+    BlockTiling           tiles;
+    /* Deterministic mode: slices are deterministic_slice_columns wide whatever the thread count and
+       the compact grid sorts its cells. Slices of a pass never overlap and each one is processed
+       sequentially, so the same initial state and inputs give bit-identical results with any thread count */
+    bool                  deterministic               = false;
+    uint32_t              deterministic_slice_columns = 4;
+    /* Set as soon as an object does not have the default radius: objects bigger than 0.5 go to the
+       hierarchy and the contact distance becomes the sum of the radii.
+       When false the uniform radius path runs unchanged */
+    bool                  variable_radius             = false;
+    GridHierarchy<TGrid>  hierarchy;
+    // Still contact islands fall asleep and are neither integrated nor collided, see SleepTracker. Off by default
+    SleepTracker          sleep;
+    /* Jacobi solves the level 0 contacts without slices or tiles, see JacobiSolver for its iterations and relaxation.
+       Contacts of the objects bigger than the default radius always go through the Gauss-Seidel hierarchy */
+    ContactSolver         contact_solver              = ContactSolver::GaussSeidel;
+    JacobiSolver          jacobi;
 
     PhysicSolver(IVec2 size, tp::ThreadPool &tp)
-        : grid{size.x, size.y}, world_size{to<float>(size.x), to<float>(size.y)}, sub_steps{8}, thread_pool{tp}
+        : grid{size.x, size.y}, world_size{to<float>(size.x), to<float>(size.y)}, sub_steps{8}, thread_pool{tp}, hierarchy{world_size}
     {
         grid.clear();
     }
 
     // Checks if two atoms are colliding and if so create a new contact
+    template<bool VariableRadius = false>
     void solveContact(uint32_t atom_1_idx, uint32_t atom_2_idx)
     {
         constexpr float response_coef = 1.0f;
@@ -31,7 +82,21 @@ struct PhysicSolver
         PhysicObject &obj_2 = objects.data[atom_2_idx];
         const Vec2 o2_o1 = obj_1.position - obj_2.position;
         const float dist2 = o2_o1.x * o2_o1.x + o2_o1.y * o2_o1.y;
-        if (dist2 < 1.0f && dist2 > eps)
+        if constexpr (VariableRadius) {
+            // The displacement is split by area, same as below for equal radii
+            const float min_dist = obj_1.radius + obj_2.radius;
+            if (dist2 < min_dist * min_dist && dist2 > eps) {
+                const float dist    = sqrt(dist2);
+                const float delta   = response_coef * (min_dist - dist);
+                const float r1_2    = obj_1.radius * obj_1.radius;
+                const float r2_2    = obj_2.radius * obj_2.radius;
+                const float ratio_1 = r2_2 / (r1_2 + r2_2);
+                const Vec2  normal  = o2_o1 / dist;
+                obj_1.position += normal * (delta * ratio_1);
+                obj_2.position -= normal * (delta * (1.0f - ratio_1));
+            }
+        }
+        else if (dist2 < 1.0f && dist2 > eps)
         {
             const float dist = sqrt(dist2);
             // Radius are all equal to 1.0f
@@ -42,127 +107,637 @@ struct PhysicSolver
         }
     }
 
-    void checkAtomCellCollisions(uint32_t atom_idx, const CollisionCell &c)
+    [[nodiscard]]
+    bool asleep(uint32_t atom_idx) const
+    {
+        return sleep.m_enabled && objects.data[atom_idx].sleep_state == SleepState::Asleep;
+    }
+
+    template<bool VariableRadius = false>
+    void checkAtomCellCollisions(uint32_t atom_idx, const Cell &c)
     {
         for (uint32_t i{0}; i < c.objects_count; ++i)
         {
-            solveContact(atom_idx, c.objects[i]);
+            solveContact<VariableRadius>(atom_idx, c.objects[i]);
         }
     }
 
-    void processCell(const CollisionCell &c, uint32_t index)
+    template<bool VariableRadius = false>
+    void processCell(const Cell &c, uint32_t index)
     {
         for (uint32_t i{0}; i < c.objects_count; ++i)
         {
             const uint32_t atom_idx = c.objects[i];
-            checkAtomCellCollisions(atom_idx, grid.data[index - 1]);
-            checkAtomCellCollisions(atom_idx, grid.data[index]);
-            checkAtomCellCollisions(atom_idx, grid.data[index + 1]);
-            checkAtomCellCollisions(atom_idx, grid.data[index + grid.height - 1]);
-            checkAtomCellCollisions(atom_idx, grid.data[index + grid.height]);
-            checkAtomCellCollisions(atom_idx, grid.data[index + grid.height + 1]);
-            checkAtomCellCollisions(atom_idx, grid.data[index - grid.height - 1]);
-            checkAtomCellCollisions(atom_idx, grid.data[index - grid.height]);
-            checkAtomCellCollisions(atom_idx, grid.data[index - grid.height + 1]);
+            // Sleeping objects are never the active side, contacts with awake objects are solved by the awake one
+            if (asleep(atom_idx)) {
+                continue;
+            }
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index - 1));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index + 1));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index + grid.height - 1));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index + grid.height));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index + grid.height + 1));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index - grid.height - 1));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index - grid.height));
+            checkAtomCellCollisions<VariableRadius>(atom_idx, grid.cell(index - grid.height + 1));
+        }
+    }
+
+    // Same as processCell for every cell of an occupied column of a sparse grid, neighbours come from the grid cursors
+    template<bool VariableRadius = false>
+    void processSparseColumn(uint32_t column)
+    {
+        grid.forEachCell(column, [this](const Cell (&neighbours)[9]) {
+            const Cell& c = neighbours[1];
+            for (uint32_t i{0}; i < c.objects_count; ++i) {
+                const uint32_t atom_idx = c.objects[i];
+                if (asleep(atom_idx)) {
+                    continue;
+                }
+                for (const Cell& neighbour : neighbours) {
+                    checkAtomCellCollisions<VariableRadius>(atom_idx, neighbour);
+                }
+            }
+        });
+    }
+
+    void solveCollisionThreaded(uint32_t i)
+    {
+        // Even slices belong to the first pass
+        PROFILE_WORK(i % 2 ? prof::Phase::CollisionPass2 : prof::Phase::CollisionPass1);
+        if constexpr (TGrid::sparse) {
+            // Slices of a sparse grid are made of occupied columns
+            for (uint32_t column{slices.begin(i, 1)}; column < slices.end(i, 1); ++column) {
+                if (variable_radius) {
+                    processSparseColumn<true>(column);
+                } else {
+                    processSparseColumn(column);
+                }
+            }
+            return;
         }
+        solveCellRange(slices.begin(i, grid.height), slices.end(i, grid.height));
     }
 
-    void solveCollisionThreaded(uint32_t i, uint32_t slice_size)
+    // Cells [start, end), shared by slices and tiles
+    void solveCellRange(uint32_t start, uint32_t end)
     {
-        const uint32_t start = i * slice_size;
-        const uint32_t end = (i + 1) * slice_size;
+        if (variable_radius) {
+            for (uint32_t idx{start}; idx < end; ++idx) {
+                processCell<true>(grid.cell(idx), idx);
+            }
+            return;
+        }
         for (uint32_t idx{start}; idx < end; ++idx)
         {
-            processCell(grid.data[idx], idx);
+            processCell(grid.cell(idx), idx);
+        }
+    }
+
+    [[nodiscard]]
+    bool tiled() const
+    {
+        return !TGrid::sparse && collision_schedule != CollisionSchedule::Slices;
+    }
+
+    // Slices or tiles of the next collision pass
+    void partitionSlices()
+    {
+        if (tiled()) {
+            tiles.tile(to<uint32_t>(grid.width), to<uint32_t>(grid.height), tile_size, collision_schedule);
+            return;
+        }
+        partitionSlices(slices, grid);
+    }
+
+    // Splits the columns of a grid in collision slices, see SlicePartition. Also used for the hierarchy levels
+    void partitionSlices(SlicePartition& partition, const TGrid& target)
+    {
+        if (deterministic) {
+            partition.uniform(to<uint32_t>(target.width), to<uint32_t>(target.width) / std::max(deterministic_slice_columns, SlicePartition::min_columns));
+            return;
+        }
+        const uint32_t slice_count = thread_pool.m_thread_count * 2 * std::max(slices_per_thread, 1u);
+        if (slice_balance == SliceBalance::Objects) {
+            partition.balance(target, slice_count, thread_pool);
+        } else {
+            partition.uniform(to<uint32_t>(target.width), slice_count);
+        }
+    }
+
+    /* Solves the even (pass 0) or odd (pass 1) slices in parallel, one job per slice.
+       With tiles pass 0 solves the first half of the colors and pass 1 the others, one color after the other
+       and one job per block */
+    void solveCollisionPass(uint32_t pass)
+    {
+        PROFILE_PHASE(pass ? prof::Phase::CollisionPass2 : prof::Phase::CollisionPass1);
+        if (tiled()) {
+            const uint32_t colors = tiles.colorCount();
+            for (uint32_t color{pass ? colors / 2 : 0}; color < (pass ? colors : colors / 2); ++color) {
+                thread_pool.parallelFor(0, tiles.colorBlockCount(color), 1, [this, color, pass](uint32_t start, uint32_t end)
+                {
+                    static_cast<void>(pass);
+                    for (uint32_t i{start}; i < end; ++i) {
+                        PROFILE_WORK(pass ? prof::Phase::CollisionPass2 : prof::Phase::CollisionPass1);
+                        tiles.forEachColumn(color, i, to<uint32_t>(grid.height), [this](uint32_t first, uint32_t last) { solveCellRange(first, last); });
+                    }
+                });
+            }
+            return;
+        }
+        thread_pool.parallelFor(0, slices.passSliceCount(pass), 1, [this, pass](uint32_t start, uint32_t end)
+        {
+            for (uint32_t i{start}; i < end; ++i) {
+                solveCollisionThreaded(2 * i + pass);
+            }
+        });
+    }
+
+    // Sums the corrections of the objects of the cell index, each object only writes its own correction
+    template<bool VariableRadius = false>
+    void gatherCell(const Cell &c, uint32_t index)
+    {
+        const uint32_t height = to<uint32_t>(grid.height);
+        for (uint32_t i{0}; i < c.objects_count; ++i) {
+            const uint32_t atom_idx = c.objects[i];
+            const bool     sleeping = asleep(atom_idx);
+            Vec2 correction = {0.0f, 0.0f};
+            for (uint32_t column{index - height}; column <= index + height; column += height) {
+                gatherAtomCell<VariableRadius>(atom_idx, sleeping, grid.cell(column - 1), correction);
+                gatherAtomCell<VariableRadius>(atom_idx, sleeping, grid.cell(column), correction);
+                gatherAtomCell<VariableRadius>(atom_idx, sleeping, grid.cell(column + 1), correction);
+            }
+            jacobi.m_corrections[atom_idx] = correction;
+        }
+    }
+
+    // Same as gatherCell for every cell of an occupied column of a sparse grid
+    template<bool VariableRadius = false>
+    void gatherSparseColumn(uint32_t column)
+    {
+        grid.forEachCell(column, [this](const Cell (&neighbours)[9]) {
+            const Cell& c = neighbours[1];
+            for (uint32_t i{0}; i < c.objects_count; ++i) {
+                const uint32_t atom_idx = c.objects[i];
+                const bool     sleeping = asleep(atom_idx);
+                Vec2 correction = {0.0f, 0.0f};
+                for (const Cell& neighbour : neighbours) {
+                    gatherAtomCell<VariableRadius>(atom_idx, sleeping, neighbour, correction);
+                }
+                jacobi.m_corrections[atom_idx] = correction;
+            }
+        });
+    }
+
+    // A sleeping object is only pushed by awake ones, as in the Gauss-Seidel pass where it is never the active side
+    template<bool VariableRadius = false>
+    void gatherAtomCell(uint32_t atom_idx, bool sleeping, const Cell &c, Vec2& correction) const
+    {
+        const PhysicObject* const data = objects.data.data();
+        for (uint32_t i{0}; i < c.objects_count; ++i) {
+            const uint32_t other_idx = c.objects[i];
+            if (!sleeping || !asleep(other_idx)) {
+                correction += JacobiSolver::contact<VariableRadius>(data[atom_idx], data[other_idx]);
+            }
+        }
+    }
+
+    template<bool VariableRadius = false>
+    void gatherColumns(uint32_t start, uint32_t end)
+    {
+        if constexpr (TGrid::sparse) {
+            for (uint32_t column{start}; column < end; ++column) {
+                gatherSparseColumn<VariableRadius>(column);
+            }
+        } else {
+            const uint32_t height = to<uint32_t>(grid.height);
+            for (uint32_t idx{start * height}; idx < end * height; ++idx) {
+                gatherCell<VariableRadius>(grid.cell(idx), idx);
+            }
+        }
+    }
+
+    /* Level 0 contacts with the Jacobi solver: every iteration gathers the corrections of all the columns
+       in parallel, in any order, then applies them. Replaces both collision passes */
+    void solveJacobi()
+    {
+        PROFILE_PHASE(prof::Phase::CollisionPass1);
+        const uint32_t count = to<uint32_t>(objects.size());
+        jacobi.resize(count);
+        const IntegratorMode mode = Integrator::resolve(integrator_mode);
+        PhysicObject* const data = objects.data.data();
+        for (uint32_t iteration{jacobi.m_iterations}; iteration--;) {
+            thread_pool.parallelFor(0, to<uint32_t>(grid.width), JacobiSolver::column_grain, [this](uint32_t start, uint32_t end)
+            {
+                PROFILE_WORK(prof::Phase::CollisionPass1);
+                if (variable_radius) {
+                    gatherColumns<true>(start, end);
+                } else {
+                    gatherColumns(start, end);
+                }
+            });
+            thread_pool.dispatch(count, [&](uint32_t start, uint32_t end)
+                                 {
+                                     jacobi.apply(mode, data, start, end);
+                                 });
         }
     }
 
     // Find colliding atoms
     void solveCollisions()
     {
-        // Multi-thread grid
-        const uint32_t thread_count = thread_pool.m_thread_count;
-        const uint32_t slice_count = thread_count * 2;
-        const uint32_t slice_size = (grid.width / slice_count) * grid.height;
-        // Find collisions in two passes to avoid data races
-        // First collision pass
-        for (uint32_t i{0}; i < thread_count; ++i)
-        {
-            thread_pool.addTask([this, i, slice_size]
-                                { solveCollisionThreaded(2 * i, slice_size); });
+        if (contact_solver == ContactSolver::Jacobi) {
+            solveJacobi();
+            solveHierarchy();
+            return;
         }
-        thread_pool.waitForCompletion();
-        // Second collision pass
-        for (uint32_t i{0}; i < thread_count; ++i)
-        {
-            thread_pool.addTask([this, i, slice_size]
-                                { solveCollisionThreaded(2 * i + 1, slice_size); });
+        partitionSlices();
+        // Find collisions in two passes to avoid data races: even slices first, then odd ones (or the two halves of the tile colors)
+        solveCollisionPass(0);
+        solveCollisionPass(1);
+        solveHierarchy();
+    }
+
+    // Contacts of the objects bigger than the default radius, after both passes of level 0
+    void solveHierarchy()
+    {
+        if (!variable_radius) {
+            return;
         }
-        thread_pool.waitForCompletion();
+        PROFILE_PHASE(prof::Phase::CollisionPass2);
+        hierarchy.solve(grid, objects.data, thread_pool,
+                        [this](SlicePartition& partition, const TGrid& target) { partitionSlices(partition, target); },
+                        [this](uint32_t atom_1_idx, uint32_t atom_2_idx) {
+                            // The big object is always the first one, a sleeping one still pushes awake small objects
+                            if (!asleep(atom_1_idx) || !asleep(atom_2_idx)) {
+                                solveContact<true>(atom_1_idx, atom_2_idx);
+                            }
+                        });
     }
 
     // Add a new object to the solver
     uint64_t addObject(const PhysicObject &object)
     {
-        return objects.push_back(object);
+        PhysicObject clamped = object;
+        clamped.radius       = clampRadius(object.radius);
+        clamped.sleep_state  = SleepState::Awake;
+        clamped.sleep_anchor = object.position;
+        clamped.sleep_island = 0;
+        clamped.buried       = false;
+        sleep.wakeAround(clamped.position, clamped.radius + SleepTracker::contact_margin);
+        sleep.m_awake.fetch_add(1, std::memory_order_relaxed);
+        return objects.push_back(clamped);
     }
 
-    // Add a new object to the solver
-    uint64_t createObject(Vec2 pos)
+    // Add a new object to the solver, the radius is clamped between 0.5 and 8 times the default one
+    uint64_t createObject(Vec2 pos, float radius = PhysicObject::default_radius)
     {
-        return objects.emplace_back(pos);
+        const uint64_t id = objects.emplace_back(pos);
+        objects[id].radius = clampRadius(radius);
+        sleep.wakeAround(pos, objects[id].radius + SleepTracker::contact_margin);
+        sleep.m_awake.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+
+    float clampRadius(float radius)
+    {
+        radius = std::clamp(radius, 0.5f * PhysicObject::default_radius, GridHierarchy<TGrid>::max_radius);
+        variable_radius |= radius != PhysicObject::default_radius;
+        return radius;
+    }
+
+    void updateVariableRadius()
+    {
+        variable_radius = std::any_of(objects.data.begin(), objects.data.end(), [](const PhysicObject& object) {
+            return object.radius != PhysicObject::default_radius;
+        });
+    }
+
+    /* Sorts objects by the space filling curve key of their cell so that neighbours in space are
+       neighbours in memory, which avoids cache misses in the collision pass.
+       IDs returned by createObject and civ::Ref handles stay valid, indices into objects.data don't */
+    void reorderObjects()
+    {
+        // The world size and not the grid size since a sparse grid has no fixed extent
+        const uint32_t side = SpatialOrder::curveSide(to<int32_t>(world_size.x), to<int32_t>(world_size.y));
+        reorder_keys.resize(objects.size());
+        thread_pool.dispatch(to<uint32_t>(objects.size()), [&](uint32_t start, uint32_t end)
+                             {
+                                 for (uint32_t i{start}; i < end; ++i) {
+                                     reorder_keys[i] = SpatialOrder::key(reorder_curve, objects.data[i].position, side);
+                                 }
+                             });
+        SpatialOrder::sortByKey(reorder_keys, reorder_order);
+        objects.reorder(reorder_order);
+    }
+
+    /* Saves the objects and the solver parameters, the grid is rebuilt at every sub step so it is not saved.
+       Returns false if the file could not be written */
+    bool save(const std::string& path, bool compress = false) const
+    {
+        SnapshotWriter writer{compress};
+        writer.m_header.data_size                = objects.data_size;
+        writer.m_header.op_count                 = objects.op_count;
+        writer.m_header.world_width              = world_size.x;
+        writer.m_header.world_height             = world_size.y;
+        writer.m_header.gravity_x                = gravity.x;
+        writer.m_header.gravity_y                = gravity.y;
+        writer.m_header.sub_steps                = sub_steps;
+        writer.m_header.frames_since_reorder     = frames_since_reorder;
+        writer.m_header.sleep_frames_since_check = sleep.framesSinceCheck();
+        std::vector<SnapshotObject> saved(objects.data.size());
+        std::vector<float>          radius(objects.data.size());
+        std::vector<SleepState>     sleep_states(objects.data.size());
+        std::vector<uint16_t>       still_substeps(objects.data.size());
+        std::vector<Vec2>           sleep_anchors(objects.data.size());
+        for (uint64_t i{0}; i < saved.size(); ++i) {
+            const PhysicObject& object = objects.data[i];
+            saved[i]          = {object.position, object.last_position, object.acceleration, object.color};
+            radius[i]         = object.radius;
+            sleep_states[i]   = object.sleep_state;
+            still_substeps[i] = object.still_substeps;
+            sleep_anchors[i]  = object.sleep_anchor;
+        }
+        writer.add(SnapshotSectionId::Objects, saved);
+        writer.add(SnapshotSectionId::Ids, objects.ids);
+        writer.add(SnapshotSectionId::Metadata, objects.metadata);
+        writer.add(SnapshotSectionId::Radius, radius);
+        writer.add(SnapshotSectionId::SleepStates, sleep_states);
+        writer.add(SnapshotSectionId::StillSubsteps, still_substeps);
+        writer.add(SnapshotSectionId::SleepAnchors, sleep_anchors);
+        return writer.write(path);
+    }
+
+    /* Restores a state written by save, the simulation then continues exactly as it would have from the save.
+       The world size has to match the one of this solver since the grid is allocated at construction.
+       Files without the Radius or sleep sections, such as version 1 ones, load with the default radius
+       and every object awake.
+       Returns false, leaving the solver untouched, if the file is invalid */
+    bool load(const std::string& path)
+    {
+        SnapshotReader reader{path};
+        const SnapshotHeader& header = reader.m_header;
+        if (!reader.m_valid || header.world_width != world_size.x || header.world_height != world_size.y) {
+            return false;
+        }
+        std::vector<SnapshotObject>    saved;
+        std::vector<uint64_t>          ids;
+        std::vector<civ::SlotMetadata> metadata;
+        std::vector<float>             radius;
+        std::vector<SleepState>        sleep_states;
+        std::vector<uint16_t>          still_substeps;
+        std::vector<Vec2>              sleep_anchors;
+        if (!reader.read(SnapshotSectionId::Objects, saved) || !reader.read(SnapshotSectionId::Ids, ids) || !reader.read(SnapshotSectionId::Metadata, metadata)) {
+            return false;
+        }
+        if (!reader.contains(SnapshotSectionId::Radius)) {
+            radius.assign(saved.size(), PhysicObject::default_radius);
+        } else if (!reader.read(SnapshotSectionId::Radius, radius)) {
+            return false;
+        }
+        if (!reader.contains(SnapshotSectionId::SleepStates)) {
+            sleep_states.assign(saved.size(), SleepState::Awake);
+            still_substeps.assign(saved.size(), 0);
+            sleep_anchors.resize(saved.size());
+            std::transform(saved.begin(), saved.end(), sleep_anchors.begin(), [](const SnapshotObject& object) { return object.position; });
+        } else if (!reader.read(SnapshotSectionId::SleepStates, sleep_states) || !reader.read(SnapshotSectionId::StillSubsteps, still_substeps)
+                   || !reader.read(SnapshotSectionId::SleepAnchors, sleep_anchors)) {
+            return false;
+        }
+        if (ids.size() != saved.size() || metadata.size() != saved.size() || radius.size() != saved.size() || header.data_size > saved.size()
+            || sleep_states.size() != saved.size() || still_substeps.size() != saved.size() || sleep_anchors.size() != saved.size()) {
+            return false;
+        }
+        for (uint64_t i{0}; i < saved.size(); ++i) {
+            if (metadata[i].rid >= ids.size() || ids[metadata[i].rid] != i || !(radius[i] > 0.0f) || sleep_states[i] > SleepState::Woken) {
+                return false;
+            }
+        }
+        std::vector<PhysicObject> data(saved.size());
+        for (uint64_t i{0}; i < saved.size(); ++i) {
+            PhysicObject& object = data[i];
+            object.position       = saved[i].position;
+            object.last_position  = saved[i].last_position;
+            object.acceleration   = saved[i].acceleration;
+            object.color          = saved[i].color;
+            object.radius         = radius[i];
+            object.sleep_anchor   = sleep_anchors[i];
+            object.still_substeps = still_substeps[i];
+            object.sleep_state    = sleep_states[i];
+        }
+        objects.data.swap(data);
+        objects.ids.swap(ids);
+        objects.metadata.swap(metadata);
+        objects.data_size    = header.data_size;
+        objects.op_count     = header.op_count;
+        gravity              = {header.gravity_x, header.gravity_y};
+        sub_steps            = header.sub_steps;
+        frames_since_reorder = header.frames_since_reorder;
+        updateVariableRadius();
+        sleep.recount(objects.data.data(), to<uint32_t>(objects.size()), header.sleep_frames_since_check);
+        grid.clear();
+        return true;
     }
 
     void update(float dt)
     {
+        // Islands holding objects created since the last frame wake up before the grid is built, see SleepTracker::wakeAround.
+        // The grid indices are no longer valid after a reorder
+        if (sleep.m_enabled) {
+            wakeIslands();
+        }
+        if (reorder_interval && ++frames_since_reorder >= reorder_interval) {
+            reorderObjects();
+            frames_since_reorder = 0;
+        }
         // Perform the sub steps
         const float sub_dt = dt / static_cast<float>(sub_steps);
         for (uint32_t i(sub_steps); i--;)
         {
+            // Nothing to compute when every object sleeps
+            if (sleep.m_enabled && sleep.m_awake.load(std::memory_order_relaxed) == 0) {
+                break;
+            }
             addObjectsToGrid();
             solveCollisions();
             updateObjects_multi(sub_dt);
         }
+        updateSleep();
+    }
+
+    // Calls f(b) for every object b closer to a than the sum of their radii plus SleepTracker::contact_margin
+    template<typename TCallback>
+    void forEachTouching(uint32_t a, TCallback&& f) const
+    {
+        const PhysicObject* const data = objects.data.data();
+        auto contact = [&](uint32_t, uint32_t b) {
+            const Vec2  to_b  = data[b].position - data[a].position;
+            const float reach = data[a].radius + data[b].radius + SleepTracker::contact_margin;
+            if (to_b.x * to_b.x + to_b.y * to_b.y < reach * reach) {
+                f(b);
+            }
+        };
+        const uint32_t levels = variable_radius ? GridHierarchy<TGrid>::max_level : 0;
+        for (uint32_t m{0}; m <= levels; ++m) {
+            hierarchy.query(grid, m, a, data[a].position, data[a].radius + SleepTracker::contact_margin, contact);
+        }
+    }
+
+    /* Mean and maximum overlap of the pairs closer than the sum of their radii, measures how far the contact
+       solver is from converging. Uses the current grid, call addObjectsToGrid first if objects moved since */
+    [[nodiscard]]
+    ContactError contactError() const
+    {
+        ContactError error;
+        double sum = 0.0;
+        const PhysicObject* const data = objects.data.data();
+        const uint32_t levels = variable_radius ? GridHierarchy<TGrid>::max_level : 0;
+        for (uint32_t a{0}; a < to<uint32_t>(objects.size()); ++a) {
+            auto contact = [&](uint32_t, uint32_t b) {
+                const Vec2  to_b     = data[b].position - data[a].position;
+                const float min_dist = data[a].radius + data[b].radius;
+                const float dist2    = to_b.x * to_b.x + to_b.y * to_b.y;
+                // Each pair once
+                if (b > a && dist2 < min_dist * min_dist) {
+                    const float overlap = min_dist - std::sqrt(dist2);
+                    sum += overlap;
+                    error.m_max = std::max(error.m_max, overlap);
+                    ++error.m_contacts;
+                }
+            };
+            for (uint32_t m{0}; m <= levels; ++m) {
+                hierarchy.query(grid, m, a, data[a].position, data[a].radius, contact);
+            }
+        }
+        error.m_mean = error.m_contacts ? to<float>(sum / to<double>(error.m_contacts)) : 0.0f;
+        return error;
+    }
+
+    // Wakes up the islands pushed during the last sub step or holding objects created since, with the current grid
+    void wakeIslands()
+    {
+        sleep.wakeIslands(objects.data.data(), to<uint32_t>(objects.size()), [this](uint32_t a, auto&& f) { forEachTouching(a, f); });
+    }
+
+    /* Looks for islands that can fall asleep every SleepTracker::m_check_interval frames, with the grid of the
+       last sub step. Wakes every object up once sleeping gets disabled */
+    void updateSleep()
+    {
+        const uint32_t count = to<uint32_t>(objects.size());
+        if (!sleep.m_enabled) {
+            if (sleep.m_awake.load(std::memory_order_relaxed) != count) {
+                sleep.wakeAll(objects.data.data(), count);
+            }
+            return;
+        }
+        if (sleep.m_awake.load(std::memory_order_relaxed) == 0 || !sleep.checkDue()) {
+            return;
+        }
+        PROFILE_PHASE(prof::Phase::Integration);
+        sleep.sleepIslands(objects.data.data(), count, [this](uint32_t a, auto&& f) { forEachTouching(a, f); }, !variable_radius);
     }
 
     void addObjectsToGrid()
     {
-        grid.clear();
-        // Safety border to avoid adding object outside the grid
-        uint32_t i{0};
-        for (const PhysicObject &obj : objects.data)
-        {
-            if (obj.position.x > 1.0f && obj.position.x < world_size.x - 1.0f &&
-                obj.position.y > 1.0f && obj.position.y < world_size.y - 1.0f)
-            {
-                grid.addAtom(to<int32_t>(obj.position.x), to<int32_t>(obj.position.y), i);
+        PROFILE_PHASE(prof::Phase::GridBuild);
+        configureGrid(grid);
+        if (!variable_radius) {
+            // Objects enclosed by a sleeping island stay out of the grid, see SleepTracker::bury_contacts
+            if (sleep.m_enabled && sleep.m_buried != 0) {
+                const PhysicObject* const data = objects.data.data();
+                buildGrid(grid, [data](uint32_t i) { return !data[i].buried; });
+            } else {
+                buildGrid(grid, InsertAll{});
+            }
+            return;
+        }
+        // Level 0 only holds objects up to the default radius, the others go to the hierarchy
+        const PhysicObject* const data = objects.data.data();
+        buildGrid(grid, [data](uint32_t i) { return data[i].radius <= PhysicObject::default_radius; });
+        hierarchy.build(objects.data, thread_pool, [this](TGrid& level_grid) { configureGrid(level_grid); });
+    }
+
+    // CollisionGrid can move only the objects that changed cell instead of rebuilding, see CollisionGrid::update
+    template<typename TFilter>
+    void buildGrid(CollisionGrid& collision_grid, TFilter filter)
+    {
+        collision_grid.incremental = grid_update == GridUpdate::Incremental;
+        collision_grid.update(objects.data, thread_pool, filter);
+    }
+
+    template<typename TOtherGrid, typename TFilter>
+    void buildGrid(TOtherGrid& other_grid, TFilter filter)
+    {
+        other_grid.build(objects.data, thread_pool, filter);
+    }
+
+    // CollisionGrid builds are always deterministic, the compact and hash grids have to sort their cells
+    void configureGrid(CollisionGrid&) {}
+
+    void configureGrid(CompactCollisionGrid& compact_grid)
+    {
+        compact_grid.deterministic = deterministic;
+    }
+
+    void configureGrid(HashCollisionGrid& hash_grid)
+    {
+        hash_grid.deterministic = deterministic;
+    }
+
+    /* FNV-1a hash of the position and last position bits of every live object, in ID order so it does
+       not depend on the objects layout. Calling it after each update gives a per frame checksum to
+       check that parallel changes do not alter the physics or to find the first diverging frame */
+    [[nodiscard]]
+    uint64_t stateHash() const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        const auto mix = [&hash](float value) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            for (uint32_t i{0}; i < 4; ++i) {
+                hash ^= (bits >> (8 * i)) & 0xff;
+                hash *= 1099511628211ull;
+            }
+        };
+        for (uint64_t id{0}; id < objects.ids.size(); ++id) {
+            const uint64_t i = objects.ids[id];
+            if (i < objects.data_size) {
+                const PhysicObject& object = objects.data[i];
+                mix(object.position.x);
+                mix(object.position.y);
+                mix(object.last_position.x);
+                mix(object.last_position.y);
             }
-            ++i;
         }
+        return hash;
     }
 
     void updateObjects_multi(float dt)
     {
+        PROFILE_PHASE(prof::Phase::Integration);
+        const IntegratorMode mode = Integrator::resolve(integrator_mode);
+        const float margin = 2.0f;
+        const IntegratorParams params{gravity, dt, {margin, margin}, {world_size.x - margin, world_size.y - margin}};
+        PhysicObject* const data = objects.data.data();
+        if (sleep.m_enabled) {
+            sleep.m_awake.store(0, std::memory_order_relaxed);
+        }
         thread_pool.dispatch(to<uint32_t>(objects.size()), [&](uint32_t start, uint32_t end)
                              {
-            for (uint32_t i{start}; i < end; ++i) {
-                PhysicObject& obj = objects.data[i];
-                // Add gravity
-                obj.acceleration += gravity;
-                // Apply Verlet integration
-                obj.update(dt);
-                // Apply map borders collisions
-                const float margin = 2.0f;
-                if (obj.position.x > world_size.x - margin) {
-                    obj.position.x = world_size.x - margin;
-                } else if (obj.position.x < margin) {
-                    obj.position.x = margin;
-                }
-                if (obj.position.y > world_size.y - margin) {
-                    obj.position.y = world_size.y - margin;
-                } else if (obj.position.y < margin) {
-                    obj.position.y = margin;
-                }
-            } });
+                                 if (sleep.m_enabled) {
+                                     sleep.updateActivity(data, start, end, dt);
+                                 }
+                                 Integrator::integrate(mode, data, start, end, params);
+                                 if (sleep.m_enabled) {
+                                     SleepTracker::restore(data, start, end);
+                                 }
+                             });
+        if (variable_radius) {
+            hierarchy.clampToWorld(objects.data, world_size);
+        }
+        if (sleep.m_enabled) {
+            wakeIslands();
+        }
     }
 };
@@ -0,0 +1,363 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "physic_object.hpp"
+#include "engine/common/utils.hpp"
+
+
+/* Sleeping objects and contact islands.
+   An object may sleep when its mean speed over the last m_substeps sub steps is below m_speed (units per
+   second): whenever it gets further than m_speed * m_substeps * dt from its anchor, the anchor moves to
+   the current position and the count restarts, so objects jittering under the weight of a pile still qualify.
+   A whole contact island sleeps at once or not at all, otherwise removing the bottom object of a pile
+   would leave sleeping objects hanging in the air.
+   Sleeping objects are not integrated and are never the active side of a contact, the awake object
+   solves it. When pushed by less than m_wake_speed during a sub step they are moved back, beyond that
+   they wake up along with their whole island.
+   Islands are made of the pairs closer than the sum of their radii plus contact_margin, enumerated by
+   the touching(a, f) callback of the solver.
+   Objects surrounded by bury_contacts objects of their own island are buried and the solver keeps them out
+   of the grid: awake objects have to push the island boundary first, which wakes the whole island by its
+   number since touching cannot find the buried objects. Objects created in the bounds of such an island
+   wake it up as well. */
+struct SleepTracker
+{
+    static constexpr float contact_margin = 0.1f;
+    // Equal circles have at most 6 neighbours, an object with 6 contacts in its island is enclosed. Does not hold for variable radii
+    static constexpr uint32_t bury_contacts = 6;
+
+    // When false every object stays awake and the solver behaves exactly as without sleeping
+    bool     m_enabled        = false;
+    /* Has to stay below the terminal falling speed (gravity / damping) or slowly falling isolated objects
+       could fall asleep. Frictionless piles keep spreading slowly and only sleep once they stop */
+    float    m_speed          = 0.2f;
+    uint16_t m_substeps       = 120;
+    float    m_wake_speed     = 5.0f;
+    // Islands are searched every m_check_interval frames, it walks through every awake object
+    uint32_t m_check_interval = 8;
+    // Awake objects, counted again at each integration, the solver skips whole sub steps when it is 0
+    std::atomic<uint32_t> m_awake{0};
+    // Objects kept out of the grid, the solver only filters its builds when it is not 0
+    uint32_t m_buried = 0;
+
+    [[nodiscard]]
+    float activeFraction(uint64_t total) const
+    {
+        return total ? to<float>(m_awake.load(std::memory_order_relaxed)) / to<float>(total) : 1.0f;
+    }
+
+    // Called once per frame by the solver, true when islands have to be searched this frame
+    bool checkDue()
+    {
+        if (++m_frames_since_check < m_check_interval) {
+            return false;
+        }
+        m_frames_since_check = 0;
+        return true;
+    }
+
+    /* Before integrating [start, end): awake objects update their still sub steps count, sleeping objects
+       are moved back if pushed a little or marked Woken beyond the threshold.
+       Each object only writes itself so ranges can be processed in parallel */
+    void updateActivity(PhysicObject* objects, uint32_t start, uint32_t end, float dt)
+    {
+        const float range   = m_speed * dt * to<float>(m_substeps);
+        const float range_2 = range * range;
+        const float push    = m_wake_speed * dt;
+        const float push_2  = push * push;
+        uint32_t count = 0;
+        bool     woken = false;
+        for (uint32_t i{start}; i < end; ++i) {
+            PhysicObject& object = objects[i];
+            if (object.sleep_state == SleepState::Awake) {
+                const Vec2 to_anchor = object.position - object.sleep_anchor;
+                if (to_anchor.x * to_anchor.x + to_anchor.y * to_anchor.y < range_2) {
+                    object.still_substeps = to<uint16_t>(std::min<uint32_t>(object.still_substeps + 1u, std::numeric_limits<uint16_t>::max()));
+                } else {
+                    wake(object);
+                }
+                ++count;
+                continue;
+            }
+            const Vec2 move = object.position - object.last_position;
+            if (move.x * move.x + move.y * move.y < push_2) {
+                object.position = object.last_position;
+            } else {
+                object.sleep_state = SleepState::Woken;
+                wake(object);
+                woken = true;
+                ++count;
+            }
+        }
+        m_awake.fetch_add(count, std::memory_order_relaxed);
+        if (woken) {
+            m_wake_pending.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    // After integrating [start, end): sleeping objects go back to their position, gravity and wall pushes are dropped
+    static void restore(PhysicObject* objects, uint32_t start, uint32_t end)
+    {
+        for (uint32_t i{start}; i < end; ++i) {
+            PhysicObject& object = objects[i];
+            if (object.sleep_state == SleepState::Asleep) {
+                object.position     = object.last_position;
+                object.acceleration = {0.0f, 0.0f};
+            }
+        }
+    }
+
+    /* Wakes up the sleeping objects touching, directly or not, an object woken during this sub step.
+       Islands with buried objects are woken up whole, their objects then wake up their own neighbours */
+    template<typename TTouching>
+    void wakeIslands(PhysicObject* objects, uint32_t count_total, TTouching&& touching)
+    {
+        if (!m_wake_pending.exchange(false, std::memory_order_relaxed)) {
+            return;
+        }
+        m_stack.clear();
+        for (uint32_t i{0}; i < count_total; ++i) {
+            if (objects[i].sleep_state == SleepState::Woken) {
+                objects[i].sleep_state = SleepState::Awake;
+                m_stack.push_back(i);
+            }
+        }
+        uint32_t count = 0;
+        while (!m_stack.empty() || !m_woken_islands.empty()) {
+            while (!m_stack.empty()) {
+                const uint32_t a = m_stack.back();
+                m_stack.pop_back();
+                leaveIsland(objects[a]);
+                touching(a, [&](uint32_t b) {
+                    PhysicObject& object = objects[b];
+                    if (object.sleep_state != SleepState::Asleep) {
+                        return;
+                    }
+                    object.sleep_state = SleepState::Awake;
+                    wake(object);
+                    m_stack.push_back(b);
+                    ++count;
+                });
+            }
+            for (uint32_t i{0}; i < count_total && !m_woken_islands.empty(); ++i) {
+                PhysicObject& object = objects[i];
+                if (object.sleep_state != SleepState::Asleep || !woken(object.sleep_island)) {
+                    continue;
+                }
+                object.sleep_state = SleepState::Awake;
+                wake(object);
+                m_stack.push_back(i);
+                ++count;
+            }
+            m_buried_islands.erase(std::remove_if(m_buried_islands.begin(), m_buried_islands.end(), [this](const IslandBounds& bounds) {
+                return woken(bounds.m_id);
+            }), m_buried_islands.end());
+            m_woken_islands.clear();
+        }
+        m_awake.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    /* Called before creating an object within reach of position: islands with buried objects whose bounds
+       are in reach wake up whole at the next wakeIslands, the new object could land on a buried one otherwise */
+    void wakeAround(Vec2 position, float reach)
+    {
+        for (const IslandBounds& bounds : m_buried_islands) {
+            if (position.x + reach < bounds.m_min.x || position.x - reach > bounds.m_max.x
+                || position.y + reach < bounds.m_min.y || position.y - reach > bounds.m_max.y) {
+                continue;
+            }
+            if (!woken(bounds.m_id)) {
+                m_woken_islands.push_back(bounds.m_id);
+            }
+            m_wake_pending.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    /* Puts to sleep the islands of awake objects that have all been still long enough.
+       Sleeping objects bound the islands, so objects resting on a sleeping pile can sleep too.
+       When bury is true, all the objects having the default radius, enclosed objects are buried, see bury_contacts */
+    template<typename TTouching>
+    void sleepIslands(PhysicObject* objects, uint32_t count_total, TTouching&& touching, bool bury)
+    {
+        if (m_visited.size() < count_total) {
+            m_visited.resize(count_total, 0);
+            // An object is pushed at most once per island, so steps with the same object count do not allocate
+            m_stack.reserve(count_total);
+            m_island.reserve(count_total);
+            // An island with a buried object holds at least bury_contacts + 1 objects
+            m_woken_islands.reserve(count_total / (bury_contacts + 1) + 1);
+            m_buried_islands.reserve(count_total / (bury_contacts + 1) + 1);
+        }
+        if (++m_epoch == 0) {
+            std::fill(m_visited.begin(), m_visited.end(), 0);
+            m_epoch = 1;
+        }
+        uint32_t count = 0;
+        for (uint32_t i{0}; i < count_total; ++i) {
+            if (!candidate(objects[i]) || m_visited[i] == m_epoch) {
+                continue;
+            }
+            m_island.clear();
+            m_stack.assign(1, i);
+            m_visited[i] = m_epoch;
+            bool still = true;
+            while (!m_stack.empty()) {
+                const uint32_t a = m_stack.back();
+                m_stack.pop_back();
+                m_island.push_back(a);
+                still &= objects[a].still_substeps >= m_substeps;
+                touching(a, [&](uint32_t b) {
+                    if (objects[b].sleep_state == SleepState::Awake && m_visited[b] != m_epoch) {
+                        m_visited[b] = m_epoch;
+                        m_stack.push_back(b);
+                    }
+                });
+            }
+            if (!still) {
+                continue;
+            }
+            if (++m_island_id == 0) {
+                m_island_id = 1;
+            }
+            for (const uint32_t a : m_island) {
+                objects[a].sleep_state  = SleepState::Asleep;
+                objects[a].sleep_island = m_island_id;
+                objects[a].stop();
+            }
+            count += to<uint32_t>(m_island.size());
+            if (bury) {
+                buryEnclosed(objects, touching);
+            }
+        }
+        m_awake.fetch_sub(count, std::memory_order_relaxed);
+    }
+
+    // Wakes up every object, when sleeping gets disabled or after moving sleeping objects from outside the solver
+    void wakeAll(PhysicObject* objects, uint32_t count)
+    {
+        for (uint32_t i{0}; i < count; ++i) {
+            objects[i].sleep_state  = SleepState::Awake;
+            objects[i].sleep_island = 0;
+            objects[i].buried       = false;
+            wake(objects[i]);
+        }
+        m_awake.store(count, std::memory_order_relaxed);
+        m_buried = 0;
+        m_buried_islands.clear();
+        m_woken_islands.clear();
+    }
+
+    // Frames since islands were last searched, saved in snapshots so that a loaded state searches on the same frames
+    [[nodiscard]]
+    uint32_t framesSinceCheck() const
+    {
+        return m_frames_since_check;
+    }
+
+    /* Counts the awake objects again and restores the search phase, after loading a snapshot.
+       Islands are not saved, loaded sleeping objects stay in the grid until they wake up and sleep again */
+    void recount(const PhysicObject* objects, uint32_t count, uint32_t frames_since_check)
+    {
+        m_frames_since_check = frames_since_check;
+        m_awake.store(to<uint32_t>(std::count_if(objects, objects + count, [](const PhysicObject& object) {
+            return object.sleep_state != SleepState::Asleep;
+        })), std::memory_order_relaxed);
+        m_buried = to<uint32_t>(std::count_if(objects, objects + count, [](const PhysicObject& object) {
+            return object.buried;
+        }));
+        m_buried_islands.clear();
+        m_woken_islands.clear();
+    }
+
+private:
+    struct IslandBounds
+    {
+        uint32_t m_id;
+        Vec2     m_min;
+        Vec2     m_max;
+    };
+
+    bool candidate(const PhysicObject& object) const
+    {
+        return object.sleep_state == SleepState::Awake && object.still_substeps >= m_substeps;
+    }
+
+    // Woken objects start counting again from their current position
+    static void wake(PhysicObject& object)
+    {
+        object.still_substeps = 0;
+        object.sleep_anchor   = object.position;
+    }
+
+    [[nodiscard]]
+    bool woken(uint32_t island) const
+    {
+        return std::find(m_woken_islands.begin(), m_woken_islands.end(), island) != m_woken_islands.end();
+    }
+
+    // A woken object leaves its island, an island with buried objects is then woken up whole by wakeIslands
+    void leaveIsland(PhysicObject& object)
+    {
+        const uint32_t id = object.sleep_island;
+        object.sleep_island = 0;
+        if (object.buried) {
+            object.buried = false;
+            --m_buried;
+        }
+        if (id == 0 || woken(id)) {
+            return;
+        }
+        if (std::any_of(m_buried_islands.begin(), m_buried_islands.end(), [id](const IslandBounds& bounds) { return bounds.m_id == id; })) {
+            m_woken_islands.push_back(id);
+        }
+    }
+
+    // Buries the objects of the island that just fell asleep enclosed by it, the grid still holds the whole island
+    template<typename TTouching>
+    void buryEnclosed(PhysicObject* objects, TTouching& touching)
+    {
+        const uint32_t before = m_buried;
+        const PhysicObject& first = objects[m_island.front()];
+        IslandBounds bounds{m_island_id, first.position, first.position};
+        for (const uint32_t a : m_island) {
+            PhysicObject& object = objects[a];
+            bounds.m_min.x = std::min(bounds.m_min.x, object.position.x - object.radius);
+            bounds.m_min.y = std::min(bounds.m_min.y, object.position.y - object.radius);
+            bounds.m_max.x = std::max(bounds.m_max.x, object.position.x + object.radius);
+            bounds.m_max.y = std::max(bounds.m_max.y, object.position.y + object.radius);
+            uint32_t contacts = 0;
+            bool     enclosed = true;
+            touching(a, [&](uint32_t b) {
+                if (b == a) {
+                    return;
+                }
+                ++contacts;
+                enclosed &= objects[b].sleep_island == m_island_id;
+            });
+            if (enclosed && contacts >= bury_contacts) {
+                object.buried = true;
+                ++m_buried;
+            }
+        }
+        if (m_buried != before) {
+            m_buried_islands.push_back(bounds);
+        }
+    }
+
+    std::atomic<bool>     m_wake_pending{false};
+    // m_visited[i] == m_epoch when sleepIslands already went through i, so it does not need clearing
+    std::vector<uint32_t> m_visited;
+    uint32_t              m_epoch              = 0;
+    uint32_t              m_frames_since_check = 0;
+    std::vector<uint32_t> m_stack;
+    std::vector<uint32_t> m_island;
+    // Number of the last island put to sleep
+    uint32_t              m_island_id = 0;
+    // Islands woken up whole by the current wakeIslands
+    std::vector<uint32_t> m_woken_islands;
+    // Bounds of the sleeping islands with buried objects
+    std::vector<IslandBounds> m_buried_islands;
+};
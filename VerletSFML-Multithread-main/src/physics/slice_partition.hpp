@@ -0,0 +1,110 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "engine/common/utils.hpp"
+
+
+enum class SliceBalance
+{
+    // Roughly the same number of columns per slice
+    Columns,
+    // Roughly the same number of objects per slice, for scenes where objects pile up on one side
+    Objects
+};
+
+/* Column slices of the collision pass: even slices are processed in parallel, then odd ones.
+   Processing a cell touches its left and right columns so every slice is at least 2 columns wide,
+   this way two slices of the same pass never write to the same column.
+   The slices always cover the whole grid whatever the thread count, there can be more slices than
+   threads in which case work stealing balances the load. */
+struct SlicePartition
+{
+    static constexpr uint32_t min_columns = 2;
+
+    // Slice i covers columns [m_bounds[i], m_bounds[i + 1]), the last bound is the grid width
+    std::vector<uint32_t> m_bounds;
+    std::vector<uint32_t> m_column_weights;
+
+    [[nodiscard]]
+    uint32_t sliceCount() const
+    {
+        return to<uint32_t>(m_bounds.size()) - 1;
+    }
+
+    // Number of slices processed by pass 0 or 1, their indexes are 2 * i + pass
+    [[nodiscard]]
+    uint32_t passSliceCount(uint32_t pass) const
+    {
+        return (sliceCount() + 1 - pass) / 2;
+    }
+
+    [[nodiscard]]
+    uint32_t begin(uint32_t slice, uint32_t height) const
+    {
+        return m_bounds[slice] * height;
+    }
+
+    [[nodiscard]]
+    uint32_t end(uint32_t slice, uint32_t height) const
+    {
+        return m_bounds[slice + 1] * height;
+    }
+
+    // Same number of columns per slice, fewer slices are used if the grid is too narrow
+    void uniform(uint32_t width, uint32_t slice_count)
+    {
+        const uint32_t count = clampSliceCount(width, slice_count);
+        m_bounds.resize(count + 1);
+        for (uint32_t i{0}; i <= count; ++i) {
+            m_bounds[i] = to<uint32_t>(uint64_t{i} * width / count);
+        }
+    }
+
+    // Same number of objects per slice, each column also weighs 1 so that empty areas are split too
+    template<typename TGrid, typename TThreadPool>
+    void balance(const TGrid& grid, uint32_t slice_count, TThreadPool& thread_pool)
+    {
+        const uint32_t width  = to<uint32_t>(grid.width);
+        const uint32_t height = to<uint32_t>(grid.height);
+        m_column_weights.resize(width);
+        thread_pool.dispatch(width, [&](uint32_t first, uint32_t last) {
+            for (uint32_t x{first}; x < last; ++x) {
+                uint32_t weight = 1;
+                if constexpr (TGrid::sparse) {
+                    // Columns of a sparse grid are its occupied columns
+                    weight += grid.columnObjectCount(x);
+                } else {
+                    for (uint32_t y{0}; y < height; ++y) {
+                        weight += grid.cell(x * height + y).objects_count;
+                    }
+                }
+                m_column_weights[x] = weight;
+            }
+        });
+        // In place prefix sum, m_column_weights[x] is the weight of the first x + 1 columns
+        for (uint32_t x{1}; x < width; ++x) {
+            m_column_weights[x] += m_column_weights[x - 1];
+        }
+
+        const uint32_t count = clampSliceCount(width, slice_count);
+        const uint64_t total = width ? m_column_weights[width - 1] : 0;
+        m_bounds.resize(count + 1);
+        m_bounds[0]     = 0;
+        m_bounds[count] = width;
+        for (uint32_t i{1}; i < count; ++i) {
+            const uint64_t target = total * i / count;
+            // The slice ends after the first column reaching the target weight
+            const auto     it      = std::lower_bound(m_column_weights.begin(), m_column_weights.end(), target);
+            const uint32_t x       = to<uint32_t>(it - m_column_weights.begin()) + 1;
+            const uint32_t lowest  = m_bounds[i - 1] + min_columns;
+            const uint32_t highest = width - (count - i) * min_columns;
+            m_bounds[i] = std::clamp(x, lowest, highest);
+        }
+    }
+
+    static uint32_t clampSliceCount(uint32_t width, uint32_t slice_count)
+    {
+        return std::max(1u, std::min(slice_count, width / min_columns));
+    }
+};
@@ -0,0 +1,479 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+/* Snapshot file layout (little endian), used to save and restore the whole solver state:
+   SnapshotHeader | SnapshotSection * section_count | section data, each aligned on 16 bytes.
+   Each section is the raw bytes of one array, optionally encoded with the built-in codec.
+   The collision grid is rebuilt from the positions at every sub step so it is not saved.
+   Fields added after version 1 are stored in their own sections so that older files still load,
+   readers skip sections they do not know. */
+constexpr char     snapshot_magic[4] = {'V', 'S', 'N', 'P'};
+// Version 2 added the Radius and sleep sections, files newer than snapshot_version are rejected
+constexpr uint32_t snapshot_version  = 2;
+
+enum class SnapshotSectionId : uint32_t
+{
+    // civ::Vector content, free slots included
+    Objects,
+    Ids,
+    Metadata,
+    // Optional, objects have the default radius without it
+    Radius,
+    // Optional and written together, objects are awake without them
+    SleepStates,
+    StillSubsteps,
+    SleepAnchors
+};
+
+enum class SnapshotCodecKind : uint32_t
+{
+    Raw,
+    // Byte shuffle by element size followed by an LZ4 style compressor
+    ShuffleLZ
+};
+
+struct SnapshotHeader
+{
+    char     magic[4];
+    uint32_t version;
+    uint32_t section_count;
+    uint32_t sub_steps;
+    uint64_t data_size;
+    uint64_t op_count;
+    float    world_width;
+    float    world_height;
+    float    gravity_x;
+    float    gravity_y;
+    uint32_t frames_since_reorder;
+    // SleepTracker::framesSinceCheck, 0 in version 1 files
+    uint32_t sleep_frames_since_check;
+};
+
+struct SnapshotSection
+{
+    SnapshotSectionId id;
+    uint32_t          element_size;
+    SnapshotCodecKind codec;
+    uint32_t          reserved;
+    // Decoded size
+    uint64_t          raw_size;
+    // Size in the file
+    uint64_t          stored_size;
+    // From the start of the file
+    uint64_t          offset;
+};
+
+static_assert(std::is_trivially_copyable<SnapshotHeader>::value && std::is_trivially_copyable<SnapshotSection>::value, "");
+
+/* Compressing float arrays directly gives poor results, so the bytes are first grouped by their
+   position in the element (blosc's shuffle): the sign and exponent bytes barely change from one
+   object to the next and become long repeated runs.
+   The LZ part uses the LZ4 block format: the token holds the literal count in its high nibble and
+   match length - 4 in its low one, values of 15 continue with 255 valued bytes, offsets are 2 bytes. */
+struct SnapshotCodec
+{
+    static void shuffle(const uint8_t* src, uint64_t size, uint64_t element_size, uint8_t* dst)
+    {
+        const uint64_t count = size / element_size;
+        for (uint64_t b{0}; b < element_size; ++b) {
+            for (uint64_t i{0}; i < count; ++i) {
+                dst[b * count + i] = src[i * element_size + b];
+            }
+        }
+        std::memcpy(dst + count * element_size, src + count * element_size, size - count * element_size);
+    }
+
+    static void unshuffle(const uint8_t* src, uint64_t size, uint64_t element_size, uint8_t* dst)
+    {
+        const uint64_t count = size / element_size;
+        for (uint64_t b{0}; b < element_size; ++b) {
+            for (uint64_t i{0}; i < count; ++i) {
+                dst[i * element_size + b] = src[b * count + i];
+            }
+        }
+        std::memcpy(dst + count * element_size, src + count * element_size, size - count * element_size);
+    }
+
+    static void compress(const uint8_t* src, uint64_t size, std::vector<uint8_t>& out)
+    {
+        constexpr uint32_t hash_bits     = 16;
+        constexpr uint64_t min_match     = 4;
+        // Like LZ4 the last bytes are always literals
+        constexpr uint64_t last_literals = 5;
+        // Stores position + 1, 0 means empty
+        std::vector<uint32_t> table(uint64_t{1} << hash_bits, 0);
+        out.clear();
+        out.reserve(size + size / 255 + 16);
+        uint64_t anchor = 0;
+        uint64_t i      = 0;
+        while (i + min_match + last_literals <= size) {
+            const uint32_t sequence  = read32(src + i);
+            const uint32_t hash      = (sequence * 2654435761u) >> (32 - hash_bits);
+            const uint64_t candidate = table[hash];
+            table[hash] = static_cast<uint32_t>(i + 1);
+            if (candidate == 0 || i - (candidate - 1) > 0xffff || read32(src + candidate - 1) != sequence) {
+                ++i;
+                continue;
+            }
+            const uint64_t match  = candidate - 1;
+            uint64_t       length = min_match;
+            while (i + length + last_literals < size && src[match + length] == src[i + length]) {
+                ++length;
+            }
+            writeSequence(out, src + anchor, i - anchor, i - match, length);
+            i += length;
+            anchor = i;
+        }
+        // Last sequence only has literals
+        const uint64_t literals = size - anchor;
+        out.push_back(static_cast<uint8_t>(std::min<uint64_t>(literals, 15) << 4));
+        writeLength(out, literals);
+        out.insert(out.end(), src + anchor, src + size);
+    }
+
+    // Returns false if the input is truncated or does not decode to exactly raw_size bytes
+    static bool decompress(const uint8_t* src, uint64_t size, uint8_t* dst, uint64_t raw_size)
+    {
+        const uint8_t* const src_end = src + size;
+        uint64_t written = 0;
+        while (src < src_end) {
+            const uint8_t token = *src++;
+            uint64_t literals = token >> 4;
+            if (!readLength(src, src_end, literals)) {
+                return false;
+            }
+            if (literals > static_cast<uint64_t>(src_end - src) || literals > raw_size - written) {
+                return false;
+            }
+            std::memcpy(dst + written, src, literals);
+            src     += literals;
+            written += literals;
+            if (src == src_end) {
+                break;
+            }
+            if (src_end - src < 2) {
+                return false;
+            }
+            const uint64_t offset = src[0] | (uint64_t{src[1]} << 8);
+            src += 2;
+            uint64_t length = token & 0x0f;
+            if (!readLength(src, src_end, length)) {
+                return false;
+            }
+            length += 4;
+            if (offset == 0 || offset > written || length > raw_size - written) {
+                return false;
+            }
+            // The match can overlap the output, it has to be copied byte per byte
+            const uint8_t* from = dst + written - offset;
+            for (uint64_t k{0}; k < length; ++k) {
+                dst[written + k] = from[k];
+            }
+            written += length;
+        }
+        return written == raw_size;
+    }
+
+    static uint32_t read32(const uint8_t* p)
+    {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static void writeLength(std::vector<uint8_t>& out, uint64_t length)
+    {
+        if (length < 15) {
+            return;
+        }
+        length -= 15;
+        while (length >= 255) {
+            out.push_back(255);
+            length -= 255;
+        }
+        out.push_back(static_cast<uint8_t>(length));
+    }
+
+    static bool readLength(const uint8_t*& src, const uint8_t* src_end, uint64_t& length)
+    {
+        if (length != 15) {
+            return true;
+        }
+        uint8_t b;
+        do {
+            if (src == src_end) {
+                return false;
+            }
+            b = *src++;
+            length += b;
+        } while (b == 255);
+        return true;
+    }
+
+    static void writeSequence(std::vector<uint8_t>& out, const uint8_t* literals, uint64_t literal_count, uint64_t offset, uint64_t length)
+    {
+        const uint64_t match_code = length - 4;
+        out.push_back(static_cast<uint8_t>((std::min<uint64_t>(literal_count, 15) << 4) | std::min<uint64_t>(match_code, 15)));
+        writeLength(out, literal_count);
+        out.insert(out.end(), literals, literals + literal_count);
+        out.push_back(static_cast<uint8_t>(offset & 0xff));
+        out.push_back(static_cast<uint8_t>(offset >> 8));
+        writeLength(out, match_code);
+    }
+};
+
+// Read only memory mapped file, snapshots are loaded without reading the whole file in a buffer first
+struct MappedFile
+{
+    const uint8_t* m_data = nullptr;
+    uint64_t       m_size = 0;
+#ifdef _WIN32
+    HANDLE         m_file    = INVALID_HANDLE_VALUE;
+    HANDLE         m_mapping = nullptr;
+#else
+    int            m_fd = -1;
+#endif
+
+    explicit
+    MappedFile(const std::string& path)
+    {
+#ifdef _WIN32
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(m_file, &file_size) || file_size.QuadPart == 0) {
+            return;
+        }
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_mapping) {
+            return;
+        }
+        m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_data) {
+            m_size = static_cast<uint64_t>(file_size.QuadPart);
+        }
+#else
+        m_fd = open(path.c_str(), O_RDONLY);
+        if (m_fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(m_fd, &st) != 0 || st.st_size == 0) {
+            return;
+        }
+        void* const p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if (p == MAP_FAILED) {
+            return;
+        }
+        m_data = static_cast<const uint8_t*>(p);
+        m_size = static_cast<uint64_t>(st.st_size);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (m_data) {
+            UnmapViewOfFile(m_data);
+        }
+        if (m_mapping) {
+            CloseHandle(m_mapping);
+        }
+        if (m_file != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_file);
+        }
+#else
+        if (m_data) {
+            munmap(const_cast<uint8_t*>(m_data), m_size);
+        }
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]]
+    bool valid() const
+    {
+        return m_data != nullptr;
+    }
+};
+
+// Arrays are registered by pointer and written at once, they must not change before write()
+struct SnapshotWriter
+{
+    struct Source
+    {
+        SnapshotSectionId id;
+        uint32_t          element_size;
+        const uint8_t*    bytes;
+        uint64_t          size;
+    };
+
+    SnapshotHeader      m_header{};
+    bool                m_compress;
+    std::vector<Source> m_sources;
+
+    explicit
+    SnapshotWriter(bool compress)
+        : m_compress{compress}
+    {
+        std::memcpy(m_header.magic, snapshot_magic, sizeof(m_header.magic));
+        m_header.version = snapshot_version;
+    }
+
+    template<typename T>
+    void add(SnapshotSectionId id, const std::vector<T>& values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Snapshot arrays are written as raw bytes");
+        m_sources.push_back({id, sizeof(T), reinterpret_cast<const uint8_t*>(values.data()), values.size() * sizeof(T)});
+    }
+
+    bool write(const std::string& path)
+    {
+        m_header.section_count = static_cast<uint32_t>(m_sources.size());
+        std::vector<SnapshotSection>      sections(m_sources.size());
+        std::vector<std::vector<uint8_t>> encoded(m_sources.size());
+        uint64_t offset = align(sizeof(SnapshotHeader) + sizeof(SnapshotSection) * sections.size());
+        for (uint64_t i{0}; i < m_sources.size(); ++i) {
+            const Source&    source  = m_sources[i];
+            SnapshotSection& section = sections[i];
+            section.id           = source.id;
+            section.element_size = source.element_size;
+            section.codec        = SnapshotCodecKind::Raw;
+            section.raw_size     = source.size;
+            section.stored_size  = source.size;
+            if (m_compress && source.size) {
+                std::vector<uint8_t> shuffled(source.size);
+                SnapshotCodec::shuffle(source.bytes, source.size, source.element_size, shuffled.data());
+                SnapshotCodec::compress(shuffled.data(), shuffled.size(), encoded[i]);
+                // Sections that do not shrink are stored as is
+                if (encoded[i].size() < source.size) {
+                    section.codec       = SnapshotCodecKind::ShuffleLZ;
+                    section.stored_size = encoded[i].size();
+                }
+            }
+            section.offset = offset;
+            offset = align(offset + section.stored_size);
+        }
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+        out.write(reinterpret_cast<const char*>(sections.data()), static_cast<std::streamsize>(sizeof(SnapshotSection) * sections.size()));
+        for (uint64_t i{0}; i < sections.size(); ++i) {
+            pad(out, sections[i].offset);
+            const uint8_t* const bytes = sections[i].codec == SnapshotCodecKind::Raw ? m_sources[i].bytes : encoded[i].data();
+            out.write(reinterpret_cast<const char*>(bytes), static_cast<std::streamsize>(sections[i].stored_size));
+        }
+        return static_cast<bool>(out);
+    }
+
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + 15) & ~uint64_t{15};
+    }
+
+    static void pad(std::ofstream& out, uint64_t offset)
+    {
+        constexpr char zeros[16] = {};
+        const uint64_t position = static_cast<uint64_t>(out.tellp());
+        out.write(zeros, static_cast<std::streamsize>(offset - position));
+    }
+};
+
+// Reads a snapshot through a memory mapping, raw sections are copied straight from the mapped pages
+struct SnapshotReader
+{
+    MappedFile                   m_file;
+    SnapshotHeader               m_header{};
+    std::vector<SnapshotSection> m_sections;
+    bool                         m_valid = false;
+
+    explicit
+    SnapshotReader(const std::string& path)
+        : m_file{path}
+    {
+        if (!m_file.valid() || m_file.m_size < sizeof(SnapshotHeader)) {
+            return;
+        }
+        std::memcpy(&m_header, m_file.m_data, sizeof(m_header));
+        if (std::memcmp(m_header.magic, snapshot_magic, sizeof(m_header.magic)) != 0 || m_header.version == 0 || m_header.version > snapshot_version) {
+            return;
+        }
+        if (m_file.m_size < sizeof(SnapshotHeader) + sizeof(SnapshotSection) * uint64_t{m_header.section_count}) {
+            return;
+        }
+        m_sections.resize(m_header.section_count);
+        std::memcpy(m_sections.data(), m_file.m_data + sizeof(SnapshotHeader), sizeof(SnapshotSection) * m_sections.size());
+        m_valid = true;
+    }
+
+    [[nodiscard]]
+    bool contains(SnapshotSectionId id) const
+    {
+        return std::any_of(m_sections.begin(), m_sections.end(), [id](const SnapshotSection& section) { return section.id == id; });
+    }
+
+    // Returns false if the section is missing or corrupted
+    template<typename T>
+    bool read(SnapshotSectionId id, std::vector<T>& values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Snapshot arrays are read as raw bytes");
+        for (const SnapshotSection& section : m_sections) {
+            if (section.id != id) {
+                continue;
+            }
+            if (section.element_size != sizeof(T) || section.raw_size % sizeof(T) != 0
+                || section.offset > m_file.m_size || section.stored_size > m_file.m_size - section.offset) {
+                return false;
+            }
+            values.resize(section.raw_size / sizeof(T));
+            uint8_t* const       dst = reinterpret_cast<uint8_t*>(values.data());
+            const uint8_t* const src = m_file.m_data + section.offset;
+            if (section.codec == SnapshotCodecKind::Raw) {
+                if (section.stored_size != section.raw_size) {
+                    return false;
+                }
+                std::memcpy(dst, src, section.raw_size);
+                return true;
+            }
+            std::vector<uint8_t> shuffled(section.raw_size);
+            if (!SnapshotCodec::decompress(src, section.stored_size, shuffled.data(), shuffled.size())) {
+                return false;
+            }
+            SnapshotCodec::unshuffle(shuffled.data(), shuffled.size(), sizeof(T), dst);
+            return true;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "engine/common/vec.hpp"
+#include "engine/common/utils.hpp"
+
+
+enum class SpatialCurve
+{
+    // Z-order, cheapest to compute
+    Morton,
+    // Consecutive keys are always adjacent cells, better locality
+    Hilbert
+};
+
+// Space filling curve keys used to store objects that are close in space close in memory
+struct SpatialOrder
+{
+    // Side of the square covered by the curve, smallest power of 2 containing the grid
+    static uint32_t curveSide(int32_t width, int32_t height)
+    {
+        uint32_t side = 1;
+        while (side < to<uint32_t>(std::max(width, height))) {
+            side <<= 1;
+        }
+        return side;
+    }
+
+    // Interleaves the bits of a 16 bits integer with zeros: b2 b1 b0 -> 0 b2 0 b1 0 b0
+    static uint32_t spreadBits(uint32_t v)
+    {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
+
+    static uint32_t mortonKey(uint32_t x, uint32_t y)
+    {
+        return spreadBits(x) | (spreadBits(y) << 1);
+    }
+
+    // side has to be a power of 2
+    static uint32_t hilbertKey(uint32_t x, uint32_t y, uint32_t side)
+    {
+        uint32_t d = 0;
+        for (uint32_t s{side / 2}; s > 0; s /= 2) {
+            const uint32_t rx = (x & s) > 0;
+            const uint32_t ry = (y & s) > 0;
+            d += s * s * ((3 * rx) ^ ry);
+            // Rotate the quadrant so that the next level connects with this one
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = side - 1 - x;
+                    y = side - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+
+    // Key of the cell containing position, out of range coordinates are clamped
+    static uint32_t key(SpatialCurve curve, Vec2 position, uint32_t side)
+    {
+        const float    max_coord = to<float>(side - 1);
+        const uint32_t x         = to<uint32_t>(std::clamp(position.x, 0.0f, max_coord));
+        const uint32_t y         = to<uint32_t>(std::clamp(position.y, 0.0f, max_coord));
+        return curve == SpatialCurve::Morton ? mortonKey(x, y) : hilbertKey(x, y, side);
+    }
+
+    // Sorts by key, order[i] is the old index of the object going to index i. Equal keys keep their order
+    static void sortByKey(const std::vector<uint32_t>& keys, std::vector<uint64_t>& order)
+    {
+        std::vector<uint64_t> packed(keys.size());
+        for (uint64_t i{0}; i < keys.size(); ++i) {
+            packed[i] = (uint64_t{keys[i]} << 32) | i;
+        }
+        std::sort(packed.begin(), packed.end());
+        order.resize(keys.size());
+        for (uint64_t i{0}; i < packed.size(); ++i) {
+            order[i] = packed[i] & 0xffffffff;
+        }
+    }
+};
@@ -0,0 +1,506 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "physic_object.hpp"
+#include "snapshot.hpp"
+#include "engine/common/index_vector.hpp"
+#include "engine/common/utils.hpp"
+
+
+/* Trajectory file layout (little endian):
+   TrajectoryHeader | (TrajectoryChunk + data) * n | TrajectoryIndexEntry * n | TrajectoryFooter
+   Positions are quantized to 16 bits fixed point within the world size and stored by object ID
+   rather than by index, so reordering the objects does not break the frame to frame deltas.
+   The first frame of a chunk is a key frame (delta against 0) and the others are deltas against
+   the previous frame, every chunk can be decoded on its own.
+   Chunk data is a sequence of TrajectoryFrame | dx[object_count] | dy[object_count] encoded with the
+   snapshot codec. Deltas wrap around in uint16_t so the encoding is lossless.
+   The chunk index is written by stop(), if it is missing the reader scans the chunks instead. */
+constexpr char     trajectory_magic[4]       = {'V', 'T', 'R', 'J'};
+constexpr char     trajectory_chunk_magic[4] = {'V', 'T', 'R', 'C'};
+constexpr char     trajectory_index_magic[4] = {'V', 'T', 'R', 'I'};
+constexpr uint32_t trajectory_version        = 1;
+
+struct TrajectoryHeader
+{
+    char     magic[4];
+    uint32_t version;
+    float    world_width;
+    float    world_height;
+};
+
+struct TrajectoryChunk
+{
+    char              magic[4];
+    uint32_t          frame_count;
+    uint64_t          first_frame;
+    uint64_t          last_frame;
+    SnapshotCodecKind codec;
+    uint32_t          reserved;
+    uint64_t          raw_size;
+    uint64_t          stored_size;
+};
+
+struct TrajectoryFrame
+{
+    uint64_t frame;
+    uint32_t object_count;
+    uint32_t reserved;
+};
+
+struct TrajectoryIndexEntry
+{
+    uint64_t first_frame;
+    uint64_t last_frame;
+    // Chunk header position in the file
+    uint64_t offset;
+};
+
+struct TrajectoryFooter
+{
+    uint64_t index_offset;
+    uint64_t chunk_count;
+    char     magic[4];
+    uint32_t reserved;
+};
+
+inline uint16_t quantizePosition(float value, float size)
+{
+    const float t = std::min(std::max(value / size, 0.0f), 1.0f);
+    return static_cast<uint16_t>(t * 65535.0f + 0.5f);
+}
+
+inline float dequantizePosition(uint16_t value, float size)
+{
+    return static_cast<float>(value) / 65535.0f * size;
+}
+
+/* Records the objects positions at every frame.
+   The simulation thread calls record() after update(), it only quantizes the positions into a
+   bounded ring buffer, delta encoding, compression and writing happen on a dedicated I/O thread.
+   When the ring is full (the disk can't keep up) the frame is dropped instead of waiting, dropped
+   frames are absent from the file and counted by m_dropped. */
+struct TrajectoryRecorder
+{
+    static constexpr uint32_t ring_size = 8;
+
+    struct Slot
+    {
+        uint64_t              frame = 0;
+        std::vector<uint16_t> x;
+        std::vector<uint16_t> y;
+    };
+
+    // Frames per chunk, more compress better but seeking has to decode more frames
+    uint32_t                chunk_frames;
+    Slot                    m_ring[ring_size];
+    alignas(64) std::atomic<uint64_t> m_head = 0;
+    alignas(64) std::atomic<uint64_t> m_tail = 0;
+    std::atomic<uint64_t>   m_dropped = 0;
+    uint64_t                m_next_frame = 0;
+    Vec2                    m_world_size = {1.0f, 1.0f};
+    bool                    m_recording  = false;
+
+    std::thread             m_io_thread;
+    std::mutex              m_mutex;
+    std::condition_variable m_condition;
+    std::atomic<bool>       m_stopping = false;
+
+    // Only used by the I/O thread
+    std::ofstream                     m_out;
+    std::vector<uint16_t>             m_previous_x;
+    std::vector<uint16_t>             m_previous_y;
+    std::vector<uint8_t>              m_chunk;
+    std::vector<uint8_t>              m_encoded;
+    std::vector<uint8_t>              m_shuffled;
+    TrajectoryChunk                   m_chunk_header{};
+    std::vector<TrajectoryIndexEntry> m_index;
+
+    // capacity is the expected maximum object count, buffers are allocated upfront so record() doesn't allocate
+    explicit
+    TrajectoryRecorder(uint32_t capacity = 0, uint32_t chunk_frames_ = 60)
+        : chunk_frames{std::max(chunk_frames_, 1u)}
+    {
+        for (Slot& slot : m_ring) {
+            slot.x.reserve(capacity);
+            slot.y.reserve(capacity);
+        }
+    }
+
+    ~TrajectoryRecorder()
+    {
+        stop();
+    }
+
+    TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+    TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+    // Opens the file and starts the I/O thread, the next recorded frame is frame 0
+    bool start(const std::string& path, Vec2 world_size)
+    {
+        stop();
+        m_out.open(path, std::ios::binary | std::ios::trunc);
+        if (!m_out) {
+            return false;
+        }
+        m_world_size = world_size;
+        TrajectoryHeader header{};
+        std::memcpy(header.magic, trajectory_magic, sizeof(header.magic));
+        header.version      = trajectory_version;
+        header.world_width  = world_size.x;
+        header.world_height = world_size.y;
+        m_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        m_index.clear();
+        m_next_frame = 0;
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+        m_dropped.store(0, std::memory_order_relaxed);
+        m_stopping.store(false, std::memory_order_relaxed);
+        m_recording = true;
+        m_io_thread = std::thread([this](){
+            writeLoop();
+        });
+        return true;
+    }
+
+    // Writes the remaining frames and the chunk index, then closes the file
+    void stop()
+    {
+        if (!m_recording) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock_guard{m_mutex};
+            m_stopping.store(true, std::memory_order_release);
+        }
+        m_condition.notify_one();
+        m_io_thread.join();
+        writeIndex();
+        m_out.close();
+        m_recording = false;
+    }
+
+    /* Simulation thread only, never blocks: returns false if the frame was dropped.
+       Objects are stored by ID, the slots of erased objects are recorded at (0, 0) */
+    bool record(const CIVector<PhysicObject>& objects)
+    {
+        if (!m_recording) {
+            return false;
+        }
+        const uint64_t frame = m_next_frame++;
+        const uint64_t tail  = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == ring_size) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Slot& slot = m_ring[tail % ring_size];
+        const uint64_t count = objects.ids.size();
+        slot.frame = frame;
+        slot.x.resize(count);
+        slot.y.resize(count);
+        for (uint64_t id{0}; id < count; ++id) {
+            const uint64_t i = objects.ids[id];
+            if (i < objects.data_size) {
+                slot.x[id] = quantizePosition(objects.data[i].position.x, m_world_size.x);
+                slot.y[id] = quantizePosition(objects.data[i].position.y, m_world_size.y);
+            } else {
+                slot.x[id] = 0;
+                slot.y[id] = 0;
+            }
+        }
+        m_tail.store(tail + 1, std::memory_order_release);
+        m_condition.notify_one();
+        return true;
+    }
+
+    void writeLoop()
+    {
+        while (true) {
+            const uint64_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire)) {
+                if (m_stopping.load(std::memory_order_acquire) && head == m_tail.load(std::memory_order_acquire)) {
+                    break;
+                }
+                // record() notifies without locking and a wake up can be missed, so only wait for a short time
+                std::unique_lock<std::mutex> lock{m_mutex};
+                m_condition.wait_for(lock, std::chrono::milliseconds(2));
+                continue;
+            }
+            appendFrame(m_ring[head % ring_size]);
+            m_head.store(head + 1, std::memory_order_release);
+            if (m_chunk_header.frame_count == chunk_frames) {
+                flushChunk();
+            }
+        }
+        flushChunk();
+    }
+
+    void appendFrame(const Slot& slot)
+    {
+        const uint64_t count = slot.x.size();
+        if (m_chunk_header.frame_count == 0) {
+            m_chunk_header.first_frame = slot.frame;
+            m_previous_x.clear();
+            m_previous_y.clear();
+        }
+        m_chunk_header.last_frame = slot.frame;
+        ++m_chunk_header.frame_count;
+        // New objects are encoded against 0
+        m_previous_x.resize(count, 0);
+        m_previous_y.resize(count, 0);
+
+        const TrajectoryFrame frame{slot.frame, to<uint32_t>(count), 0};
+        const uint64_t offset = m_chunk.size();
+        m_chunk.resize(offset + sizeof(frame) + count * 2 * sizeof(uint16_t));
+        std::memcpy(m_chunk.data() + offset, &frame, sizeof(frame));
+        uint16_t* const dx = reinterpret_cast<uint16_t*>(m_chunk.data() + offset + sizeof(frame));
+        uint16_t* const dy = dx + count;
+        for (uint64_t i{0}; i < count; ++i) {
+            dx[i] = static_cast<uint16_t>(slot.x[i] - m_previous_x[i]);
+            dy[i] = static_cast<uint16_t>(slot.y[i] - m_previous_y[i]);
+        }
+        std::copy(slot.x.begin(), slot.x.end(), m_previous_x.begin());
+        std::copy(slot.y.begin(), slot.y.end(), m_previous_y.begin());
+    }
+
+    void flushChunk()
+    {
+        if (m_chunk_header.frame_count == 0) {
+            return;
+        }
+        std::memcpy(m_chunk_header.magic, trajectory_chunk_magic, sizeof(m_chunk_header.magic));
+        m_chunk_header.raw_size = m_chunk.size();
+        m_shuffled.resize(m_chunk.size());
+        SnapshotCodec::shuffle(m_chunk.data(), m_chunk.size(), sizeof(uint16_t), m_shuffled.data());
+        SnapshotCodec::compress(m_shuffled.data(), m_shuffled.size(), m_encoded);
+        const bool compressed = m_encoded.size() < m_chunk.size();
+        m_chunk_header.codec       = compressed ? SnapshotCodecKind::ShuffleLZ : SnapshotCodecKind::Raw;
+        m_chunk_header.stored_size = compressed ? m_encoded.size() : m_chunk.size();
+
+        m_index.push_back({m_chunk_header.first_frame, m_chunk_header.last_frame, static_cast<uint64_t>(m_out.tellp())});
+        m_out.write(reinterpret_cast<const char*>(&m_chunk_header), sizeof(m_chunk_header));
+        const std::vector<uint8_t>& bytes = compressed ? m_encoded : m_chunk;
+        m_out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        m_out.flush();
+
+        m_chunk.clear();
+        m_chunk_header = TrajectoryChunk{};
+    }
+
+    void writeIndex()
+    {
+        TrajectoryFooter footer{};
+        footer.index_offset = static_cast<uint64_t>(m_out.tellp());
+        footer.chunk_count  = m_index.size();
+        std::memcpy(footer.magic, trajectory_index_magic, sizeof(footer.magic));
+        m_out.write(reinterpret_cast<const char*>(m_index.data()), static_cast<std::streamsize>(m_index.size() * sizeof(TrajectoryIndexEntry)));
+        m_out.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    }
+};
+
+/* Reads a file written by TrajectoryRecorder through a memory mapping.
+   seek(n) finds the chunk holding frame n with the index and accumulates the deltas from its key
+   frame, next() decodes each frame only once when reading sequentially. */
+struct TrajectoryReader
+{
+    // Positions by object ID
+    std::vector<Vec2>                 positions;
+
+    MappedFile                        m_file;
+    TrajectoryHeader                  m_header{};
+    std::vector<TrajectoryIndexEntry> m_index;
+    bool                              m_valid = false;
+
+    std::vector<uint8_t>              m_chunk;
+    std::vector<uint8_t>              m_shuffled;
+    std::vector<uint16_t>             m_qx;
+    std::vector<uint16_t>             m_qy;
+    uint64_t                          m_current_chunk = 0;
+    uint64_t                          m_cursor        = 0;
+    uint64_t                          m_current_frame = 0;
+    // True once a frame has been decoded
+    bool                              m_has_frame     = false;
+
+    explicit
+    TrajectoryReader(const std::string& path)
+        : m_file{path}
+    {
+        if (!m_file.valid() || m_file.m_size < sizeof(TrajectoryHeader)) {
+            return;
+        }
+        std::memcpy(&m_header, m_file.m_data, sizeof(m_header));
+        if (std::memcmp(m_header.magic, trajectory_magic, sizeof(m_header.magic)) != 0 || m_header.version != trajectory_version) {
+            return;
+        }
+        if (!readIndex()) {
+            scanChunks();
+        }
+        m_valid = true;
+    }
+
+    // First and last frame numbers, dropped frames may be missing in between
+    [[nodiscard]]
+    uint64_t firstFrame() const
+    {
+        return m_index.empty() ? 0 : m_index.front().first_frame;
+    }
+
+    [[nodiscard]]
+    uint64_t lastFrame() const
+    {
+        return m_index.empty() ? 0 : m_index.back().last_frame;
+    }
+
+    // Returns false if frame n is not in the file (out of range or dropped during recording)
+    bool seek(uint64_t n)
+    {
+        const auto it = std::upper_bound(m_index.begin(), m_index.end(), n, [](uint64_t f, const TrajectoryIndexEntry& e) {
+            return f < e.first_frame;
+        });
+        if (it == m_index.begin() || n > std::prev(it)->last_frame) {
+            return false;
+        }
+        const uint64_t target = to<uint64_t>(std::prev(it) - m_index.begin());
+        // Moving forward in the same chunk continues from the current state, otherwise restart from the key frame
+        if (target != m_current_chunk || !m_has_frame || n < m_current_frame) {
+            if (!loadChunk(target)) {
+                return false;
+            }
+        } else if (n == m_current_frame) {
+            return true;
+        }
+        while (m_cursor < m_chunk.size()) {
+            TrajectoryFrame next_frame;
+            std::memcpy(&next_frame, m_chunk.data() + m_cursor, sizeof(next_frame));
+            if (next_frame.frame > n || !applyFrame()) {
+                return false;
+            }
+            if (m_current_frame == n) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Moves to the next recorded frame, returns false after the last one
+    bool next()
+    {
+        if (!m_has_frame) {
+            return !m_index.empty() && loadChunk(0) && applyFrame();
+        }
+        if (m_cursor < m_chunk.size()) {
+            return applyFrame();
+        }
+        return m_current_chunk + 1 < m_index.size() && loadChunk(m_current_chunk + 1) && applyFrame();
+    }
+
+    bool readIndex()
+    {
+        if (m_file.m_size < sizeof(TrajectoryHeader) + sizeof(TrajectoryFooter)) {
+            return false;
+        }
+        TrajectoryFooter footer;
+        std::memcpy(&footer, m_file.m_data + m_file.m_size - sizeof(footer), sizeof(footer));
+        if (std::memcmp(footer.magic, trajectory_index_magic, sizeof(footer.magic)) != 0) {
+            return false;
+        }
+        const uint64_t index_end = m_file.m_size - sizeof(footer);
+        if (footer.index_offset > index_end || (index_end - footer.index_offset) / sizeof(TrajectoryIndexEntry) != footer.chunk_count) {
+            return false;
+        }
+        m_index.resize(footer.chunk_count);
+        std::memcpy(m_index.data(), m_file.m_data + footer.index_offset, m_index.size() * sizeof(TrajectoryIndexEntry));
+        return true;
+    }
+
+    // Rebuilds the index from the chunk headers, an incomplete last chunk is ignored
+    void scanChunks()
+    {
+        m_index.clear();
+        uint64_t offset = sizeof(TrajectoryHeader);
+        while (offset + sizeof(TrajectoryChunk) <= m_file.m_size) {
+            TrajectoryChunk chunk;
+            std::memcpy(&chunk, m_file.m_data + offset, sizeof(chunk));
+            if (std::memcmp(chunk.magic, trajectory_chunk_magic, sizeof(chunk.magic)) != 0
+                || chunk.stored_size > m_file.m_size - offset - sizeof(TrajectoryChunk)) {
+                break;
+            }
+            m_index.push_back({chunk.first_frame, chunk.last_frame, offset});
+            offset += sizeof(TrajectoryChunk) + chunk.stored_size;
+        }
+    }
+
+    bool loadChunk(uint64_t i)
+    {
+        m_has_frame = false;
+        const uint64_t offset = m_index[i].offset;
+        if (offset > m_file.m_size || m_file.m_size - offset < sizeof(TrajectoryChunk)) {
+            return false;
+        }
+        TrajectoryChunk chunk;
+        std::memcpy(&chunk, m_file.m_data + offset, sizeof(chunk));
+        const uint8_t* const src = m_file.m_data + offset + sizeof(TrajectoryChunk);
+        if (std::memcmp(chunk.magic, trajectory_chunk_magic, sizeof(chunk.magic)) != 0
+            || chunk.stored_size > m_file.m_size - offset - sizeof(TrajectoryChunk)) {
+            return false;
+        }
+        m_chunk.resize(chunk.raw_size);
+        if (chunk.codec == SnapshotCodecKind::Raw) {
+            if (chunk.stored_size != chunk.raw_size) {
+                return false;
+            }
+            std::memcpy(m_chunk.data(), src, m_chunk.size());
+        } else {
+            m_shuffled.resize(chunk.raw_size);
+            if (!SnapshotCodec::decompress(src, chunk.stored_size, m_shuffled.data(), m_shuffled.size())) {
+                return false;
+            }
+            SnapshotCodec::unshuffle(m_shuffled.data(), m_shuffled.size(), sizeof(uint16_t), m_chunk.data());
+        }
+        m_current_chunk = i;
+        m_cursor        = 0;
+        m_qx.clear();
+        m_qy.clear();
+        return true;
+    }
+
+    bool applyFrame()
+    {
+        if (m_chunk.size() - m_cursor < sizeof(TrajectoryFrame)) {
+            return false;
+        }
+        TrajectoryFrame frame;
+        std::memcpy(&frame, m_chunk.data() + m_cursor, sizeof(frame));
+        const uint64_t count = frame.object_count;
+        if ((m_chunk.size() - m_cursor - sizeof(frame)) / (2 * sizeof(uint16_t)) < count) {
+            return false;
+        }
+        const uint8_t* const dx = m_chunk.data() + m_cursor + sizeof(frame);
+        const uint8_t* const dy = dx + count * sizeof(uint16_t);
+        m_qx.resize(count, 0);
+        m_qy.resize(count, 0);
+        positions.resize(count);
+        for (uint64_t i{0}; i < count; ++i) {
+            uint16_t delta_x;
+            uint16_t delta_y;
+            std::memcpy(&delta_x, dx + i * sizeof(uint16_t), sizeof(uint16_t));
+            std::memcpy(&delta_y, dy + i * sizeof(uint16_t), sizeof(uint16_t));
+            m_qx[i] = static_cast<uint16_t>(m_qx[i] + delta_x);
+            m_qy[i] = static_cast<uint16_t>(m_qy[i] + delta_y);
+            positions[i] = {dequantizePosition(m_qx[i], m_header.world_width), dequantizePosition(m_qy[i], m_header.world_height)};
+        }
+        m_cursor += sizeof(frame) + count * 2 * sizeof(uint16_t);
+        m_current_frame = frame.frame;
+        m_has_frame     = true;
+        return true;
+    }
+};
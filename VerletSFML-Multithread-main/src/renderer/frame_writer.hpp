@@ -0,0 +1,207 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <SFML/Graphics/Image.hpp>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+
+enum class FrameFormat
+{
+    // One <path>_<frame>.png file per frame, encoded by SFML
+    Png,
+    // One <path>_<frame>.ppm file per frame, binary RGB
+    Ppm,
+    // RGB24 frames back to back in a single file, "-" for stdout, e.g. piped to
+    // ffmpeg -f rawvideo -pixel_format rgb24 -video_size WxH -framerate 60 -i - out.mp4
+    Raw
+};
+
+/* Writes RGBA frames on a dedicated I/O thread so encoding overlaps the simulation and rendering of
+   the next frames. Unlike TrajectoryRecorder nothing is dropped: these are offline dumps, write()
+   waits when ring_size frames are already pending. */
+struct FrameWriter
+{
+    static constexpr uint32_t ring_size = 3;
+
+    struct Slot
+    {
+        uint64_t             frame = 0;
+        std::vector<uint8_t> pixels;
+    };
+
+    FrameFormat m_format = FrameFormat::Png;
+    std::string m_path;
+    uint32_t    m_width  = 0;
+    uint32_t    m_height = 0;
+    bool        m_open   = false;
+    // Set by the I/O thread when a file could not be written
+    bool        m_failed = false;
+
+    Slot                    m_ring[ring_size];
+    uint64_t                m_head = 0;
+    uint64_t                m_tail = 0;
+    bool                    m_stopping = false;
+    std::thread             m_io_thread;
+    std::mutex              m_mutex;
+    std::condition_variable m_condition;
+
+    // Only used by the I/O thread
+    std::ofstream        m_stream;
+    std::vector<uint8_t> m_rgb;
+
+    FrameWriter() = default;
+
+    ~FrameWriter()
+    {
+        close();
+    }
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    bool open(FrameFormat format, const std::string& path, uint32_t width, uint32_t height)
+    {
+        close();
+        m_format = format;
+        m_path   = path;
+        m_width  = width;
+        m_height = height;
+        if (format == FrameFormat::Raw) {
+            if (path == "-") {
+#ifdef _WIN32
+                _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            } else {
+                m_stream.open(path, std::ios::binary | std::ios::trunc);
+                if (!m_stream) {
+                    return false;
+                }
+            }
+        }
+        for (Slot& slot : m_ring) {
+            slot.pixels.resize(static_cast<size_t>(width) * height * 4);
+        }
+        m_head = m_tail = 0;
+        m_stopping = false;
+        m_failed   = false;
+        m_open     = true;
+        m_io_thread = std::thread([this](){
+            writeLoop();
+        });
+        return true;
+    }
+
+    // Writes the pending frames then stops the I/O thread
+    void close()
+    {
+        if (!m_open) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock_guard{m_mutex};
+            m_stopping = true;
+        }
+        m_condition.notify_all();
+        m_io_thread.join();
+        m_stream.close();
+        m_open = false;
+    }
+
+    // Copies width x height RGBA pixels, waits if the I/O thread is ring_size frames behind
+    bool write(const uint8_t* pixels, uint64_t frame)
+    {
+        Slot* slot = nullptr;
+        {
+            std::unique_lock<std::mutex> lock{m_mutex};
+            m_condition.wait(lock, [this]{ return m_head - m_tail < ring_size || m_failed; });
+            if (m_failed) {
+                return false;
+            }
+            slot = &m_ring[m_head % ring_size];
+        }
+        // The I/O thread doesn't touch the slot until m_head moves past it
+        slot->frame = frame;
+        std::copy(pixels, pixels + slot->pixels.size(), slot->pixels.begin());
+        {
+            std::lock_guard<std::mutex> lock_guard{m_mutex};
+            ++m_head;
+        }
+        m_condition.notify_all();
+        return true;
+    }
+
+private:
+    void writeLoop()
+    {
+        while (true) {
+            Slot* slot = nullptr;
+            {
+                std::unique_lock<std::mutex> lock{m_mutex};
+                m_condition.wait(lock, [this]{ return m_head != m_tail || m_stopping; });
+                if (m_head == m_tail) {
+                    return;
+                }
+                slot = &m_ring[m_tail % ring_size];
+            }
+            const bool written = writeFrame(*slot);
+            {
+                std::lock_guard<std::mutex> lock_guard{m_mutex};
+                ++m_tail;
+                m_failed |= !written;
+            }
+            m_condition.notify_all();
+        }
+    }
+
+    std::string framePath(uint64_t frame, const char* extension) const
+    {
+        std::stringstream stream;
+        stream << m_path << '_' << std::setw(6) << std::setfill('0') << frame << extension;
+        return stream.str();
+    }
+
+    void toRgb(const Slot& slot)
+    {
+        m_rgb.resize(static_cast<size_t>(m_width) * m_height * 3);
+        for (size_t i{0}, count{static_cast<size_t>(m_width) * m_height}; i < count; ++i) {
+            m_rgb[3 * i + 0] = slot.pixels[4 * i + 0];
+            m_rgb[3 * i + 1] = slot.pixels[4 * i + 1];
+            m_rgb[3 * i + 2] = slot.pixels[4 * i + 2];
+        }
+    }
+
+    bool writeFrame(const Slot& slot)
+    {
+        if (m_format == FrameFormat::Png) {
+            sf::Image image;
+            image.create(m_width, m_height, slot.pixels.data());
+            return image.saveToFile(framePath(slot.frame, ".png"));
+        }
+        toRgb(slot);
+        const char* const data = reinterpret_cast<const char*>(m_rgb.data());
+        const auto        size = static_cast<std::streamsize>(m_rgb.size());
+        if (m_format == FrameFormat::Ppm) {
+            std::ofstream file(framePath(slot.frame, ".ppm"), std::ios::binary | std::ios::trunc);
+            file << "P6\n" << m_width << ' ' << m_height << "\n255\n";
+            file.write(data, size);
+            return static_cast<bool>(file);
+        }
+        if (m_path == "-") {
+            return std::fwrite(data, 1, m_rgb.size(), stdout) == m_rgb.size() && std::fflush(stdout) == 0;
+        }
+        m_stream.write(data, size);
+        return static_cast<bool>(m_stream);
+    }
+};
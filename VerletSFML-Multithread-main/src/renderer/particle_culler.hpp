@@ -0,0 +1,378 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include <SFML/Graphics/VertexArray.hpp>
+#include "physics/physic_object.hpp"
+#include "engine/render/viewport_handler.hpp"
+#include "engine/common/math.hpp"
+#include "engine/common/utils.hpp"
+#include "engine/common/vec.hpp"
+
+
+// World rectangle seen through the viewport, pixels_per_unit is the zoom
+struct ViewBounds
+{
+    Vec2  m_min;
+    Vec2  m_max;
+    float m_pixels_per_unit = 1.0f;
+
+    // focus is the world position at the center of a render target of render_size pixels
+    static ViewBounds fromView(Vec2 focus, Vec2 render_size, float zoom)
+    {
+        const Vec2 half_size = render_size / (2.0f * zoom);
+        return {focus - half_size, focus + half_size, zoom};
+    }
+
+    static ViewBounds fromViewport(const ViewportHandler::State& state)
+    {
+        return fromView(state.offset, 2.0f * state.center, state.zoom);
+    }
+};
+
+enum class ParticleDetail
+{
+    // One textured quad per visible object
+    Particles,
+    // One untextured quad per block of cells, see ParticleCuller::m_density_threshold
+    Density
+};
+
+/* Builds the vertex arrays of the visible objects only, walking the cells of the solver grid that
+   intersect the view instead of every object. The grid is the one of the last sub step, objects moved
+   less than a cell since so the visible range is widened by one cell; objects of the hierarchy levels
+   (radius above the default) are few and tested one by one. The visible cells of a column are consecutive
+   in every grid: a range of x * height + y in the dense grids, the occupied cells of the column between two
+   binary searches on y in a sparse grid, which only walks its occupied columns.
+   When a default object would be smaller than m_density_threshold pixels, blocks of cells about that
+   many pixels wide are drawn instead as a single quad of the mean object color, with an alpha equal to
+   the share of the block covered by objects. */
+struct ParticleCuller
+{
+    static constexpr float texture_size = 1024.0f;
+
+    // Diameter in pixels of a default object under which the density impostors are drawn
+    float           m_density_threshold = 1.0f;
+    ParticleDetail  m_detail            = ParticleDetail::Particles;
+    sf::VertexArray m_particles{sf::Quads};
+    sf::VertexArray m_impostors{sf::Quads};
+    // Quads written by the last build, in m_particles or m_impostors depending on m_detail
+    uint32_t        m_quad_count        = 0;
+
+    template<typename TSolver, typename TThreadPool>
+    void build(const TSolver& solver, const ViewBounds& view, TThreadPool& thread_pool)
+    {
+        if (view.m_pixels_per_unit * 2.0f * PhysicObject::default_radius < m_density_threshold) {
+            m_detail = ParticleDetail::Density;
+            buildImpostors(solver, view, thread_pool);
+        } else {
+            m_detail = ParticleDetail::Particles;
+            buildParticles(solver, view, thread_pool);
+        }
+    }
+
+private:
+    // Visible cells of the solver grid, inclusive. Not clamped for sparse grids, which have no bounds
+    struct CellRange
+    {
+        int32_t x0, x1, y0, y1;
+
+        [[nodiscard]]
+        bool empty() const
+        {
+            return x0 > x1 || y0 > y1;
+        }
+    };
+
+    // Sum of the objects of a block of cells, colors weighted by the object area
+    struct BlockSum
+    {
+        float r = 0.0f, g = 0.0f, b = 0.0f;
+        float area = 0.0f;
+
+        void add(const PhysicObject& object)
+        {
+            const float a = object.radius * object.radius * Math::PI;
+            r    += a * to<float>(object.color.r);
+            g    += a * to<float>(object.color.g);
+            b    += a * to<float>(object.color.b);
+            area += a;
+        }
+    };
+
+    // Visible cells [m_first, m_last) of column m_x
+    struct ColumnCells
+    {
+        int32_t  m_x;
+        uint32_t m_first;
+        uint32_t m_last;
+    };
+
+    std::vector<ColumnCells> m_columns;
+    std::vector<uint32_t> m_column_offsets;
+    std::vector<uint32_t> m_large;
+    std::vector<BlockSum> m_blocks;
+
+    template<typename TGrid>
+    static CellRange visibleCells(const TGrid& grid, const ViewBounds& view)
+    {
+        CellRange range{to<int32_t>(std::floor(view.m_min.x)) - 1, to<int32_t>(std::floor(view.m_max.x)) + 1,
+                        to<int32_t>(std::floor(view.m_min.y)) - 1, to<int32_t>(std::floor(view.m_max.y)) + 1};
+        if constexpr (!TGrid::sparse) {
+            range.x0 = std::max(range.x0, 0);
+            range.x1 = std::min(range.x1, grid.width - 1);
+            range.y0 = std::max(range.y0, 0);
+            range.y1 = std::min(range.y1, grid.height - 1);
+        }
+        return range;
+    }
+
+    // First cell of [first, last) at row y or below it, cells of an occupied column are sorted by y
+    template<typename TGrid>
+    static uint32_t lowerRow(const TGrid& grid, uint32_t first, uint32_t last, int32_t y)
+    {
+        while (first < last) {
+            const uint32_t middle = first + (last - first) / 2;
+            if (grid.cellY(middle) < y) {
+                first = middle + 1;
+            } else {
+                last = middle;
+            }
+        }
+        return first;
+    }
+
+    // Fills m_columns with the columns of the range holding visible cells
+    template<typename TGrid>
+    void visibleColumns(const TGrid& grid, const CellRange& range)
+    {
+        m_columns.clear();
+        if (range.empty()) {
+            return;
+        }
+        if constexpr (TGrid::sparse) {
+            // Occupied columns are sorted by x, the first one in the range is found by binary search
+            const uint32_t column_count = to<uint32_t>(grid.width);
+            uint32_t       column       = 0;
+            for (uint32_t last{column_count}; column < last;) {
+                const uint32_t middle = column + (last - column) / 2;
+                if (grid.cellX(grid.columnBegin(middle)) < range.x0) {
+                    column = middle + 1;
+                } else {
+                    last = middle;
+                }
+            }
+            for (; column < column_count && grid.cellX(grid.columnBegin(column)) <= range.x1; ++column) {
+                const uint32_t end   = grid.columnBegin(column + 1);
+                const uint32_t first = lowerRow(grid, grid.columnBegin(column), end, range.y0);
+                const uint32_t last  = lowerRow(grid, first, end, range.y1 + 1);
+                if (first < last) {
+                    m_columns.push_back({grid.cellX(first), first, last});
+                }
+            }
+        } else {
+            const uint32_t rows = to<uint32_t>(range.y1 - range.y0 + 1);
+            for (int32_t x{range.x0}; x <= range.x1; ++x) {
+                const uint32_t first = to<uint32_t>(x * grid.height + range.y0);
+                m_columns.push_back({x, first, first + rows});
+            }
+        }
+    }
+
+    static bool overlaps(const PhysicObject& object, const ViewBounds& view)
+    {
+        const float r = object.radius;
+        return object.position.x + r >= view.m_min.x && object.position.x - r <= view.m_max.x &&
+               object.position.y + r >= view.m_min.y && object.position.y - r <= view.m_max.y;
+    }
+
+    // Visible objects above the default radius, they are not in the solver grid
+    template<typename TSolver>
+    void collectLarge(const TSolver& solver, const ViewBounds& view)
+    {
+        m_large.clear();
+        if (!solver.variable_radius) {
+            return;
+        }
+        for (const auto& level : solver.hierarchy.m_levels) {
+            for (const uint32_t id : level.m_ids) {
+                if (id < solver.objects.size() && overlaps(solver.objects.data[id], view)) {
+                    m_large.push_back(id);
+                }
+            }
+        }
+    }
+
+    static void writeQuad(sf::Vertex* quad, const PhysicObject& object)
+    {
+        const float r = object.radius;
+        quad[0].position  = object.position + Vec2{-r, -r};
+        quad[1].position  = object.position + Vec2{ r, -r};
+        quad[2].position  = object.position + Vec2{ r,  r};
+        quad[3].position  = object.position + Vec2{-r,  r};
+        quad[0].texCoords = {0.0f        , 0.0f};
+        quad[1].texCoords = {texture_size, 0.0f};
+        quad[2].texCoords = {texture_size, texture_size};
+        quad[3].texCoords = {0.0f        , texture_size};
+        for (uint32_t k{0}; k < 4; ++k) {
+            quad[k].color = object.color;
+        }
+    }
+
+    template<typename TSolver, typename TThreadPool>
+    void buildParticles(const TSolver& solver, const ViewBounds& view, TThreadPool& thread_pool)
+    {
+        const auto& grid = solver.grid;
+        visibleColumns(grid, visibleCells(grid, view));
+        collectLarge(solver, view);
+        // Objects per visible column, then their offsets in the vertex array
+        const uint32_t columns = to<uint32_t>(m_columns.size());
+        m_column_offsets.resize(columns + 1);
+        thread_pool.dispatch(columns, [&](uint32_t start, uint32_t end) {
+            for (uint32_t c{start}; c < end; ++c) {
+                uint32_t count = 0;
+                for (uint32_t p{m_columns[c].m_first}; p < m_columns[c].m_last; ++p) {
+                    count += grid.cell(p).objects_count;
+                }
+                m_column_offsets[c + 1] = count;
+            }
+        });
+        m_column_offsets[0] = 0;
+        for (uint32_t c{0}; c < columns; ++c) {
+            m_column_offsets[c + 1] += m_column_offsets[c];
+        }
+        m_quad_count = m_column_offsets[columns] + to<uint32_t>(m_large.size());
+        m_particles.resize(m_quad_count * 4);
+        if (m_quad_count == 0) {
+            return;
+        }
+
+        sf::Vertex* const         vertices = &m_particles[0];
+        const PhysicObject* const objects  = solver.objects.data.data();
+        const uint32_t            count    = to<uint32_t>(solver.objects.size());
+        thread_pool.dispatch(columns, [&](uint32_t start, uint32_t end) {
+            for (uint32_t c{start}; c < end; ++c) {
+                sf::Vertex* quad = vertices + 4 * m_column_offsets[c];
+                for (uint32_t p{m_columns[c].m_first}; p < m_columns[c].m_last; ++p) {
+                    const auto& cell = grid.cell(p);
+                    for (uint32_t k{0}; k < cell.objects_count; ++k, quad += 4) {
+                        // Objects removed since the grid was built are drawn collapsed
+                        if (cell.objects[k] < count) {
+                            writeQuad(quad, objects[cell.objects[k]]);
+                        } else {
+                            std::fill(quad, quad + 4, sf::Vertex{});
+                        }
+                    }
+                }
+            }
+        });
+        sf::Vertex* quad = vertices + 4 * (m_quad_count - to<uint32_t>(m_large.size()));
+        for (const uint32_t id : m_large) {
+            writeQuad(quad, objects[id]);
+            quad += 4;
+        }
+    }
+
+    template<typename TSolver, typename TThreadPool>
+    void buildImpostors(const TSolver& solver, const ViewBounds& view, TThreadPool& thread_pool)
+    {
+        using Grid = std::decay_t<decltype(solver.grid)>;
+        const auto&               grid    = solver.grid;
+        const PhysicObject* const objects = solver.objects.data.data();
+        const uint32_t            count   = to<uint32_t>(solver.objects.size());
+        CellRange                 range   = visibleCells(grid, view);
+        visibleColumns(grid, range);
+        collectLarge(solver, view);
+        if constexpr (Grid::sparse) {
+            // The view range is not clamped, blocks only cover the visible part of the occupied cells
+            CellRange occupied{range.x1 + 1, range.x0 - 1, range.y1 + 1, range.y0 - 1};
+            const auto include = [&](int32_t x, int32_t y) {
+                occupied.x0 = std::min(occupied.x0, std::max(x, range.x0));
+                occupied.x1 = std::max(occupied.x1, std::min(x, range.x1));
+                occupied.y0 = std::min(occupied.y0, std::max(y, range.y0));
+                occupied.y1 = std::max(occupied.y1, std::min(y, range.y1));
+            };
+            for (const ColumnCells& column : m_columns) {
+                include(column.m_x, grid.cellY(column.m_first));
+                include(column.m_x, grid.cellY(column.m_last - 1));
+            }
+            for (const uint32_t id : m_large) {
+                include(to<int32_t>(objects[id].position.x), to<int32_t>(objects[id].position.y));
+            }
+            range = occupied;
+        }
+        if (range.empty()) {
+            m_quad_count = 0;
+            m_impostors.resize(0);
+            return;
+        }
+        // Blocks of block x block cells, about m_density_threshold pixels wide
+        const uint32_t block   = std::max(1u, to<uint32_t>(std::ceil(m_density_threshold / view.m_pixels_per_unit)));
+        const uint32_t columns = to<uint32_t>(range.x1 - range.x0) / block + 1;
+        const uint32_t rows    = to<uint32_t>(range.y1 - range.y0) / block + 1;
+        m_blocks.assign(columns * rows, BlockSum{});
+
+        // A task per column of blocks, no two tasks write the same block
+        thread_pool.dispatch(columns, [&](uint32_t start, uint32_t end) {
+            const auto column_of = [](const ColumnCells& column, int32_t x) { return column.m_x < x; };
+            for (uint32_t bx{start}; bx < end; ++bx) {
+                const int32_t x_begin = range.x0 + to<int32_t>(bx * block);
+                const int32_t x_end   = std::min(x_begin + to<int32_t>(block), range.x1 + 1);
+                for (auto column = std::lower_bound(m_columns.begin(), m_columns.end(), x_begin, column_of);
+                     column != m_columns.end() && column->m_x < x_end; ++column) {
+                    for (uint32_t p{column->m_first}; p < column->m_last; ++p) {
+                        int32_t y = range.y0 + to<int32_t>(p - column->m_first);
+                        if constexpr (Grid::sparse) {
+                            y = grid.cellY(p);
+                        }
+                        const auto& cell = grid.cell(p);
+                        BlockSum&   sum  = m_blocks[bx * rows + to<uint32_t>(y - range.y0) / block];
+                        for (uint32_t k{0}; k < cell.objects_count; ++k) {
+                            if (cell.objects[k] < count) {
+                                sum.add(objects[cell.objects[k]]);
+                            }
+                        }
+                    }
+                }
+            }
+        });
+        // Objects of the hierarchy levels count in the block of their center
+        for (const uint32_t id : m_large) {
+            const int32_t x = to<int32_t>(objects[id].position.x) - range.x0;
+            const int32_t y = to<int32_t>(objects[id].position.y) - range.y0;
+            if (x >= 0 && y >= 0 && x <= range.x1 - range.x0 && y <= range.y1 - range.y0) {
+                m_blocks[to<uint32_t>(x) / block * rows + to<uint32_t>(y) / block].add(objects[id]);
+            }
+        }
+
+        m_quad_count = columns * rows;
+        m_impostors.resize(m_quad_count * 4);
+        sf::Vertex* const vertices   = &m_impostors[0];
+        const float       block_area = to<float>(block * block);
+        thread_pool.dispatch(columns, [&](uint32_t start, uint32_t end) {
+            for (uint32_t bx{start}; bx < end; ++bx) {
+                for (uint32_t by{0}; by < rows; ++by) {
+                    const BlockSum& sum  = m_blocks[bx * rows + by];
+                    sf::Vertex*     quad = vertices + 4 * (bx * rows + by);
+                    const Vec2 min{to<float>(range.x0 + to<int32_t>(bx * block)), to<float>(range.y0 + to<int32_t>(by * block))};
+                    const Vec2 max = min + Vec2{to<float>(block), to<float>(block)};
+                    quad[0].position = min;
+                    quad[1].position = {max.x, min.y};
+                    quad[2].position = max;
+                    quad[3].position = {min.x, max.y};
+                    sf::Color color = sf::Color::Transparent;
+                    if (sum.area > 0.0f) {
+                        const float coverage = std::min(sum.area / block_area, 1.0f);
+                        color = sf::Color{to<uint8_t>(sum.r / sum.area), to<uint8_t>(sum.g / sum.area), to<uint8_t>(sum.b / sum.area),
+                                          to<uint8_t>(coverage * 255.0f)};
+                    }
+                    for (uint32_t k{0}; k < 4; ++k) {
+                        quad[k].color = color;
+                    }
+                }
+            }
+        });
+    }
+};
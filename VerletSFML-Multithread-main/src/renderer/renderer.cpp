@@ -1,10 +1,12 @@
 #include "renderer.hpp"
+#include <iomanip>
+#include "engine/common/color_utils.hpp"
+#include "engine/common/profiler.hpp"
 
 
-Renderer::Renderer(PhysicSolver& solver_, tp::ThreadPool& tp)
+Renderer::Renderer(PhysicSolver<>& solver_, tp::ThreadPool& tp)
     : solver{solver_}
     , world_va{sf::Quads, 4}
-    , objects_va{sf::Quads}
     , thread_pool{tp}
 {
     initializeWorldVA();
@@ -12,19 +14,32 @@ Renderer::Renderer(PhysicSolver& solver_, tp::ThreadPool& tp)
     object_texture.loadFromFile("res/circle.png");
     object_texture.generateMipmap();
     object_texture.setSmooth(true);
+
+    hud_has_font = hud_font.loadFromFile("res/font.ttf");
+    hud_text.setFont(hud_font);
+    hud_text.setCharacterSize(16);
+    hud_text.setFillColor(sf::Color::White);
 }
 
 void Renderer::render(RenderContext& context)
 {
-    renderHUD(context);
     context.draw(world_va);
 
     sf::RenderStates states;
     states.texture = &object_texture;
     context.draw(world_va, states);
     // Particles
-    updateParticlesVA();
-    context.draw(objects_va, states);
+    updateParticlesVA(ViewBounds::fromViewport(context.getViewportState()));
+    {
+        // SFML sends the vertex array to the GPU on each draw
+        PROFILE_PHASE(prof::Phase::Upload);
+        if (culler.m_detail == ParticleDetail::Density) {
+            context.draw(culler.m_impostors);
+        } else {
+            context.draw(culler.m_particles, states);
+        }
+    }
+    renderHUD(context);
 }
 
 void Renderer::initializeWorldVA()
@@ -42,46 +57,53 @@ void Renderer::initializeWorldVA()
     world_va[3].color = background_color;
 }
 
-void Renderer::updateParticlesVA()
+void Renderer::updateParticlesVA(const ViewBounds& view)
 {
-    objects_va.resize(solver.objects.size() * 4);
-
-    const float texture_size = 1024.0f;
-    const float radius       = 0.5f;
-    thread_pool.dispatch(to<uint32_t>(solver.objects.size()), [&](uint32_t start, uint32_t end) {
-        for (uint32_t i{start}; i < end; ++i) {
-            const PhysicObject& object = solver.objects.data[i];
-            const uint32_t idx = i << 2;
-            objects_va[idx + 0].position = object.position + Vec2{-radius, -radius};
-            objects_va[idx + 1].position = object.position + Vec2{ radius, -radius};
-            objects_va[idx + 2].position = object.position + Vec2{ radius,  radius};
-            objects_va[idx + 3].position = object.position + Vec2{-radius,  radius};
-            objects_va[idx + 0].texCoords = {0.0f        , 0.0f};
-            objects_va[idx + 1].texCoords = {texture_size, 0.0f};
-            objects_va[idx + 2].texCoords = {texture_size, texture_size};
-            objects_va[idx + 3].texCoords = {0.0f        , texture_size};
-
-            const sf::Color color = object.color;
-            objects_va[idx + 0].color = color;
-            objects_va[idx + 1].color = color;
-            objects_va[idx + 2].color = color;
-            objects_va[idx + 3].color = color;
-        }
-    });
+    PROFILE_PHASE(prof::Phase::RenderBuild);
+    culler.build(solver, view, thread_pool);
 }
 
-void Renderer::renderHUD(RenderContext&)
+void Renderer::renderHUD(RenderContext& context)
 {
-    // HUD
-    /*const float margin    = 20.0f;
-    float       current_y = margin;
-    text_time.setString("Simulation time: " + toString(phys_time.get()) + "ms");
-    text_time.setPosition({margin, current_y});
-    current_y += text_time.getBounds().y + 0.5f * margin;
-    context.renderToHUD(text_time, RenderContext::Mode::Normal);
+    // One bar per phase, its length is the mean duration over the last frames
+    const float margin      = 20.0f;
+    const float bar_height  = 12.0f;
+    const float row_height  = 24.0f;
+    const float px_per_ms   = 40.0f;
+    const float label_width = hud_has_font ? 260.0f : 0.0f;
+    const prof::Profiler& profiler = prof::Profiler::get();
+    float current_y = margin;
+    for (uint32_t i{0}; i < prof::phase_count; ++i) {
+        const auto  phase = static_cast<prof::Phase>(i);
+        const float ms    = profiler.phaseMs(phase);
+        const float idle  = profiler.idleRatio(phase);
+        if (hud_has_font) {
+            std::stringstream label;
+            label << prof::phaseName(phase) << ": " << std::fixed << std::setprecision(2) << ms << "ms";
+            if (idle > 0.0f) {
+                label << " (" << to<int32_t>(idle * 100.0f) << "% idle)";
+            }
+            hud_text.setString(label.str());
+            hud_text.setPosition({margin, current_y - 4.0f});
+            context.drawDirect(hud_text);
+        }
+        const sf::Color color = ColorUtils::getRainbow(to<float>(i) * 0.5f);
+        hud_bar.setPosition({margin + label_width, current_y});
+        hud_bar.setSize({std::min(ms * px_per_ms, 600.0f), bar_height});
+        hud_bar.setFillColor(color);
+        context.drawDirect(hud_bar);
+        // Waiting share of the collision passes drawn as a darker tail
+        if (idle > 0.0f) {
+            hud_bar.setSize({std::min(ms * px_per_ms, 600.0f) * idle, bar_height * 0.5f});
+            hud_bar.setFillColor(sf::Color(color.r / 3, color.g / 3, color.b / 3));
+            context.drawDirect(hud_bar);
+        }
+        current_y += row_height;
+    }
 
-    text_objects.setString("Objects: " + toString(simulation.solver.objects.size()));
-    text_objects.setPosition({margin, current_y});
-    current_y += text_objects.getBounds().y + 0.5f * margin;
-    context.renderToHUD(text_objects, RenderContext::Mode::Normal);*/
+    if (hud_has_font) {
+        hud_text.setString("Objects: " + toString(solver.objects.size()) + "  Quads: " + toString(culler.m_quad_count));
+        hud_text.setPosition({margin, current_y});
+        context.drawDirect(hud_text);
+    }
 }
@@ -2,26 +2,34 @@
 #include <SFML/Graphics.hpp>
 #include "physics/physics.hpp"
 #include "engine/window_context_handler.hpp"
+#include "renderer/particle_culler.hpp"
 
 
 struct Renderer
 {
-    PhysicSolver& solver;
+    PhysicSolver<>& solver;
 
     sf::VertexArray world_va;
-    sf::VertexArray objects_va;
+    // Quads of the visible objects, or density impostors when zoomed out
+    ParticleCuller  culler;
     sf::Texture     object_texture;
 
+    // HUD, the phase timings are drawn as bars and labelled only if res/font.ttf exists
+    sf::RectangleShape hud_bar;
+    sf::Font           hud_font;
+    sf::Text           hud_text;
+    bool               hud_has_font = false;
+
     tp::ThreadPool& thread_pool;
 
     explicit
-    Renderer(PhysicSolver& solver_, tp::ThreadPool& tp);
+    Renderer(PhysicSolver<>& solver_, tp::ThreadPool& tp);
 
     void render(RenderContext& context);
 
     void initializeWorldVA();
 
-    void updateParticlesVA();
+    void updateParticlesVA(const ViewBounds& view);
 
     void renderHUD(RenderContext& context);
 };
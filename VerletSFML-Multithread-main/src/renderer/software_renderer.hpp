@@ -0,0 +1,293 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <SFML/Graphics/Image.hpp>
+#include "renderer/particle_culler.hpp"
+#include "engine/common/utils.hpp"
+#include "engine/common/vec.hpp"
+
+
+/* CPU rasterizer of the ParticleCuller quads, for machines without a GPU or a display.
+   Draws the same scene as Renderer: the world background then one sprite per visible object (or the
+   density impostors), alpha blended in order into an RGBA framebuffer.
+   The framebuffer is cut in tiles of tile_size pixels. Quads are binned in parallel by contiguous
+   chunks: each chunk counts then writes the quads it has in every tile, and the per tile lists are the
+   chunks concatenated in order, so every tile sees its quads in draw order. Tiles are then filled in
+   parallel, each by a single thread, and the image does not depend on the thread count.
+   The sprite is sampled with the nearest texel of the mip level closest to the quad size. */
+struct SoftwareRenderer
+{
+    static constexpr uint32_t tile_size   = 64;
+    static constexpr uint32_t chunk_count = 64;
+
+    struct MipLevel
+    {
+        uint32_t             m_size = 0;
+        // RGBA, m_size x m_size
+        std::vector<uint8_t> m_texels;
+    };
+
+    uint32_t             m_width  = 0;
+    uint32_t             m_height = 0;
+    // RGBA, row major, the layout of sf::Image
+    std::vector<uint8_t> m_pixels;
+    sf::Color            m_clear_color      = sf::Color::Black;
+    sf::Color            m_background_color = {50, 50, 50};
+
+    SoftwareRenderer(uint32_t width, uint32_t height)
+        : m_width{width}
+        , m_height{height}
+        , m_pixels(to<size_t>(width) * height * 4)
+        , m_tiles_x{(width + tile_size - 1) / tile_size}
+        , m_tiles_y{(height + tile_size - 1) / tile_size}
+    {}
+
+    // Square power of two sprite, mip levels are 2x2 box filtered down to 1x1
+    bool loadSprite(const std::string& path)
+    {
+        sf::Image image;
+        if (!image.loadFromFile(path)) {
+            return false;
+        }
+        const sf::Vector2u size = image.getSize();
+        if (size.x != size.y || size.x == 0 || (size.x & (size.x - 1))) {
+            return false;
+        }
+        m_levels.clear();
+        m_levels.push_back({size.x, {image.getPixelsPtr(), image.getPixelsPtr() + to<size_t>(size.x) * size.y * 4}});
+        while (m_levels.back().m_size > 1) {
+            const MipLevel& parent = m_levels.back();
+            MipLevel level{parent.m_size / 2, {}};
+            level.m_texels.resize(to<size_t>(level.m_size) * level.m_size * 4);
+            for (uint32_t y{0}; y < level.m_size; ++y) {
+                for (uint32_t x{0}; x < level.m_size; ++x) {
+                    for (uint32_t c{0}; c < 4; ++c) {
+                        const auto texel = [&](uint32_t tx, uint32_t ty) {
+                            return to<uint32_t>(parent.m_texels[(to<size_t>(ty) * parent.m_size + tx) * 4 + c]);
+                        };
+                        const uint32_t sum = texel(2 * x, 2 * y) + texel(2 * x + 1, 2 * y) + texel(2 * x, 2 * y + 1) + texel(2 * x + 1, 2 * y + 1);
+                        level.m_texels[(to<size_t>(y) * level.m_size + x) * 4 + c] = to<uint8_t>((sum + 2) / 4);
+                    }
+                }
+            }
+            m_levels.push_back(std::move(level));
+        }
+        return true;
+    }
+
+    template<typename TThreadPool>
+    void render(const ParticleCuller& culler, const ViewBounds& view, Vec2 world_size, TThreadPool& thread_pool)
+    {
+        const bool             density  = culler.m_detail == ParticleDetail::Density;
+        const sf::VertexArray& vertices = density ? culler.m_impostors : culler.m_particles;
+        prepareQuads(vertices, culler.m_quad_count, view, thread_pool);
+        binQuads(thread_pool);
+
+        const Vec2 world_min = toScreen({0.0f, 0.0f}, view);
+        const Vec2 world_max = toScreen(world_size, view);
+        thread_pool.dispatch(m_tiles_x * m_tiles_y, [&](uint32_t start, uint32_t end) {
+            for (uint32_t t{start}; t < end; ++t) {
+                renderTile(t, world_min, world_max, !density && !m_levels.empty());
+            }
+        });
+    }
+
+    // Screen coordinates in pixels, the transform of the SFML view
+    static Vec2 toScreen(Vec2 position, const ViewBounds& view)
+    {
+        return (position - view.m_min) * view.m_pixels_per_unit;
+    }
+
+private:
+    // Quad in screen space with its color
+    struct ScreenQuad
+    {
+        float     x0, y0, x1, y1;
+        sf::Color color;
+    };
+
+    // Pixels whose center is in a screen rectangle, clipped to a tile
+    struct PixelRange
+    {
+        int32_t x0, x1, y0, y1;
+    };
+
+    uint32_t                m_tiles_x;
+    uint32_t                m_tiles_y;
+    std::vector<MipLevel>   m_levels;
+    std::vector<ScreenQuad> m_quads;
+    // Quads of each chunk in each tile, chunk major, then their offsets in m_tile_quads
+    std::vector<uint32_t>   m_chunk_counts;
+    // Offset in m_tile_quads of the quads of each tile, tile count + 1 entries
+    std::vector<uint32_t>   m_tile_offsets;
+    std::vector<uint32_t>   m_tile_quads;
+
+    template<typename TThreadPool>
+    void prepareQuads(const sf::VertexArray& vertices, uint32_t quad_count, const ViewBounds& view, TThreadPool& thread_pool)
+    {
+        m_quads.resize(quad_count);
+        thread_pool.dispatch(quad_count, [&](uint32_t start, uint32_t end) {
+            for (uint32_t i{start}; i < end; ++i) {
+                // Culler quads are axis aligned, vertex 0 is the top left corner and vertex 2 the bottom right one
+                const Vec2 min = toScreen(vertices[4 * i].position, view);
+                const Vec2 max = toScreen(vertices[4 * i + 2].position, view);
+                m_quads[i] = {min.x, min.y, max.x, max.y, vertices[4 * i].color};
+            }
+        });
+    }
+
+    bool tileRange(const ScreenQuad& quad, uint32_t& tx0, uint32_t& tx1, uint32_t& ty0, uint32_t& ty1) const
+    {
+        const PixelRange pixels = pixelRange(quad, 0, to<int32_t>(m_width), 0, to<int32_t>(m_height));
+        if (pixels.x0 >= pixels.x1 || pixels.y0 >= pixels.y1 || quad.color.a == 0) {
+            return false;
+        }
+        tx0 = to<uint32_t>(pixels.x0) / tile_size;
+        tx1 = to<uint32_t>(pixels.x1 - 1) / tile_size;
+        ty0 = to<uint32_t>(pixels.y0) / tile_size;
+        ty1 = to<uint32_t>(pixels.y1 - 1) / tile_size;
+        return true;
+    }
+
+    template<typename TThreadPool>
+    void binQuads(TThreadPool& thread_pool)
+    {
+        const uint32_t tile_count = m_tiles_x * m_tiles_y;
+        const uint32_t quad_count = to<uint32_t>(m_quads.size());
+        const uint32_t chunk_size = std::max((quad_count + chunk_count - 1) / chunk_count, 1u);
+        const auto forEachTile = [&](uint32_t chunk, auto&& callback) {
+            const uint32_t end = std::min((chunk + 1) * chunk_size, quad_count);
+            for (uint32_t i{chunk * chunk_size}; i < end; ++i) {
+                uint32_t tx0, tx1, ty0, ty1;
+                if (tileRange(m_quads[i], tx0, tx1, ty0, ty1)) {
+                    for (uint32_t ty{ty0}; ty <= ty1; ++ty) {
+                        for (uint32_t tx{tx0}; tx <= tx1; ++tx) {
+                            callback(i, ty * m_tiles_x + tx);
+                        }
+                    }
+                }
+            }
+        };
+
+        m_chunk_counts.assign(to<size_t>(chunk_count) * tile_count, 0);
+        thread_pool.dispatch(chunk_count, [&](uint32_t start, uint32_t end) {
+            for (uint32_t chunk{start}; chunk < end; ++chunk) {
+                uint32_t* const counts = &m_chunk_counts[to<size_t>(chunk) * tile_count];
+                forEachTile(chunk, [&](uint32_t, uint32_t tile) {
+                    ++counts[tile];
+                });
+            }
+        });
+        // Tile major then chunk major, so each tile lists its quads in order
+        m_tile_offsets.resize(tile_count + 1);
+        uint32_t offset = 0;
+        for (uint32_t tile{0}; tile < tile_count; ++tile) {
+            m_tile_offsets[tile] = offset;
+            for (uint32_t chunk{0}; chunk < chunk_count; ++chunk) {
+                uint32_t& count = m_chunk_counts[to<size_t>(chunk) * tile_count + tile];
+                const uint32_t chunk_quads = count;
+                count   = offset;
+                offset += chunk_quads;
+            }
+        }
+        m_tile_offsets[tile_count] = offset;
+        m_tile_quads.resize(offset);
+        thread_pool.dispatch(chunk_count, [&](uint32_t start, uint32_t end) {
+            for (uint32_t chunk{start}; chunk < end; ++chunk) {
+                uint32_t* const offsets = &m_chunk_counts[to<size_t>(chunk) * tile_count];
+                forEachTile(chunk, [&](uint32_t quad, uint32_t tile) {
+                    m_tile_quads[offsets[tile]++] = quad;
+                });
+            }
+        });
+    }
+
+    static PixelRange pixelRange(const ScreenQuad& quad, int32_t x_min, int32_t x_max, int32_t y_min, int32_t y_max)
+    {
+        // Pixel x is covered when its center x + 0.5 is in [x0, x1)
+        const auto first = [](float v, int32_t min, int32_t max) {
+            return to<int32_t>(std::clamp(std::ceil(v - 0.5f), to<float>(min), to<float>(max)));
+        };
+        return {first(quad.x0, x_min, x_max), first(quad.x1, x_min, x_max),
+                first(quad.y0, y_min, y_max), first(quad.y1, y_min, y_max)};
+    }
+
+    // Source over, src is not premultiplied
+    static void blend(uint8_t* dst, uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+    {
+        const uint32_t inv = 255 - a;
+        dst[0] = to<uint8_t>((r * a + dst[0] * inv + 127) / 255);
+        dst[1] = to<uint8_t>((g * a + dst[1] * inv + 127) / 255);
+        dst[2] = to<uint8_t>((b * a + dst[2] * inv + 127) / 255);
+        dst[3] = to<uint8_t>(a + (dst[3] * inv + 127) / 255);
+    }
+
+    void fill(const PixelRange& range, sf::Color color)
+    {
+        for (int32_t y{range.y0}; y < range.y1; ++y) {
+            uint8_t* row = &m_pixels[(to<size_t>(y) * m_width + to<uint32_t>(range.x0)) * 4];
+            for (int32_t x{range.x0}; x < range.x1; ++x, row += 4) {
+                row[0] = color.r;
+                row[1] = color.g;
+                row[2] = color.b;
+                row[3] = color.a;
+            }
+        }
+    }
+
+    // Smallest level still at least as large as the quad on screen, the GL_NEAREST_MIPMAP_NEAREST choice
+    const MipLevel& mipLevel(float screen_size) const
+    {
+        uint32_t level = 0;
+        while (level + 1 < m_levels.size() && to<float>(m_levels[level + 1].m_size) >= screen_size) {
+            ++level;
+        }
+        return m_levels[level];
+    }
+
+    void renderTile(uint32_t tile, Vec2 world_min, Vec2 world_max, bool textured)
+    {
+        const int32_t x_min = to<int32_t>((tile % m_tiles_x) * tile_size);
+        const int32_t y_min = to<int32_t>((tile / m_tiles_x) * tile_size);
+        const int32_t x_max = std::min(x_min + to<int32_t>(tile_size), to<int32_t>(m_width));
+        const int32_t y_max = std::min(y_min + to<int32_t>(tile_size), to<int32_t>(m_height));
+        fill({x_min, x_max, y_min, y_max}, m_clear_color);
+        fill(pixelRange({world_min.x, world_min.y, world_max.x, world_max.y, m_background_color}, x_min, x_max, y_min, y_max), m_background_color);
+
+        for (uint32_t k{m_tile_offsets[tile]}; k < m_tile_offsets[tile + 1]; ++k) {
+            const ScreenQuad& quad  = m_quads[m_tile_quads[k]];
+            const PixelRange  range = pixelRange(quad, x_min, x_max, y_min, y_max);
+            const sf::Color   color = quad.color;
+            if (!textured) {
+                for (int32_t y{range.y0}; y < range.y1; ++y) {
+                    uint8_t* row = &m_pixels[(to<size_t>(y) * m_width + to<uint32_t>(range.x0)) * 4];
+                    for (int32_t x{range.x0}; x < range.x1; ++x, row += 4) {
+                        blend(row, color.r, color.g, color.b, color.a);
+                    }
+                }
+                continue;
+            }
+            const MipLevel& level   = mipLevel(std::max(quad.x1 - quad.x0, quad.y1 - quad.y0));
+            const float     u_scale = to<float>(level.m_size) / (quad.x1 - quad.x0);
+            const float     v_scale = to<float>(level.m_size) / (quad.y1 - quad.y0);
+            const int32_t   last    = to<int32_t>(level.m_size) - 1;
+            for (int32_t y{range.y0}; y < range.y1; ++y) {
+                const int32_t  v         = std::min(to<int32_t>((to<float>(y) + 0.5f - quad.y0) * v_scale), last);
+                const uint8_t* texel_row = &level.m_texels[to<size_t>(v) * level.m_size * 4];
+                uint8_t*       row       = &m_pixels[(to<size_t>(y) * m_width + to<uint32_t>(range.x0)) * 4];
+                for (int32_t x{range.x0}; x < range.x1; ++x, row += 4) {
+                    const int32_t  u     = std::min(to<int32_t>((to<float>(x) + 0.5f - quad.x0) * u_scale), last);
+                    const uint8_t* texel = texel_row + to<size_t>(u) * 4;
+                    // Texture modulated by the vertex color, as with sf::RenderStates
+                    const uint32_t a = (texel[3] * color.a + 127) / 255;
+                    if (a) {
+                        blend(row, (texel[0] * color.r + 127) / 255, (texel[1] * color.g + 127) / 255, (texel[2] * color.b + 127) / 255, a);
+                    }
+                }
+            }
+        }
+    }
+};
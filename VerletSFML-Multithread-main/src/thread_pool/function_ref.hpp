@@ -0,0 +1,35 @@
+#pragma once
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+
+namespace tp
+{
+
+template<typename TSignature>
+struct FunctionRef;
+
+/* Non owning reference to a callable: only stores its address and a call trampoline so building one
+   never allocates. The callable has to outlive the reference, use it for synchronous calls only. */
+template<typename TReturn, typename... TArgs>
+struct FunctionRef<TReturn(TArgs...)>
+{
+    void*   m_object;
+    TReturn (*m_invoker)(void*, TArgs...);
+
+    template<typename TCallable, typename = std::enable_if_t<!std::is_same_v<std::decay_t<TCallable>, FunctionRef>>>
+    FunctionRef(TCallable&& callable) noexcept
+        : m_object{const_cast<void*>(static_cast<const void*>(std::addressof(callable)))}
+        , m_invoker{[](void* object, TArgs... args) -> TReturn {
+            return (*static_cast<std::remove_reference_t<TCallable>*>(object))(std::forward<TArgs>(args)...);
+        }}
+    {}
+
+    TReturn operator()(TArgs... args) const
+    {
+        return m_invoker(m_object, std::forward<TArgs>(args)...);
+    }
+};
+
+}
@@ -1,150 +1,400 @@
 #pragma once
-#include <functional>
-#include <queue>
-#include <vector>
-#include <thread>
-#include <mutex>
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "function_ref.hpp"
+#include "work_stealing_deque.hpp"
 
 
 namespace tp
 {
 
-struct TaskQueue
+// Only pointers are queued, the submitter owns the job
+struct Job
 {
-    std::queue<std::function<void()>> m_tasks;
-    std::mutex                        m_mutex;
-    std::atomic<uint32_t>             m_remaining_tasks = 0;
+    virtual void execute() = 0;
 
-    template<typename TCallback>
-    void addTask(TCallback&& callback)
-    {
-        std::lock_guard<std::mutex> lock_guard{m_mutex};
-        m_tasks.push(std::forward<TCallback>(callback));
-        m_remaining_tasks++;
-    }
+protected:
+    ~Job() = default;
+};
 
-    void getTask(std::function<void()>& target_callback)
-    {
-        {
-            std::lock_guard<std::mutex> lock_guard{m_mutex};
-            if (m_tasks.empty()) {
-                return;
-            }
-            target_callback = std::move(m_tasks.front());
-            m_tasks.pop();
-        }
-    }
+// Counts down to 0 when a group of jobs is done, owned by the waiting caller (usually on its stack)
+struct Latch
+{
+    std::atomic<uint32_t> m_remaining;
 
-    static void wait()
+    explicit
+    Latch(uint32_t count = 0)
+        : m_remaining{count}
+    {}
+
+    void reset(uint32_t count)
     {
-        std::this_thread::yield();
+        m_remaining.store(count, std::memory_order_relaxed);
     }
 
-    void waitForCompletion() const
+    void countDown(uint32_t n = 1)
     {
-        while (m_remaining_tasks > 0) {
-            wait();
-        }
+        m_remaining.fetch_sub(n, std::memory_order_acq_rel);
     }
 
-    void workDone()
+    [[nodiscard]]
+    bool done() const
     {
-        m_remaining_tasks--;
+        return m_remaining.load(std::memory_order_acquire) == 0;
     }
 };
 
-struct Worker
+/* Work stealing pool.
+   Each worker owns a Chase-Lev deque: it pops from its bottom and, when empty, steals from the top
+   of a random other worker. Jobs submitted from outside the pool go through a locked injection queue,
+   jobs submitted by workers go to their own deque without locking.
+   Idle workers yield for a while before parking on a condition variable.
+   parallelFor/dispatch do not allocate once warmed up, addTask still allocates its job. */
+struct ThreadPool
 {
-    uint32_t              m_id      = 0;
-    std::thread           m_thread;
-    std::function<void()> m_task    = nullptr;
-    bool                  m_running = true;
-    TaskQueue*            m_queue   = nullptr;
+    // addTask jobs, freed after execution
+    template<typename TCallback>
+    struct CallableJob final : public Job
+    {
+        TCallback   m_callback;
+        ThreadPool& m_pool;
+
+        CallableJob(TCallback&& callback, ThreadPool& pool)
+            : m_callback{std::move(callback)}
+            , m_pool{pool}
+        {}
+
+        void execute() override
+        {
+            m_callback();
+            m_pool.m_remaining_tasks--;
+            delete this;
+        }
+    };
 
-    Worker() = default;
+    using RangeCallback = FunctionRef<void(uint32_t, uint32_t)>;
 
-    Worker(TaskQueue& queue, uint32_t id)
-        : m_id{id}
-        , m_queue{&queue}
+    struct ParallelFor;
+
+    struct RangeJob final : public Job
     {
-        m_thread = std::thread([this](){
-            run();
-        });
-    }
+        ParallelFor* m_state = nullptr;
+        uint32_t     m_start = 0;
+        uint32_t     m_end   = 0;
+
+        void execute() override;
+    };
 
-    void run()
+    /* Shared state of a parallel for: ranges larger than the grain are split in two halves, the right
+       one is submitted as a new job and the left one processed right away, so thieves always take the
+       largest remaining chunk from the top of the deques.
+       The state and its jobs live on the caller's stack, once the fixed job slots are used up the
+       remaining range is processed in place in grain sized pieces. */
+    struct ParallelFor
     {
-        while (m_running) {
-            m_queue->getTask(m_task);
-            if (m_task == nullptr) {
-                TaskQueue::wait();
-            } else {
-                m_task();
-                m_queue->workDone();
-                m_task = nullptr;
+        static constexpr uint32_t max_jobs = 128;
+
+        ThreadPool&           m_pool;
+        RangeCallback         m_callback;
+        const uint32_t        m_grain;
+        // Elements not processed yet
+        Latch                 m_latch;
+        RangeJob              m_jobs[max_jobs];
+        std::atomic<uint32_t> m_used_jobs = 0;
+
+        ParallelFor(ThreadPool& pool, RangeCallback callback, uint32_t count, uint32_t grain)
+            : m_pool{pool}
+            , m_callback{callback}
+            , m_grain{grain}
+            , m_latch{count}
+        {}
+
+        void run(uint32_t start, uint32_t end)
+        {
+            while (end - start > m_grain) {
+                const uint32_t slot = m_used_jobs.fetch_add(1, std::memory_order_relaxed);
+                if (slot >= max_jobs) {
+                    break;
+                }
+                const uint32_t mid = start + (end - start) / 2;
+                RangeJob& right = m_jobs[slot];
+                right.m_state = this;
+                right.m_start = mid;
+                right.m_end   = end;
+                m_pool.submit(&right);
+                end = mid;
+            }
+            for (uint32_t first{start}; first < end; first += std::min(m_grain, end - first)) {
+                m_callback(first, first + std::min(m_grain, end - first));
             }
+            m_latch.countDown(end - start);
         }
-    }
+    };
 
-    void stop()
+    struct alignas(64) Worker
     {
-        m_running = false;
-        m_thread.join();
-    }
-};
+        WorkStealingDeque<Job> m_deque;
+        std::thread            m_thread;
+        uint32_t               m_seed;
 
-struct ThreadPool
-{
-    uint32_t            m_thread_count = 0;
-    TaskQueue           m_queue;
-    std::vector<Worker> m_workers;
+        explicit
+        Worker(uint32_t seed)
+            : m_seed{seed}
+        {}
+    };
+
+    static constexpr uint32_t spin_count = 64;
+
+    inline static thread_local ThreadPool* s_current_pool  = nullptr;
+    inline static thread_local uint32_t    s_current_index = 0;
+
+    uint32_t                             m_thread_count = 0;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<uint32_t>                m_remaining_tasks = 0;
+
+    // Ring buffer under a lock, only grows when full
+    std::mutex              m_injection_mutex;
+    std::vector<Job*>       m_injection;
+    uint64_t                m_injection_head = 0;
+    uint64_t                m_injection_tail = 0;
+    std::atomic<uint32_t>   m_injection_size = 0;
+
+    std::mutex              m_park_mutex;
+    std::condition_variable m_park_condition;
+    std::atomic<uint64_t>   m_epoch    = 0;
+    std::atomic<uint32_t>   m_sleepers = 0;
+    std::atomic<bool>       m_stopping = false;
 
     explicit
     ThreadPool(uint32_t thread_count)
         : m_thread_count{thread_count}
+        , m_injection(256)
     {
         m_workers.reserve(thread_count);
-        for (uint32_t i{thread_count}; i--;) {
-            m_workers.emplace_back(m_queue, static_cast<uint32_t>(m_workers.size()));
+        for (uint32_t i{0}; i < thread_count; ++i) {
+            m_workers.emplace_back(new Worker(2654435761u * (i + 1)));
+        }
+        // Threads are started once every deque exists since stealing iterates over all workers
+        for (uint32_t i{0}; i < thread_count; ++i) {
+            m_workers[i]->m_thread = std::thread([this, i](){
+                run(i);
+            });
         }
     }
 
     virtual ~ThreadPool()
     {
-        for (Worker& worker : m_workers) {
-            worker.stop();
+        m_stopping.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock_guard{m_park_mutex};
+            m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        }
+        m_park_condition.notify_all();
+        for (auto& worker : m_workers) {
+            worker->m_thread.join();
+        }
+    }
+
+    // Jobs submitted from a worker go to its own deque, others to the injection queue
+    void submit(Job* job)
+    {
+        if (s_current_pool == this) {
+            m_workers[s_current_index]->m_deque.push(job);
+        } else {
+            std::lock_guard<std::mutex> lock_guard{m_injection_mutex};
+            pushInjection(job);
+            m_injection_size.fetch_add(1, std::memory_order_release);
         }
+        wake();
     }
 
     template<typename TCallback>
     void addTask(TCallback&& callback)
     {
-        m_queue.addTask(std::forward<TCallback>(callback));
+        m_remaining_tasks++;
+        submit(new CallableJob<std::decay_t<TCallback>>(std::decay_t<TCallback>(std::forward<TCallback>(callback)), *this));
     }
 
-    void waitForCompletion() const
+    // Waits for all the tasks added with addTask, the calling thread executes jobs meanwhile
+    void waitForCompletion()
     {
-        m_queue.waitForCompletion();
+        helpUntilZero(m_remaining_tasks);
     }
 
-    template<typename TCallback>
-    void dispatch(uint32_t element_count, TCallback&& callback)
+    // Waits for the latch to reach 0, the calling thread executes jobs meanwhile
+    void wait(const Latch& latch)
     {
-        const uint32_t batch_size = element_count / m_thread_count;
+        helpUntilZero(latch.m_remaining);
+    }
+
+    // Calls callback(start, end) over [start, end) in parallel with ranges no larger than grain
+    void parallelFor(uint32_t start, uint32_t end, uint32_t grain, RangeCallback callback)
+    {
+        if (start >= end) {
+            return;
+        }
+        ParallelFor state{*this, callback, end - start, std::max(grain, 1u)};
+        state.run(start, end);
+        wait(state.m_latch);
+    }
+
+    // Splits [0, element_count) in roughly one range per thread
+    void dispatch(uint32_t element_count, RangeCallback callback)
+    {
+        const uint32_t grain = (element_count + m_thread_count - 1) / m_thread_count;
+        parallelFor(0, element_count, grain, callback);
+    }
+
+    static uint32_t nextRandom(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    Job* popInjection()
+    {
+        if (m_injection_size.load(std::memory_order_acquire) == 0) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock_guard{m_injection_mutex};
+        if (m_injection_head == m_injection_tail) {
+            return nullptr;
+        }
+        Job* const job = m_injection[m_injection_head++ & (m_injection.size() - 1)];
+        m_injection_size.fetch_sub(1, std::memory_order_release);
+        return job;
+    }
+
+    // m_injection_mutex has to be held
+    void pushInjection(Job* job)
+    {
+        const uint64_t capacity = m_injection.size();
+        if (m_injection_tail - m_injection_head == capacity) {
+            std::vector<Job*> bigger(capacity * 2);
+            for (uint64_t i{m_injection_head}; i < m_injection_tail; ++i) {
+                bigger[i - m_injection_head] = m_injection[i & (capacity - 1)];
+            }
+            m_injection.swap(bigger);
+            m_injection_tail -= m_injection_head;
+            m_injection_head = 0;
+        }
+        m_injection[m_injection_tail++ & (m_injection.size() - 1)] = job;
+    }
+
+    // self is the index of the calling worker, m_thread_count for other threads
+    Job* findWork(uint32_t self, uint32_t& seed)
+    {
+        if (self < m_thread_count) {
+            if (Job* job = m_workers[self]->m_deque.pop()) {
+                return job;
+            }
+        }
+        if (Job* job = popInjection()) {
+            return job;
+        }
+        const uint32_t start = nextRandom(seed) % m_thread_count;
         for (uint32_t i{0}; i < m_thread_count; ++i) {
-            const uint32_t start = batch_size * i;
-            const uint32_t end   = start + batch_size;
-            addTask([start, end, &callback](){ callback(start, end); });
+            const uint32_t victim = (start + i) % m_thread_count;
+            if (victim == self) {
+                continue;
+            }
+            if (Job* job = m_workers[victim]->m_deque.steal()) {
+                return job;
+            }
         }
+        return nullptr;
+    }
 
-        if (batch_size * m_thread_count < element_count) {
-            const uint32_t start = batch_size * m_thread_count;
-            callback(start, element_count);
+    [[nodiscard]]
+    bool hasWork() const
+    {
+        if (m_injection_size.load(std::memory_order_acquire)) {
+            return true;
+        }
+        for (const auto& worker : m_workers) {
+            if (!worker->m_deque.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void wake()
+    {
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock_guard{m_park_mutex};
+            m_park_condition.notify_one();
+        }
+    }
+
+    // The epoch is read before checking for work, any job submitted after that changes it so no wake up is lost
+    void park()
+    {
+        const uint64_t seen = m_epoch.load(std::memory_order_seq_cst);
+        if (hasWork() || m_stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock{m_park_mutex};
+        m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+        m_park_condition.wait(lock, [this, seen](){
+            return m_epoch.load(std::memory_order_seq_cst) != seen || m_stopping.load(std::memory_order_acquire);
+        });
+        m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void run(uint32_t index)
+    {
+        s_current_pool  = this;
+        s_current_index = index;
+        uint32_t& seed = m_workers[index]->m_seed;
+        uint32_t  idle = 0;
+        while (true) {
+            if (Job* job = findWork(index, seed)) {
+                job->execute();
+                idle = 0;
+                continue;
+            }
+            if (m_stopping.load(std::memory_order_acquire)) {
+                return;
+            }
+            if (++idle < spin_count) {
+                std::this_thread::yield();
+                continue;
+            }
+            park();
+            idle = 0;
         }
+    }
 
-        waitForCompletion();
+    // Waits for the counter to reach 0 while executing jobs instead of blocking
+    void helpUntilZero(const std::atomic<uint32_t>& counter)
+    {
+        thread_local uint32_t external_seed = 0x9e3779b9u;
+        const bool     is_worker = s_current_pool == this;
+        const uint32_t self      = is_worker ? s_current_index : m_thread_count;
+        uint32_t&      seed      = is_worker ? m_workers[self]->m_seed : external_seed;
+        while (counter.load(std::memory_order_acquire)) {
+            if (Job* job = findWork(self, seed)) {
+                job->execute();
+            } else {
+                std::this_thread::yield();
+            }
+        }
     }
 };
 
+inline void ThreadPool::RangeJob::execute()
+{
+    m_state->run(m_start, m_end);
+}
+
 }
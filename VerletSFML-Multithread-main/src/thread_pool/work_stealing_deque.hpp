@@ -0,0 +1,123 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+namespace tp
+{
+
+/* Chase-Lev work stealing deque, memory orders from the C11 version of Le et al. (PPoPP 2013).
+   Only the owner thread may push/pop at the bottom, any thread can steal from the top.
+   Stores pointers only and grows when full. */
+template<typename T>
+struct WorkStealingDeque
+{
+    struct Buffer
+    {
+        const int64_t                      m_capacity;
+        std::unique_ptr<std::atomic<T*>[]> m_slots;
+
+        explicit
+        Buffer(int64_t capacity)
+            : m_capacity{capacity}
+            , m_slots{new std::atomic<T*>[capacity]}
+        {}
+
+        T* get(int64_t i) const
+        {
+            return m_slots[i & (m_capacity - 1)].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T* item)
+        {
+            m_slots[i & (m_capacity - 1)].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    alignas(64) std::atomic<int64_t> m_top    = 0;
+    alignas(64) std::atomic<int64_t> m_bottom = 0;
+    std::atomic<Buffer*>             m_buffer = nullptr;
+    // Thieves may still read an old buffer after a grow so they are kept until destruction
+    std::vector<std::unique_ptr<Buffer>> m_buffers;
+
+    // capacity has to be a power of 2
+    explicit
+    WorkStealingDeque(int64_t capacity = 256)
+    {
+        m_buffers.emplace_back(new Buffer(capacity));
+        m_buffer.store(m_buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only
+    void push(T* item)
+    {
+        const int64_t b = m_bottom.load(std::memory_order_relaxed);
+        const int64_t t = m_top.load(std::memory_order_acquire);
+        Buffer* a = m_buffer.load(std::memory_order_relaxed);
+        if (b - t > a->m_capacity - 1) {
+            Buffer* const bigger = new Buffer(a->m_capacity * 2);
+            for (int64_t i{t}; i < b; ++i) {
+                bigger->put(i, a->get(i));
+            }
+            m_buffers.emplace_back(bigger);
+            m_buffer.store(bigger, std::memory_order_release);
+            a = bigger;
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only, returns nullptr if empty
+    T* pop()
+    {
+        const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* const a = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        if (t > b) {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = a->get(b);
+        if (t == b) {
+            // Last item, race against thieves
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread, returns nullptr if empty or if another thread won the race
+    T* steal()
+    {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        Buffer* const a    = m_buffer.load(std::memory_order_acquire);
+        T* const      item = a->get(t);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    [[nodiscard]]
+    bool empty() const
+    {
+        return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+    }
+};
+
+}